@@ -760,9 +760,21 @@ class PyBtcAddress(object):
    def isAddrChainRoot(self):
       return (self.chainIndex==-1)
 
+   #############################################################################
+   def extendsFromPublicKey(self, secureKdfOutput=None):
+      """
+      True if extendAddressChain will chain off the public key alone, in which
+      case the new public keys can be computed ahead, in a batch.
+      """
+      privKeyAvailButNotDecryptable = (self.hasPrivKey() and \
+                                       self.isLocked     and \
+                                       not secureKdfOutput  )
+      return not (self.hasPrivKey() and not privKeyAvailButNotDecryptable)
+
    #############################################################################
    @TimeThisFunction
-   def extendAddressChain(self, secureKdfOutput=None, newIV=None):
+   def extendAddressChain(self, secureKdfOutput=None, newIV=None, \
+                                newPub65=None, newAddr160=None):
       """
       We require some fairly complicated logic here, due to the fact that a
       user with a full, private-key-bearing wallet, may try to generate a new
@@ -771,6 +783,10 @@ class PyBtcAddress(object):
       generate a new address, but we can't compute the private key until the
       next time the user unlocks their wallet.  Thus, we have to save off the
       data they will need to create the key, to be applied on next unlock.
+
+      newPub65 and newAddr160 are the chained public key and its hash160 when
+      the caller computed them already, they are only used when extending
+      from the public key.
       """
       if not self.chaincode.getSize() == 32:
          raise KeyDataError, 'No chaincode has been defined to extend chain'
@@ -833,10 +849,13 @@ class PyBtcAddress(object):
 
          #newAddr.binPublicKey65 = CryptoECDSA().ComputeChainedPublicKey( \
                                     #self.binPublicKey65, self.chaincode)
-         newAddr.binPublicKey65 = self.safeExtendPublicKey( \
-                                    self.binPublicKey65, self.chaincode)
-
-         newAddr.addrStr20 = newAddr.binPublicKey65.getHash160()
+         if newPub65 is None:
+            newAddr.binPublicKey65 = self.safeExtendPublicKey( \
+                                       self.binPublicKey65, self.chaincode)
+            newAddr.addrStr20 = newAddr.binPublicKey65.getHash160()
+         else:
+            newAddr.binPublicKey65 = SecureBinaryData(newPub65)
+            newAddr.addrStr20 = newAddr160
          newAddr.useEncryption = self.useEncryption
          newAddr.isInitialized = True
          newAddr.chaincode  = self.chaincode
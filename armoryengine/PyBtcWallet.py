@@ -953,7 +953,8 @@ class PyBtcWallet(object):
 
 
    #############################################################################
-   def computeNextAddress(self, addr160=None, isActuallyNew=True, doRegister=True):
+   def computeNextAddress(self, addr160=None, isActuallyNew=True, \
+                          doRegister=True, newPub65=None, newAddr160=None):
       """
       Use this to extend the chain beyond the last-computed address.
 
@@ -961,11 +962,14 @@ class PyBtcWallet(object):
       chain, but I suppose someone messing with the file format may
       leave gaps in the chain requiring some to be generated in the middle
       (then we can use the addr160 arg to specify which address to extend)
+
+      newPub65 and newAddr160 are passed on to extendAddressChain.
       """
       if not addr160:
          addr160 = self.lastComputedChainAddr160
 
-      newAddr = self.addrMap[addr160].extendAddressChain(self.kdfKey)
+      newAddr = self.addrMap[addr160].extendAddressChain(self.kdfKey, \
+                                    newPub65=newPub65, newAddr160=newAddr160)
       new160 = newAddr.getAddr160()
       newDataLoc = self.walletFileSafeUpdate( \
          [[WLT_UPDATE_ADD, WLT_DATATYPE_KEYDATA, new160, newAddr]])
@@ -1010,12 +1014,25 @@ class PyBtcWallet(object):
       numToCreate = max(numPool - gap, 0)
       
       newAddrList = []
+
+      # Chaining off public keys only (watching-only or locked wallet), get
+      # the whole run of keys and hash160s in one call instead of one per 
+      # address
+      newPubList = [None] * numToCreate
+      new160List = [None] * numToCreate
+      if numToCreate > 1 and self.lastComputedChainAddr160 in self.addrMap:
+         tipAddr = self.addrMap[self.lastComputedChainAddr160]
+         if tipAddr.extendsFromPublicKey(self.kdfKey):
+            newPubList, new160List = self.computeChainedPublicKeys( \
+                                                   tipAddr, numToCreate)
       
       for i in range(numToCreate):
          Progress(i+1, numToCreate)
          newAddrList.append(Hash160ToScrAddr(self.computeNextAddress(\
                                  isActuallyNew=isActuallyNew, \
-                                 doRegister=False))) 
+                                 doRegister=False, \
+                                 newPub65=newPubList[i], \
+                                 newAddr160=new160List[i]))) 
          
       #add addresses in bulk once they are all computed   
       if doRegister and self.isRegistered():
@@ -1030,6 +1047,36 @@ class PyBtcWallet(object):
          
       return self.lastComputedChainIndex
 
+   #############################################################################
+   def computeChainedPublicKeys(self, fromAddr, count):
+      """
+      The count public keys chained off fromAddr and their hash160s. Like 
+      PyBtcAddress.safeExtendPublicKey, the run is computed twice and has to 
+      match, or all entries come back None and the keys get chained one at a
+      time instead. The multipliers are logged the same way too.
+      """
+      ecdsa = CryptoECDSA()
+      pubList1, hashList1, multList1 = \
+         ecdsa.ComputeChainedPublicKeysHash160sAndMults( \
+                     fromAddr.binPublicKey65, fromAddr.chaincode, count)
+      pubList2, hashList2, multList2 = \
+         ecdsa.ComputeChainedPublicKeysHash160sAndMults( \
+                     fromAddr.binPublicKey65, fromAddr.chaincode, count)
+
+      if len(pubList1) != count or pubList1 != pubList2 or \
+         hashList1 != hashList2 or multList1 != multList2:
+         LOGCRIT('Batch chaining failed!  Computed keys are different!')
+         return [None] * count, [None] * count
+
+      # Each multiplier is logged against the key it extends
+      parent160List = [fromAddr.getAddr160()] + hashList1[:-1]
+      with open(MULT_LOG_FILE,'a') as f:
+         for a160,mult in zip(parent160List, multList1):
+            f.write('PubChain (pkh, mult): %s,%s\n' % \
+                    (binary_to_hex(a160), binary_to_hex(mult)))
+
+      return pubList1, hashList1
+
    #############################################################################
    def setAddrPoolSize(self, newSize):
       if newSize<5:
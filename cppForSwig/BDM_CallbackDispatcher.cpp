@@ -0,0 +1,275 @@
+////////////////////////////////////////////////////////////////////////////////
+//                                                                            //
+//  Copyright (C) 2011-2015, Armory Technologies, Inc.                        //
+//  Distributed under the GNU Affero General Public License (AGPL v3)         //
+//  See LICENSE or http://www.gnu.org/licenses/agpl.html                      //
+//                                                                            //
+////////////////////////////////////////////////////////////////////////////////
+
+#include "BDM_CallbackDispatcher.h"
+#include "BDM_mainthread.h"
+#include "log.h"
+
+////////////////////////////////////////////////////////////////////////////////
+BDM_CallbackDispatcher::BDM_CallbackDispatcher(
+   BDM_CallBack* callback, size_t capacity) :
+   callback_(callback), queue_(capacity),
+   overflowCount_(0), overflowTotal_(0), droppedProgress_(0),
+   sleeping_(false), run_(false)
+{}
+
+////////////////////////////////////////////////////////////////////////////////
+BDM_CallbackDispatcher::~BDM_CallbackDispatcher()
+{
+   stop();
+}
+
+////////////////////////////////////////////////////////////////////////////////
+void BDM_CallbackDispatcher::start(void)
+{
+   if (thread_.joinable())
+      return;
+
+   run_.store(true);
+   thread_ = thread(&BDM_CallbackDispatcher::dispatchThread, this);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+void BDM_CallbackDispatcher::stop(void)
+{
+   if (!thread_.joinable())
+      return;
+
+   run_.store(false);
+   wakeDispatcher(true);
+   thread_.join();
+}
+
+////////////////////////////////////////////////////////////////////////////////
+void BDM_CallbackDispatcher::post(BDM_Notification&& notification)
+{
+   //once something went to the overflow, everything after it has to go 
+   //there too, even if the dispatcher freed a spot in the queue meanwhile
+   if (overflowCount_.load() == 0 && queue_.tryPush(move(notification)))
+   {
+      wakeDispatcher(false);
+      return;
+   }
+
+   //the client is falling behind. A stale progress report is worthless,
+   //everything else has to get there eventually
+   if (!notification.isAction_)
+   {
+      droppedProgress_.fetch_add(1);
+      return;
+   }
+
+   {
+      lock_guard<mutex> lock(overflowMutex_);
+      overflow_.push_back(move(notification));
+      overflowCount_.fetch_add(1);
+   }
+
+   if (overflowTotal_.fetch_add(1) == 0)
+      LOGWARN << "BDM callback queue is full, client is lagging";
+
+   wakeDispatcher(false);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+void BDM_CallbackDispatcher::postNewBlock(int nNewBlocks, int topHeight)
+{
+   BDM_Notification notification;
+   notification.action_ = BDMAction_NewBlock;
+   notification.nNewBlocks_ = nNewBlocks;
+   notification.block_ = topHeight;
+   post(move(notification));
+}
+
+////////////////////////////////////////////////////////////////////////////////
+void BDM_CallbackDispatcher::postZC(vector<LedgerEntry>&& zcLedgers)
+{
+   BDM_Notification notification;
+   notification.action_ = BDMAction_ZC;
+   notification.zcLedgers_ = move(zcLedgers);
+   post(move(notification));
+}
+
+////////////////////////////////////////////////////////////////////////////////
+void BDM_CallbackDispatcher::postRefresh(const set<BinaryData>& refreshIDs)
+{
+   {
+      lock_guard<mutex> lock(refreshMutex_);
+      refreshIDs_.insert(refreshIDs.begin(), refreshIDs.end());
+
+      //there's one in the queue already, it will carry these IDs too
+      if (refreshQueued_)
+         return;
+      refreshQueued_ = true;
+   }
+
+   //the IDs are picked up at delivery time
+   BDM_Notification notification;
+   notification.action_ = BDMAction_Refresh;
+   post(move(notification));
+}
+
+////////////////////////////////////////////////////////////////////////////////
+void BDM_CallbackDispatcher::postStartedWalletScan(
+   const vector<string>& walletIDs)
+{
+   BDM_Notification notification;
+   notification.action_ = BDMAction_StartedWalletScan;
+   notification.walletIDs_ = walletIDs;
+   post(move(notification));
+}
+
+////////////////////////////////////////////////////////////////////////////////
+void BDM_CallbackDispatcher::postErrorMsg(const string& errorMsg)
+{
+   BDM_Notification notification;
+   notification.action_ = BDMAction_ErrorMsg;
+   notification.errorMsg_ = errorMsg;
+   post(move(notification));
+}
+
+////////////////////////////////////////////////////////////////////////////////
+void BDM_CallbackDispatcher::postProgress(BDMPhase phase,
+   const vector<string>& walletIDs, float progress, unsigned secondsRem,
+   unsigned progressNumeric)
+{
+   BDM_Notification notification;
+   notification.isAction_ = false;
+   notification.phase_ = phase;
+   notification.walletIDs_ = walletIDs;
+   notification.progress_ = progress;
+   notification.secondsRem_ = secondsRem;
+   notification.progressNumeric_ = progressNumeric;
+   post(move(notification));
+}
+
+////////////////////////////////////////////////////////////////////////////////
+void BDM_CallbackDispatcher::wakeDispatcher(bool always)
+{
+   //pairs with the fence in dispatchThread: either it sees what we just
+   //pushed before going to sleep, or we see it's sleeping
+   atomic_thread_fence(memory_order_seq_cst);
+   if (!always && !sleeping_.load(memory_order_relaxed))
+      return;
+
+   lock_guard<mutex> lock(wakeMutex_);
+   wakeCV_.notify_one();
+}
+
+////////////////////////////////////////////////////////////////////////////////
+bool BDM_CallbackDispatcher::pop(BDM_Notification& notification)
+{
+   if (queue_.tryPop(notification))
+      return true;
+
+   //nothing goes to the queue while the overflow has data, so draining it
+   //after the queue keeps the notifications from each producer in order
+   if (overflowCount_.load() == 0)
+      return false;
+
+   lock_guard<mutex> lock(overflowMutex_);
+   if (overflow_.empty())
+      return false;
+
+   notification = move(overflow_.front());
+   overflow_.pop_front();
+   overflowCount_.fetch_sub(1);
+   return true;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+void BDM_CallbackDispatcher::deliver(BDM_Notification& notification)
+{
+   if (!notification.isAction_)
+   {
+      callback_->progress(notification.phase_, notification.walletIDs_,
+         notification.progress_, notification.secondsRem_,
+         notification.progressNumeric_);
+      return;
+   }
+
+   switch (notification.action_)
+   {
+   case BDMAction_NewBlock:
+      callback_->run(BDMAction_NewBlock, &notification.nNewBlocks_,
+         notification.block_);
+      break;
+
+   case BDMAction_ZC:
+      callback_->run(BDMAction_ZC, &notification.zcLedgers_);
+      break;
+
+   case BDMAction_Refresh:
+   {
+      {
+         lock_guard<mutex> lock(refreshMutex_);
+         notification.refreshIDs_.assign(
+            refreshIDs_.begin(), refreshIDs_.end());
+         refreshIDs_.clear();
+         refreshQueued_ = false;
+      }
+
+      callback_->run(BDMAction_Refresh, &notification.refreshIDs_);
+      break;
+   }
+
+   case BDMAction_StartedWalletScan:
+      callback_->run(BDMAction_StartedWalletScan, &notification.walletIDs_);
+      break;
+
+   case BDMAction_ErrorMsg:
+      callback_->run(BDMAction_ErrorMsg, &notification.errorMsg_,
+         notification.block_);
+      break;
+
+   default:
+      callback_->run(notification.action_, nullptr, notification.block_);
+   }
+}
+
+////////////////////////////////////////////////////////////////////////////////
+void BDM_CallbackDispatcher::dispatchThread(void)
+{
+   BDM_Notification notification;
+
+   while (true)
+   {
+      if (pop(notification))
+      {
+         try
+         {
+            deliver(notification);
+         }
+         catch (exception& e)
+         {
+            LOGERR << "BDM callback failed: " << e.what();
+         }
+
+         notification = BDM_Notification();
+         continue;
+      }
+
+      unique_lock<mutex> lock(wakeMutex_);
+      sleeping_.store(true, memory_order_relaxed);
+      atomic_thread_fence(memory_order_seq_cst);
+
+      if (!queue_.hasData() && overflowCount_.load() == 0)
+      {
+         //everything posted before stop() has been delivered
+         if (!run_.load())
+         {
+            sleeping_.store(false);
+            return;
+         }
+
+         wakeCV_.wait(lock);
+      }
+
+      sleeping_.store(false);
+   }
+}
@@ -0,0 +1,120 @@
+////////////////////////////////////////////////////////////////////////////////
+//                                                                            //
+//  Copyright (C) 2011-2015, Armory Technologies, Inc.                        //
+//  Distributed under the GNU Affero General Public License (AGPL v3)         //
+//  See LICENSE or http://www.gnu.org/licenses/agpl.html                      //
+//                                                                            //
+////////////////////////////////////////////////////////////////////////////////
+
+#ifndef _BDM_CALLBACK_DISPATCHER_H_
+#define _BDM_CALLBACK_DISPATCHER_H_
+
+#include <string>
+#include <vector>
+#include <set>
+#include <deque>
+#include <atomic>
+#include <mutex>
+#include <thread>
+#include <condition_variable>
+
+#include "BinaryData.h"
+#include "LedgerEntry.h"
+#include "bdmenums.h"
+#include "MPSCQueue.h"
+
+class BDM_CallBack;
+
+////////////////////////////////////////////////////////////////////////////////
+struct BDM_Notification
+{
+   //false: progress
+   bool isAction_ = true;
+
+   BDMAction action_ = BDMAction_Ready;
+   int block_ = 0;
+
+   //action payloads, which one is passed to BDM_CallBack::run depends on
+   //action_
+   int nNewBlocks_ = 0;
+   vector<LedgerEntry> zcLedgers_;
+   vector<BinaryData> refreshIDs_;
+   vector<string> walletIDs_;
+   string errorMsg_;
+
+   //progress
+   BDMPhase phase_ = BDMPhase_Rescan;
+   float progress_ = 0.0f;
+   unsigned secondsRem_ = 0;
+   unsigned progressNumeric_ = 0;
+};
+
+////////////////////////////////////////////////////////////////////////////////
+// Hands BDM notifications to the client (the Python side, GIL bound) from a
+// thread of its own, so a slow client doesn't hold up the BDM thread.
+//
+// Producers post to a BoundedMPSCQueue and only ever take short locks that
+// the dispatcher never holds while it is calling the client. Refresh
+// notifications are coalesced: while one is queued, later ones just add
+// their IDs to it. If the queue is full, progress notifications are dropped
+// (the next one supersedes them) and the others go to an overflow list,
+// which takes every notification until it's drained.
+//
+// Notifications from a given thread are delivered in the order they were
+// posted. stop(), and the destructor, deliver what's left before returning.
+class BDM_CallbackDispatcher
+{
+public:
+   BDM_CallbackDispatcher(BDM_CallBack* callback, size_t capacity = 1024);
+   ~BDM_CallbackDispatcher();
+
+   void start(void);
+   void stop(void);
+
+   void post(BDM_Notification&& notification);
+
+   void postNewBlock(int nNewBlocks, int topHeight);
+   void postZC(vector<LedgerEntry>&& zcLedgers);
+   void postRefresh(const set<BinaryData>& refreshIDs);
+   void postStartedWalletScan(const vector<string>& walletIDs);
+   void postErrorMsg(const string& errorMsg);
+   void postProgress(BDMPhase phase, const vector<string>& walletIDs,
+      float progress, unsigned secondsRem, unsigned progressNumeric);
+
+   size_t getOverflowCount(void) const { return overflowTotal_.load(); }
+   size_t getDroppedProgressCount(void) const { return droppedProgress_.load(); }
+
+private:
+   bool pop(BDM_Notification& notification);
+   void deliver(BDM_Notification& notification);
+   void wakeDispatcher(bool always);
+   void dispatchThread(void);
+
+private:
+   BDM_CallBack* const callback_;
+
+   BoundedMPSCQueue<BDM_Notification> queue_;
+
+   mutex overflowMutex_;
+   deque<BDM_Notification> overflow_;
+   atomic<size_t> overflowCount_;
+   atomic<size_t> overflowTotal_;
+   atomic<size_t> droppedProgress_;
+
+   mutex refreshMutex_;
+   set<BinaryData> refreshIDs_;
+   bool refreshQueued_ = false;
+
+   mutex wakeMutex_;
+   condition_variable wakeCV_;
+   atomic<bool> sleeping_;
+   atomic<bool> run_;
+
+   thread thread_;
+
+private:
+   BDM_CallbackDispatcher(const BDM_CallbackDispatcher&);
+   BDM_CallbackDispatcher& operator=(const BDM_CallbackDispatcher&);
+};
+
+#endif
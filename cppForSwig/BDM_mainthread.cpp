@@ -8,6 +8,8 @@
 #include "BDM_mainthread.h"
 #include "BlockUtils.h"
 #include "BlockDataViewer.h"
+#include "BlkFileWatcher.h"
+#include "BDM_CallbackDispatcher.h"
 
 #include <ctime>
 #include <unistd.h>
@@ -21,6 +23,7 @@ struct BDM_Inject::BDM_Inject_Impl
    pthread_mutex_t notifierLock;
    pthread_cond_t notifier;
    bool wantsToRun=false, failure=false;
+   bool wakeUp=false;
 };
 
 BDM_Inject::BDM_Inject()
@@ -45,6 +48,14 @@ void BDM_Inject::notify()
    pthread_mutex_unlock(&pimpl->notifierLock);
 }
 
+void BDM_Inject::wake()
+{
+   pthread_mutex_lock(&pimpl->notifierLock);
+   pimpl->wakeUp=true;
+   pthread_cond_signal(&pimpl->notifier);
+   pthread_mutex_unlock(&pimpl->notifierLock);
+}
+
 void BDM_Inject::wait(unsigned ms)
 {
 #ifdef _WIN32_
@@ -52,7 +63,7 @@ void BDM_Inject::wait(unsigned ms)
    abstime += ms;
    
    pthread_mutex_lock(&pimpl->notifierLock);
-   while (!pimpl->wantsToRun)
+   while (!pimpl->wantsToRun && !pimpl->wakeUp)
    {
       pthread_cond_timedwait(&pimpl->notifier, &pimpl->notifierLock, &abstime); 
       
@@ -63,6 +74,7 @@ void BDM_Inject::wait(unsigned ms)
    if (pimpl->wantsToRun)
       run();
    pimpl->wantsToRun=false;
+   pimpl->wakeUp=false;
    pthread_cond_signal(&pimpl->notifier);
    pthread_mutex_unlock(&pimpl->notifierLock);
 #else
@@ -71,7 +83,7 @@ void BDM_Inject::wait(unsigned ms)
    abstime.tv_sec += ms/1000;
    
    pthread_mutex_lock(&pimpl->notifierLock);
-   while (!pimpl->wantsToRun)
+   while (!pimpl->wantsToRun && !pimpl->wakeUp)
    {
       struct timespec abstimets;
       abstimets.tv_sec = abstime.tv_sec;
@@ -86,6 +98,7 @@ void BDM_Inject::wait(unsigned ms)
    if (pimpl->wantsToRun)
       run();
    pimpl->wantsToRun=false;
+   pimpl->wakeUp=false;
    pthread_cond_signal(&pimpl->notifier);
    pthread_mutex_unlock(&pimpl->notifierLock);
 #endif
@@ -319,6 +332,11 @@ try
       }
    }
    
+   //from here on the client is notified from the dispatcher's thread, the
+   //BDM thread only queues notifications. Declared after onFinish so that
+   //whatever is still queued goes out before BDMAction_Exited
+   BDM_CallbackDispatcher dispatcher(callback);
+
    double lastprog=0;
    unsigned lasttime=0;
    
@@ -331,15 +349,25 @@ try
       lastprog = prog;
       lasttime = time;
       
-      callback->progress(
+      dispatcher.postProgress(
          BDMPhase_Rescan,
          wltIdVec,
          lastprog, lasttime, 0
       );
    };   
    
+   //wake up as soon as bitcoind writes to the blk files rather than on the 
+   //next 1 sec poll. If the watcher can't run, hasChanges() is always true
+   //and we poll like before. wake() rather than notify(): the loop picks the
+   //change up itself, there's nothing for the injector to run
+   BDM_Inject* inject = pimpl->inject;
+   BlkFileWatcher blkFileWatcher(bdm->config().blkFileLocation,
+      [inject](void)->void { inject->wake(); });
+   blkFileWatcher.start();
+
    //push 'bdm is ready' to Python
    callback->run(BDMAction_Ready, nullptr, bdm->getTopBlockHeight());
+   dispatcher.start();
    
    while(pimpl->run)
    {
@@ -354,7 +382,7 @@ try
          vector<string> wltIDs = bdm->getNextWalletIDToScan();
          if (wltIDs.size() && doScan)
          {
-            callback->run(BDMAction_StartedWalletScan, &wltIDs);
+            dispatcher.postStartedWalletScan(wltIDs);
          }
       }
 
@@ -386,7 +414,7 @@ try
 
             LOGINFO << newZCLedgers.size() << " new ZC Txn";
             //notify ZC
-            callback->run(BDMAction_ZC, &newZCLedgers);
+            dispatcher.postZC(move(newZCLedgers));
          }
       }
 
@@ -398,25 +426,23 @@ try
          bdv->refresh_ = BDV_dontRefresh;
          bdv->scanWallets(UINT32_MAX, UINT32_MAX, refresh);
          
-         vector<BinaryData> refreshIDVec;
-         for (const auto& refreshID : bdv->refreshIDSet_)
-            refreshIDVec.push_back(refreshID);
-
+         //refreshes still waiting in the queue are merged with this one
+         dispatcher.postRefresh(bdv->refreshIDSet_);
          bdv->refreshIDSet_.clear();
-         callback->run(BDMAction_Refresh, &refreshIDVec);
       }
 
-      const uint32_t prevTopBlk = bdm->readBlkFileUpdate();
-      if(prevTopBlk > 0)
+      if (blkFileWatcher.hasChanges())
       {
-         bdv->scanWallets(prevTopBlk);
-
-         //notify Python that new blocks have been parsed
-         int nNewBlocks = bdm->blockchain().top().getBlockHeight() + 1
-            - prevTopBlk;
-         callback->run(BDMAction_NewBlock, &nNewBlocks,
-            bdm->getTopBlockHeight()
-         );
+         const uint32_t prevTopBlk = bdm->readBlkFileUpdate();
+         if(prevTopBlk > 0)
+         {
+            bdv->scanWallets(prevTopBlk);
+
+            //notify Python that new blocks have been parsed
+            int nNewBlocks = bdm->blockchain().top().getBlockHeight() + 1
+               - prevTopBlk;
+            dispatcher.postNewBlock(nNewBlocks, bdm->getTopBlockHeight());
+         }
       }
       
 #ifndef _DEBUG_REPLAY_BLOCKS
@@ -59,9 +59,13 @@ public:
    
    // instruct the BDM to wake up and call run() ASAP
    void notify();
+
+   // only cuts the BDM's wait() short, without calling run(). For the BDM's 
+   // own events (blk file writes), run() is Python's and takes the GIL
+   void wake();
    
    // Block for 'ms' milliseconds or until someone
-   // notify()es me
+   // notify()es or wake()s me
    void wait(unsigned ms);
    
    // once notify() is called, only returns on your
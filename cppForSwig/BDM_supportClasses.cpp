@@ -12,6 +12,32 @@
 #include <thread>
 
 
+///////////////////////////////////////////////////////////////////////////////
+//ScrAddrPrefilter Methods
+///////////////////////////////////////////////////////////////////////////////
+void ScrAddrPrefilter::rebuild(size_t expectedKeys)
+{
+   capacity_ = max(expectedKeys + expectedKeys / 2, (size_t)1024);
+   nBlocks_ = (capacity_ * BITS_PER_KEY + 511) / 512;
+
+   bits_.assign(nBlocks_ * WORDS_PER_BLOCK, 0);
+}
+
+///////////////////////////////////////////////////////////////////////////////
+void ScrAddrPrefilter::add(BinaryData const & key)
+{
+   if (nBlocks_ == 0)
+      rebuild(0);
+
+   uint64_t hash = hasher_.hash64(key);
+   uint64_t* block = getBlock(hash);
+   for (unsigned i = 0; i < PROBES; i++)
+   {
+      unsigned bit = (hash >> (9 * i)) & 511;
+      block[bit >> 6] |= 1ULL << (bit & 63);
+   }
+}
+
 ///////////////////////////////////////////////////////////////////////////////
 //ScrAddrScanData Methods
 ///////////////////////////////////////////////////////////////////////////////
@@ -116,6 +142,8 @@ bool ScrAddrFilter::registerAddressBatch(
 
       //check DB for the scrAddr's SSH
       StoredScriptHistory ssh;
+
+      unique_lock<mutex> lock(sideScanMutex_);
          
       ScrAddrFilter* topChild = this;
       while (topChild->child_)
@@ -160,7 +188,7 @@ bool ScrAddrFilter::registerAddressBatch(
       for (auto& batch : wltNAddrMap)
       {
          for (const auto& scrAddr : batch.second)
-            scrAddrMap_.insert(make_pair(scrAddr, 0));
+            addScrAddr(scrAddr, 0, false);
       }
 
       return true;
@@ -170,7 +198,7 @@ bool ScrAddrFilter::registerAddressBatch(
 ///////////////////////////////////////////////////////////////////////////////
 void ScrAddrFilter::scanScrAddrThread()
 {
-   //Only one wallet at a time         
+   //every wallet queued for the same kind of scan goes in this pass
    uint32_t endBlock = currentTopBlockHeight();
    vector<string> wltIDs = scrAddrDataForSideScan_.getWalletIDString();
 
@@ -204,41 +232,40 @@ void ScrAddrFilter::scanScrAddrThread()
       saVec.clear();
 
       //scan from height 0
+      useBlockFilters_ = true;
       topScannedBlockHash =
          applyBlockRangeToDB(0, endBlock, wltIDs);
+      useBlockFilters_ = false;
    }
 
+   bool hasBdv = false;
    for (auto& batch : scrAddrDataForSideScan_.wltNAddrMap_)
-   {
-      if (batch.first->hasBdvPtr())
-      {
-         //merge with main ScrAddrScanData object
-         merge(topScannedBlockHash);
+      hasBdv |= batch.first->hasBdvPtr();
 
-         vector<BinaryData> addressVec;
-         addressVec.reserve(scrAddrMap_.size());
+   //merge with main ScrAddrScanData object
+   if (hasBdv)
+      merge(topScannedBlockHash);
 
-         //notify the wallets that the scrAddr are ready
-         for (auto& scrAddrPair : scrAddrMap_)
-         {
-            addressVec.push_back(scrAddrPair.first);
-         }
+   //notify each wallet that its own scrAddr are ready, this scan may cover 
+   //several of them
+   for (auto& batch : scrAddrDataForSideScan_.wltNAddrMap_)
+   {
+      if (!batch.first->hasBdvPtr() || batch.second.empty())
+         continue;
 
-         if (!scrAddrMap_.empty())
-         {
-            batch.first->prepareScrAddrForMerge(addressVec, !((bool)doScan_),
-               topScannedBlockHash);
+      batch.first->prepareScrAddrForMerge(batch.second, !((bool)doScan_),
+         topScannedBlockHash);
 
-            //notify the bdv that it needs to refresh through the wallet
-            batch.first->needsRefresh();
-         }
-      }
+      //notify the bdv that it needs to refresh through the wallet
+      batch.first->needsRefresh();
    }
 
    //clean up
    if (root_ != nullptr)
    {
       ScrAddrFilter* root = root_;
+      unique_lock<mutex> lock(root->sideScanMutex_);
+
       shared_ptr<ScrAddrFilter> newChild = child_;
       root->child_ = newChild;
 
@@ -302,7 +329,7 @@ void ScrAddrFilter::checkForMerge()
       //create SAF to scan the addresses to merge
       std::shared_ptr<ScrAddrFilter> sca(copy());
       for (auto& scraddr : scrAddrDataForSideScan_.scrAddrsToMerge_)
-         sca->scrAddrMap_.insert(scraddr);
+         sca->addScrAddr(scraddr.first, scraddr.second, false);
 
       if (config().armoryDbType != ARMORY_DB_SUPER)
       {
@@ -337,7 +364,8 @@ void ScrAddrFilter::checkForMerge()
       //grab merge lock
       while (mergeLock_.fetch_or(1, memory_order_acquire));
 
-      scrAddrMap_.insert(sca->scrAddrMap_.begin(), sca->scrAddrMap_.end());
+      for (auto& scraddr : sca->scrAddrMap_)
+         addScrAddr(scraddr.first, scraddr.second, false);
       scrAddrDataForSideScan_.scrAddrsToMerge_.clear();
 
       mergeFlag_ = false;
@@ -382,11 +410,13 @@ void ScrAddrFilter::clear()
 bool ScrAddrFilter::startSideScan(
    function<void(const vector<string>&, double prog, unsigned time)> progress)
 {
+   unique_lock<mutex> lock(sideScanMutex_);
    ScrAddrFilter* sca = child_.get();
 
    if (sca != nullptr && !isScanning_)
    {
       isScanning_ = true;
+      sca->coalesceQueuedScans();
       sca->scanThreadProgressCallback_ = progress;
       sca->scanScrAddrMapInNewThread();
 
@@ -397,6 +427,47 @@ bool ScrAddrFilter::startSideScan(
    return false;
 }
 
+///////////////////////////////////////////////////////////////////////////////
+void ScrAddrFilter::coalesceQueuedScans()
+{
+   /***
+   Wallets registered while a side scan is running queue up as children of 
+   the scanning SAF, and used to be scanned one after the other. Fold the 
+   queued batches that need the same kind of scan into this one, so they all 
+   go over the block range in a single pass. The others keep their place in 
+   the queue.
+
+   Called on the next SAF to scan, with the root's sideScanMutex_ held.
+   ***/
+
+   shared_ptr<ScrAddrFilter>* link = &child_;
+   while (*link != nullptr)
+   {
+      ScrAddrFilter* next = link->get();
+      if (next->doScan_ != doScan_)
+      {
+         link = &next->child_;
+         continue;
+      }
+
+      for (auto& scrAddrPair : next->scrAddrMap_)
+         addScrAddr(scrAddrPair.first, scrAddrPair.second, true);
+
+      auto& sideScanData = next->scrAddrDataForSideScan_;
+      for (auto& batch : sideScanData.wltNAddrMap_)
+      {
+         auto& addrVec = scrAddrDataForSideScan_.wltNAddrMap_[batch.first];
+         addrVec.insert(addrVec.end(), batch.second.begin(), batch.second.end());
+      }
+
+      scrAddrDataForSideScan_.startScanFrom_ = min(
+         scrAddrDataForSideScan_.startScanFrom_, sideScanData.startScanFrom_);
+
+      //unlink it, its children move up the queue
+      *link = next->child_;
+   }
+}
+
 ///////////////////////////////////////////////////////////////////////////////
 void ScrAddrFilter::buildSideScanData(
    const map<shared_ptr<BtcWallet>, vector<BinaryData>>& wltNAddrMap)
@@ -409,9 +480,33 @@ void ScrAddrFilter::buildSideScanData(
    scrAddrDataForSideScan_.wltNAddrMap_ = wltNAddrMap;
 }
 
+///////////////////////////////////////////////////////////////////////////////
+void ScrAddrFilter::addScrAddr(
+   const BinaryData& scrAddr, uint32_t scanFrom, bool overwrite)
+{
+   if (overwrite)
+      scrAddrMap_[scrAddr] = scanFrom;
+   else if (!scrAddrMap_.insert(make_pair(scrAddr, scanFrom)).second)
+      return;
+
+   if (scrAddrMap_.size() > prefilter_.capacity())
+      rebuildPrefilter();
+   else
+      prefilter_.add(scrAddr);
+}
+
+///////////////////////////////////////////////////////////////////////////////
+void ScrAddrFilter::rebuildPrefilter(void)
+{
+   prefilter_.rebuild(scrAddrMap_.size());
+   for (auto& scrAddrPair : scrAddrMap_)
+      prefilter_.add(scrAddrPair.first);
+}
+
 ///////////////////////////////////////////////////////////////////////////////
 const vector<string> ScrAddrFilter::getNextWalletIDToScan(void)
 {
+   unique_lock<mutex> lock(sideScanMutex_);
    if (child_.get() != nullptr)
       return child_->scrAddrDataForSideScan_.getWalletIDString();
    
@@ -11,8 +11,10 @@
 #include <vector>
 #include <atomic>
 #include <functional>
+#include <mutex>
 
 #include "BinaryData.h"
+#include "FlatHashMap.h"
 #include "ScrAddrObj.h"
 #include "BtcWallet.h"
 #include "SSHheaders.h"
@@ -31,6 +33,71 @@ struct ZeroConfData
    }
 };
 
+////////////////////////////////////////////////////////////////////////////////
+// Blocked Bloom filter in front of ScrAddrFilter's map. Each key sets PROBES
+// bits within a single 64 byte block, so a lookup costs at most one cache 
+// miss, and most scrAddrs that aren't registered get turned down without 
+// hashing into the map. No false negatives, around 1% false positives when
+// full.
+//
+// Keys can't be taken out. An erased key costs false positives until the
+// next rebuild.
+class ScrAddrPrefilter
+{
+public:
+   ScrAddrPrefilter(void) : hasher_(HASH_SEED) {}
+
+   // Clears the filter and sizes it for expectedKeys with some headroom
+   void rebuild(size_t expectedKeys);
+
+   void add(BinaryData const & key);
+
+   bool mayContain(BinaryData const & key) const
+   {
+      if (nBlocks_ == 0)
+         return false;
+
+      uint64_t hash = hasher_.hash64(key);
+      uint64_t const * block = getBlock(hash);
+      for (unsigned i = 0; i < PROBES; i++)
+      {
+         unsigned bit = (hash >> (9 * i)) & 511;
+         if ((block[bit >> 6] & (1ULL << (bit & 63))) == 0)
+            return false;
+      }
+
+      return true;
+   }
+
+   // Number of keys the filter was sized for
+   size_t capacity(void) const { return capacity_; }
+
+private:
+   static const unsigned WORDS_PER_BLOCK = 8;
+   static const unsigned BITS_PER_KEY = 12;
+   static const unsigned PROBES = 6;
+   static const uint64_t HASH_SEED = 0x5ca1ab1e;
+
+   // the probes use the low 54 bits, the block comes from all of them
+   uint64_t const * getBlock(uint64_t hash) const
+   {
+      uint64_t blockHash = (hash * 0x9e3779b97f4a7c15ULL) >> 32;
+      return &bits_[((blockHash * nBlocks_) >> 32) * WORDS_PER_BLOCK];
+   }
+
+   uint64_t* getBlock(uint64_t hash)
+   {
+      return const_cast<uint64_t*>(
+         static_cast<ScrAddrPrefilter const *>(this)->getBlock(hash));
+   }
+
+private:
+   vector<uint64_t> bits_;
+   uint64_t         nBlocks_ = 0;
+   size_t           capacity_ = 0;
+   BinaryDataHash   hasher_;
+};
+
 class ScrAddrFilter
 {
    /***
@@ -76,8 +143,9 @@ public:
    struct ScrAddrSideScanData
    {
       /***
-      scrAddrMap_ is a map so it can only have meta per scrAddr. This means
-      only 1 wallet can be registered per post BDM init address scan.
+      scrAddrMap_ is a map so it can only have meta per scrAddr. Several 
+      wallets can share a post BDM init address scan, wltNAddrMap_ keeps 
+      track of which scrAddr goes to which wallet.
       ***/
       uint32_t startScanFrom_=0;
       map<shared_ptr<BtcWallet>, vector<BinaryData>> wltNAddrMap_;
@@ -100,21 +168,18 @@ public:
          return strVec;
       }
    };
-   
-   struct hashBinData
-   {
-      std::size_t operator()(const BinaryData& bd) const
-      {
-         return *((std::size_t*)bd.getPtr());
-      }
-   };
+
+   typedef FlatHashMap<BinaryData, uint32_t> ScrAddrMap;
 
 private:
    //map of scrAddr and their respective last scanned block
    //this is used only for the inital load currently
 
 
-   unordered_map<BinaryData, uint32_t, hashBinData>   scrAddrMap_;
+   ScrAddrMap                     scrAddrMap_;
+
+   //has every key of scrAddrMap_, all insertions go through addScrAddr
+   ScrAddrPrefilter               prefilter_;
 
    LMDBBlockDatabase *const       lmdb_;
 
@@ -123,6 +188,10 @@ private:
    ScrAddrFilter*                 root_;
    ScrAddrSideScanData            scrAddrDataForSideScan_;
    atomic<int32_t>                mergeLock_;
+
+   //guards the child_ chain, on the root object
+   mutex                          sideScanMutex_;
+
    bool                           mergeFlag_=false;
    
    //false: dont scan
@@ -130,6 +199,9 @@ private:
    bool                           doScan_ = true; 
    bool                           isScanning_ = false;
 
+   //side scans from genesis skip blocks by their filters
+   bool                           useBlockFilters_ = false;
+
    void setScrAddrLastScanned(const BinaryData& scrAddr, uint32_t blkHgt)
    {
       auto scrAddrIter = scrAddrMap_.find(scrAddr);
@@ -160,7 +232,7 @@ public:
    
    LMDBBlockDatabase* lmdb() { return lmdb_; }
 
-   const unordered_map<BinaryData, uint32_t, hashBinData>& getScrAddrMap(void) const
+   const ScrAddrMap& getScrAddrMap(void) const
    { return scrAddrMap_; }
 
    size_t numScrAddr(void) const
@@ -178,8 +250,16 @@ public:
 
    void clear(void);
 
-   bool hasScrAddress(const BinaryData & sa)
-   { return (scrAddrMap_.find(sa) != scrAddrMap_.end()); }
+   bool useBlockFilters(void) const { return useBlockFilters_; }
+
+   bool hasScrAddress(const BinaryData & sa) const
+   {
+      //most txouts aren't ours, turn them down before hitting the map
+      if (!prefilter_.mayContain(sa))
+         return false;
+
+      return (scrAddrMap_.find(sa) != scrAddrMap_.end()); 
+   }
 
    void getScrAddrCurrentSyncState();
    void getScrAddrCurrentSyncState(BinaryData const & scrAddr);
@@ -187,7 +267,7 @@ public:
    void setSSHLastScanned(uint32_t height);
 
    void regScrAddrForScan(const BinaryData& scrAddr, uint32_t scanFrom)
-   { scrAddrMap_[scrAddr] = scanFrom; }
+   { addScrAddr(scrAddr, scanFrom, true); }
 
    void scanScrAddrMapInNewThread(void);
 
@@ -225,10 +305,15 @@ protected:
    virtual BlockDataManagerConfig config(void) = 0;
 
 private:
+   void addScrAddr(const BinaryData& scrAddr, uint32_t scanFrom, 
+      bool overwrite);
+   void rebuildPrefilter(void);
+
    void scanScrAddrThread(void);
    void buildSideScanData(
       const map<shared_ptr<BtcWallet>, vector<BinaryData>>& wltnAddrMap);
    void buildSSHKeys(void);
+   void coalesceQueuedScans(void);
 };
 
 class ZeroConfContainer
@@ -6,11 +6,69 @@
 //                                                                            //
 ////////////////////////////////////////////////////////////////////////////////
 
+#include <algorithm>
+
 #include "BinaryData.h"
 #include "BtcUtils.h"
 
 BinaryData BinaryData::EmptyBinData_(0);
 
+////////////////////////////////////////////////////////////////////////////////
+void BinaryDataBuffer::append(uint8_t const * ptr, size_t sz)
+{
+   if(sz == 0)
+      return;
+
+   size_t newSize = (size_t)size_ + sz;
+   if(newSize > capacity())
+   {
+      //ptr may point into our own bytes, which grow() is about to free
+      uint8_t const * oldData = data();
+      bool isAlias = (ptr >= oldData && ptr < oldData + size_);
+      size_t offset = ptr - oldData;
+
+      grow(newSize, false);
+      if(isAlias)
+         ptr = data() + offset;
+   }
+
+   memmove(data() + size_, ptr, sz);
+   size_ = (uint32_t)newSize;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+void BinaryDataBuffer::grow(size_t minCapacity, bool exact)
+{
+   if(minCapacity > UINT32_MAX)
+      throw length_error("BinaryData can't hold more than 4GB");
+
+   size_t newCapacity = minCapacity;
+   if(!exact)
+      newCapacity = max(minCapacity, min(2 * capacity(), (size_t)UINT32_MAX));
+
+   BinaryDataAllocator<uint8_t> allocator(secure_);
+   uint8_t* newPtr = allocator.allocate(newCapacity);
+   if(size_ > 0)
+      memcpy(newPtr, data(), size_);
+
+   release();
+
+   heap_.ptr = newPtr;
+   heap_.capacity = newCapacity;
+   onHeap_ = true;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+void BinaryDataBuffer::release(void)
+{
+   if(!onHeap_)
+      return;
+
+   BinaryDataAllocator<uint8_t> allocator(secure_);
+   allocator.deallocate(heap_.ptr, heap_.capacity);
+   onHeap_ = false;
+}
+
 ////////////////////////////////////////////////////////////////////////////////
 BinaryData::BinaryData(BinaryDataRef const & bdRef) 
 { 
@@ -42,7 +100,7 @@ BinaryData & BinaryData::append(BinaryDataRef const & bd2)
    if(getSize()==0) 
       copyFrom(bd2.getPtr(), bd2.getSize());
    else
-      data_.insert(data_.end(), bd2.getPtr(), bd2.getPtr()+bd2.getSize());
+      data_.append(bd2.getPtr(), bd2.getSize());
 
    return (*this);
 }
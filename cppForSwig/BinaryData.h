@@ -54,6 +54,7 @@
 #define DEFAULT_BUFFER_SIZE 32*1048576
 
 #include "UniversalTimer.h"
+#include "SecureAllocator.h"
 
 #define READHEX        BinaryData::CreateFromHex
 
@@ -100,6 +101,171 @@ using namespace std;
 
 class BinaryDataRef;
 
+////////////////////////////////////////////////////////////////////////////////
+// Byte storage behind BinaryData. Most BinaryData objects are hashes, 
+// hash160s, DB keys and standard scripts, so up to INLINE_BYTES bytes are 
+// kept inside the object itself and only larger buffers go to the heap.
+// 
+// Secure storage (SecureBinaryData) never uses the inline bytes: its data 
+// always lives in the SecureMemoryPool, wherever the object itself is.
+//
+// Sizes are capped at 4GB, growing past that throws length_error.
+class BinaryDataBuffer
+{
+public:
+   static const size_t INLINE_BYTES = 40;
+
+   BinaryDataBuffer(void) : 
+      size_(0), onHeap_(false), secure_(false) {}
+   explicit BinaryDataBuffer(BinaryDataAllocator<uint8_t> const & allocator) :
+      size_(0), onHeap_(false), secure_(allocator.isSecure()) {}
+   BinaryDataBuffer(BinaryDataBuffer const & other) :
+      size_(0), onHeap_(false), secure_(false)
+      { assign(other.data(), other.size()); }
+   BinaryDataBuffer(BinaryDataBuffer && other) :
+      size_(0), onHeap_(false), secure_(other.secure_)
+      { swap(other); }
+
+   ~BinaryDataBuffer(void) { release(); }
+
+   /////////////////////////////////////////////////////////////////////////////
+   // Copies keep their own secure flag
+   BinaryDataBuffer& operator=(BinaryDataBuffer const & other)
+   {
+      if(this != &other)
+         assign(other.data(), other.size());
+      return *this;
+   }
+
+   // Buffers only trade places within the same kind of storage, secure
+   // data doesn't move to the heap or the other way around
+   BinaryDataBuffer& operator=(BinaryDataBuffer && other)
+   {
+      if(secure_ == other.secure_)
+         swap(other);
+      else
+         assign(other.data(), other.size());
+      return *this;
+   }
+
+   /////////////////////////////////////////////////////////////////////////////
+   size_t size(void) const     { return size_; }
+   size_t capacity(void) const 
+   { 
+      if(onHeap_)
+         return heap_.capacity;
+      return (secure_ ? 0 : INLINE_BYTES);
+   }
+
+   bool isSecure(void) const   { return secure_; }
+   bool isInline(void) const   { return !onHeap_; }
+
+   uint8_t* data(void)             { return (onHeap_ ? heap_.ptr : inline_); }
+   uint8_t const * data(void) const { return (onHeap_ ? heap_.ptr : inline_); }
+
+   uint8_t& operator[](size_t i)             { return data()[i]; }
+   uint8_t const & operator[](size_t i) const { return data()[i]; }
+
+   /////////////////////////////////////////////////////////////////////////////
+   // New bytes are zeroed, same as vector<uint8_t>::resize
+   void resize(size_t sz)
+   {
+      if(sz > capacity())
+         grow(sz, false);
+      if(sz > size_)
+         memset(data() + size_, 0, sz - size_);
+      size_ = (uint32_t)sz;
+   }
+
+   void reserve(size_t sz)
+   {
+      if(sz > capacity())
+         grow(sz, true);
+   }
+
+   // Keeps the capacity
+   void clear(void) { size_ = 0; }
+
+   void append(uint8_t const * ptr, size_t sz);
+   
+   void push_back(uint8_t byte)
+   {
+      if(size_ == capacity())
+         grow((size_t)size_ + 1, false);
+      data()[size_++] = byte;
+   }
+
+   /////////////////////////////////////////////////////////////////////////////
+   // Only between buffers with the same secure flag
+   void swap(BinaryDataBuffer & other)
+   {
+      //only move what each side holds, the rest of inline_ is uninitialized
+      if(onHeap_ && other.onHeap_)
+      {
+         std::swap(heap_, other.heap_);
+      }
+      else if(onHeap_ || other.onHeap_)
+      {
+         BinaryDataBuffer& heapSide   = (onHeap_ ? *this : other);
+         BinaryDataBuffer& inlineSide = (onHeap_ ? other : *this);
+
+         //heap_ and inline_ share their bytes, save the pointer first
+         HeapBuffer heap = heapSide.heap_;
+         if(inlineSide.size_ > 0)
+            memcpy(heapSide.inline_, inlineSide.inline_, inlineSide.size_);
+         inlineSide.heap_ = heap;
+      }
+      else
+      {
+         uint8_t tmp[INLINE_BYTES];
+         if(size_ > 0)
+            memcpy(tmp, inline_, size_);
+         if(other.size_ > 0)
+            memcpy(inline_, other.inline_, other.size_);
+         if(size_ > 0)
+            memcpy(other.inline_, tmp, size_);
+      }
+
+      std::swap(size_, other.size_);
+      std::swap(onHeap_, other.onHeap_);
+   }
+
+private:
+   void assign(uint8_t const * ptr, size_t sz)
+   {
+      if(sz > capacity())
+      {
+         //nothing worth keeping, don't copy the old bytes over
+         size_ = 0;
+         grow(sz, true);
+      }
+
+      if(sz > 0)
+         memcpy(data(), ptr, sz);
+      size_ = (uint32_t)sz;
+   }
+
+   void grow(size_t minCapacity, bool exact);
+   void release(void);
+
+private:
+   struct HeapBuffer
+   {
+      uint8_t* ptr;
+      size_t   capacity;
+   };
+
+   union
+   {
+      uint8_t    inline_[INLINE_BYTES];
+      HeapBuffer heap_;
+   };
+
+   uint32_t size_;
+   bool     onHeap_;
+   bool     secure_;
+};
+
 //template<typename T> class BitPacker;
 
 ////////////////////////////////////////////////////////////////////////////////
@@ -110,7 +276,7 @@ public:
 
 
    /////////////////////////////////////////////////////////////////////////////
-   BinaryData(void) : data_(0)                 {                         }
+   BinaryData(void) : data_()                  {                         }
    explicit BinaryData(size_t sz)              { alloc(sz);              }
    BinaryData(uint8_t const * inData, size_t sz)      
                                                { copyFrom(inData, sz);   }
@@ -134,7 +300,7 @@ public:
    }
    BinaryData& operator=(BinaryData &&o)
    {
-      swap(data_, o.data_);
+      data_ = move(o.data_);
       return *this;
    }
 
@@ -243,7 +409,7 @@ public:
       if(getSize()==0) 
          copyFrom(bd2.getPtr(), bd2.getSize());
       else
-         data_.insert(data_.end(), bd2.data_.begin(), bd2.data_.end());
+         data_.append(bd2.data_.data(), bd2.data_.size());
       return (*this);
    }
 
@@ -256,7 +422,7 @@ public:
    /////////////////////////////////////////////////////////////////////////////
    BinaryData & append(uint8_t byte)
    {
-      data_.insert(data_.end(), byte);
+      data_.push_back(byte);
       return (*this);
    }
 
@@ -569,8 +735,13 @@ public:
 public:
    static BinaryData EmptyBinData_;
 
+protected:
+   // For SecureBinaryData, which keeps its bytes in the locked pool
+   explicit BinaryData(BinaryDataAllocator<uint8_t> const & allocator) : 
+      data_(allocator) {}
+
 private:
-   vector<uint8_t> data_;
+   BinaryDataBuffer data_;
 
 private:
    void alloc(size_t sz) 
@@ -1687,15 +1858,129 @@ private:
 
 };
 
-struct BinaryDataHash
+////////////////////////////////////////////////////////////////////////////////
+// Hash functor for unordered containers keyed by BinaryData. This is the
+// wyhash construction: the whole key goes through 64x64->128 bit multiplies,
+// so keys sharing a prefix (every scrAddr starts with its prefix byte, db 
+// keys with their height) still spread over all the buckets. Reads are
+// unaligned safe.
+//
+// The seed keys the hash. Containers holding data that comes off the 
+// network can pass a random one.
+class BinaryDataHash
 {
-   size_t operator()(const BinaryData &x) const
+public:
+   explicit BinaryDataHash(uint64_t seed = 0) : 
+      mixedSeed_(mixSeed(seed)) {}
+
+   size_t operator()(BinaryData const & bd) const
+   { return (size_t)hashMixed(bd.getPtr(), bd.getSize(), mixedSeed_); }
+
+   size_t operator()(BinaryDataRef const & bdr) const
+   { return (size_t)hashMixed(bdr.getPtr(), bdr.getSize(), mixedSeed_); }
+
+   // full 64 bits on every platform
+   uint64_t hash64(BinaryData const & bd) const
+   { return hashMixed(bd.getPtr(), bd.getSize(), mixedSeed_); }
+
+   static uint64_t hash(uint8_t const * ptr, size_t len, uint64_t seed)
+   { return hashMixed(ptr, len, mixSeed(seed)); }
+
+private:
+   static const uint64_t SECRET0 = 0xa0761d6478bd642fULL;
+   static const uint64_t SECRET1 = 0xe7037ed1a0b428dbULL;
+
+   /////////////////////////////////////////////////////////////////////////////
+   // the seed's own mixing round is done once, by the constructor
+   static uint64_t mixSeed(uint64_t seed)
+   { return seed ^ mix(seed ^ SECRET0, SECRET1); }
+
+   static uint64_t hashMixed(uint8_t const * ptr, size_t len, uint64_t seed)
+   {
+      uint64_t a, b;
+      if (len <= 16)
+      {
+         if (len >= 4)
+         {
+            //two overlapping 4 byte reads at each end cover 4 to 16 bytes
+            size_t step = (len >> 3) << 2;
+            a = (read4(ptr) << 32) | read4(ptr + step);
+            b = (read4(ptr + len - 4) << 32) | read4(ptr + len - 4 - step);
+         }
+         else if (len > 0)
+         {
+            a = ((uint64_t)ptr[0] << 16) | ((uint64_t)ptr[len >> 1] << 8) | 
+                ptr[len - 1];
+            b = 0;
+         }
+         else
+         {
+            a = b = 0;
+         }
+      }
+      else
+      {
+         size_t remaining = len;
+         while (remaining > 16)
+         {
+            seed = mix(read8(ptr) ^ SECRET1, read8(ptr + 8) ^ seed);
+            ptr += 16;
+            remaining -= 16;
+         }
+
+         a = read8(ptr + remaining - 16);
+         b = read8(ptr + remaining - 8);
+      }
+
+      a ^= SECRET1;
+      b ^= seed;
+      multiply(a, b);
+      return mix(a ^ SECRET0 ^ len, b ^ SECRET1);
+   }
+
+   /////////////////////////////////////////////////////////////////////////////
+   // a, b <- low and high halves of a*b
+   static void multiply(uint64_t& a, uint64_t& b)
    {
-      // use the first size_t bytes of HashString in our hashtable
-      // hash256 should have good even distribution
-      const char *y = x.toCharPtr();
-      return *reinterpret_cast<const size_t*>(y);
+#if defined(__SIZEOF_INT128__)
+      unsigned __int128 r = (unsigned __int128)a * b;
+      a = (uint64_t)r;
+      b = (uint64_t)(r >> 64);
+#else
+      uint64_t aHi = a >> 32, aLo = (uint32_t)a;
+      uint64_t bHi = b >> 32, bLo = (uint32_t)b;
+
+      uint64_t hh = aHi * bHi, hl = aHi * bLo;
+      uint64_t lh = aLo * bHi, ll = aLo * bLo;
+
+      uint64_t mid = (ll >> 32) + (uint32_t)hl + (uint32_t)lh;
+      a = (mid << 32) | (uint32_t)ll;
+      b = hh + (hl >> 32) + (lh >> 32) + (mid >> 32);
+#endif
    }
+
+   static uint64_t mix(uint64_t a, uint64_t b)
+   {
+      multiply(a, b);
+      return a ^ b;
+   }
+
+   static uint64_t read8(uint8_t const * ptr)
+   {
+      uint64_t val;
+      memcpy(&val, ptr, 8);
+      return val;
+   }
+
+   static uint64_t read4(uint8_t const * ptr)
+   {
+      uint32_t val;
+      memcpy(&val, ptr, 4);
+      return val;
+   }
+
+private:
+   uint64_t mixedSeed_;
 };
 
 
@@ -0,0 +1,193 @@
+////////////////////////////////////////////////////////////////////////////////
+//                                                                            //
+//  Copyright (C) 2011-2015, Armory Technologies, Inc.                        //
+//  Distributed under the GNU Affero General Public License (AGPL v3)         //
+//  See LICENSE or http://www.gnu.org/licenses/agpl.html                      //
+//                                                                            //
+////////////////////////////////////////////////////////////////////////////////
+
+#include <string.h>
+
+#include "BlkFileWatcher.h"
+#include "log.h"
+
+#if defined(__linux__)
+   #define BLKFILEWATCHER_INOTIFY
+   #include <unistd.h>
+   #include <errno.h>
+   #include <limits.h>
+   #include <poll.h>
+   #include <sys/inotify.h>
+#endif
+
+using namespace std;
+
+////////////////////////////////////////////////////////////////////////////////
+BlkFileWatcher::BlkFileWatcher(const string& blkFileLocation,
+   function<void(void)> onChange) :
+   blkFileLocation_(blkFileLocation), onChange_(onChange),
+   active_(false), changed_(true)
+{
+   stopPipe_[0] = stopPipe_[1] = -1;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+BlkFileWatcher::~BlkFileWatcher()
+{
+   stop();
+}
+
+////////////////////////////////////////////////////////////////////////////////
+bool BlkFileWatcher::start(void)
+{
+#ifdef BLKFILEWATCHER_INOTIFY
+   if (thread_.joinable())
+      return isActive();
+
+   inotifyFd_ = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+   if (inotifyFd_ < 0)
+   {
+      LOGWARN << "inotify_init1 failed (" << strerror(errno) <<
+         "), polling blk files";
+      return false;
+   }
+
+   //bitcoind appends to the current blk file and creates the next one when
+   //it's full
+   if (inotify_add_watch(inotifyFd_, blkFileLocation_.c_str(),
+      IN_MODIFY | IN_CREATE | IN_MOVED_TO | IN_DELETE_SELF | IN_MOVE_SELF) < 0)
+   {
+      LOGWARN << "can't watch " << blkFileLocation_ << " (" <<
+         strerror(errno) << "), polling blk files";
+      close(inotifyFd_);
+      inotifyFd_ = -1;
+      return false;
+   }
+
+   if (pipe(stopPipe_) != 0)
+   {
+      close(inotifyFd_);
+      inotifyFd_ = -1;
+      stopPipe_[0] = stopPipe_[1] = -1;
+      return false;
+   }
+
+   active_.store(true);
+   changed_.store(true);
+   thread_ = thread(&BlkFileWatcher::watchThread, this);
+
+   LOGINFO << "watching " << blkFileLocation_ << " for new blocks";
+   return true;
+#else
+   return false;
+#endif
+}
+
+////////////////////////////////////////////////////////////////////////////////
+void BlkFileWatcher::stop(void)
+{
+#ifdef BLKFILEWATCHER_INOTIFY
+   if (thread_.joinable())
+   {
+      char c = 0;
+      if (write(stopPipe_[1], &c, 1) != 1)
+         LOGERR << "failed to signal the blk file watcher thread";
+      thread_.join();
+   }
+
+   if (inotifyFd_ >= 0)
+      close(inotifyFd_);
+   inotifyFd_ = -1;
+
+   for (auto& fd : stopPipe_)
+   {
+      if (fd >= 0)
+         close(fd);
+      fd = -1;
+   }
+#endif
+
+   active_.store(false);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+bool BlkFileWatcher::hasChanges(void)
+{
+   //once the watcher is gone, poll every time
+   bool changed = changed_.exchange(false);
+   return changed || !isActive();
+}
+
+////////////////////////////////////////////////////////////////////////////////
+void BlkFileWatcher::watchThread(void)
+{
+#ifdef BLKFILEWATCHER_INOTIFY
+   //room for a few events at least, names are at most NAME_MAX long
+   char buffer[16 * (sizeof(struct inotify_event) + NAME_MAX + 1)]
+      __attribute__((aligned(__alignof__(struct inotify_event))));
+
+   struct pollfd fds[2];
+   fds[0].fd = inotifyFd_;
+   fds[0].events = POLLIN;
+   fds[1].fd = stopPipe_[0];
+   fds[1].events = POLLIN;
+
+   while (true)
+   {
+      if (poll(fds, 2, -1) < 0)
+      {
+         if (errno == EINTR)
+            continue;
+         break;
+      }
+
+      if (fds[1].revents != 0)
+         return;
+
+      //drain everything that's queued, one wake up covers all of it
+      bool blkFileChanged = false;
+      bool watchLost = false;
+      while (true)
+      {
+         ssize_t len = read(inotifyFd_, buffer, sizeof(buffer));
+         if (len <= 0)
+            break;
+
+         for (char* ptr = buffer; ptr < buffer + len;)
+         {
+            const struct inotify_event* ev =
+               reinterpret_cast<const struct inotify_event*>(ptr);
+            ptr += sizeof(struct inotify_event) + ev->len;
+
+            if (ev->mask & (IN_DELETE_SELF | IN_MOVE_SELF | IN_IGNORED))
+               watchLost = true;
+            else if (ev->mask & IN_Q_OVERFLOW)
+               blkFileChanged = true;
+            else if (ev->len > 0 && strncmp(ev->name, "blk", 3) == 0)
+               blkFileChanged = true;
+         }
+      }
+
+      if (watchLost)
+      {
+         LOGWARN << blkFileLocation_ << " went away, polling blk files";
+         changed_.store(true);
+         active_.store(false);
+         onChange_();
+         return;
+      }
+
+      if (blkFileChanged)
+      {
+         changed_.store(true);
+         onChange_();
+      }
+   }
+
+   //poll failed, let the BDM thread go back to polling the blk files
+   LOGWARN << "blk file watcher failed (" << strerror(errno) <<
+      "), polling blk files";
+   active_.store(false);
+   onChange_();
+#endif
+}
@@ -0,0 +1,63 @@
+////////////////////////////////////////////////////////////////////////////////
+//                                                                            //
+//  Copyright (C) 2011-2015, Armory Technologies, Inc.                        //
+//  Distributed under the GNU Affero General Public License (AGPL v3)         //
+//  See LICENSE or http://www.gnu.org/licenses/agpl.html                      //
+//                                                                            //
+////////////////////////////////////////////////////////////////////////////////
+
+#ifndef _BLK_FILE_WATCHER_H_
+#define _BLK_FILE_WATCHER_H_
+
+#include <string>
+#include <atomic>
+#include <thread>
+#include <functional>
+
+////////////////////////////////////////////////////////////////////////////////
+// Watches the blk file directory so the BDM thread can pick up new blocks as
+// soon as bitcoind appends them, instead of polling the blk files every
+// second.
+//
+// On Linux this is an inotify watch on the directory, serviced by its own
+// thread, which calls onChange whenever a blkXXXXX.dat file is created or
+// written to. Elsewhere, or if the watch can't be set up, start() returns
+// false and hasChanges() always returns true, so the caller falls back to
+// polling.
+class BlkFileWatcher
+{
+public:
+   BlkFileWatcher(const std::string& blkFileLocation,
+      std::function<void(void)> onChange);
+   ~BlkFileWatcher();
+
+   bool start(void);
+   void stop(void);
+
+   bool isActive(void) const { return active_.load(); }
+
+   // true if the blk files may have changed since the last call. Always true
+   // while the watcher isn't running.
+   bool hasChanges(void);
+
+private:
+   void watchThread(void);
+
+private:
+   const std::string blkFileLocation_;
+   const std::function<void(void)> onChange_;
+
+   std::atomic<bool> active_;
+   std::atomic<bool> changed_;
+
+   int inotifyFd_ = -1;
+   int stopPipe_[2];
+
+   std::thread thread_;
+
+private:
+   BlkFileWatcher(const BlkFileWatcher&);
+   BlkFileWatcher& operator=(const BlkFileWatcher&);
+};
+
+#endif
@@ -32,6 +32,17 @@ struct BlockDataManagerConfig
 {
    ARMORY_DB_TYPE armoryDbType;
    DB_PRUNE_TYPE pruneType;
+
+   //keep a scrAddr keyed UTXO DB alongside the history
+   bool maintainUtxoIndex;
+
+   //threads scanning wallets side by side, 0 to size it to the machine
+   unsigned walletScanThreads;
+
+   //dump the Stats to this file every statsInterval seconds, in the
+   //Prometheus text format if the name ends in .prom. Empty for none
+   string statsFile;
+   unsigned statsInterval;
    
    string blkFileLocation;
    string levelDBLocation;
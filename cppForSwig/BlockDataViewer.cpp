@@ -7,6 +7,77 @@
 ////////////////////////////////////////////////////////////////////////////////
 #include "BlockDataViewer.h"
 
+#include <thread>
+#include <atomic>
+#include <exception>
+
+namespace
+{
+////////////////////////////////////////////////////////////////////////////////
+// Runs job(0) to job(count - 1) on up to nThreads threads, the calling thread
+// being one of them. 0 threads means one per core, up to MAX_SCAN_THREADS. 
+// Returns once every job is done, rethrowing the first exception a job threw,
+// if any.
+const unsigned MAX_SCAN_THREADS = 8;
+
+void runInParallel(size_t nThreads, size_t count, 
+   const function<void(size_t)>& job)
+{
+   if (nThreads == 0)
+   {
+      nThreads = thread::hardware_concurrency();
+      if (nThreads > MAX_SCAN_THREADS)
+         nThreads = MAX_SCAN_THREADS;
+   }
+   if (nThreads > count)
+      nThreads = count;
+
+   if (nThreads <= 1)
+   {
+      for (size_t i = 0; i < count; i++)
+         job(i);
+      return;
+   }
+
+   atomic<size_t> nextJob(0);
+   mutex errorMutex;
+   exception_ptr error;
+
+   auto worker = [&](void)->void
+   {
+      while (true)
+      {
+         size_t i = nextJob.fetch_add(1);
+         if (i >= count)
+            return;
+
+         try
+         {
+            job(i);
+         }
+         catch (...)
+         {
+            unique_lock<mutex> lock(errorMutex);
+            if (!error)
+               error = current_exception();
+         }
+      }
+   };
+
+   vector<thread> threads;
+   for (size_t i = 1; i < nThreads; i++)
+      threads.push_back(thread(worker));
+
+   worker();
+
+   for (auto& thr : threads)
+      thr.join();
+
+   if (error)
+      rethrow_exception(error);
+}
+}
+
 
 /////////////////////////////////////////////////////////////////////////////
 BlockDataViewer::BlockDataViewer(BlockDataManager_LevelDB* bdm) :
@@ -72,8 +143,11 @@ void BlockDataViewer::scanWallets(uint32_t startBlock,
    if (endBlock == UINT32_MAX)
       endBlock = getTopBlockHeight() + 1;
    
+   bool merged = false;
    for (auto& group : groups_)
-      group.merge();
+      merged |= group.merge();
+
+   const bool wasInitialized = initialized_;
 
    vector<uint32_t> startBlocks;
    for (auto& group : groups_)
@@ -102,12 +176,19 @@ void BlockDataViewer::scanWallets(uint32_t startBlock,
    }
    const bool reorg = (lastScanned_ > startBlock);
 
+   //on a plain new block, only the wallets the block pays to or spends from
+   //have history to fetch. Paging, reorgs and freshly merged scrAddr need
+   //the full scan
+   const set<BinaryData>* touchedScrAddr = nullptr;
+   if (wasInitialized && !reorg && !merged && startBlock < endBlock)
+      touchedScrAddr = bdmPtr_->getScrAddrTouchedByUpdate(startBlock, endBlock);
+
    sbIter = startBlocks.begin();
    for (auto& group : groups_)
    {
 
       group.scanWallets(*sbIter, endBlock, 
-         reorg, invalidatedZCKeys);
+         reorg, invalidatedZCKeys, touchedScrAddr);
 
       group.updateGlobalLedgerFirstPage(*sbIter, endBlock,
          forceRefresh);
@@ -266,10 +347,12 @@ Tx BlockDataViewer::getTxByHash(HashString const & txhash) const
 {
    checkBDMisReady();
 
+   //the hints and the tx they point to come from the same batch. Python 
+   //calls this for every ledger row, pin only the envs the lookup reads
+   DBSnapshot snapshot(db_, { BLKDATA, TXHINTS });
+
    if (config().armoryDbType == ARMORY_DB_SUPER)
    {
-      LMDBEnv::Transaction tx(db_->dbEnv_[BLKDATA].get(), LMDB::ReadOnly);
-
       TxRef txrefobj = db_->getTxRef(txhash);
 
       if (!txrefobj.isNull())
@@ -529,11 +612,14 @@ vector<UnspentTxOut> BlockDataViewer::getUnspentTxoutsForAddr160List(
    {
       const auto& zcTxioMap = zeroConfCont_.getZCforScrAddr(scrAddr);
 
-      StoredScriptHistory ssh;
-      db_->getStoredScriptHistory(ssh, scrAddr);
-
+      //only pull the full history when there is no utxo index to go by
       map<BinaryData, UnspentTxOut> scrAddrUtxoMap;
-      db_->getFullUTXOMapForSSH(ssh, scrAddrUtxoMap);
+      if (!db_->getUtxosForScrAddr(scrAddr, scrAddrUtxoMap))
+      {
+         StoredScriptHistory ssh;
+         db_->getStoredScriptHistory(ssh, scrAddr);
+         db_->getFullUTXOMapForSSH(ssh, scrAddrUtxoMap);
+      }
 
       for (const auto& utxoPair : scrAddrUtxoMap)
       {
@@ -935,6 +1021,9 @@ vector<LedgerEntry> WalletGroup::getHistoryPage(uint32_t pageId,
 {
    unique_lock<mutex> mu(globalLedgerLock_);
 
+   //the page map and every wallet's ledgers come from the same batches
+   DBSnapshot snapshot(bdvPtr_->getDB());
+
    if (pageId >= hist_.getPageCount())
       throw std::range_error("pageId out of range");
 
@@ -1001,20 +1090,43 @@ void WalletGroup::updateLedgerFilter(const vector<BinaryData>& walletsList)
 }
 
 ////////////////////////////////////////////////////////////////////////////////
-void WalletGroup::merge()
+bool WalletGroup::merge()
 {
+   //returns true if any wallet had scrAddr to merge
+   bool merged = false;
+
    ReadWriteLock::ReadLock rl(lock_);
    for (auto& wlt : values(wallets_))
+   {
+      if (wlt->getMergeFlag() == BtcWallet::NeedsMerging)
+         merged = true;
       wlt->merge();
+   }
+
+   return merged;
 }
 
 ////////////////////////////////////////////////////////////////////////////////
 void WalletGroup::scanWallets(uint32_t startBlock, uint32_t endBlock, 
-   bool reorg, map<BinaryData, vector<BinaryData> > invalidatedZCKeys)
+   bool reorg, map<BinaryData, vector<BinaryData> > invalidatedZCKeys,
+   const set<BinaryData>* touchedScrAddr)
 {
    ReadWriteLock::ReadLock rl(lock_);
+
+   vector<shared_ptr<BtcWallet>> wallets;
    for (auto& wlt : values(wallets_))
-      wlt->scanWallet(startBlock, endBlock, reorg, invalidatedZCKeys);
+      wallets.push_back(wlt);
+
+   //wallets don't share scan state, each thread opens its own read 
+   //transactions
+   auto scanWallet = [&](size_t i)->void
+   {
+      wallets[i]->scanWallet(startBlock, endBlock, reorg, invalidatedZCKeys,
+         touchedScrAddr);
+   };
+
+   runInParallel(bdvPtr_->config().walletScanThreads, 
+      wallets.size(), scanWallet);
 }
 
 ////////////////////////////////////////////////////////////////////////////////
@@ -1038,18 +1150,30 @@ void WalletGroup::updateGlobalLedgerFirstPage(uint32_t startBlock,
 
       LedgerEntry::purgeLedgerVectorFromHeight(globalLedger_, startBlock);
 
+      vector<shared_ptr<BtcWallet>> wallets;
       for (auto& wlt : values(wallets_))
+         wallets.push_back(wlt);
+
+      //compute the ledgers side by side, then append them in wallet order so
+      //that the sort below sees the same input as a serial pass would
+      vector<map<BinaryData, LedgerEntry>> leMaps(wallets.size());
+      auto computeLedgers = [&](size_t i)->void
       {
          map<BinaryData, TxIOPair> txioMap;
-         wlt->getTxioForRange(startBlock, UINT32_MAX, txioMap);
+         wallets[i]->getTxioForRange(startBlock, UINT32_MAX, txioMap);
+         wallets[i]->updateWalletLedgersFromTxio(
+            leMaps[i], txioMap, startBlock, UINT32_MAX);
+      };
 
-         map<BinaryData, LedgerEntry> leMap;
-         wlt->updateWalletLedgersFromTxio(leMap, txioMap, startBlock, UINT32_MAX);
+      runInParallel(bdvPtr_->config().walletScanThreads, 
+         wallets.size(), computeLedgers);
 
-         if (!wlt->uiFilter_)
+      for (size_t i = 0; i < wallets.size(); i++)
+      {
+         if (!wallets[i]->uiFilter_)
             continue;
 
-         for (const auto& lePair : leMap)
+         for (const auto& lePair : leMaps[i])
             globalLedger_.push_back(lePair.second);
       }
 
@@ -321,9 +321,10 @@ private:
    uint32_t pageHistory(bool forcePaging = true);
    void updateLedgerFilter(const vector<BinaryData>& walletsVec);
 
-   void merge();
+   bool merge();
    void scanWallets(uint32_t, uint32_t, bool,
-      map<BinaryData, vector<BinaryData> >);
+      map<BinaryData, vector<BinaryData> >,
+      const set<BinaryData>* touchedScrAddr = nullptr);
    void updateGlobalLedgerFirstPage(uint32_t startBlock, 
       uint32_t endBlock, BDV_refresh forceRefresh);
 
@@ -0,0 +1,343 @@
+////////////////////////////////////////////////////////////////////////////////
+//                                                                            //
+//  Copyright (C) 2011-2015, Armory Technologies, Inc.                        //
+//  Distributed under the GNU Affero General Public License (AGPL v3)         //
+//  See LICENSE or http://www.gnu.org/licenses/agpl.html                      //
+//                                                                            //
+////////////////////////////////////////////////////////////////////////////////
+
+#include <algorithm>
+
+#include "BlockFilter.h"
+#include "BtcUtils.h"
+
+using namespace std;
+
+namespace
+{
+
+////////////////////////////////////////////////////////////////////////////////
+uint64_t readUint64LE(uint8_t const * ptr)
+{
+   uint64_t val = 0;
+   for (unsigned i = 0; i < 8; i++)
+      val |= (uint64_t)ptr[i] << (8 * i);
+   return val;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+uint64_t rotl(uint64_t val, unsigned bits)
+{
+   return (val << bits) | (val >> (64 - bits));
+}
+
+////////////////////////////////////////////////////////////////////////////////
+void sipRound(uint64_t& v0, uint64_t& v1, uint64_t& v2, uint64_t& v3)
+{
+   v0 += v1; v1 = rotl(v1, 13); v1 ^= v0; v0 = rotl(v0, 32);
+   v2 += v3; v3 = rotl(v3, 16); v3 ^= v2;
+   v0 += v3; v3 = rotl(v3, 21); v3 ^= v0;
+   v2 += v1; v1 = rotl(v1, 17); v1 ^= v2; v2 = rotl(v2, 32);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+// (hash * range) >> 64: maps hash onto [0, range), preserving order
+uint64_t mapToRange(uint64_t hash, uint64_t range)
+{
+#if defined(__SIZEOF_INT128__)
+   return (uint64_t)(((unsigned __int128)hash * range) >> 64);
+#else
+   uint64_t hHi = hash >> 32, hLo = (uint32_t)hash;
+   uint64_t rHi = range >> 32, rLo = (uint32_t)range;
+
+   uint64_t hh = hHi * rHi, hl = hHi * rLo;
+   uint64_t lh = hLo * rHi, ll = hLo * rLo;
+
+   uint64_t mid = (ll >> 32) + (uint32_t)hl + (uint32_t)lh;
+   return hh + (hl >> 32) + (lh >> 32) + (mid >> 32);
+#endif
+}
+
+////////////////////////////////////////////////////////////////////////////////
+unsigned countLeadingZeros(uint64_t val)
+{
+#if defined(__GNUC__)
+   return val == 0 ? 64 : __builtin_clzll(val);
+#else
+   unsigned count = 0;
+   while (count < 64 && (val & (1ULL << (63 - count))) == 0)
+      count++;
+   return count;
+#endif
+}
+
+////////////////////////////////////////////////////////////////////////////////
+// Most significant bit first
+class BitWriter
+{
+public:
+   explicit BitWriter(BinaryWriter& bw) : bw_(bw) {}
+
+   // nBits <= 32
+   void putBits(uint64_t val, unsigned nBits)
+   {
+      acc_ = (acc_ << nBits) | (val & ((1ULL << nBits) - 1));
+      nAcc_ += nBits;
+
+      while (nAcc_ >= 8)
+      {
+         nAcc_ -= 8;
+         bw_.put_uint8_t((uint8_t)(acc_ >> nAcc_));
+      }
+   }
+
+   void putUnary(uint64_t val)
+   {
+      while (val >= 32)
+      {
+         putBits(UINT32_MAX, 32);
+         val -= 32;
+      }
+
+      putBits(((1ULL << val) - 1) << 1, (unsigned)val + 1);
+   }
+
+   void flush(void)
+   {
+      if (nAcc_ > 0)
+         bw_.put_uint8_t((uint8_t)(acc_ << (8 - nAcc_)));
+      nAcc_ = 0;
+   }
+
+private:
+   BinaryWriter& bw_;
+   uint64_t acc_ = 0;
+   unsigned nAcc_ = 0;
+};
+
+////////////////////////////////////////////////////////////////////////////////
+class BitReader
+{
+public:
+   BitReader(uint8_t const * ptr, size_t size) : ptr_(ptr), size_(size) {}
+
+   bool getBits(unsigned nBits, uint64_t& val)
+   {
+      refill();
+      if (avail_ < nBits)
+         return false;
+
+      val = window_ >> (64 - nBits);
+      consume(nBits);
+      return true;
+   }
+
+   bool getUnary(uint64_t& val)
+   {
+      val = 0;
+      while (true)
+      {
+         refill();
+         if (avail_ == 0)
+            return false;
+
+         unsigned ones = countLeadingZeros(~window_);
+         if (ones < avail_)
+         {
+            val += ones;
+            consume(ones + 1);
+            return true;
+         }
+
+         val += avail_;
+         consume(avail_);
+      }
+   }
+
+private:
+   //window_ holds the next avail_ bits, left aligned
+   void refill(void)
+   {
+      while (avail_ <= 56 && pos_ < size_)
+      {
+         window_ |= (uint64_t)ptr_[pos_++] << (56 - avail_);
+         avail_ += 8;
+      }
+   }
+
+   void consume(unsigned nBits)
+   {
+      window_ = (nBits == 64 ? 0 : window_ << nBits);
+      avail_ -= nBits;
+   }
+
+private:
+   uint8_t const * ptr_;
+   size_t size_;
+   size_t pos_ = 0;
+
+   uint64_t window_ = 0;
+   unsigned avail_ = 0;
+};
+
+} //namespace
+
+
+////////////////////////////////////////////////////////////////////////////////
+uint64_t BlockFilter::sipHash24(uint64_t k0, uint64_t k1, 
+   uint8_t const * ptr, size_t size)
+{
+   uint64_t v0 = 0x736f6d6570736575ULL ^ k0;
+   uint64_t v1 = 0x646f72616e646f6dULL ^ k1;
+   uint64_t v2 = 0x6c7967656e657261ULL ^ k0;
+   uint64_t v3 = 0x7465646279746573ULL ^ k1;
+
+   size_t tail = size & 7;
+   uint8_t const * end = ptr + size - tail;
+   for (; ptr != end; ptr += 8)
+   {
+      uint64_t m = readUint64LE(ptr);
+      v3 ^= m;
+      sipRound(v0, v1, v2, v3);
+      sipRound(v0, v1, v2, v3);
+      v0 ^= m;
+   }
+
+   //last block: the remaining bytes, and the length in the top byte
+   uint64_t m = (uint64_t)size << 56;
+   for (size_t i = 0; i < tail; i++)
+      m |= (uint64_t)ptr[i] << (8 * i);
+
+   v3 ^= m;
+   sipRound(v0, v1, v2, v3);
+   sipRound(v0, v1, v2, v3);
+   v0 ^= m;
+
+   v2 ^= 0xff;
+   for (unsigned i = 0; i < 4; i++)
+      sipRound(v0, v1, v2, v3);
+
+   return v0 ^ v1 ^ v2 ^ v3;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+uint64_t BlockFilter::hashItem(BinaryDataRef blockHash, BinaryDataRef item)
+{
+   if (blockHash.getSize() < 16)
+      throw runtime_error("block filters need the block hash");
+
+   uint64_t k0 = readUint64LE(blockHash.getPtr());
+   uint64_t k1 = readUint64LE(blockHash.getPtr() + 8);
+   return sipHash24(k0, k1, item.getPtr(), item.getSize());
+}
+
+////////////////////////////////////////////////////////////////////////////////
+BlockFilter::Query::Query(vector<BinaryDataRef> const & items)
+{
+   items_.reserve(items.size());
+   for (auto& item : items)
+      items_.push_back(BinaryData(item));
+}
+
+////////////////////////////////////////////////////////////////////////////////
+BinaryData BlockFilter::build(BinaryDataRef blockHash, 
+   vector<BinaryDataRef> const & items)
+{
+   vector<uint64_t> hashes;
+   hashes.reserve(items.size());
+   for (auto& item : items)
+      hashes.push_back(hashItem(blockHash, item));
+
+   //the same scrAddr is often paid several times in a block
+   sort(hashes.begin(), hashes.end());
+   hashes.erase(unique(hashes.begin(), hashes.end()), hashes.end());
+
+   uint64_t count = hashes.size();
+   uint64_t range = count * M;
+
+   //about P + 2 bits per item
+   BinaryWriter bw((uint32_t)(9 + count * (P + 2) / 8));
+   bw.put_var_int(count);
+
+   BitWriter bits(bw);
+   uint64_t last = 0;
+   for (auto hash : hashes)
+   {
+      uint64_t val = mapToRange(hash, range);
+      uint64_t delta = val - last;
+      last = val;
+
+      bits.putUnary(delta >> P);
+      bits.putBits(delta, P);
+   }
+   bits.flush();
+
+   return bw.getData();
+}
+
+////////////////////////////////////////////////////////////////////////////////
+bool BlockFilter::matchAny(BinaryDataRef filter, BinaryDataRef blockHash,
+   Query const & query)
+{
+   if (query.items_.empty())
+      return false;
+
+   //from here on, anything that doesn't add up pulls the block rather than
+   //risk skipping one of ours
+   if (filter.getSize() == 0 || blockHash.getSize() < 16)
+      return true;
+
+   uint64_t count;
+   uint32_t countLen;
+   try
+   {
+      count = BtcUtils::readVarInt(
+         filter.getPtr(), filter.getSize(), &countLen);
+   }
+   catch (BlockDeserializingException&)
+   {
+      return true;
+   }
+
+   size_t codedSize = filter.getSize() - countLen;
+   if (count == 0)
+      return codedSize != 0;
+
+   //each item takes at least P + 1 bits, this catches truncated filters
+   if (count > codedSize * 8 / (P + 1))
+      return true;
+
+   uint64_t range = count * M;
+
+   vector<uint64_t> targets;
+   targets.reserve(query.items_.size());
+   for (auto& item : query.items_)
+      targets.push_back(mapToRange(hashItem(blockHash, item), range));
+   sort(targets.begin(), targets.end());
+
+   BitReader bits(filter.getPtr() + countLen, codedSize);
+
+   //both sides are sorted, walk them in step
+   auto targetIter = targets.begin();
+   uint64_t val = 0;
+
+   for (uint64_t i = 0; i < count; i++)
+   {
+      uint64_t quotient, remainder;
+      if (!bits.getUnary(quotient) || !bits.getBits(P, remainder))
+         return true;
+
+      val += (quotient << P) | remainder;
+
+      while (*targetIter < val)
+      {
+         if (++targetIter == targets.end())
+            return false;
+      }
+
+      if (*targetIter == val)
+         return true;
+   }
+
+   return false;
+}
@@ -0,0 +1,72 @@
+////////////////////////////////////////////////////////////////////////////////
+//                                                                            //
+//  Copyright (C) 2011-2015, Armory Technologies, Inc.                        //
+//  Distributed under the GNU Affero General Public License (AGPL v3)         //
+//  See LICENSE or http://www.gnu.org/licenses/agpl.html                      //
+//                                                                            //
+////////////////////////////////////////////////////////////////////////////////
+
+#ifndef _BLOCK_FILTER_H_
+#define _BLOCK_FILTER_H_
+
+#include <stdint.h>
+#include <vector>
+
+#include "BinaryData.h"
+
+////////////////////////////////////////////////////////////////////////////////
+// Compact per block filters, so that side scans of newly registered wallets
+// can skip the blocks that have nothing to do with them.
+//
+// A filter is a Golomb-Rice coded set with BIP158's parameters (P = 19,
+// M = 784931) over the block's items: the scrAddr of every txout, and the
+// txHash|txOutIndex (34 bytes, as in PulledTx::txHash34_) of every outpoint
+// spent by a non coinbase txin. Items are hashed to 64 bits with SipHash-2-4,
+// keyed with the first 16 bytes of the block hash as in BIP158, mapped onto
+// [0, N*M), and the sorted values are stored as Rice coded deltas. Queries
+// never miss an item that is in the block, and report an item that isn't
+// with a probability of about 1/M.
+//
+// Filters are persisted: the hash is frozen and reads its input bytes in a 
+// fixed order, it can't change without a new DB prefix.
+//
+// Serialized as var_int N | coded deltas. An empty block still gets a 1 byte
+// filter, so a missing DB entry always means the block has no filter.
+class BlockFilter
+{
+public:
+   static const unsigned P = 19;
+   static const uint64_t M = 784931;
+
+   /////////////////////////////////////////////////////////////////////////////
+   // Items to look for, to be matched against any number of filters. The 
+   // hash is keyed per block, so the items are hashed per filter.
+   class Query
+   {
+      friend class BlockFilter;
+
+   public:
+      explicit Query(std::vector<BinaryDataRef> const & items);
+
+      size_t size(void) const { return items_.size(); }
+
+   private:
+      std::vector<BinaryData> items_;
+   };
+
+   /////////////////////////////////////////////////////////////////////////////
+   static BinaryData build(BinaryDataRef blockHash, 
+      std::vector<BinaryDataRef> const & items);
+
+   // true if any of query's items may be in the block. A filter that doesn't
+   // decode matches too, the block has to be pulled to find out.
+   static bool matchAny(BinaryDataRef filter, BinaryDataRef blockHash,
+      Query const & query);
+
+   static uint64_t hashItem(BinaryDataRef blockHash, BinaryDataRef item);
+
+   static uint64_t sipHash24(uint64_t k0, uint64_t k1, 
+      uint8_t const * ptr, size_t size);
+};
+
+#endif
@@ -13,6 +13,7 @@
 #include "BlockWriteBatcher.h"
 #include "lmdbpp.h"
 #include "Progress.h"
+#include "Stats.h"
 #include "util.h"
 
 #include "ReorgUpdater.h"
@@ -82,6 +83,14 @@ class BlockDataManager_LevelDB::BitcoinQtBlockFiles
    
    const BinaryData magicBytes_;
 
+   //the last blk file, kept open between updates to read what Core appends
+   ifstream tailStream_;
+   size_t tailFnum_ = SIZE_MAX;
+
+   //a single block record with room to spare, a block that doesn't fit goes
+   //through the regular header pass
+   static const uint64_t MAX_TAIL_BYTES = 4 * 1024 * 1024;
+
    class stopReadingHeaders
    {
    public:
@@ -146,6 +155,61 @@ public:
    
    uint64_t totalBlockchainBytes() const { return totalBlockchainBytes_; }
    unsigned numBlockFiles() const { return blkFiles_->size(); }
+
+   // Reads what was appended to the last blk file past pos, up to 
+   // MAX_TAIL_BYTES of it, and sets filesize to the current size of that 
+   // file. Returns false if pos isn't in the last file or Core started a new
+   // one, in which case the blk files have to be detected again. The new size
+   // is only recorded once the caller is done with the data, through 
+   // setLastFileSize.
+   bool readAppendedBytes(
+      const BlockFilePosition& pos, BinaryData& data, uint64_t& filesize)
+   {
+      if (blkFiles_->size() == 0 || pos.first != blkFiles_->size() - 1)
+         return false;
+
+      const string nextPath = 
+         BtcUtils::getBlkFilename(blkFileLocation_, blkFiles_->size());
+      if (BtcUtils::GetFileSize(nextPath) != FILE_DOES_NOT_EXIST)
+         return false;
+
+      const BlkFile& blkFile = blkFiles_->back();
+      filesize = BtcUtils::GetFileSize(blkFile.path);
+      if (filesize == FILE_DOES_NOT_EXIST || 
+         filesize < blkFile.filesize || filesize < pos.second)
+         return false;
+
+      //Core preallocates blk files in zero filled chunks, the tail can be
+      //much larger than what was actually written
+      data.resize((size_t)min(filesize - pos.second, uint64_t(MAX_TAIL_BYTES)));
+      if (data.getSize() == 0)
+         return true;
+
+      if (tailFnum_ != pos.first || !tailStream_.is_open())
+      {
+         tailStream_.close();
+         tailStream_.open(blkFile.path, ios::binary);
+         tailFnum_ = pos.first;
+      }
+
+      tailStream_.clear();
+      tailStream_.seekg(pos.second, ios::beg);
+      tailStream_.read(data.getCharPtr(), data.getSize());
+      if (!tailStream_)
+      {
+         tailStream_.close();
+         return false;
+      }
+
+      return true;
+   }
+
+   void setLastFileSize(uint64_t filesize)
+   {
+      BlkFile& blkFile = blkFiles_->back();
+      totalBlockchainBytes_ += filesize - blkFile.filesize;
+      blkFile.filesize = filesize;
+   }
    
    uint64_t offsetAtStartOfFile(size_t fnum) const
    {
@@ -664,6 +728,9 @@ BlockDataManagerConfig::BlockDataManagerConfig()
 {
    armoryDbType = ARMORY_DB_BARE;
    pruneType = DB_PRUNE_NONE;
+   maintainUtxoIndex = false;
+   walletScanThreads = 0;
+   statsInterval = 10;
 }
 
 void BlockDataManagerConfig::selectNetwork(const string &netname)
@@ -862,7 +929,8 @@ void BlockDataManager_LevelDB::openDatabase()
          config_.genesisTxHash,
          config_.magicBytes,
          config_.armoryDbType,
-         config_.pruneType);
+         config_.pruneType,
+         config_.maintainUtxoIndex);
    }
    catch (runtime_error &e)
    {
@@ -878,11 +946,18 @@ void BlockDataManager_LevelDB::openDatabase()
       throw runtime_error(ss.str());
    }
 
+   if (config_.statsFile.size() > 0 && statsDumper_ == nullptr)
+   {
+      statsDumper_ = make_shared<StatsDumper>(
+         config_.statsFile, config_.statsInterval);
+      statsDumper_->start();
+   }
 }
 
 /////////////////////////////////////////////////////////////////////////////
 BlockDataManager_LevelDB::~BlockDataManager_LevelDB()
 {
+   statsDumper_.reset();
    iface_->closeDatabases();
    scrAddrData_.reset();
    delete iface_;
@@ -1043,7 +1118,8 @@ BinaryData BlockDataManager_LevelDB::applyBlockRangeToDB(
    ProgressReporter &prog, 
    uint32_t blk0, uint32_t blk1, 
    ScrAddrFilter& scrAddrData,
-   bool updateSDBI)
+   bool updateSDBI,
+   set<BinaryData>* touchedScrAddr)
 {
    // compute how many bytes of raw blockdata we're going to apply
    uint64_t startingAt=0, totalBytes=0;
@@ -1069,7 +1145,13 @@ BinaryData BlockDataManager_LevelDB::applyBlockRangeToDB(
       blk1 = blockchain_.top().getBlockHeight();
    
    LOGWARN << "Scanning from " << blk0 << " to " << blk1;
-   return blockWrites.scanBlocks(progress, blk0, blk1, scrAddrData);
+   BinaryData topScannedHash = 
+      blockWrites.scanBlocks(progress, blk0, blk1, scrAddrData);
+
+   if (touchedScrAddr != nullptr)
+      *touchedScrAddr = blockWrites.getTouchedScrAddr();
+
+   return topScannedHash;
 }
 
 /////////////////////////////////////////////////////////////////////////////
@@ -1501,7 +1583,20 @@ uint32_t BlockDataManager_LevelDB::readBlkFileUpdate(
 
    // i don't know why this is here
    scrAddrData_->checkForMerge();
+
+   touchedScrAddr_.clear();
+   touchedFrom_ = touchedTo_ = UINT32_MAX;
    
+   //common case: Core appended a single block to the last blk file. The
+   //test callbacks instrument the full update, skip the fast path for them
+   if (!callbacks.headersRead && !callbacks.headersUpdated &&
+      !callbacks.blockDataLoaded)
+   {
+      uint32_t newBlocksFrom;
+      if (readBlkFileTail(newBlocksFrom))
+         return newBlocksFrom;
+   }
+
    uint32_t prevTopBlk = blockchain_.top().getBlockHeight()+1;
    
    const BlockFilePosition headerOffset
@@ -1601,7 +1696,10 @@ uint32_t BlockDataManager_LevelDB::readBlkFileUpdate(
          uint32_t hgt = bh.getBlockHeight();
    
          //LOGINFO << "Applying block to DB!";
-         applyBlockRangeToDB(prog, prevTopBlk, hgt, *scrAddrData_.get());
+         applyBlockRangeToDB(prog, prevTopBlk, hgt, *scrAddrData_.get(),
+            true, &touchedScrAddr_);
+         touchedFrom_ = prevTopBlk;
+         touchedTo_ = hgt + 1;
       }
       else
       {
@@ -1623,6 +1721,187 @@ uint32_t BlockDataManager_LevelDB::readBlkFileUpdate(
    return prevTopBlk;
 }
 
+////////////////////////////////////////////////////////////////////////////////
+static bool isZeroPadding(BinaryDataRef bdr)
+{
+   for (size_t i = 0; i < bdr.getSize(); i++)
+   {
+      if (bdr.getPtr()[i] != 0)
+         return false;
+   }
+
+   return true;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+// Checks that the txs of a block record fill it exactly and hash to the 
+// merkle root of its header
+static bool isBlockComplete(BinaryDataRef rawBlock, const BlockHeader& header)
+{
+   try
+   {
+      BinaryRefReader brr(rawBlock);
+      brr.advance(HEADER_SIZE);
+      const uint64_t nTx = brr.get_var_int();
+      if (nTx == 0 || nTx > brr.getSizeRemaining())
+         return false;
+
+      BinaryData txHashes((size_t)nTx * 32);
+      for (size_t i = 0; i < nTx; i++)
+      {
+         const size_t txSize = BtcUtils::TxCalcLength(
+            brr.getCurrPtr(), brr.getSizeRemaining());
+         if (txSize == 0 || txSize > brr.getSizeRemaining())
+            return false;
+
+         BtcUtils::getHash256_Batch(
+            brr.getCurrPtr(), txSize, 1, txHashes.getPtr() + i * 32);
+         brr.advance(txSize);
+      }
+
+      if (brr.getSizeRemaining() != 0)
+         return false;
+
+      BtcUtils::calculateMerkleRoot_InPlace(txHashes.getPtr(), (size_t)nTx);
+      return txHashes.getSliceRef(0, 32) == header.getMerkleRootRef();
+   }
+   catch (exception&)
+   {
+      return false;
+   }
+}
+
+////////////////////////////////////////////////////////////////////////////////
+// Fast path for readBlkFileUpdate. If the bytes appended to the blk file
+// since the last update are a single block on top of the chain, add and
+// apply just that block: no blk file detection, no header pass over the file
+// and no organize() over the whole header map. Core preallocates blk files,
+// zeros where the next record would start are the end of the data. Returns 
+// false when the update needs the full treatment (new blk file, several 
+// blocks, forks, orphans...), otherwise sets prevTopBlk to what 
+// readBlkFileUpdate returns.
+bool BlockDataManager_LevelDB::readBlkFileTail(uint32_t& prevTopBlk)
+{
+   BinaryData appended;
+   uint64_t filesize;
+   if (!readBlockHeaders_->readAppendedBytes(
+      blkDataPosition_, appended, filesize))
+      return false;
+
+   //the buffer holds everything past blkDataPosition_ unless the tail is 
+   //larger than MAX_TAIL_BYTES
+   const bool wholeTail = 
+      filesize - blkDataPosition_.second == appended.getSize();
+
+   //nothing new yet, or Core is halfway through writing the record, the 
+   //rest will come with the next update
+   prevTopBlk = 0;
+   BinaryRefReader brr(appended.getRef());
+   const size_t magicSize = min(appended.getSize(), size_t(4));
+   if (isZeroPadding(appended.getSliceRef(0, magicSize)) ||
+      (appended.getSize() < 8 && wholeTail))
+   {
+      readBlockHeaders_->setLastFileSize(filesize);
+      return true;
+   }
+
+   if (appended.getSize() < 8 || brr.get_BinaryDataRef(4) != getMagicBytes())
+      return false;
+
+   const uint32_t blkSize = brr.get_uint32_t();
+   if (blkSize < HEADER_SIZE)
+      return false;
+   if (brr.getSizeRemaining() < blkSize)
+   {
+      if (!wholeTail)
+         return false;
+
+      readBlockHeaders_->setLastFileSize(filesize);
+      return true;
+   }
+
+   const BinaryDataRef rawBlock = brr.get_BinaryDataRef(blkSize);
+
+   //anything but padding past the block is another record
+   const size_t nextSize = min(brr.getSizeRemaining(), size_t(4));
+   if (!isZeroPadding(brr.get_BinaryDataRef(nextSize)))
+      return false;
+
+   BlockHeader block;
+   BinaryRefReader blockReader(rawBlock);
+   block.unserialize(blockReader);
+   const uint32_t nTx = (uint32_t)blockReader.get_var_int();
+
+   //Core writes through buffered stdio over the zeros, a block it is halfway
+   //through can pass for a whole record. Leave it for the next update
+   if (!isBlockComplete(rawBlock, block))
+      return true;
+
+   //orphans waiting on this block would need organize() too
+   const HashString blockHash = block.getThisHash();
+   if (block.getPrevHash() != blockchain_.top().getThisHash() ||
+      blockchain_.hasHeaderWithHash(blockHash) || blockchain_.hasOrphans())
+      return false;
+
+   readBlockHeaders_->setLastFileSize(filesize);
+
+   const BlockFilePosition recordPos = blkDataPosition_;
+   prevTopBlk = blockchain_.top().getBlockHeight() + 1;
+
+   BlockHeader& addedBlock = 
+      blockchain_.addNewBlock(blockHash, block, true);
+   addedBlock.setBlockFileNum(recordPos.first);
+   addedBlock.setBlockFileOffset(recordPos.second);
+   addedBlock.setNumTx(nTx);
+   addedBlock.setBlockSize(blkSize);
+
+   blockchain_.extendTop(addedBlock);
+   blkDataPosition_.second += 8 + blkSize;
+
+   try
+   {
+      {
+         LMDBEnv::Transaction tx;
+         iface_->beginDBTransaction(&tx, HEADERS, LMDB::ReadWrite);
+
+         StoredHeader sbh;
+         sbh.createFromBlockHeader(addedBlock);
+         addedBlock.setDuplicateID(iface_->putBareHeader(sbh, true));
+
+         LMDBEnv::Transaction txblk(iface_->dbEnv_[BLKDATA].get(), LMDB::ReadWrite);
+         LMDBEnv::Transaction txhints(iface_->dbEnv_[TXHINTS].get(), LMDB::ReadWrite);
+         LMDBEnv::Transaction txstxo(iface_->dbEnv_[STXO].get(), LMDB::ReadWrite);
+         LMDBEnv::Transaction txhistory(iface_->dbEnv_[HISTORY].get(), LMDB::ReadWrite);
+
+         //raw block offsets point past the magic bytes and block size
+         BinaryRefReader rawReader(rawBlock);
+         addRawBlockToDB(rawReader, recordPos.first, recordPos.second + 8);
+      }
+
+      NullProgressReporter prog;
+      applyBlockRangeToDB(prog, prevTopBlk, addedBlock.getBlockHeight(), 
+         *scrAddrData_.get(), true, &touchedScrAddr_);
+      touchedFrom_ = prevTopBlk;
+      touchedTo_ = addedBlock.getBlockHeight() + 1;
+   }
+   catch (std::exception &e)
+   {
+      LOGERR << "Error adding block data: " << e.what();
+   }
+
+   return true;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+const set<BinaryData>* BlockDataManager_LevelDB::getScrAddrTouchedByUpdate(
+   uint32_t startBlock, uint32_t endBlock) const
+{
+   if (startBlock != touchedFrom_ || endBlock != touchedTo_)
+      return nullptr;
+
+   return &touchedScrAddr_;
+}
+
 void BlockDataManager_LevelDB::loadBlockHeadersFromDB(const ProgressCallback &progress)
 {
    LOGINFO << "Reading headers from db";
@@ -1877,6 +2156,36 @@ void BlockDataManager_LevelDB::wipeScrAddrsSSH(const vector<BinaryData>& saVec)
       for (const auto& keyToDel : keysToDelete)
          iface_->deleteValue(HISTORY, keyToDel);
    }
+
+   if (!iface_->hasUtxoIndex())
+      return;
+
+   //the side scan will repopulate the utxo index for these scrAddr
+   LMDBEnv::Transaction utxotx;
+   iface_->beginDBTransaction(&utxotx, UTXO, LMDB::ReadWrite);
+
+   for (const auto& scrAddr : saVec)
+   {
+      vector<BinaryData> utxoKeysToDelete;
+      LDBIter ldbIter = iface_->getIterator(UTXO);
+
+      if (!ldbIter.seekToStartsWith(DB_PREFIX_SCRIPT, scrAddr))
+         continue;
+
+      do
+      {
+         if (!ldbIter.checkKeyStartsWith(DB_PREFIX_SCRIPT, scrAddr))
+            break;
+
+         if (ldbIter.getKeyRef().getSize() != scrAddr.getSize() + 9)
+            continue;
+
+         utxoKeysToDelete.push_back(ldbIter.getKey());
+      } while (ldbIter.advanceAndRead(DB_PREFIX_SCRIPT));
+
+      for (const auto& keyToDel : utxoKeysToDelete)
+         iface_->deleteValue(UTXO, keyToDel);
+   }
 }
 
 ////////////////////////////////////////////////////////////////////////////////
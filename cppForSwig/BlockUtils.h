@@ -58,6 +58,7 @@ using namespace std;
 
 class BlockDataManager_LevelDB;
 class LSM;
+class StatsDumper;
 //class BDM_Inject;
 
 typedef enum
@@ -113,6 +114,8 @@ private:
    class BDM_ScrAddrFilter;
    shared_ptr<BDM_ScrAddrFilter>    scrAddrData_;
 
+   shared_ptr<StatsDumper>          statsDumper_;
+
   
    // If the BDM is not in super-node mode, then it will be specifically tracking
    // a set of addresses & wallets.  We register those addresses and wallets so
@@ -141,6 +144,11 @@ private:
 
    BDM_state BDMstate_ = BDM_offline;
 
+   //see getScrAddrTouchedByUpdate
+   set<BinaryData> touchedScrAddr_;
+   uint32_t touchedFrom_ = UINT32_MAX;
+   uint32_t touchedTo_ = UINT32_MAX;
+
 
 public:
    bool                               sideScanFlag_ = false;
@@ -204,8 +212,15 @@ public:
    };
    
    uint32_t readBlkFileUpdate(const BlkFileUpdateCallbacks &callbacks=BlkFileUpdateCallbacks());
+
+   // scrAddr that got history from the blocks the last readBlkFileUpdate 
+   // applied, if those are the blocks in [startBlock, endBlock). nullptr
+   // otherwise (reorg, nothing applied, another range)
+   const set<BinaryData>* getScrAddrTouchedByUpdate(
+      uint32_t startBlock, uint32_t endBlock) const;
    
 private:
+   bool readBlkFileTail(uint32_t& prevTopBlk);
    void loadDiskState(
       const ProgressCallback &progress,
       bool doRescan=false
@@ -234,7 +249,8 @@ public:
    BinaryData applyBlockRangeToDB(ProgressReporter &prog, 
                             uint32_t blk0, uint32_t blk1,
                             ScrAddrFilter& scrAddrData,
-                            bool updateSDBI = true);
+                            bool updateSDBI = true,
+                            set<BinaryData>* touchedScrAddr = nullptr);
 
    uint32_t getTopBlockHeight() const {return blockchain_.top().getBlockHeight();}
       
@@ -8,9 +8,11 @@
 #include "BlockWriteBatcher.h"
 
 #include "StoredBlockObj.h"
+#include "BlockFilter.h"
 #include "BlockDataManagerConfig.h"
 #include "lmdb_wrapper.h"
 #include "Progress.h"
+#include "Stats.h"
 #include "util.h"
 
 #ifdef _MSC_VER
@@ -22,6 +24,28 @@ LMDBBlockDatabase* BlockWriteBatcher::iface_;
 ScrAddrFilter* BlockWriteBatcher::scrAddrData_;
 function<void(string)> BlockWriteBatcher::criticalError_;
 
+static const StatId statGrabBlock = Stats::registerHistogram(
+   "bwb_grab_block_seconds", "Reading and parsing a block for a scan");
+static const StatId statGrabbedBytes = Stats::registerCounter(
+   "bwb_grabbed_bytes_total", "Bytes of blocks read for scans");
+static const StatId statApplyBlock = Stats::registerHistogram(
+   "bwb_apply_block_seconds", "Applying a block's txs to the batch");
+static const StatId statAppliedTxs = Stats::registerCounter(
+   "bwb_applied_txs_total", "Txs applied to batches");
+static const StatId statSerializeSsh = Stats::registerHistogram(
+   "bwb_serialize_batch_seconds", "Serializing a batch", "batch=\"ssh\"");
+static const StatId statSerializeStxo = Stats::registerHistogram(
+   "bwb_serialize_batch_seconds", "Serializing a batch", "batch=\"stxo\"");
+static const StatId statWriteSsh = Stats::registerHistogram(
+   "bwb_write_batch_seconds", "Writing a serialized batch to the DBs", 
+   "batch=\"ssh\"");
+static const StatId statWriteStxo = Stats::registerHistogram(
+   "bwb_write_batch_seconds", "Writing a serialized batch to the DBs", 
+   "batch=\"stxo\"");
+static const StatId statPublishBatch = Stats::registerHistogram(
+   "bwb_publish_batch_seconds", 
+   "Committing a batch, snapshots wait on this");
+
 
 ////////////////////////////////////////////////////////////////////////////////
 static void updateBlkDataHeader(
@@ -173,6 +197,15 @@ void LoadedBlockData::nextHeight(LoadedBlockData& blockData,
       hgt -= blockData.nThreads_;
 }
 
+////////////////////////////////////////////////////////////////////////////////
+bool LoadedBlockData::isFilteredOut(LoadedBlockData& lbd, int32_t hgt)
+{
+   if (lbd.blocksToPull_ == nullptr)
+      return false;
+
+   return !(*lbd.blocksToPull_)[hgt - lbd.startBlock_];
+}
+
 ////////////////////////////////////////////////////////////////////////////////
 uint32_t LoadedBlockData::getTopHeight(LoadedBlockData& lbd, PulledBlock& pb)
 {
@@ -232,6 +265,11 @@ void GrabThreadData::grabBlocksFromDB(shared_ptr<LoadedBlockData> blockData,
       LMDBEnv::Transaction tx(db->dbEnv_[BLKDATA].get(), LMDB::ReadOnly);
       LDBIter ldbIter = db->getIterator(BLKDATA);
 
+      //filtered out blocks only get their hash from the headers
+      LMDBEnv::Transaction headersTx;
+      if (blockData->blocksToPull_ != nullptr)
+         db->beginDBTransaction(&headersTx, HEADERS, LMDB::ReadOnly);
+
       uint8_t dupID = db->getValidDupIDForHeight(hgt);
       if (!ldbIter.seekToExact(DBUtils::getBlkMetaKey(hgt, dupID)))
       {
@@ -258,33 +296,56 @@ void GrabThreadData::grabBlocksFromDB(shared_ptr<LoadedBlockData> blockData,
             return;
          }
 
-         //make sure iterator is at the right position
-         auto expected = DBUtils::heightAndDupToHgtx(hgt, dupID);
-         auto key = ldbIter.getKeyRef().getSliceRef(1, 4);
-         if (key != expected)
+         shared_ptr<PulledBlock> pb(new PulledBlock());
+
+         if (LoadedBlockData::isFilteredOut(*blockData, hgt))
          {
-            //in case the iterator is not at the right key, set it
-            if (!ldbIter.seekToExact(DBUtils::getBlkMetaKey(hgt, dupID)))
+            //the processing threads only need the height and hash of 
+            //skipped blocks to keep track of the feeds
+            StoredHeader sbh;
+            db->getBareHeader(sbh, hgt, dupID);
+
+            pb->blockHeight_ = hgt;
+            pb->duplicateID_ = dupID;
+            pb->thisHash_ = sbh.thisHash_;
+            pb->filteredOut_ = true;
+
+            //nothing to parse, but it still takes room in the buffer
+            pb->numBytes_ = sizeof(PulledBlock);
+         }
+         else
+         {
+            //make sure iterator is at the right position
+            auto expected = DBUtils::heightAndDupToHgtx(hgt, dupID);
+            auto key = ldbIter.getKeyRef().getSliceRef(1, 4);
+            if (key != expected)
+            {
+               //in case the iterator is not at the right key, set it
+               if (!ldbIter.seekToExact(DBUtils::getBlkMetaKey(hgt, dupID)))
+               {
+                  unique_lock<mutex> assignLock(GTD.assignLock_);
+                  *lastBlock = blockData->interruptBlock_;
+                  LOGERR << "Header heigh&dup is not in BLKDATA DB";
+                  LOGERR << "(" << hgt << ", " << dupID << ")";
+                  return;
+               }
+            }
+
+            pb->fmp_.prev_ = &prevFileMap;
+            StatTimer grabTimer(statGrabBlock);
+            if (!pullBlockAtIter(*pb, ldbIter, db, blockData->BFA_))
             {
                unique_lock<mutex> assignLock(GTD.assignLock_);
                *lastBlock = blockData->interruptBlock_;
-               LOGERR << "Header heigh&dup is not in BLKDATA DB";
-               LOGERR << "(" << hgt << ", " << dupID << ")";
+               LOGERR << "No block in DB at height " << hgt;
                return;
             }
-         }
 
-         shared_ptr<PulledBlock> pb(new PulledBlock());
-         pb->fmp_.prev_ = &prevFileMap;
-         if (!pullBlockAtIter(*pb, ldbIter, db, blockData->BFA_))
-         {
-            unique_lock<mutex> assignLock(GTD.assignLock_);
-            *lastBlock = blockData->interruptBlock_;
-            LOGERR << "No block in DB at height " << hgt;
-            return;
-         }
+            grabTimer.stop();
+            Stats::add(statGrabbedBytes, pb->numBytes_);
 
-         prevFileMap = pb->fmp_.current_;
+            prevFileMap = pb->fmp_.current_;
+         }
 
          //increment bufferLoad
          GTD.bufferLoad_.fetch_add(
@@ -371,6 +432,7 @@ BinaryData BlockWriteBatcher::applyBlocksToDB(ProgressFilter &progress,
 
             if (processorTID.joinable())
                processorTID.join();
+            blockData->joinGrabThreads();
             break;
          }
 
@@ -425,6 +487,10 @@ BinaryData BlockWriteBatcher::scanBlocks(
    shared_ptr<LoadedBlockData> blockData = 
       make_shared<LoadedBlockData>(startBlock, endBlock, scf, nThreads);
 
+   if (scf.useBlockFilters() && !undo_ && startBlock < endBlock &&
+       armoryDbType_ != ARMORY_DB_SUPER)
+      blockData->blocksToPull_ = getBlocksToPull(scf, startBlock, endBlock);
+
    BinaryData bd = applyBlocksToDB(prog, blockData);
 
    /*double timeElapsed = TIMER_READ_SEC("scanThreadSleep");
@@ -528,6 +594,122 @@ bool BlockWriteBatcher::pullBlockFromDB(
    return GrabThreadData::pullBlockAtIter(pb, ldbIter, iface_, bfa);
 }
 
+////////////////////////////////////////////////////////////////////////////////
+shared_ptr<vector<bool>> BlockWriteBatcher::getBlocksToPull(
+   ScrAddrFilter& scf, uint32_t startBlock, uint32_t endBlock)
+{
+   /***
+   A side scan only needs the blocks paying to one of its scrAddr, and the 
+   blocks spending these outputs. The first pass matches the scrAddr against 
+   the block filters and pulls the hits to collect the outpoints they create
+   for us, the second pass matches these outpoints against the filters of 
+   the blocks that follow.
+
+   Blocks without a filter are pulled regardless. If there are too many of 
+   them, the DB predates the filters: return null to scan the whole range, 
+   which will write the missing filters.
+   ***/
+
+   const uint32_t maxMissingFilters = 100;
+
+   uint32_t nBlocks = endBlock - startBlock + 1;
+   shared_ptr<vector<bool>> blocksToPull = 
+      make_shared<vector<bool>>(nBlocks, false);
+
+   vector<BinaryDataRef> scrAddrVec;
+   scrAddrVec.reserve(scf.numScrAddr());
+   for (auto& scrAddrPair : scf.getScrAddrMap())
+      scrAddrVec.push_back(scrAddrPair.first.getRef());
+   BlockFilter::Query scrAddrQuery(scrAddrVec);
+
+   vector<BinaryData> outpoints;
+   uint32_t firstHit = nBlocks, nMissing = 0, nPulled = 0;
+
+   LMDBEnv::Transaction tx(iface_->dbEnv_[BLKDATA].get(), LMDB::ReadOnly);
+   LMDBEnv::Transaction txHeaders(
+      iface_->dbEnv_[HEADERS].get(), LMDB::ReadOnly);
+   BlockFileAccessor bfa(iface_->getBlkFiles());
+
+   //filters are keyed with their block's hash
+   vector<BinaryData> blockHashes(nBlocks);
+
+   for (uint32_t i = 0; i < nBlocks; i++)
+   {
+      uint32_t height = startBlock + i;
+      uint8_t dup = iface_->getValidDupIDForHeight(height);
+
+      BinaryDataRef filter = iface_->getValueNoCopy(
+         BLKDATA, DBUtils::getBlkFilterKey(height, dup));
+
+      if (filter.getSize() == 0)
+      {
+         if (++nMissing > maxMissingFilters)
+         {
+            LOGINFO << "Block filters are missing, scanning all blocks";
+            return nullptr;
+         }
+      }
+      else
+      {
+         blockHashes[i] = iface_->getHashForDBKey(height, dup);
+         if (!BlockFilter::matchAny(filter, blockHashes[i], scrAddrQuery))
+            continue;
+      }
+
+      (*blocksToPull)[i] = true;
+      nPulled++;
+      if (firstHit == nBlocks)
+         firstHit = i;
+
+      //the scan reports blocks it fails to pull
+      PulledBlock pb;
+      if (!pullBlockFromDB(pb, height, dup, bfa))
+         continue;
+
+      for (auto& stxPair : pb.stxMap_)
+      {
+         for (auto& stxoPair : stxPair.second.stxoMap_)
+         {
+            if (scf.hasScrAddress(stxoPair.second->getScrAddress()))
+               outpoints.push_back(stxoPair.second->hashAndId_);
+         }
+      }
+   }
+
+   if (outpoints.size() > 0)
+   {
+      vector<BinaryDataRef> outpointVec;
+      outpointVec.reserve(outpoints.size());
+      for (auto& outpoint : outpoints)
+         outpointVec.push_back(outpoint.getRef());
+      BlockFilter::Query outpointQuery(outpointVec);
+
+      for (uint32_t i = firstHit + 1; i < nBlocks; i++)
+      {
+         if ((*blocksToPull)[i])
+            continue;
+
+         uint32_t height = startBlock + i;
+         uint8_t dup = iface_->getValidDupIDForHeight(height);
+
+         BinaryDataRef filter = iface_->getValueNoCopy(
+            BLKDATA, DBUtils::getBlkFilterKey(height, dup));
+
+         //blocks without a filter were pulled by the first pass
+         if (BlockFilter::matchAny(filter, blockHashes[i], outpointQuery))
+         {
+            (*blocksToPull)[i] = true;
+            nPulled++;
+         }
+      }
+   }
+
+   LOGINFO << "Block filters: scanning " << nPulled << " out of " <<
+      nBlocks << " blocks";
+
+   return blocksToPull;
+}
+
 ////////////////////////////////////////////////////////////////////////////////
 /// DataToCommit
 ////////////////////////////////////////////////////////////////////////////////
@@ -574,16 +756,28 @@ void DataToCommit::serializeSSH(shared_ptr<BlockDataContainer> bdc)
                            if (txio.isUTXO() || txio.flagged_)
                            {
                               ssh.totalUnspent_ += txio.getValue();
+                              ssh.utxoCount_++;
                               ssh.totalTxioCount_++;
                            }
                         }
                         else
+                        {
+                           //multisig refs are never marked spent
+                           if (txio.isUTXO())
+                           {
+                              ssh.totalMultisigUnspent_ += txio.getValue();
+                              ssh.multisigUtxoCount_++;
+                           }
                            ssh.totalTxioCount_++;
+                        }
                      }
                      else
                      {
                         if (!txio.flagged_)
+                        {
                            ssh.totalUnspent_ -= txio.getValue();
+                           ssh.utxoCount_--;
+                        }
                         else
                            ssh.totalTxioCount_++;
                         ssh.totalTxioCount_++;
@@ -626,6 +820,8 @@ void DataToCommit::serializeStxo(STXOS& stxos)
    if (isSerialized_)
       return;
 
+   StatTimer timer(statSerializeStxo);
+
    auto dbType = BlockWriteBatcher::armoryDbType_;
    auto pruneType = DB_PRUNE_TYPE();
 
@@ -768,6 +964,25 @@ void DataToCommit::serializeDataToCommit(shared_ptr<BlockDataContainer> bdc)
       }
    }
 
+   //utxo index
+   for (auto& threadData : bdc->threads_)
+   {
+      for (auto& utxoPair : threadData->utxoIndexToPut_)
+      {
+         BinaryWriter& bw = serializedUtxoToPut_[utxoPair.first];
+         bw.reset();
+         utxoPair.second.serializeDBValue(bw);
+      }
+
+      utxoKeysToDelete_.insert(
+         threadData->utxoIndexToDelete_.begin(),
+         threadData->utxoIndexToDelete_.end());
+
+      blockFiltersToPut_.insert(
+         threadData->blockFilters_.begin(),
+         threadData->blockFilters_.end());
+   }
+
    topBlockHash_ = bdc->topScannedBlockHash_;
    mostRecentBlockApplied_ = bdc->highestBlockProcessed_ + 1;
 }
@@ -778,6 +993,8 @@ void DataToCommit::serializeData(shared_ptr<BlockDataContainer> bdc)
    if (isSerialized_)
       return;
 
+   StatTimer timer(statSerializeSsh);
+
    uint32_t nThreads = getProcessSSHnThreads();
    sshHeaders_.reset(new SSHheaders(nThreads));
 
@@ -849,41 +1066,160 @@ void DataToCommit::serializeData(shared_ptr<BlockDataContainer> bdc)
 }
 
 ////////////////////////////////////////////////////////////////////////////////
-void DataToCommit::putSSH()
+////////////////////////////////////////////////////////////////////////////////
+BatchTransactions::BatchTransactions(LMDBBlockDatabase* db, 
+   const set<DB_SELECT>& dbs) :
+   db_(db)
+{
+   //set<DB_SELECT> iterates in DB_SELECT order
+   for (auto dbSelect : dbs)
+   {
+      txs_.push_back(make_shared<LMDBEnv::Transaction>(
+         db_->dbEnv_[dbSelect].get(), LMDB::ReadWrite));
+   }
+}
+
+////////////////////////////////////////////////////////////////////////////////
+BatchTransactions::~BatchTransactions()
+{
+   publish();
+}
+
+////////////////////////////////////////////////////////////////////////////////
+void BatchTransactions::writeSubSSH(uint32_t keyLength, 
+   function<void(void)> writes)
+{
+   auto writeThread = [this, keyLength, writes](void)->void
+   {
+      LMDBEnv::Transaction subsshtx;
+      db_->beginSubSSHDBTransaction(subsshtx, keyLength, LMDB::ReadWrite);
+
+      writes();
+
+      //write transactions are bound to their thread, hold on to this one 
+      //until the batch is published
+      unique_lock<mutex> lock(mu_);
+      filled_++;
+      cv_.notify_all();
+
+      while (!publish_)
+         cv_.wait(lock);
+   };
+
+   subSshThreads_.push_back(thread(writeThread));
+}
+
+////////////////////////////////////////////////////////////////////////////////
+void BatchTransactions::publish(void)
+{
+   if (published_)
+      return;
+   published_ = true;
+
+   {
+      unique_lock<mutex> lock(mu_);
+      while (filled_ < subSshThreads_.size())
+         cv_.wait(lock);
+   }
+
+   //all the writes are in, only the commits happen under the lock
+   lock_guard<mutex> publishLock(db_->getPublishMutex());
+   StatTimer timer(statPublishBatch);
+
+   {
+      lock_guard<mutex> lock(mu_);
+      publish_ = true;
+      cv_.notify_all();
+   }
+
+   for (auto& tx : txs_)
+      tx->commit();
+
+   for (auto& writeThread : subSshThreads_)
+   {
+      if (writeThread.joinable())
+         writeThread.join();
+   }
+}
+
+////////////////////////////////////////////////////////////////////////////////
+set<DB_SELECT> DataToCommit::getDBsToWrite(bool withSSH) const
+{
+   auto db = BlockWriteBatcher::iface_;
+   set<DB_SELECT> dbs;
+
+   //putSTX
+   if (serializedStxOutToModify_.size() > 0)
+      dbs.insert(STXO);
+   dbs.insert(SPENTNESS);
+
+   if (BlockWriteBatcher::armoryDbType_ != ARMORY_DB_SUPER)
+   {
+      dbs.insert(HISTORY);
+      dbs.insert(TXHINTS);
+   }
+
+   if (!withSSH)
+      return dbs;
+
+   //putSSH, deleteEmptyKeys, updateSDBI
+   dbs.insert(HISTORY);
+
+   //putUTXO, updateSDBI
+   if (db->hasUtxoIndex())
+      dbs.insert(UTXO);
+
+   //putBlockFilters
+   if (blockFiltersToPut_.size() > 0)
+      dbs.insert(BLKDATA);
+
+   return dbs;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+void DataToCommit::putSSH(BatchTransactions& batch)
 {
    LMDBEnv::Transaction tx;
    auto db = BlockWriteBatcher::iface_;
    db->beginDBTransaction(&tx, HISTORY, LMDB::ReadWrite);
 
-   auto putThread = [this](uint32_t keyLength)->void
-   { this->putSubSSH(keyLength); };
-
-   vector<thread> subSshThreads;
+   set<uint32_t> keyLengths;
    for (auto& submap : serializedSubSshToApply_)
-      subSshThreads.push_back(thread(putThread, submap.first));
+      keyLengths.insert(submap.first);
+   for (auto& subset : subSshKeysToDelete_)
+      keyLengths.insert(subset.first);
+
+   for (auto keyLength : keyLengths)
+   {
+      batch.writeSubSSH(keyLength, [this, keyLength](void)->void
+      { this->putSubSSH(keyLength); });
+   }
 
    for (auto& sshPair : serializedSshToModify_)
       db->putValue(HISTORY, sshPair.first, sshPair.second.getData());
-
-   for (auto& writeThread : subSshThreads)
-      if (writeThread.joinable())
-         writeThread.join();
 }
 
 ////////////////////////////////////////////////////////////////////////////////
 void DataToCommit::putSubSSH(uint32_t keyLength)
 {
-   LMDBEnv::Transaction subsshtx;
+   //runs in the shard's write transaction, see BatchTransactions
    auto db = BlockWriteBatcher::iface_;
 
-   db->beginSubSSHDBTransaction(subsshtx,
-      keyLength, LMDB::ReadWrite);
-
-   auto& submap = serializedSubSshToApply_[keyLength];
+   auto submapIter = serializedSubSshToApply_.find(keyLength);
+   if (submapIter != serializedSubSshToApply_.end())
+   {
+      for (auto& subsshentry : submapIter->second)
+         db->putValue(keyLength, subsshentry.first,
+         subsshentry.second.getData());
+   }
 
-   for (auto& subsshentry : submap)
-      db->putValue(keyLength, subsshentry.first,
-      subsshentry.second.getData());
+   //empty keys go last
+   auto subsetIter = subSshKeysToDelete_.find(keyLength);
+   if (subsetIter != subSshKeysToDelete_.end())
+   {
+      for (auto& ktd : subsetIter->second)
+         db->deleteValue(keyLength, ktd.getRef());
+   }
 }
 
 ////////////////////////////////////////////////////////////////////////////////
@@ -915,9 +1251,18 @@ void DataToCommit::putSTX()
    {
       LMDBEnv::Transaction tx(db->dbEnv_[HISTORY].get(), LMDB::ReadWrite);
 
+      //written by this batch, current as of now
+      auto generation = db->txHashCache().getGeneration();
+
       for (auto& txCount : serializedTxCountAndHash_)
+      {
          db->putValue(HISTORY, txCount.first, txCount.second.getData());
 
+         //these are the txs wallets are about to ask the hash of
+         db->txHashCache().put(txCount.first.getSliceRef(1, 6),
+            txCount.second.getDataRef().getSliceRef(4, 32), generation);
+      }
+
       ////
       LMDBEnv::Transaction txHints(db->dbEnv_[TXHINTS].get(), LMDB::ReadWrite);
       for (auto& txHints : serializedTxHints_)
@@ -926,28 +1271,48 @@ void DataToCommit::putSTX()
 }
 
 ////////////////////////////////////////////////////////////////////////////////
-void DataToCommit::deleteEmptyKeys()
+void DataToCommit::putUTXO()
 {
    auto db = BlockWriteBatcher::iface_;
-   
-   {
-      LMDBEnv::Transaction tx;
-      db->beginDBTransaction(&tx, HISTORY, LMDB::ReadWrite);
+   if (!db->hasUtxoIndex())
+      return;
 
-      for (auto& toDel : sshKeysToDelete_)
-         db->deleteValue(HISTORY, toDel.getRef());
-   }
+   LMDBEnv::Transaction tx(db->dbEnv_[UTXO].get(), LMDB::ReadWrite);
 
-   for (auto& subset : subSshKeysToDelete_)
-   {
-      uint32_t keySize = subset.first;
+   //outputs created and spent within the same batch show up in both sets, 
+   //so deletes have to go in last
+   for (auto& utxoPair : serializedUtxoToPut_)
+      db->putValue(UTXO, utxoPair.first, utxoPair.second.getData());
 
-      LMDBEnv::Transaction subtx;
-      db->beginSubSSHDBTransaction(subtx, keySize, LMDB::ReadWrite);
+   for (auto& delKey : utxoKeysToDelete_)
+      db->deleteValue(UTXO, delKey.getRef());
+}
 
-      for (auto& ktd : subset.second)
-         db->deleteValue(keySize, ktd.getRef());
-   }
+////////////////////////////////////////////////////////////////////////////////
+void DataToCommit::putBlockFilters()
+{
+   if (blockFiltersToPut_.size() == 0)
+      return;
+
+   auto db = BlockWriteBatcher::iface_;
+   LMDBEnv::Transaction tx(db->dbEnv_[BLKDATA].get(), LMDB::ReadWrite);
+
+   for (auto& filterPair : blockFiltersToPut_)
+      db->putValue(BLKDATA, filterPair.first.getRef(), 
+         filterPair.second.getRef());
+}
+
+////////////////////////////////////////////////////////////////////////////////
+void DataToCommit::deleteEmptyKeys()
+{
+   //the shard threads delete the empty sub-SSH keys, see putSubSSH
+   auto db = BlockWriteBatcher::iface_;
+   
+   LMDBEnv::Transaction tx;
+   db->beginDBTransaction(&tx, HISTORY, LMDB::ReadWrite);
+
+   for (auto& toDel : sshKeysToDelete_)
+      db->deleteValue(HISTORY, toDel.getRef());
 }
 
 ////////////////////////////////////////////////////////////////////////////////
@@ -964,6 +1329,9 @@ void DataToCommit::updateSDBI()
       LOGERR << "How do we have invalid SDBI in applyMods?";
    else
    {
+      //the utxo index follows HISTORY only as long as it was in sync with it
+      bool updateUtxoIndex = db->isUtxoIndexUsable();
+
       //save top block height
       sdbi.appliedToHgt_ = mostRecentBlockApplied_;
 
@@ -972,6 +1340,9 @@ void DataToCommit::updateSDBI()
          sdbi.topScannedBlkHash_ = topBlockHash_;
 
       db->putStoredDBInfo(HISTORY, sdbi);
+
+      if (updateUtxoIndex)
+         db->putUtxoIndexSDBI(sdbi);
    }
 }
 
@@ -994,6 +1365,11 @@ DataToCommit::DataToCommit(DataToCommit&& dtc)
    serializedTxCountAndHash_ = move(dtc.serializedTxCountAndHash_);
    serializedTxHints_ = move(dtc.serializedTxHints_);
 
+   serializedUtxoToPut_ = move(dtc.serializedUtxoToPut_);
+   utxoKeysToDelete_    = move(dtc.utxoKeysToDelete_);
+
+   blockFiltersToPut_ = move(dtc.blockFiltersToPut_);
+
    topBlockHash_ = move(dtc.topBlockHash_);
 }
 
@@ -1200,8 +1576,9 @@ thread STXOS::commitStxo(shared_ptr<BlockDataContainer> bdc)
 ////////////////////////////////////////////////////////////////////////////////
 void STXOS::commit(shared_ptr<BlockDataContainer> bdp)
 {
+   //a detached writer can still hold its tx when the db closes
    if (committhread_.joinable())
-      committhread_.detach();
+      committhread_.join();
    committhread_ = commitStxo(bdp);
 }
 
@@ -1214,7 +1591,11 @@ void STXOS::writeStxoToDB(shared_ptr<STXOS> stxos)
          LMDBBlockDatabase *db = BlockWriteBatcher::iface_;
          stxos->dataToCommit_.serializeStxo(*stxos);
 
+         StatTimer timer(statWriteStxo);
+         BatchTransactions batch(db, 
+            stxos->dataToCommit_.getDBsToWrite(false));
          stxos->dataToCommit_.putSTX();
+         batch.publish();
       }
    }
 
@@ -1299,9 +1680,19 @@ shared_ptr<BlockDataFeed> LoadedBlockData::getNextFeed()
 void LoadedBlockData::startGrabThreads(shared_ptr<LoadedBlockData>& lbd)
 {
    for (uint32_t i = 0; i < nThreads_; i++)
+      grabThreads_.push_back(thread(GrabThreadData::grabBlocksFromDB, lbd, i));
+}
+
+////////////////////////////////////////////////////////////////////////////////
+void LoadedBlockData::joinGrabThreads()
+{
+   //once every block was consumed, the grab threads are on their way out 
+   //but may still hold read txns. Wait on them so that the DB can be closed
+   //right after the scan
+   for (auto& grabThread : grabThreads_)
    {
-      thread grabThread(GrabThreadData::grabBlocksFromDB, lbd, i);
-      grabThread.detach();
+      if (grabThread.joinable())
+         grabThread.join();
    }
 }
 
@@ -1486,8 +1877,10 @@ void BlockDataProcessor::processBlockData(shared_ptr<LoadedBlockData> blockData)
 
       stxos_.commit(worker_);
 
+      //commit() waits on the previous writer anyway, join it rather than
+      //leave it running past the db
       if (committhread.joinable())
-         committhread.detach();
+         committhread.join();
       committhread = commit();
    }
 
@@ -1515,6 +1908,12 @@ thread BlockDataProcessor::commit(bool finalCommit)
    shared_ptr<BlockDataContainer> commitObject = worker_;
    worker_.reset();
 
+   for (auto& threadData : commitObject->threads_)
+   {
+      for (auto& subsshPair : threadData->subSshMap_)
+         touchedScrAddr_.insert(subsshPair.first);
+   }
+
    if (forceUpdateSSH_)
    {
       commitObject->dataToCommit_.forceUpdateSshAtHeight_ =
@@ -1555,14 +1954,22 @@ void BlockDataProcessor::writeToDB(shared_ptr<BlockDataContainer> commitObject)
       commitObject->dataToCommit_.serializeData(commitObject);
 
       {
+         StatTimer timer(statWriteSsh);
+         BatchTransactions batch(BlockWriteBatcher::iface_,
+            commitObject->dataToCommit_.getDBsToWrite(true));
+
          //TIMER_START("putSSH");
-         commitObject->dataToCommit_.putSSH();
+         commitObject->dataToCommit_.putSSH(batch);
          //TIMER_STOP("putSSH");
 
          //TIMER_START("putSTX");
          commitObject->dataToCommit_.putSTX();
          //TIMER_STOP("putSTX");
 
+         commitObject->dataToCommit_.putUTXO();
+
+         commitObject->dataToCommit_.putBlockFilters();
+
          commitObject->dataToCommit_.deleteEmptyKeys();
 
 
@@ -1570,6 +1977,8 @@ void BlockDataProcessor::writeToDB(shared_ptr<BlockDataContainer> commitObject)
             commitObject->updateSDBI_ == true)
             commitObject->dataToCommit_.updateSDBI();
 
+         batch.publish();
+
          commitObject->processor_->lastScannedBlockHash_ =
             commitObject->topScannedBlockHash_;
          commitObject->processor_->writer_.reset();
@@ -1695,6 +2104,31 @@ void BlockDataThread::applyBlockToDB(shared_ptr<PulledBlock> pb)
       return;
    }
 
+   //side scan placeholder, nothing to apply
+   if (pb->filteredOut_)
+      return;
+
+   StatTimer timer(statApplyBlock);
+
+   if (BlockWriteBatcher::armoryDbType_ != ARMORY_DB_SUPER)
+   {
+      vector<BinaryDataRef> filterItems;
+      for (auto& stx : pb->stxMap_)
+      {
+         for (auto& stxo : stx.second.stxoMap_)
+            filterItems.push_back(stxo.second->getScrAddress().getRef());
+
+         if (stx.second.isCoinbase_)
+            continue;
+
+         for (auto& opTxHashAndId : stx.second.txHash34_)
+            filterItems.push_back(opTxHashAndId.getRef());
+      }
+
+      blockFilters_[DBUtils::getBlkFilterKey(pb->blockHeight_, 
+         pb->duplicateID_)] = BlockFilter::build(pb->thisHash_, filterItems);
+   }
+
    // We will accumulate undoData as we apply the tx
    StoredUndoData sud;
    sud.blockHash_ = pb->thisHash_;
@@ -1712,6 +2146,8 @@ void BlockDataThread::applyBlockToDB(shared_ptr<PulledBlock> pb)
 
       applyTxToBatchWriteData(stx.second, &sud);
    }
+
+   Stats::add(statAppliedTxs, pb->stxMap_.size());
 }
 
 ////////////////////////////////////////////////////////////////////////////////
@@ -1789,6 +2225,9 @@ bool BlockDataThread::parseTxIns(
       }
       subssh.markTxOutSpent(stxoKey);
 
+      if (BlockWriteBatcher::iface_->hasUtxoIndex())
+         utxoIndexToDelete_.insert(StoredUTXO::getDBKey(uniqKey, stxoKey));
+
       //Mirror the spent txio at txin height
       insertSpentTxio(txio, mirrorsubssh, stxoKey, stxoPtr->spentByTxInKey_);
    }
@@ -1807,7 +2246,6 @@ bool BlockDataThread::parseTxOuts(
    {
       auto& stxoToAdd = *stxoPair.second;
       const BinaryData& uniqKey = stxoToAdd.getScrAddress();
-      BinaryData hgtX = stxoToAdd.getHgtX();
 
       if (BlockWriteBatcher::armoryDbType_ != ARMORY_DB_SUPER)
       {
@@ -1821,7 +2259,7 @@ bool BlockDataThread::parseTxOuts(
          txIsMine = true;
       }
 
-
+      BinaryData hgtX = stxoToAdd.getHgtX();
       StoredSubHistory& subssh = 
          makeSureSubSSHInMap_IgnoreDB(uniqKey, hgtX);
 
@@ -1844,6 +2282,14 @@ bool BlockDataThread::parseTxOuts(
             false, true);
       }
 
+      bool withUtxoIndex = BlockWriteBatcher::iface_->hasUtxoIndex();
+      if (withUtxoIndex)
+      {
+         utxoIndexToPut_[StoredUTXO::getDBKey(uniqKey, 
+            stxoToAdd.getDBKey(false))] = 
+            StoredUTXO(stxoToAdd, thisSTX.thisHash_);
+      }
+
       // If this was a multisig address, add a ref to each individual scraddr
       if (uniqKey[0] == SCRIPT_PREFIX_MULTISIG)
       {
@@ -1870,6 +2316,13 @@ bool BlockDataThread::parseTxOuts(
                stxoToAdd.getValue(),
                stxoToAdd.isCoinbase_,
                true, true);
+
+            if (withUtxoIndex)
+            {
+               StoredUTXO msUtxo(stxoToAdd, thisSTX.thisHash_);
+               msUtxo.scrAddr_ = uniqKey;
+               utxoIndexToPut_[msUtxo.getDBKey()] = msUtxo;
+            }
          }
       }
 
@@ -1988,6 +2441,14 @@ void BlockDataThread::processUndoData(StoredUndoData & sud,
 
       auto& ssh = makeSureSSHInMap(uniqKey);
       ssh.totalUnspent_ += stxoPtr->getValue();
+      ssh.utxoCount_++;
+
+      if (BlockWriteBatcher::iface_->hasUtxoIndex())
+      {
+         utxoIndexToPut_[StoredUTXO::getDBKey(uniqKey, 
+            stxoPtr->getDBKey(false))] =
+            StoredUTXO(*stxoPtr, sudStxo.parentHash_);
+      }
 
       //delete the spent subssh at TxIn hgtX
       if (stxoPtr->spentness_ == TXOUT_SPENT)
@@ -2039,6 +2500,11 @@ void BlockDataThread::processUndoData(StoredUndoData & sud,
          auto& ssh = makeSureSSHInMap(uniqKey);
          ssh.totalTxioCount_--;
          ssh.totalUnspent_ -= stxo->getValue();
+         ssh.utxoCount_--;
+
+         bool withUtxoIndex = BlockWriteBatcher::iface_->hasUtxoIndex();
+         if (withUtxoIndex)
+            utxoIndexToDelete_.insert(StoredUTXO::getDBKey(uniqKey, stxoKey));
 
          // Now remove any multisig entries that were added due to this TxOut
          if (uniqKey[0] == SCRIPT_PREFIX_MULTISIG)
@@ -2062,6 +2528,12 @@ void BlockDataThread::processUndoData(StoredUndoData & sud,
 
                auto& ssh = makeSureSSHInMap(uniqKey);
                ssh.totalTxioCount_--;
+               ssh.totalMultisigUnspent_ -= stxo->getValue();
+               ssh.multisigUtxoCount_--;
+
+               if (withUtxoIndex)
+                  utxoIndexToDelete_.insert(
+                     StoredUTXO::getDBKey(uniqKey, stxoKey));
             }
          }
       }
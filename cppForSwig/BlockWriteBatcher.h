@@ -144,6 +144,9 @@ struct PulledBlock : public DBBlock
    shared_ptr<PulledBlock> nextBlock_ = nullptr;
    FileMapContainer fmp_;
 
+   //stands in for a block the side scan skips, no tx data
+   bool filteredOut_ = false;
+
    ////
    PulledBlock(void) : DBBlock() {}
 
@@ -172,6 +175,7 @@ struct PulledBlock : public DBBlock
       unserPrType_ = pb.unserPrType_;
       unserMkType_ = pb.unserMkType_;
       hasBlockHeader_ = pb.hasBlockHeader_;
+      filteredOut_ = pb.filteredOut_;
    }
 
    virtual DBTx& getTxByIndex(uint16_t index)
@@ -384,6 +388,7 @@ private:
 
    BlockFileAccessor BFA_;
    vector<GrabThreadData> GTD_;
+   vector<thread> grabThreads_;
 
 
 public:
@@ -395,8 +400,12 @@ public:
    shared_ptr<BlockDataFeed> blockDataFeed_;
    shared_ptr<BlockDataFeed> interruptFeed_ = nullptr;
 
+   //indexed by height - startBlock_, null to pull every block
+   shared_ptr<vector<bool>> blocksToPull_;
+
    static int32_t getOffsetHeight(LoadedBlockData&, uint32_t);
    static bool isHeightValid(LoadedBlockData&, int32_t);
+   static bool isFilteredOut(LoadedBlockData&, int32_t);
    static void nextHeight(LoadedBlockData&, int32_t&);
    static uint32_t getTopHeight(LoadedBlockData& lbd, PulledBlock&);
    static BinaryData getTopHash(LoadedBlockData& lbd, PulledBlock&);
@@ -414,6 +423,13 @@ private:
 public:
    ~LoadedBlockData(void)
    {
+      //the last reference may be held by a grab thread
+      for (auto& grabThread : grabThreads_)
+      {
+         if (grabThread.joinable())
+            grabThread.detach();
+      }
+
       interruptBlock_->nextBlock_.reset();
       interruptBlock_.reset();
 
@@ -439,6 +455,7 @@ public:
 
    shared_ptr<PulledBlock> getNextBlock(unique_lock<mutex>* mu);
    void startGrabThreads(shared_ptr<LoadedBlockData>& lbd);
+   void joinGrabThreads(void);
    void wakeGrabThreadsIfNecessary();
 
    shared_ptr<BlockDataFeed> getNextFeed(void);
@@ -474,17 +491,42 @@ struct GrabThreadData
    condition_variable grabCV_;
 };
 
-struct keyHasher
+typedef BinaryDataHash keyHasher;
+
+struct STXOS;
+
+////////////////////////////////////////////////////////////////////////////////
+// The write transactions of one batch, committed together by publish() under
+// the DB's publish mutex, so a DBSnapshot sees all of the batch or none of it.
+//
+// The main envs are begun on the calling thread in DB_SELECT order: the stxo
+// and ssh write threads run side by side and would otherwise deadlock on
+// each other's envs. Each sub-SSH shard gets a thread, that fills the shard's
+// transaction and holds it until publish().
+class BatchTransactions
 {
-   size_t operator()(const BinaryData& k) const
-   {
-      size_t* keyHash = (size_t*)k.getPtr();
+public:
+   BatchTransactions(LMDBBlockDatabase* db, const set<DB_SELECT>& dbs);
+   ~BatchTransactions(void);
 
-      return *keyHash;
-   }
-};
+   void writeSubSSH(uint32_t keyLength, function<void(void)> writes);
+   void publish(void);
 
-struct STXOS;
+private:
+   LMDBBlockDatabase* const db_;
+   vector<shared_ptr<LMDBEnv::Transaction>> txs_;
+   vector<thread> subSshThreads_;
+
+   mutex mu_;
+   condition_variable cv_;
+   size_t filled_ = 0;
+   bool publish_ = false;
+   bool published_ = false;
+
+private:
+   BatchTransactions(const BatchTransactions&);
+   BatchTransactions& operator=(const BatchTransactions&);
+};
 
 struct DataToCommit
 {
@@ -504,6 +546,13 @@ struct DataToCommit
    map<BinaryData, BinaryWriter> serializedTxCountAndHash_;
    map<BinaryData, BinaryWriter> serializedTxHints_;
 
+   //UTXO index, only filled when the index is maintained
+   map<BinaryData, BinaryWriter> serializedUtxoToPut_;
+   set<BinaryData>               utxoKeysToDelete_;
+
+   //Fullnode only, serialized BlockFilter per filter key
+   map<BinaryData, BinaryData>   blockFiltersToPut_;
+
    shared_ptr<SSHheaders> sshHeaders_;
 
    uint32_t mostRecentBlockApplied_;
@@ -522,9 +571,14 @@ struct DataToCommit
    void serializeStxo(STXOS& stxos);
    void serializeDataToCommit(shared_ptr<BlockDataContainer>);
 
-   void putSSH();
+   //the envs the put methods below write to
+   set<DB_SELECT> getDBsToWrite(bool withSSH) const;
+
+   void putSSH(BatchTransactions& batch);
    void putSubSSH(uint32_t keyLength);
    void putSTX();
+   void putUTXO();
+   void putBlockFilters();
    void deleteEmptyKeys();
    void updateSDBI();
 
@@ -646,6 +700,13 @@ private:
 
    //Fullnode only
    map<BinaryData, CountAndHint> txCountAndHint_;
+
+   //UTXO index entries touched by this thread's blocks
+   map<BinaryData, StoredUTXO> utxoIndexToPut_;
+   set<BinaryData>             utxoIndexToDelete_;
+
+   //Fullnode only
+   map<BinaryData, BinaryData> blockFilters_;
 };
 
 class BlockDataContainer
@@ -744,6 +805,9 @@ public:
 
    STXOS stxos_;
 
+   //every scrAddr that got new history from the blocks processed so far
+   set<BinaryData> touchedScrAddr_;
+
 private:
    static void writeToDB(shared_ptr<BlockDataContainer>);
 };
@@ -763,6 +827,10 @@ public:
    
    void setCriticalErrorLambda(function<void(string)> lbd) 
    { criticalError_ = lbd; }
+
+   //scrAddr with history in the blocks applied by scanBlocks
+   const set<BinaryData>& getTouchedScrAddr(void) const
+   { return dataProcessor_.touchedScrAddr_; }
    static void criticalError(string msg)
    { criticalError_(msg); }
 
@@ -776,6 +844,9 @@ private:
       uint32_t height, uint8_t dup,
       BlockFileAccessor& bfa);
 
+   shared_ptr<vector<bool>> getBlocksToPull(ScrAddrFilter& scf,
+      uint32_t startBlock, uint32_t endBlock);
+
 private:
    void insertSpentTxio(
       const TxIOPair& txio,
@@ -31,6 +31,7 @@ void Blockchain::clear()
    newlyParsedBlocks_.clear();
    headersByHeight_.resize(0);
    headerMap_.clear();
+   hasOrphans_ = false;
    topBlockPtr_ = genesisBlockBlockPtr_ =
       &headerMap_[genesisHash_];
 
@@ -98,6 +99,37 @@ Blockchain::ReorganizationState Blockchain::forceOrganize()
    return st;
 }
 
+/////////////////////////////////////////////////////////////////////////////
+// organize() for a header that builds on top of the current chain. It goes 
+// over every header in the map, this doesn't. bh has to be in the map 
+// already. Anything else than a child of the top, or any orphan that bh may
+// be the parent of, goes through organize().
+Blockchain::ReorganizationState Blockchain::extendTop(BlockHeader& bh)
+{
+   BlockHeader& prevTop = top();
+   if (bh.getPrevHash() != prevTop.getThisHash() || bh.isFinishedCalc_ ||
+      hasOrphans_)
+      return organize();
+
+   bh.difficultySum_  = prevTop.difficultySum_ + bh.difficultyDbl_;
+   bh.blockHeight_    = prevTop.blockHeight_ + 1;
+   bh.nextHash_       = BtcUtils::EmptyHash();
+   bh.isOrphan_       = false;
+   bh.isMainBranch_   = true;
+   bh.isFinishedCalc_ = true;
+   prevTop.nextHash_  = bh.thisHash_;
+
+   headersByHeight_.resize(bh.blockHeight_ + 1);
+   headersByHeight_[bh.blockHeight_] = &bh;
+   topBlockPtr_ = &bh;
+
+   ReorganizationState st;
+   st.prevTopBlock = &prevTop;
+   st.prevTopBlockStillValid = true;
+   st.hasNewTop = true;
+   return st;
+}
+
 void Blockchain::setDuplicateIDinRAM(
    LMDBBlockDatabase* iface, bool forceUpdateDupID)
 {
@@ -254,6 +286,7 @@ BlockHeader* Blockchain::organizeChain(bool forceRebuild)
    
    // Iterate over all blocks, track the maximum difficulty-sum block
    double   maxDiffSum     = prevTopBlock.getDifficultySum();
+   hasOrphans_ = false;
    for( BlockHeader &header : values(headerMap_))
    {
       // *** Walk down the chain following prevHash fields, until
@@ -263,6 +296,10 @@ BlockHeader* Blockchain::organizeChain(bool forceRebuild)
       //     Method returns instantly if block is already "solved"
       double thisDiffSum = traceChainDown(header);
 
+      //orphans stay unsolved until their parent shows up
+      if (header.difficultySum_ < 0)
+         hasOrphans_ = true;
+
       if (header.isOrphan_)
       {
          // disregard this block
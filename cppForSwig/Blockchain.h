@@ -49,11 +49,15 @@ public:
 
    ReorganizationState organize();
    ReorganizationState forceOrganize();
+   ReorganizationState extendTop(BlockHeader& bh);
    ReorganizationState findReorgPointFromBlock(const BinaryData& blkHash);
 
    void setDuplicateIDinRAM(LMDBBlockDatabase* iface, bool forceUpdateDupID);
 
    BlockHeader& top() const;
+   
+   //headers that didn't connect to the chain last time it was organized
+   bool hasOrphans() const { return hasOrphans_; }
    BlockHeader& getGenesisBlock() const;
    BlockHeader& getHeaderByHeight(unsigned height) const;
    bool hasHeaderByHeight(unsigned height) const;
@@ -103,6 +107,7 @@ private:
    deque<BlockHeader*> headersByHeight_;
    BlockHeader *topBlockPtr_;
    BlockHeader *genesisBlockBlockPtr_;
+   bool hasOrphans_ = false;
    Blockchain(const Blockchain&); // not defined
 };
 
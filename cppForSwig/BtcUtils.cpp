@@ -11,3 +11,258 @@
 const BinaryData BtcUtils::BadAddress_ = BinaryData::CreateFromHex("0000000000000000000000000000000000000000");
 const BinaryData BtcUtils::EmptyHash_  = BinaryData::CreateFromHex("0000000000000000000000000000000000000000000000000000000000000000");
 
+
+#if (defined(__x86_64__) || defined(__i386__)) && \
+   (defined(__GNUC__) || defined(__clang__)) && \
+   ((__GNUC__ > 4) || (__GNUC__ == 4 && __GNUC_MINOR__ >= 9) || defined(__clang__))
+   #define BTCUTILS_SHANI
+   #include <cpuid.h>
+   #include <immintrin.h>
+#endif
+
+//storage of the hash contexts, one per thread. There is no thread_local 
+//before VS2015, a static would be shared by every thread there: use a plain
+//local, a context per call
+#if defined(_MSC_VER) && _MSC_VER < 1900
+   #define BTCUTILS_HASH_CONTEXT
+#else
+   #define BTCUTILS_HASH_CONTEXT static thread_local
+#endif
+
+////////////////////////////////////////////////////////////////////////////////
+void BtcUtils::sha256(uint8_t const * strToHash, size_t nBytes, 
+                      uint8_t* digest)
+{
+   BTCUTILS_HASH_CONTEXT CryptoPP::SHA256 sha256_;
+   sha256_.CalculateDigest(digest, strToHash, nBytes);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+void BtcUtils::ripemd160(uint8_t const * strToHash, size_t nBytes, 
+                         uint8_t* digest)
+{
+   BTCUTILS_HASH_CONTEXT CryptoPP::RIPEMD160 ripemd160_;
+   ripemd160_.CalculateDigest(digest, strToHash, nBytes);
+}
+
+#ifdef BTCUTILS_SHANI
+namespace
+{
+   const uint32_t sha256InitState[8] =
+   {
+      0x6a09e667, 0xbb67ae85, 0x3c6ef372, 0xa54ff53a,
+      0x510e527f, 0x9b05688c, 0x1f83d9ab, 0x5be0cd19
+   };
+
+   const uint32_t sha256K[64] =
+   {
+      0x428a2f98, 0x71374491, 0xb5c0fbcf, 0xe9b5dba5,
+      0x3956c25b, 0x59f111f1, 0x923f82a4, 0xab1c5ed5,
+      0xd807aa98, 0x12835b01, 0x243185be, 0x550c7dc3,
+      0x72be5d74, 0x80deb1fe, 0x9bdc06a7, 0xc19bf174,
+      0xe49b69c1, 0xefbe4786, 0x0fc19dc6, 0x240ca1cc,
+      0x2de92c6f, 0x4a7484aa, 0x5cb0a9dc, 0x76f988da,
+      0x983e5152, 0xa831c66d, 0xb00327c8, 0xbf597fc7,
+      0xc6e00bf3, 0xd5a79147, 0x06ca6351, 0x14292967,
+      0x27b70a85, 0x2e1b2138, 0x4d2c6dfc, 0x53380d13,
+      0x650a7354, 0x766a0abb, 0x81c2c92e, 0x92722c85,
+      0xa2bfe8a1, 0xa81a664b, 0xc24b8b70, 0xc76c51a3,
+      0xd192e819, 0xd6990624, 0xf40e3585, 0x106aa070,
+      0x19a4c116, 0x1e376c08, 0x2748774c, 0x34b0bcb5,
+      0x391c0cb3, 0x4ed8aa4a, 0x5b9cca4f, 0x682e6ff3,
+      0x748f82ee, 0x78a5636f, 0x84c87814, 0x8cc70208,
+      0x90befffa, 0xa4506ceb, 0xbef9a3f7, 0xc67178f2
+   };
+
+   /////////////////////////////////////////////////////////////////////////////
+   bool detectSha256Ni(void)
+   {
+      unsigned int eax, ebx, ecx, edx;
+      if (__get_cpuid_max(0, nullptr) < 7)
+         return false;
+
+      __cpuid(1, eax, ebx, ecx, edx);
+      bool hasSSSE3 = (ecx & (1 << 9)) != 0;
+      bool hasSSE41 = (ecx & (1 << 19)) != 0;
+
+      __cpuid_count(7, 0, eax, ebx, ecx, edx);
+      bool hasSHA = (ebx & (1 << 29)) != 0;
+
+      return hasSSSE3 && hasSSE41 && hasSHA;
+   }
+
+   const bool hasShaNi_ = detectSha256Ni();
+
+   /////////////////////////////////////////////////////////////////////////////
+   // Compresses nBlocks 64 byte blocks into state (plain a..h word order)
+   __attribute__((target("sha,sse4.1,ssse3")))
+   void sha256Transform_ShaNi(uint32_t* state, 
+                              uint8_t const * data, size_t nBlocks)
+   {
+      const __m128i byteSwap = 
+         _mm_set_epi64x(0x0c0d0e0f08090a0bULL, 0x0405060700010203ULL);
+
+      //shuffle a..h into the ABEF/CDGH layout sha256rnds2 works on
+      __m128i tmp    = _mm_loadu_si128((__m128i const*)state);
+      __m128i state1 = _mm_loadu_si128((__m128i const*)(state + 4));
+      tmp    = _mm_shuffle_epi32(tmp, 0xB1);
+      state1 = _mm_shuffle_epi32(state1, 0x1B);
+      __m128i state0 = _mm_alignr_epi8(tmp, state1, 8);
+      state1 = _mm_blend_epi16(state1, tmp, 0xF0);
+
+      for (size_t blk = 0; blk < nBlocks; blk++, data += 64)
+      {
+         __m128i abefSave = state0;
+         __m128i cdghSave = state1;
+         __m128i msg[4];
+
+         for (unsigned i = 0; i < 16; i++)
+         {
+            __m128i& w = msg[i & 3];
+            if (i < 4)
+            {
+               w = _mm_shuffle_epi8(
+                  _mm_loadu_si128((__m128i const*)(data + 16*i)), byteSwap);
+            }
+            else
+            {
+               //w still holds the words from 4 groups back
+               w = _mm_sha256msg1_epu32(w, msg[(i + 1) & 3]);
+               w = _mm_add_epi32(w, 
+                  _mm_alignr_epi8(msg[(i + 3) & 3], msg[(i + 2) & 3], 4));
+               w = _mm_sha256msg2_epu32(w, msg[(i + 3) & 3]);
+            }
+
+            __m128i wk = _mm_add_epi32(w, 
+               _mm_loadu_si128((__m128i const*)(sha256K + 4*i)));
+            state1 = _mm_sha256rnds2_epu32(state1, state0, wk);
+            wk = _mm_shuffle_epi32(wk, 0x0E);
+            state0 = _mm_sha256rnds2_epu32(state0, state1, wk);
+         }
+
+         state0 = _mm_add_epi32(state0, abefSave);
+         state1 = _mm_add_epi32(state1, cdghSave);
+      }
+
+      tmp    = _mm_shuffle_epi32(state0, 0x1B);
+      state1 = _mm_shuffle_epi32(state1, 0xB1);
+      state0 = _mm_blend_epi16(tmp, state1, 0xF0);
+      state1 = _mm_alignr_epi8(state1, tmp, 8);
+
+      _mm_storeu_si128((__m128i*)state, state0);
+      _mm_storeu_si128((__m128i*)(state + 4), state1);
+   }
+
+   /////////////////////////////////////////////////////////////////////////////
+   inline void putBE32(uint8_t* ptr, uint32_t val)
+   {
+      ptr[0] = (uint8_t)(val >> 24);
+      ptr[1] = (uint8_t)(val >> 16);
+      ptr[2] = (uint8_t)(val >> 8);
+      ptr[3] = (uint8_t)val;
+   }
+
+   /////////////////////////////////////////////////////////////////////////////
+   void getHash256_ShaNi(uint8_t const * strToHash, size_t nBytes,
+                         uint8_t* hashOutput)
+   {
+      uint32_t state[8];
+      memcpy(state, sha256InitState, sizeof(state));
+
+      //full blocks straight from the input
+      size_t nBlocks = nBytes / 64;
+      sha256Transform_ShaNi(state, strToHash, nBlocks);
+
+      //padding: 0x80, zeros, then the bit length on the last 8 bytes
+      uint8_t tail[128];
+      size_t rem = nBytes % 64;
+      memcpy(tail, strToHash + nBlocks*64, rem);
+      tail[rem] = 0x80;
+      size_t tailSize = (rem < 56 ? 64 : 128);
+      memset(tail + rem + 1, 0, tailSize - rem - 1);
+
+      uint64_t nBits = (uint64_t)nBytes * 8;
+      putBE32(tail + tailSize - 8, (uint32_t)(nBits >> 32));
+      putBE32(tail + tailSize - 4, (uint32_t)nBits);
+      sha256Transform_ShaNi(state, tail, tailSize / 64);
+
+      //second pass over the 32 byte digest always fits a single block
+      uint8_t block[64];
+      for (unsigned i = 0; i < 8; i++)
+         putBE32(block + 4*i, state[i]);
+      block[32] = 0x80;
+      memset(block + 33, 0, 29);
+      block[62] = 0x01; //256 bits
+      block[63] = 0x00;
+
+      memcpy(state, sha256InitState, sizeof(state));
+      sha256Transform_ShaNi(state, block, 1);
+
+      for (unsigned i = 0; i < 8; i++)
+         putBE32(hashOutput + 4*i, state[i]);
+   }
+}
+#endif
+
+////////////////////////////////////////////////////////////////////////////////
+bool BtcUtils::hasHardwareSha256(void)
+{
+#ifdef BTCUTILS_SHANI
+   return hasShaNi_;
+#else
+   return false;
+#endif
+}
+
+////////////////////////////////////////////////////////////////////////////////
+void BtcUtils::getHash256_Batch(uint8_t const * strToHash,
+                                size_t          nBytes,
+                                size_t          count,
+                                uint8_t*        hashOutput)
+{
+#ifdef BTCUTILS_SHANI
+   if (hasShaNi_)
+   {
+      for (size_t i = 0; i < count; i++)
+         getHash256_ShaNi(strToHash + i*nBytes, nBytes, hashOutput + i*32);
+      return;
+   }
+#endif
+
+   //the input may alias the output (in place merkle levels), so the first
+   //pass goes through a scratch buffer
+   uint8_t digest32[32];
+   for (size_t i = 0; i < count; i++)
+   {
+      sha256(strToHash + i*nBytes, nBytes, digest32);
+      sha256(digest32, 32, hashOutput + i*32);
+   }
+}
+
+////////////////////////////////////////////////////////////////////////////////
+void BtcUtils::calculateMerkleRoot_InPlace(uint8_t* hashBuffer, size_t numTx)
+{
+   size_t levelSize = numTx;
+   while (levelSize > 1)
+   {
+      //an odd level pairs its last node with itself, grab it before the
+      //batch overwrites the front of the buffer
+      uint8_t lastPair[64];
+      bool isOdd = (levelSize % 2) == 1;
+      if (isOdd)
+      {
+         memcpy(lastPair,      hashBuffer + 32*(levelSize-1), 32);
+         memcpy(lastPair + 32, hashBuffer + 32*(levelSize-1), 32);
+      }
+
+      //pair j sits at 64*j and its parent goes to 32*j, so hashing a level
+      //front to back never overwrites a pair that hasn't been read yet
+      size_t nPairs = levelSize / 2;
+      getHash256_Batch(hashBuffer, 64, nPairs, hashBuffer);
+
+      if (isOdd)
+         getHash256_Batch(lastPair, 64, 1, hashBuffer + 32*nPairs);
+
+      levelSize = nPairs + (isOdd ? 1 : 0);
+   }
+}
@@ -482,17 +482,35 @@ public:
    }
 
 
+   /////////////////////////////////////////////////////////////////////////////
+   // Single pass digests. The hash contexts are kept per thread and reused
+   // across calls, defined in BtcUtils.cpp
+   static void sha256(uint8_t const * strToHash, size_t nBytes,
+                      uint8_t* digest);
+   static void ripemd160(uint8_t const * strToHash, size_t nBytes,
+                         uint8_t* digest);
+
+   /////////////////////////////////////////////////////////////////////////////
+   // Double SHA256 of count inputs of nBytes each, laid out back to back
+   // in strToHash (headers, merkle nodes...). Digests are written back to
+   // back in hashOutput, which must hold 32*count bytes. Runs on the SHA
+   // extensions when the CPU has them, CryptoPP otherwise.
+   static void getHash256_Batch(uint8_t const * strToHash,
+                                size_t          nBytes,
+                                size_t          count,
+                                uint8_t*        hashOutput);
+
+   static bool hasHardwareSha256(void);
+
    /////////////////////////////////////////////////////////////////////////////
    static void getHash256(uint8_t const * strToHash,
                           size_t          nBytes,
                           BinaryData &    hashOutput)
    {
-      CryptoPP::SHA256 sha256_;
       if(hashOutput.getSize() != 32)
          hashOutput.resize(32);
 
-      sha256_.CalculateDigest(hashOutput.getPtr(), strToHash, nBytes);
-      sha256_.CalculateDigest(hashOutput.getPtr(), hashOutput.getPtr(), 32);
+      getHash256_Batch(strToHash, nBytes, 1, hashOutput.getPtr());
    }
 
    /////////////////////////////////////////////////////////////////////////////
@@ -501,21 +519,15 @@ public:
                           uint32_t        nBytes,
                           BinaryData &    hashOutput)
    {
-      CryptoPP::SHA256 sha256_;
-
-      sha256_.CalculateDigest(hashOutput.getPtr(), strToHash, nBytes);
-      sha256_.CalculateDigest(hashOutput.getPtr(), hashOutput.getPtr(), 32);
+      getHash256_Batch(strToHash, nBytes, 1, hashOutput.getPtr());
    }
 
    /////////////////////////////////////////////////////////////////////////////
    static BinaryData getHash256(uint8_t const * strToHash,
                                 uint32_t        nBytes)
    {
-      CryptoPP::SHA256 sha256_;
-
       BinaryData hashOutput(32);
-      sha256_.CalculateDigest(hashOutput.getPtr(), strToHash, nBytes);
-      sha256_.CalculateDigest(hashOutput.getPtr(), hashOutput.getPtr(), 32);
+      getHash256_Batch(strToHash, nBytes, 1, hashOutput.getPtr());
       return hashOutput;
    }
 
@@ -555,14 +567,10 @@ public:
                           size_t          nBytes,
                           BinaryData &    hashOutput)
    {
-      CryptoPP::SHA256 sha256_;
-      CryptoPP::RIPEMD160 ripemd160_;
-      BinaryData bd32(32);
       if(hashOutput.getSize() != 20)
          hashOutput.resize(20);
 
-      sha256_.CalculateDigest(bd32.getPtr(), strToHash, nBytes);
-      ripemd160_.CalculateDigest(hashOutput.getPtr(), bd32.getPtr(), 32);
+      getHash160_NoSafetyCheck(strToHash, nBytes, hashOutput);
    }
 
    /////////////////////////////////////////////////////////////////////////////
@@ -571,13 +579,10 @@ public:
                           size_t          nBytes,
                           BinaryData &    hashOutput)
    {
-      CryptoPP::SHA256 sha256_;
-      CryptoPP::RIPEMD160 ripemd160_;
-      BinaryData bd32(32);
-
-      sha256_.CalculateDigest(bd32.getPtr(), strToHash, nBytes);
-      ripemd160_.CalculateDigest(hashOutput.getPtr(), bd32.getPtr(), 32);
+      uint8_t digest32[32];
 
+      sha256(strToHash, nBytes, digest32);
+      ripemd160(digest32, 32, hashOutput.getPtr());
    }
 
    /////////////////////////////////////////////////////////////////////////////
@@ -625,29 +630,55 @@ public:
    //  I need a non-static, non-overloaded method to be able to use this in SWIG
    BinaryData ripemd160_SWIG(BinaryData const & strToHash)
    {
-      CryptoPP::RIPEMD160 ripemd160_;
       BinaryData bd20(20);
 
-      ripemd160_.CalculateDigest(bd20.getPtr(), strToHash.getPtr(), strToHash.getSize());
+      ripemd160(strToHash.getPtr(), strToHash.getSize(), bd20.getPtr());
       return bd20;
    }
 
 
+   /////////////////////////////////////////////////////////////////////////////
+   // Root only merkle computation over numTx 32 byte hashes laid out back to 
+   // back in hashBuffer. Each level is hashed in place with the batch kernel,
+   // so hashBuffer is clobbered and the root ends up in its first 32 bytes.
+   // Does not allocate.
+   static void calculateMerkleRoot_InPlace(uint8_t* hashBuffer, size_t numTx);
+
+   /////////////////////////////////////////////////////////////////////////////
+   static BinaryData calculateMerkleRoot(BinaryData const & txHashBuffer)
+   {
+      if(txHashBuffer.getSize() < 32)
+         return BinaryData(0);
+
+      BinaryData buffer(txHashBuffer);
+      calculateMerkleRoot_InPlace(buffer.getPtr(), buffer.getSize() / 32);
+      buffer.resize(32);
+      return buffer;
+   }
+
    /////////////////////////////////////////////////////////////////////////////
    static BinaryData calculateMerkleRoot(vector<BinaryData> const & txhashlist)
    {
-      vector<BinaryData> mtree = calculateMerkleTree(txhashlist);
-      return mtree[mtree.size()-1];
+      if(txhashlist.size() == 0)
+         return BinaryData(0);
+
+      BinaryData buffer(32 * txhashlist.size());
+      for(uint32_t i=0; i<txhashlist.size(); i++)
+         txhashlist[i].copyTo(buffer.getPtr() + 32*i, 32);
+
+      calculateMerkleRoot_InPlace(buffer.getPtr(), txhashlist.size());
+      buffer.resize(32);
+      return buffer;
    }
 
    /////////////////////////////////////////////////////////////////////////////
+   // Full tree (leaves first, root last), for building proofs
    static vector<BinaryData> calculateMerkleTree(vector<BinaryData> const & txhashlist)
    {
       // Don't know in advance how big this list will be, make a list too big
       // and copy the result to the right size list afterwards
       size_t numTx = txhashlist.size();
       vector<BinaryData> merkleTree(3*numTx);
-      CryptoPP::SHA256 sha256_;
       BinaryData hashInput(64);
       BinaryData hashOutput(32);
    
@@ -675,8 +706,7 @@ public:
                merkleTree[nextLevelStart-1].copyTo(half2Ptr, 32);
             }
             
-            sha256_.CalculateDigest(hashOutput.getPtr(), hashInput.getPtr(),  64);
-            sha256_.CalculateDigest(hashOutput.getPtr(), hashOutput.getPtr(), 32);
+            getHash256_Batch(hashInput.getPtr(), 64, 1, hashOutput.getPtr());
             merkleTree[nextLevelStart+j] = hashOutput;
          }
          levelSize = (levelSize+1)/2;
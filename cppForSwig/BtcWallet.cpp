@@ -5,6 +5,7 @@
 //  See LICENSE or http://www.gnu.org/licenses/agpl.html                      //
 //                                                                            //
 ////////////////////////////////////////////////////////////////////////////////
+#include <queue>
 #include "BtcWallet.h"
 #include "BlockUtils.h"
 #include "txio.h"
@@ -659,7 +660,8 @@ vector<LedgerEntry> BtcWallet::getTxLedger() const
 
 ///////////////////////////////////////////////////////////////////////////////
 void BtcWallet::fetchDBScrAddrData(uint32_t startBlock, 
-                                             uint32_t endBlock)
+                                             uint32_t endBlock,
+                                   const set<BinaryData>* touchedScrAddr)
 {
    SCOPED_TIMER("fetchWalletRegisteredScrAddrData");
 
@@ -667,10 +669,35 @@ void BtcWallet::fetchDBScrAddrData(uint32_t startBlock,
       saIter != scrAddrMap_.end(); 
       saIter++)
    {
+      //nothing new in the DB for this one
+      if (touchedScrAddr != nullptr &&
+          touchedScrAddr->find(saIter->first) == touchedScrAddr->end())
+         continue;
+
       saIter->second.fetchDBScrAddrData(startBlock, endBlock);
    }
 }
 
+////////////////////////////////////////////////////////////////////////////////
+bool BtcWallet::isTouched(const set<BinaryData>& touchedScrAddr,
+   const map<BinaryData, vector<BinaryData> >& invalidatedZCKeys) const
+{
+   for (const auto& scrAddrPair : scrAddrMap_)
+   {
+      if (touchedScrAddr.find(scrAddrPair.first) != touchedScrAddr.end())
+         return true;
+   }
+
+   //dropped ZC need their ledger entries purged
+   for (const auto& zcPair : invalidatedZCKeys)
+   {
+      if (scrAddrMap_.find(zcPair.first) != scrAddrMap_.end())
+         return true;
+   }
+
+   return false;
+}
+
 ////////////////////////////////////////////////////////////////////////////////
 void BtcWallet::updateAfterReorg(uint32_t lastValidBlockHeight)
 {
@@ -725,8 +752,15 @@ void BtcWallet::scanWalletZeroConf(bool withReorg)
 
 ////////////////////////////////////////////////////////////////////////////////
 bool BtcWallet::scanWallet(uint32_t startBlock, uint32_t endBlock, 
-   bool reorg, const map<BinaryData, vector<BinaryData> >& invalidatedZCKeys)
+   bool reorg, const map<BinaryData, vector<BinaryData> >& invalidatedZCKeys,
+   const set<BinaryData>* touchedScrAddr)
 {
+   //the new blocks don't concern this wallet, its history is unchanged. 
+   //Only look for new ZC
+   if (startBlock < endBlock && touchedScrAddr != nullptr && 
+       !isTouched(*touchedScrAddr, invalidatedZCKeys))
+      startBlock = endBlock;
+
    if (startBlock < endBlock)
    {
       purgeZeroConfTxIO(invalidatedZCKeys);
@@ -738,7 +772,7 @@ bool BtcWallet::scanWallet(uint32_t startBlock, uint32_t endBlock,
       LMDBEnv::Transaction tx;
       bdvPtr_->getDB()->beginDBTransaction(&tx, HISTORY, LMDB::ReadOnly);
 
-      fetchDBScrAddrData(startBlock, endBlock);
+      fetchDBScrAddrData(startBlock, endBlock, touchedScrAddr);
       scanWalletZeroConf(reorg);
 
       map<BinaryData, TxIOPair> txioMap;
@@ -1124,6 +1158,7 @@ const map<BinaryData, LedgerEntry>& BtcWallet::getHistoryPage(uint32_t pageId)
       uint32_t start)->void
    { this->updateWalletLedgersFromTxio(leMap, txioMap, start, UINT32_MAX, false); };
 
+   DBSnapshot snapshot(bdvPtr_->getDB());
    return histPages_.getPageLedgerMap(getTxio, computeLedgers, pageId);
 }
 
@@ -1175,4 +1210,240 @@ uint64_t BtcWallet::getWltTotalTxnCount(void) const
 
    return ntxn;
 }
+
+////////////////////////////////////////////////////////////////////////////////
+////////////////////////////////////////////////////////////////////////////////
+UTXOCursor::UTXOCursor(BtcWallet* wlt, UTXOOrder order, uint32_t batchSize)
+   : wlt_(wlt), order_(order), batchSize_(batchSize > 0 ? batchSize : 1)
+{}
+
+////////////////////////////////////////////////////////////////////////////////
+void UTXOCursor::reset(void)
+{
+   started_ = false;
+   scrAddrPages_.clear();
+   heads_.clear();
+   valueWindow_.clear();
+   valuePos_ = 0;
+   valueDone_ = false;
+   streamedValue_ = 0;
+   streamedCount_ = 0;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+void UTXOCursor::start(void)
+{
+   auto bdvPtr = wlt_->getBdvPtr();
+   spentByZC_ = [bdvPtr](const BinaryData& dbkey)->bool
+   { return bdvPtr->isTxOutSpentByZC(dbkey); };
+
+   for (const auto& scrAddrPair : wlt_->scrAddrMap_)
+   {
+      ScrAddrPage sap;
+      sap.scrAddr_ = scrAddrPair.first;
+      scrAddrPages_.push_back(move(sap));
+   }
+
+   if (order_ == UTXO_ORDER_AGE)
+   {
+      LMDBEnv::Transaction tx;
+      bdvPtr->getDB()->beginDBTransaction(&tx, HISTORY, LMDB::ReadOnly);
+
+      for (size_t i = 0; i < scrAddrPages_.size(); i++)
+      {
+         if (fillPage(scrAddrPages_[i]))
+            heads_[scrAddrPages_[i].page_.begin()->first] = i;
+      }
+   }
+   else
+   {
+      fillValueWindow();
+   }
+
+   started_ = true;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+bool UTXOCursor::fillPage(ScrAddrPage& sap) const
+{
+   //the wallet may have dropped the scrAddr since the cursor started
+   auto saIter = wlt_->scrAddrMap_.find(sap.scrAddr_);
+   if (saIter == wlt_->scrAddrMap_.end())
+   {
+      sap.nextHeight_ = UINT32_MAX;
+      return sap.page_.size() > 0;
+   }
+
+   while (sap.page_.size() == 0 && sap.nextHeight_ != UINT32_MAX)
+   {
+      sap.nextHeight_ = saIter->second.fetchUTXOPage(
+         sap.nextHeight_, sap.page_, spentByZC_);
+   }
+
+   return sap.page_.size() > 0;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+bool UTXOCursor::nextTxioByAge(TxIOPair& txio)
+{
+   if (heads_.size() == 0)
+      return false;
+
+   //txout keys lead with the block height, the smallest head is the oldest
+   auto headIter = heads_.begin();
+   auto& sap = scrAddrPages_[headIter->second];
+   heads_.erase(headIter);
+
+   auto txioIter = sap.page_.begin();
+   txio = txioIter->second;
+   sap.page_.erase(txioIter);
+
+   if (sap.page_.size() == 0)
+   {
+      LMDBEnv::Transaction tx;
+      wlt_->getBdvPtr()->getDB()->beginDBTransaction(
+         &tx, HISTORY, LMDB::ReadOnly);
+      fillPage(sap);
+   }
+
+   if (sap.page_.size() > 0)
+      heads_[sap.page_.begin()->first] = &sap - &scrAddrPages_[0];
+
+   return true;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+bool UTXOCursor::fillValueWindow(void)
+{
+   valueWindow_.clear();
+   valuePos_ = 0;
+   if (valueDone_)
+      return false;
+
+   LMDBEnv::Transaction tx;
+   wlt_->getBdvPtr()->getDB()->beginDBTransaction(
+      &tx, HISTORY, LMDB::ReadOnly);
+
+   //the top of the heap is the worst of the ranks kept so far
+   ValueRankCompare rankBefore;
+   priority_queue<ValueRank, vector<ValueRank>, ValueRankCompare> best;
+
+   //one pass over the wallet, a page at a time
+   for (auto& sapRef : scrAddrPages_)
+   {
+      ScrAddrPage sap;
+      sap.scrAddr_ = sapRef.scrAddr_;
+
+      while (fillPage(sap))
+      {
+         for (const auto& txioPair : sap.page_)
+         {
+            ValueRank rank(txioPair.second.getValue(), txioPair.first);
+
+            //streamed already
+            if (streamedCount_ > 0 && !rankBefore(lastRank_, rank))
+               continue;
+
+            if (best.size() == batchSize_)
+            {
+               if (!rankBefore(rank, best.top()))
+                  continue;
+               best.pop();
+            }
+
+            best.push(move(rank));
+         }
+
+         sap.page_.clear();
+      }
+   }
+
+   //a short window means nothing is left past it
+   valueDone_ = best.size() < batchSize_;
+
+   valueWindow_.resize(best.size());
+   for (size_t i = valueWindow_.size(); i > 0; i--)
+   {
+      valueWindow_[i - 1] = best.top();
+      best.pop();
+   }
+
+   return valueWindow_.size() > 0;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+bool UTXOCursor::getNext(UnspentTxOut& utxo)
+{
+   if (!started_)
+      start();
+
+   auto bdvPtr = wlt_->getBdvPtr();
+   auto db = bdvPtr->getDB();
+
+   TxOut txout;
+   uint64_t value;
+
+   if (order_ == UTXO_ORDER_AGE)
+   {
+      TxIOPair txio;
+      if (!nextTxioByAge(txio))
+         return false;
+
+      LMDBEnv::Transaction tx;
+      db->beginDBTransaction(&tx, STXO, LMDB::ReadOnly);
+
+      txout = txio.getTxOutCopy(db);
+      value = txio.getValue();
+   }
+   else
+   {
+      if (valuePos_ >= valueWindow_.size() && !fillValueWindow())
+         return false;
+
+      //the window only has the txout key, 6 bytes of tx key and the index
+      lastRank_ = valueWindow_[valuePos_++];
+      const ValueRank& rank = lastRank_;
+
+      LMDBEnv::Transaction tx;
+      db->beginDBTransaction(&tx, STXO, LMDB::ReadOnly);
+
+      txout = db->getTxOutCopy(rank.second.getSliceCopy(0, 6),
+         READ_UINT16_BE(rank.second.getPtr() + 6));
+      value = rank.first;
+   }
+
+   utxo = UnspentTxOut(db, txout, bdvPtr->getTopBlockHeight());
+
+   streamedValue_ += value;
+   streamedCount_++;
+   return true;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+vector<UnspentTxOut> UTXOCursor::getNextBatch(void)
+{
+   vector<UnspentTxOut> utxoVec;
+
+   UnspentTxOut utxo;
+   while (utxoVec.size() < batchSize_ && getNext(utxo))
+      utxoVec.push_back(utxo);
+
+   return utxoVec;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+vector<UnspentTxOut> UTXOCursor::getUTXOsForValue(uint64_t val)
+{
+   vector<UnspentTxOut> utxoVec;
+   uint64_t total = 0;
+
+   UnspentTxOut utxo;
+   while (total < val && getNext(utxo))
+   {
+      total += utxo.getValue();
+      utxoVec.push_back(utxo);
+   }
+
+   return utxoVec;
+}
 // kate: indent-width 3; replace-tabs on;
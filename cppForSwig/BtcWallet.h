@@ -57,6 +57,7 @@ private:
 class BtcWallet
 {
    friend class WalletGroup;
+   friend class UTXOCursor;
 
    static const uint32_t MIN_UTXO_PER_TXN = 100;
 
@@ -210,16 +211,22 @@ private:
    
    //new all purpose wallet scanning call, returns true on bootstrap and new block,
    //false on ZC
+   //touchedScrAddr: if set, only these scrAddr have history in the new
+   //blocks, wallets with none of them skip the DB
    bool scanWallet(uint32_t startBlock,
       uint32_t endBlock,
       bool reorg,
-      const map<BinaryData, vector<BinaryData> >& invalidatedZCKeys);
+      const map<BinaryData, vector<BinaryData> >& invalidatedZCKeys,
+      const set<BinaryData>* touchedScrAddr = nullptr);
 
    //wallet side reorg processing
    void updateAfterReorg(uint32_t lastValidBlockHeight);
    void scanWalletZeroConf(bool withReorg = false);
 
-   void fetchDBScrAddrData(uint32_t startBlock, uint32_t endBlock);
+   void fetchDBScrAddrData(uint32_t startBlock, uint32_t endBlock,
+      const set<BinaryData>* touchedScrAddr = nullptr);
+   bool isTouched(const set<BinaryData>& touchedScrAddr,
+      const map<BinaryData, vector<BinaryData> >& invalidatedZCKeys) const;
 
    void setRegistered(bool isTrue = true) { isRegistered_ = isTrue; }
    void purgeZeroConfTxIO(
@@ -288,5 +295,102 @@ private:
    bool                          uiFilter_ = true;
 };
 
+////////////////////////////////////////////////////////////////////////////////
+//
+// UTXOCursor
+//
+// Streams the spendable DB UTXOs of a wallet with bounded memory, so coin 
+// selection can stop as soon as its target is covered. 
+//
+// UTXO_ORDER_AGE merges the per scrAddr UTXO pages in block order, holding at
+// most one page per scrAddr. UTXO_ORDER_VALUE returns the biggest UTXOs 
+// first: each pass over the wallet's pages keeps the value and txout key of
+// the next batchSize UTXOs only, in a bounded heap, and the txouts are pulled
+// as they are streamed. Memory stays at one page and one batch, the cost is 
+// a pass over the wallet per batch: streaming all N UTXOs of a wallet reads
+// its pages N/batchSize times. Coin selection usually stops after a few.
+//
+// The cursor walks the scrAddr set of the wallet as it was when the cursor 
+// was started, looking each scrAddr up again when it needs a page. Addresses
+// removed since are skipped, reset() the cursor to pick up new ones.
+//
+////////////////////////////////////////////////////////////////////////////////
+class UTXOCursor
+{
+public:
+
+   enum UTXOOrder
+   {
+      UTXO_ORDER_AGE,
+      UTXO_ORDER_VALUE
+   };
+
+   static const uint32_t UTXOperBatch = 100;
+
+   UTXOCursor(BtcWallet* wlt, UTXOOrder order, 
+      uint32_t batchSize = UTXOperBatch);
+
+   //returns false once all UTXOs have been streamed
+   bool getNext(UnspentTxOut& utxo);
+   vector<UnspentTxOut> getNextBatch(void);
+
+   //streams UTXOs until their total value covers val, or the wallet runs out
+   vector<UnspentTxOut> getUTXOsForValue(uint64_t val);
+
+   void reset(void);
+
+   uint64_t getStreamedValue(void) const { return streamedValue_; }
+   uint32_t getStreamedCount(void) const { return streamedCount_; }
+
+private:
+
+   struct ScrAddrPage
+   {
+      BinaryData                 scrAddr_;
+      uint32_t                   nextHeight_ = 0;
+      map<BinaryData, TxIOPair>  page_;
+   };
+
+   //value order ranks bigger UTXOs first, then by txout key
+   typedef pair<uint64_t, BinaryData> ValueRank;
+   struct ValueRankCompare
+   {
+      bool operator()(const ValueRank& lhs, const ValueRank& rhs) const
+      {
+         if (lhs.first != rhs.first)
+            return lhs.first > rhs.first;
+         return lhs.second < rhs.second;
+      }
+   };
+
+   void start(void);
+   bool fillPage(ScrAddrPage& sap) const;
+
+   bool nextTxioByAge(TxIOPair& txio);
+   bool fillValueWindow(void);
+
+private:
+
+   BtcWallet* const                 wlt_;
+   const UTXOOrder                  order_;
+   const uint32_t                   batchSize_;
+
+   bool                             started_ = false;
+   function<bool(const BinaryData&)> spentByZC_;
+
+   //age order, heads_ carries the first txout key of each non empty page
+   vector<ScrAddrPage>              scrAddrPages_;
+   map<BinaryData, size_t>          heads_;
+
+   //value order, the next batchSize_ ranks past lastRank_
+   vector<ValueRank>                valueWindow_;
+   size_t                           valuePos_ = 0;
+   ValueRank                        lastRank_;
+   bool                             valueDone_ = false;
+
+   uint64_t                         streamedValue_ = 0;
+   uint32_t                         streamedCount_ = 0;
+};
+
 #endif
 // kate: indent-width 3; replace-tabs on;
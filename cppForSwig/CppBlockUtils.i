@@ -54,6 +54,7 @@
 %ignore BlockDataManager_LevelDB::readBlockUpdate(const pair<size_t, uint64_t>& headerOffset);
 %ignore BlockDataManager_LevelDB::loadDiskState(const function<void(unsigned, double,unsigned)> &progress);
 %ignore BlockDataViewer::refreshLock_;
+%ignore BlockDataManager_LevelDB::getScrAddrTouchedByUpdate(uint32_t, uint32_t) const;
 
 
 %allowexception;
@@ -62,6 +63,8 @@ namespace std
 {
    %template(vector_int) std::vector<int>;
    %template(vector_float) std::vector<float>;
+   %template(vector_bool) std::vector<bool>;
+   %template(vector_SecureBinaryData) std::vector<SecureBinaryData>;
    %template(vector_string) std::vector<string>;
    //%template(vector_BinaryData) std::vector<BinaryData>;
    %template(vector_LedgerEntry) std::vector<LedgerEntry>;
@@ -178,6 +181,34 @@ namespace std
 	$result = thisList;
 }
 
+/******************************************************************************/
+// Convert C++(vector<vector<BinaryData>>) to 
+// Python(tuple(list[string], ...))
+%typemap(out) vector<vector<BinaryData> >
+{
+	// $1 may come wrapped in a SwigValueWrapper, go through its operator&
+	vector<vector<BinaryData> >& bdVecs = *(&$1);
+	PyObject* thisTuple = PyTuple_New(bdVecs.size());
+
+	for(size_t v=0; v<bdVecs.size(); v++)
+	{
+		PyObject* thisList = PyList_New(bdVecs[v].size());
+
+		for(size_t i=0; i<bdVecs[v].size(); i++)
+		{
+			BinaryData & bdobj = bdVecs[v][i];
+
+			PyObject* thisPyObj = PyString_FromStringAndSize((char*)(bdobj.getPtr()), bdobj.getSize());
+
+			PyList_SET_ITEM(thisList, i, thisPyObj);
+		}
+
+		PyTuple_SET_ITEM(thisTuple, v, thisList);
+	}
+
+	$result = thisTuple;
+}
+
 /******************************************************************************/
 // Convert C++(set<BinaryData>) to Python(list[string])
 %typemap(out) set<BinaryData>
@@ -9,6 +9,13 @@
 #include "log.h"
 #include "integer.h"
 #include "oids.h"
+#include "Secp256k1.h"
+
+#include <thread>
+
+#if defined(__SSE2__) || defined(_M_X64)
+   #include <emmintrin.h>
+#endif
 
 //#include <openssl/ec.h>
 //#include <openssl/ecdsa.h>
@@ -31,7 +38,6 @@ SecureBinaryData & SecureBinaryData::append(SecureBinaryData & sbd2)
    else
       BinaryData::append(sbd2.getRawRef());
 
-   lockData();
    return (*this);
 }
 
@@ -41,7 +47,6 @@ SecureBinaryData SecureBinaryData::operator+(SecureBinaryData & sbd2) const
    SecureBinaryData out(getSize() + sbd2.getSize());
    memcpy(out.getPtr(), getPtr(), getSize());
    memcpy(out.getPtr()+getSize(), sbd2.getPtr(), sbd2.getSize());
-   out.lockData();
    return out;
 }
 
@@ -49,7 +54,6 @@ SecureBinaryData SecureBinaryData::operator+(SecureBinaryData & sbd2) const
 SecureBinaryData & SecureBinaryData::operator=(SecureBinaryData const & sbd2)
 { 
    copyFrom(sbd2.getPtr(), sbd2.getSize() );
-   lockData(); 
    return (*this);
 }
 
@@ -88,28 +92,202 @@ SecureBinaryData SecureBinaryData::GenerateRandom(uint32_t numBytes,
    return randData;  
 }
 
+/////////////////////////////////////////////////////////////////////////////
+// KdfRomix internals.  The lookup table is kept as SHA512 state words rather
+// than digest bytes: a 64 byte input is exactly one padded SHA512 block, so
+// each step feeds the previous state straight into the compression function
+// with no byte swapping or hash object bookkeeping.  XOR doesn't care about
+// byte order, only the final output and the lookup index need converting.
+namespace
+{
+
+typedef CryptoPP::word64 KdfWord;
+const uint32_t KDF_SLOT_WORDS = 8;
+
+/////////////////////////////////////////////////////////////////////////////
+// Huge page backed, locked and wiped on release
+class KdfLookupTable
+{
+public:
+   explicit KdfLookupTable(size_t nBytes) : 
+      ptr_(NULL), size_(nBytes)
+   {
+#if defined(_MSC_VER) || defined(__MINGW32__)
+      ptr_ = VirtualAlloc(NULL, size_, MEM_COMMIT | MEM_RESERVE, 
+                          PAGE_READWRITE);
+      if(ptr_ == NULL)
+         throw bad_alloc();
+      VirtualLock(ptr_, size_);
+#else
+      const size_t hugePageSize = 2*1024*1024;
+   #ifdef MAP_HUGETLB
+      // Only works if the admin reserved huge pages, fall through if not
+      if(size_ >= hugePageSize && size_ % hugePageSize == 0)
+      {
+         ptr_ = mmap(NULL, size_, PROT_READ | PROT_WRITE, 
+                     MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+         if(ptr_ == MAP_FAILED)
+            ptr_ = NULL;
+      }
+   #endif
+
+      if(ptr_ == NULL)
+      {
+         ptr_ = mmap(NULL, size_, PROT_READ | PROT_WRITE, 
+                     MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+         if(ptr_ == MAP_FAILED)
+            throw bad_alloc();
+
+   #ifdef MADV_HUGEPAGE
+         // Transparent huge pages, lookups are random over the whole table
+         if(size_ >= hugePageSize)
+            madvise(ptr_, size_, MADV_HUGEPAGE);
+   #endif
+      }
+
+      mlock(ptr_, size_);
+#endif
+   }
+
+   ~KdfLookupTable(void)
+   {
+      memset(ptr_, 0, size_);
+#if defined(_MSC_VER) || defined(__MINGW32__)
+      VirtualUnlock(ptr_, size_);
+      VirtualFree(ptr_, 0, MEM_RELEASE);
+#else
+      munlock(ptr_, size_);
+      munmap(ptr_, size_);
+#endif
+   }
+
+   uint64_t* getPtr(void) { return (uint64_t*)ptr_; }
+
+private:
+   KdfLookupTable(KdfLookupTable const &);
+   KdfLookupTable & operator=(KdfLookupTable const &);
+
+   void*  ptr_;
+   size_t size_;
+};
+
+/////////////////////////////////////////////////////////////////////////////
+// out = SHA512(in ^ mask), all 64 byte values in state word form.  mask may
+// be NULL, out may alias in.
+inline void sha512Slot(KdfWord* out, KdfWord const * in, KdfWord const * mask)
+{
+   CRYPTOPP_ALIGN_DATA(16) KdfWord block[16];
+
+#if defined(__SSE2__) || defined(_M_X64)
+   if(mask != NULL)
+   {
+      for(uint32_t i=0; i<KDF_SLOT_WORDS; i+=2)
+      {
+         __m128i a = _mm_loadu_si128((__m128i const *)(in + i));
+         __m128i b = _mm_loadu_si128((__m128i const *)(mask + i));
+         _mm_store_si128((__m128i*)(block + i), _mm_xor_si128(a, b));
+      }
+   }
+   else
+      memcpy(block, in, 64);
+#else
+   for(uint32_t i=0; i<KDF_SLOT_WORDS; i++)
+      block[i] = (mask != NULL ? in[i] ^ mask[i] : in[i]);
+#endif
+
+   // Padding for a 512 bit message
+   block[8] = W64LIT(0x8000000000000000);
+   memset(block + 9, 0, 6*sizeof(KdfWord));
+   block[15] = 512;
+
+   CryptoPP::SHA512::InitState(out);
+   CryptoPP::SHA512::Transform(out, block);
+}
+
+/////////////////////////////////////////////////////////////////////////////
+void digestToSlot(KdfWord* slot, uint8_t const * digest)
+{
+   for(uint32_t i=0; i<KDF_SLOT_WORDS; i++)
+      slot[i] = READ_UINT64_BE(digest + 8*i);
+}
+
+/////////////////////////////////////////////////////////////////////////////
+void slotToDigest(uint8_t* digest, KdfWord const * slot)
+{
+   for(uint32_t i=0; i<KDF_SLOT_WORDS; i++)
+      for(uint32_t j=0; j<8; j++)
+         digest[8*i + j] = (uint8_t)(slot[i] >> (56 - 8*j));
+}
+
+/////////////////////////////////////////////////////////////////////////////
+// One ROMix chain over seqCount slots of table.  Leaves the final 64 byte
+// hash in digestOut.
+void romixLane(SecureBinaryData const & input,
+               KdfWord* table,
+               uint32_t seqCount,
+               uint8_t* digestOut)
+{
+   // First hash to seed the lookup table, input is variable length anyway
+   uint8_t seed[64];
+   CryptoPP::SHA512().CalculateDigest(seed, input.getPtr(), input.getSize());
+   digestToSlot(table, seed);
+   memset(seed, 0, 64);
+
+   // Compute <seqCount> consecutive hashes of the passphrase
+   // Every iteration is stored in the next slot of the lookup table
+   for(uint32_t i=1; i<seqCount; i++)
+      sha512Slot(table + KDF_SLOT_WORDS*i, table + KDF_SLOT_WORDS*(i-1), NULL);
+
+   // Start the lookup sequence with the last hash from the previous step
+   CRYPTOPP_ALIGN_DATA(16) KdfWord X[KDF_SLOT_WORDS];
+   memcpy(X, table + KDF_SLOT_WORDS*(seqCount-1), 64);
+
+   // Pure ROMix would use seqCount for the number of lookups, we do half
+   // to use more memory in the same amount of time
+   uint32_t const nLookups = seqCount / 2;
+   for(uint32_t nSeq=0; nSeq<nLookups; nSeq++)
+   {
+      // Last 4 bytes of X, read little endian, mod seqCount
+      uint32_t low = (uint32_t)X[KDF_SLOT_WORDS-1];
+      uint32_t newIndex = ((low >> 24) | ((low >> 8) & 0xFF00) |
+                           ((low << 8) & 0xFF0000) | (low << 24)) % seqCount;
+
+      // Hash X xor'd with the slot at <newIndex>
+      sha512Slot(X, X, table + KDF_SLOT_WORDS*newIndex);
+   }
+
+   slotToDigest(digestOut, X);
+   memset(X, 0, sizeof(X));
+}
+
+} // namespace
+
 /////////////////////////////////////////////////////////////////////////////
 KdfRomix::KdfRomix(void) : 
    hashFunctionName_( "sha512" ),
    hashOutputBytes_( 64 ),
    kdfOutputBytes_( 32 ),
    memoryReqtBytes_( 32 ),
+   sequenceCount_( 0 ),
+   numLanes_( 1 ),
    numIterations_( 0 )
 { 
    // Nothing to do here
 }
 
 /////////////////////////////////////////////////////////////////////////////
-KdfRomix::KdfRomix(uint32_t memReqts, uint32_t numIter, SecureBinaryData salt) :
+KdfRomix::KdfRomix(uint32_t memReqts, uint32_t numIter, SecureBinaryData salt,
+                   uint32_t numLanes) :
    hashFunctionName_( "sha512" ),
    hashOutputBytes_( 64 ),
    kdfOutputBytes_( 32 )
 {
-   usePrecomputedKdfParams(memReqts, numIter, salt);
+   usePrecomputedKdfParams(memReqts, numIter, salt, numLanes);
 }
 
 /////////////////////////////////////////////////////////////////////////////
-void KdfRomix::computeKdfParams(double targetComputeSec, uint32_t maxMemReqts)
+void KdfRomix::computeKdfParams(double targetComputeSec, uint32_t maxMemReqts,
+                                uint32_t numLanes)
 {
    // Create a random salt, even though this is probably unnecessary:
    // the variation in numIter and memReqts is probably effective enough
@@ -121,6 +299,7 @@ void KdfRomix::computeKdfParams(double targetComputeSec, uint32_t maxMemReqts)
    {
       numIterations_ = 1;
       memoryReqtBytes_ = 1024;
+      setLanes(numLanes);
       return;
    }
 
@@ -138,8 +317,7 @@ void KdfRomix::computeKdfParams(double targetComputeSec, uint32_t maxMemReqts)
    {
       memoryReqtBytes_ *= 2;
 
-      sequenceCount_ = memoryReqtBytes_ / hashOutputBytes_;
-      lookupTable_.resize(memoryReqtBytes_);
+      setLanes(numLanes);
 
       TIMER_RESTART("KDF_Mem_Search");
       testKey = DeriveKey_OneIter(testKey);
@@ -148,13 +326,15 @@ void KdfRomix::computeKdfParams(double targetComputeSec, uint32_t maxMemReqts)
    }
 
    // Recompute here, in case we didn't enter the search above 
-   sequenceCount_ = memoryReqtBytes_ / hashOutputBytes_;
-   lookupTable_.resize(memoryReqtBytes_);
+   setLanes(numLanes);
 
 
    // Depending on the search above (or if a low max memory was chosen, 
    // we may need to do multiple iterations to achieve the desired compute
-   // time on this system.
+   // time on this system.  Time them the way DeriveKey runs them, sharing
+   // one lookup table.
+   KdfLookupTable lookupTable((size_t)sequenceCount_ * numLanes_ * 
+                              hashOutputBytes_);
    double allItersSec = 0;
    uint32_t numTest = 1;
    while(allItersSec < 0.02)
@@ -164,7 +344,7 @@ void KdfRomix::computeKdfParams(double targetComputeSec, uint32_t maxMemReqts)
       for(uint32_t i=0; i<numTest; i++)
       {
          SecureBinaryData testKey("This is an example key to test KDF iteration speed");
-         testKey = DeriveKey_OneIter(testKey);
+         testKey = deriveKey_OneIter(testKey, lookupTable.getPtr());
       }
       TIMER_STOP("KDF_Time_Search");
       allItersSec = TIMER_READ_SEC("KDF_Time_Search");
@@ -185,14 +365,29 @@ void KdfRomix::computeKdfParams(double targetComputeSec, uint32_t maxMemReqts)
 /////////////////////////////////////////////////////////////////////////////
 void KdfRomix::usePrecomputedKdfParams(uint32_t memReqts, 
                                        uint32_t numIter, 
-                                       SecureBinaryData salt)
+                                       SecureBinaryData salt,
+                                       uint32_t numLanes)
 {
+   // The lane count is part of the key, it can't be lowered to fit here
+   numLanes = (numLanes < 1 ? 1 : numLanes);
+   if (memReqts / numLanes / hashOutputBytes_ < 2)
+      throw runtime_error("KDF memory too small for its lane count");
+
    memoryReqtBytes_ = memReqts;
-   sequenceCount_   = memoryReqtBytes_ / hashOutputBytes_;
+   setLanes(numLanes);
    numIterations_   = numIter;
    salt_            = salt;
 }
 
+/////////////////////////////////////////////////////////////////////////////
+void KdfRomix::setLanes(uint32_t numLanes)
+{
+   uint32_t const maxLanes = memoryReqtBytes_ / hashOutputBytes_ / 2;
+   numLanes_ = min(numLanes, maxLanes);
+   numLanes_ = (numLanes_ < 1 ? 1 : numLanes_);
+   sequenceCount_ = memoryReqtBytes_ / numLanes_ / hashOutputBytes_;
+}
+
 /////////////////////////////////////////////////////////////////////////////
 void KdfRomix::printKdfParams(void)
 {
@@ -202,6 +397,7 @@ void KdfRomix::printKdfParams(void)
    cout << "   HashOutBytes : " << hashOutputBytes_ << endl;
    cout << "   Memory/thread: " << memoryReqtBytes_ << " bytes" << endl;
    cout << "   SequenceCount: " << sequenceCount_   << endl;
+   cout << "   NumLanes     : " << numLanes_        << endl;
    cout << "   NumIterations: " << numIterations_   << endl;
    cout << "   KDFOutBytes  : " << kdfOutputBytes_  << endl;
    cout << "   Salt         : " << salt_.toHexStr() << endl;
@@ -211,80 +407,67 @@ void KdfRomix::printKdfParams(void)
 /////////////////////////////////////////////////////////////////////////////
 SecureBinaryData KdfRomix::DeriveKey_OneIter(SecureBinaryData const & password)
 {
-   CryptoPP::SHA512 sha512;
+   KdfLookupTable lookupTable((size_t)sequenceCount_ * numLanes_ * 
+                              hashOutputBytes_);
+   return deriveKey_OneIter(password, lookupTable.getPtr());
+}
 
+/////////////////////////////////////////////////////////////////////////////
+SecureBinaryData KdfRomix::deriveKey_OneIter(SecureBinaryData const & password,
+                                             uint64_t* lookupTable)
+{
    // Concatenate the salt/IV to the password
    SecureBinaryData saltedPassword = password + salt_; 
-   
-   // Prepare the lookup table
-   lookupTable_.resize(memoryReqtBytes_);
-   lookupTable_.fill(0);
-   uint32_t const HSZ = hashOutputBytes_;
-   uint8_t* frontOfLUT = lookupTable_.getPtr();
-   uint8_t* nextRead  = NULL;
-   uint8_t* nextWrite = NULL;
+   KdfWord* table = (KdfWord*)lookupTable;
+   uint32_t const laneWords = sequenceCount_ * KDF_SLOT_WORDS;
 
-   // First hash to seed the lookup table, input is variable length anyway
-   sha512.CalculateDigest(frontOfLUT, 
-                          saltedPassword.getPtr(), 
-                          saltedPassword.getSize());
+   if(numLanes_ == 1)
+   {
+      SecureBinaryData X(hashOutputBytes_);
+      romixLane(saltedPassword, table, sequenceCount_, X.getPtr());
+
+      // Truncate the final result to get the final key
+      return X.getSliceCopy(0,kdfOutputBytes_);
+   }
 
-   // Compute <sequenceCount_> consecutive hashes of the passphrase
-   // Every iteration is stored in the next 64-bytes in the Lookup table
-   for(uint32_t nByte=0; nByte<memoryReqtBytes_-HSZ; nByte+=HSZ)
+   // Each lane gets its own chain and slice of the table, lane 0 runs here
+   SecureBinaryData laneOutputs(hashOutputBytes_ * numLanes_);
+   vector<SecureBinaryData> laneInputs(numLanes_);
+   for(uint32_t lane=0; lane<numLanes_; lane++)
    {
-      // Compute hash of slot i, put result in slot i+1
-      nextRead  = frontOfLUT + nByte;
-      nextWrite = nextRead + hashOutputBytes_;
-      sha512.CalculateDigest(nextWrite, nextRead, hashOutputBytes_);
+      SecureBinaryData laneIndex(WRITE_UINT32_LE(lane));
+      laneInputs[lane] = saltedPassword + laneIndex;
    }
 
-   // LookupTable should be complete, now start lookup sequence.
-   // Start with the last hash from the previous step
-   SecureBinaryData X(frontOfLUT + memoryReqtBytes_ - HSZ, HSZ);
-   SecureBinaryData Y(HSZ);
-
-   // We "integerize" a hash value by taking the last 4 bytes of
-   // as a uint32_t, and take modulo sequenceCount
-   uint64_t* X64ptr = (uint64_t*)(X.getPtr());
-   uint64_t* Y64ptr = (uint64_t*)(Y.getPtr());
-   uint64_t* V64ptr = NULL;
-   uint32_t newIndex;
-   uint32_t const nXorOps = HSZ/sizeof(uint64_t);
-
-   // Pure ROMix would use sequenceCount_ for the number of lookups.
-   // We divide by 2 to reduce computation time RELATIVE to the memory usage
-   // This still provides suffient LUT operations, but allows us to use more
-   // memory in the same amount of time (and this is the justification for
-   // the scrypt algorithm -- it is basically ROMix, modified for more 
-   // flexibility in controlling compute-time vs memory-usage).
-   uint32_t const nLookups = sequenceCount_ / 2;
-   for(uint32_t nSeq=0; nSeq<nLookups; nSeq++)
+   vector<thread> laneThreads;
+   for(uint32_t lane=1; lane<numLanes_; lane++)
    {
-      // Interpret last 4 bytes of last result (mod seqCt) as next LUT index
-      newIndex = *(uint32_t*)(X.getPtr()+HSZ-4) % sequenceCount_;
+      laneThreads.push_back(thread(romixLane, 
+         cref(laneInputs[lane]), table + laneWords*lane, sequenceCount_,
+         laneOutputs.getPtr() + hashOutputBytes_*lane));
+   }
 
-      // V represents the hash result at <newIndex>
-      V64ptr = (uint64_t*)(frontOfLUT + HSZ*newIndex);
+   romixLane(laneInputs[0], table, sequenceCount_, laneOutputs.getPtr());
 
-      // xor X with V, and store the result in X
-      for(uint32_t i=0; i<nXorOps; i++)
-         *(Y64ptr+i) = *(X64ptr+i) ^ *(V64ptr+i);
+   for(auto& laneThread : laneThreads)
+      laneThread.join();
 
-      // Hash the xor'd data to get the next index for lookup
-      sha512.CalculateDigest(X.getPtr(), Y.getPtr(), HSZ);
-   }
-   // Truncate the final result to get the final key
-   lookupTable_.destroy();
+   SecureBinaryData X(hashOutputBytes_);
+   CryptoPP::SHA512().CalculateDigest(X.getPtr(), 
+                                      laneOutputs.getPtr(), 
+                                      laneOutputs.getSize());
    return X.getSliceCopy(0,kdfOutputBytes_);
 }
 
 /////////////////////////////////////////////////////////////////////////////
 SecureBinaryData KdfRomix::DeriveKey(SecureBinaryData const & password)
 {
+   KdfLookupTable lookupTable((size_t)sequenceCount_ * numLanes_ * 
+                              hashOutputBytes_);
+
    SecureBinaryData masterKey(password);
    for(uint32_t i=0; i<numIterations_; i++)
-      masterKey = DeriveKey_OneIter(masterKey);
+      masterKey = deriveKey_OneIter(masterKey, lookupTable.getPtr());
    
    return SecureBinaryData(masterKey);
 }
@@ -431,6 +614,186 @@ SecureBinaryData CryptoAES::DecryptCBC(SecureBinaryData & data,
 
 
 
+/////////////////////////////////////////////////////////////////////////////
+// Bulk CFB internals
+namespace
+{
+
+typedef BTC_AES::Encryption AesBlockCipher;
+const size_t AES_BLOCK = BTC_AES::BLOCKSIZE;
+
+/////////////////////////////////////////////////////////////////////////////
+bool checkBulkArgs(vector<SecureBinaryData> const & data,
+                   SecureBinaryData const & key,
+                   vector<SecureBinaryData> const & ivs)
+{
+   if(ivs.size() != data.size())
+      return false;
+
+   size_t keySize = key.getSize();
+   if(keySize != 16 && keySize != 24 && keySize != 32)
+      return false;
+
+   for(auto& iv : ivs)
+   {
+      if(iv.getSize() != AES_BLOCK)
+         return false;
+   }
+
+   return true;
+}
+
+/////////////////////////////////////////////////////////////////////////////
+// CFB over blobs [start, end).  Each blob's n'th keystream block only needs
+// its (n-1)'th ciphertext block, so block n of every blob can go through
+// AES in one multi-block call.
+void cfbBulkRange(AesBlockCipher const & aes,
+                  vector<SecureBinaryData> const & data,
+                  vector<SecureBinaryData> const & ivs,
+                  vector<SecureBinaryData> & out,
+                  size_t start, size_t end,
+                  bool encrypt)
+{
+   size_t maxLen = 0;
+   for(size_t i=start; i<end; i++)
+      maxLen = max(maxLen, data[i].getSize());
+
+   SecureBinaryData feedback(AES_BLOCK * (end-start));
+   SecureBinaryData keystream(AES_BLOCK * (end-start));
+   vector<size_t> active;
+   active.reserve(end-start);
+
+   for(size_t pos=0; pos<maxLen; pos+=AES_BLOCK)
+   {
+      // Previous ciphertext block, or the IV for the first one
+      active.clear();
+      for(size_t i=start; i<end; i++)
+      {
+         if(data[i].getSize() <= pos)
+            continue;
+
+         uint8_t const * prev = ivs[i].getPtr();
+         if(pos > 0)
+            prev = (encrypt ? out[i].getPtr() : data[i].getPtr()) + pos - AES_BLOCK;
+
+         memcpy(feedback.getPtr() + AES_BLOCK*active.size(), prev, AES_BLOCK);
+         active.push_back(i);
+      }
+
+      aes.AdvancedProcessBlocks(feedback.getPtr(), NULL, keystream.getPtr(),
+                                AES_BLOCK * active.size(),
+                                CryptoPP::BlockTransformation::BT_AllowParallel);
+
+      // Partial last blocks use a prefix of the keystream, like CFB_Mode
+      for(size_t n=0; n<active.size(); n++)
+      {
+         size_t i = active[n];
+         size_t len = min(AES_BLOCK, data[i].getSize() - pos);
+         uint8_t const * ks = keystream.getPtr() + AES_BLOCK*n;
+         uint8_t const * src = data[i].getPtr() + pos;
+         uint8_t* dst = out[i].getPtr() + pos;
+         for(size_t j=0; j<len; j++)
+            dst[j] = src[j] ^ ks[j];
+      }
+   }
+}
+
+/////////////////////////////////////////////////////////////////////////////
+bool cfbBulk(vector<SecureBinaryData> const & data,
+             SecureBinaryData const & key,
+             vector<SecureBinaryData> const & ivs,
+             vector<SecureBinaryData> & out,
+             uint32_t nThreads,
+             bool encrypt)
+{
+   if(!checkBulkArgs(data, key, ivs))
+      return false;
+
+   // Only reallocate the buffers that don't fit
+   out.resize(data.size());
+   for(size_t i=0; i<data.size(); i++)
+   {
+      if(out[i].getSize() != data[i].getSize())
+         out[i].resize(data[i].getSize());
+   }
+
+   if(data.empty())
+      return true;
+
+   // One key schedule for everyone, AES objects are safe to share for
+   // processing once keyed
+   AesBlockCipher aes(key.getPtr(), key.getSize());
+
+   // Wallet keys are a couple blocks each, don't bother with threads for
+   // less than a few thousand
+   const size_t minPerThread = 2048;
+   if(nThreads == 0)
+      nThreads = thread::hardware_concurrency();
+   nThreads = (uint32_t)max((size_t)1, 
+      min((size_t)nThreads, data.size() / minPerThread));
+
+   size_t perThread = (data.size() + nThreads - 1) / nThreads;
+   vector<thread> workers;
+   for(uint32_t t=1; t<nThreads; t++)
+   {
+      size_t start = min(data.size(), perThread * t);
+      size_t end   = min(data.size(), start + perThread);
+      workers.push_back(thread(cfbBulkRange, cref(aes), cref(data), 
+         cref(ivs), ref(out), start, end, encrypt));
+   }
+
+   cfbBulkRange(aes, data, ivs, out, 0, min(data.size(), perThread), encrypt);
+
+   for(auto& worker : workers)
+      worker.join();
+
+   return true;
+}
+
+} // namespace
+
+/////////////////////////////////////////////////////////////////////////////
+bool CryptoAES::EncryptCFB_Bulk(vector<SecureBinaryData> const & data,
+                                SecureBinaryData const & key,
+                                vector<SecureBinaryData> const & ivs,
+                                vector<SecureBinaryData> & out,
+                                uint32_t nThreads)
+{
+   return cfbBulk(data, key, ivs, out, nThreads, true);
+}
+
+/////////////////////////////////////////////////////////////////////////////
+bool CryptoAES::DecryptCFB_Bulk(vector<SecureBinaryData> const & data,
+                                SecureBinaryData const & key,
+                                vector<SecureBinaryData> const & ivs,
+                                vector<SecureBinaryData> & out,
+                                uint32_t nThreads)
+{
+   return cfbBulk(data, key, ivs, out, nThreads, false);
+}
+
+/////////////////////////////////////////////////////////////////////////////
+bool CryptoAES::ReencryptCFB_Bulk(vector<SecureBinaryData> const & data,
+                                  SecureBinaryData const & oldKey,
+                                  vector<SecureBinaryData> const & oldIVs,
+                                  SecureBinaryData const & newKey,
+                                  vector<SecureBinaryData> const & newIVs,
+                                  vector<SecureBinaryData> & out,
+                                  uint32_t nThreads)
+{
+   if(!checkBulkArgs(data, oldKey, oldIVs) || 
+      !checkBulkArgs(data, newKey, newIVs))
+      return false;
+
+   // Plaintext lives in locked buffers wiped on the way out
+   vector<SecureBinaryData> plainText;
+   cfbBulk(data, oldKey, oldIVs, plainText, nThreads, false);
+   return cfbBulk(plainText, newKey, newIVs, out, nThreads, true);
+}
+
+
+
+
 /////////////////////////////////////////////////////////////////////////////
 BTC_PRIVKEY CryptoECDSA::CreateNewPrivateKey(SecureBinaryData entropy)
 {
@@ -505,6 +868,13 @@ SecureBinaryData CryptoECDSA::SerializePublicKey(BTC_PUBKEY const & pubKey)
 /////////////////////////////////////////////////////////////////////////////
 SecureBinaryData CryptoECDSA::ComputePublicKey(SecureBinaryData const & cppPrivKey)
 {
+   if(cppPrivKey.getSize() == 32)
+   {
+      SecureBinaryData pubKey(65);
+      Secp256k1::computePublicKey(cppPrivKey.getPtr(), pubKey.getPtr());
+      return pubKey;
+   }
+
    BTC_PRIVKEY pk = ParsePrivateKey(cppPrivKey);
    BTC_PUBKEY  pub;
    pk.MakePublicKey(pub);
@@ -677,6 +1047,15 @@ bool CryptoECDSA::VerifyData(SecureBinaryData const & binMessage,
       cout << "   BinPub: " << pubkey65B.toHexStr() << endl;
    }
 
+   if(pubkey65B.getSize() == 65 && binSignature.getSize() == 64)
+   {
+      // Same digest the Crypto++ verifier ends up with: SHA256 of our SHA256
+      BinaryData hashVal = BtcUtils::getHash256(binMessage);
+      return Secp256k1::verify(hashVal.getPtr(), 
+                               binSignature.getPtr(), 
+                               pubkey65B.getPtr());
+   }
+
    BTC_PUBKEY cppPubKey = ParsePublicKey(pubkey65B);
    return VerifyData(binMessage, binSignature, cppPubKey);
 }
@@ -708,6 +1087,113 @@ bool CryptoECDSA::VerifyData(SecureBinaryData const & binMessage,
                                               binSignature.getSize());
 }
 
+/////////////////////////////////////////////////////////////////////////////
+// 30 len 02 rlen r 02 slen s [sighash] to raw r|s. r and s are unsigned big
+// endian, zero padded to 32 bytes.
+static bool parseDerSignature(BinaryData const & sig, uint8_t* rs64)
+{
+   uint8_t const * ptr = sig.getPtr();
+   size_t size = sig.getSize();
+
+   if(size < 8 || ptr[0] != 0x30)
+      return false;
+
+   // Sighash byte after the sequence is ignored
+   size_t seqEnd = 2 + (size_t)ptr[1];
+   if(seqEnd != size && seqEnd + 1 != size)
+      return false;
+
+   size_t pos = 2;
+   for(unsigned i=0; i<2; i++)
+   {
+      if(pos + 2 > seqEnd || ptr[pos] != 0x02)
+         return false;
+
+      size_t len = ptr[pos+1];
+      pos += 2;
+      if(len == 0 || pos + len > seqEnd)
+         return false;
+
+      uint8_t const * intPtr = ptr + pos;
+      pos += len;
+
+      while(len > 0 && *intPtr == 0)
+      {
+         intPtr++;
+         len--;
+      }
+
+      if(len > 32)
+         return false;
+
+      uint8_t* out = rs64 + 32*i;
+      memset(out, 0, 32 - len);
+      memcpy(out + 32 - len, intPtr, len);
+   }
+
+   return pos == seqEnd;
+}
+
+/////////////////////////////////////////////////////////////////////////////
+vector<bool> CryptoECDSA::VerifyDataBatch(
+                                vector<BinaryData> const & messages,
+                                vector<BinaryData> const & signatures,
+                                vector<BinaryData> const & pubKeys,
+                                bool derEncoded,
+                                uint32_t nThreads)
+{
+   size_t count = messages.size();
+   vector<bool> results(count, false);
+   if(signatures.size() != count || pubKeys.size() != count)
+      return results;
+
+   // Hashes and r|s signatures back to back, so items can point into them
+   BinaryData hashes(32 * count);
+   BinaryData rawSigs(64 * count);
+   vector<Secp256k1::VerifyItem> items;
+   vector<size_t> itemIndex;
+   items.reserve(count);
+   itemIndex.reserve(count);
+
+   for(size_t i=0; i<count; i++)
+   {
+      if(pubKeys[i].getSize() != 65)
+         continue;
+
+      uint8_t* rs = rawSigs.getPtr() + 64*i;
+      if(derEncoded)
+      {
+         if(!parseDerSignature(signatures[i], rs))
+            continue;
+      }
+      else
+      {
+         if(signatures[i].getSize() != 64)
+            continue;
+         memcpy(rs, signatures[i].getPtr(), 64);
+      }
+
+      uint8_t* hash = hashes.getPtr() + 32*i;
+      BtcUtils::getHash256_Batch(
+         messages[i].getPtr(), messages[i].getSize(), 1, hash);
+
+      Secp256k1::VerifyItem item = { hash, rs, pubKeys[i].getPtr() };
+      items.push_back(item);
+      itemIndex.push_back(i);
+   }
+
+   if(items.empty())
+      return results;
+
+   bool* itemResults = new bool[items.size()];
+   Secp256k1::verifyBatch(&items[0], items.size(), itemResults, nThreads);
+   for(size_t i=0; i<items.size(); i++)
+      results[itemIndex[i]] = itemResults[i];
+   delete[] itemResults;
+
+   return results;
+}
+
 /////////////////////////////////////////////////////////////////////////////
 // Deterministically generate new private key using a chaincode
 // Changed:  added using the hash of the public key to the mix
@@ -818,6 +1304,17 @@ SecureBinaryData CryptoECDSA::ComputeChainedPublicKey(
                            *(uint32_t*)(chainOrig.getPtr()+offset);
    }
 
+   if(multiplierOut != NULL)
+      (*multiplierOut) = SecureBinaryData(chainXor);
+
+   if(binPubKey.getSize() == 65)
+   {
+      SecureBinaryData newPubKey(65);
+      if(Secp256k1::multiplyPoint(
+            chainXor.getPtr(), binPubKey.getPtr(), newPubKey.getPtr()))
+         return newPubKey;
+   }
+
    // Parse the chaincode as a big-endian integer
    CryptoPP::Integer mult;
    mult.Decode(chainXor.getPtr(), chainXor.getSize(), UNSIGNED);
@@ -829,9 +1326,6 @@ SecureBinaryData CryptoECDSA::ComputeChainedPublicKey(
    // Let Crypto++ do the EC math for us, serialize the new public key
    newPubKey.SetPublicElement( oldPubKey.ExponentiatePublicElement(mult) );
 
-   if(multiplierOut != NULL)
-      (*multiplierOut) = SecureBinaryData(chainXor);
-
    //LOGINFO << "Computed new chained public key using:";
    //LOGINFO << "   Public key: " << binPubKey.toHexStr().c_str();
    //LOGINFO << "   PubKeyHash: " << chainMod.toHexStr().c_str();
@@ -841,6 +1335,77 @@ SecureBinaryData CryptoECDSA::ComputeChainedPublicKey(
    return CryptoECDSA::SerializePublicKey(newPubKey);
 }
 
+////////////////////////////////////////////////////////////////////////////////
+vector<BinaryData> CryptoECDSA::ComputeChainedPublicKeys(
+                                SecureBinaryData const & binPubKey,
+                                SecureBinaryData const & chainCode,
+                                uint32_t count,
+                                vector<BinaryData>* hash160Out,
+                                vector<BinaryData>* multiplierOut)
+{
+   vector<BinaryData> pubKeys;
+   pubKeys.reserve(count);
+   vector<BinaryData> mults;
+   mults.reserve(count);
+
+   if(binPubKey.getSize() == 65 && chainCode.getSize() == 32)
+   {
+      BinaryData keys(65 * (size_t)count);
+      BinaryData multBuf(32 * (size_t)count);
+      if(count > 0 && Secp256k1::computeChainedPublicKeys(
+            binPubKey.getPtr(), chainCode.getPtr(), count, keys.getPtr(),
+            multBuf.getPtr()))
+      {
+         for(uint32_t i=0; i<count; i++)
+         {
+            pubKeys.push_back(keys.getSliceCopy(65*i, 65));
+            mults.push_back(multBuf.getSliceCopy(32*i, 32));
+         }
+      }
+   }
+
+   // Root key the engine can't take, walk the chain one key at a time
+   if(pubKeys.size() != count)
+   {
+      pubKeys.clear();
+      mults.clear();
+      SecureBinaryData prevKey = binPubKey;
+      for(uint32_t i=0; i<count; i++)
+      {
+         SecureBinaryData mult;
+         prevKey = ComputeChainedPublicKey(prevKey, chainCode, &mult);
+         pubKeys.push_back(prevKey);
+         mults.push_back(mult);
+      }
+   }
+
+   if(multiplierOut != NULL)
+      multiplierOut->swap(mults);
+
+   if(hash160Out != NULL)
+   {
+      hash160Out->resize(count);
+      for(uint32_t i=0; i<count; i++)
+         BtcUtils::getHash160(pubKeys[i].getRef(), (*hash160Out)[i]);
+   }
+
+   return pubKeys;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+vector<vector<BinaryData> > 
+   CryptoECDSA::ComputeChainedPublicKeysHash160sAndMults(
+                                SecureBinaryData const & binPubKey,
+                                SecureBinaryData const & chainCode,
+                                uint32_t count)
+{
+   vector<vector<BinaryData> > result(3);
+   result[0] = ComputeChainedPublicKeys(
+      binPubKey, chainCode, count, &result[1], &result[2]);
+
+   return result;
+}
+
 ////////////////////////////////////////////////////////////////////////////////
 SecureBinaryData CryptoECDSA::InvMod(const SecureBinaryData& m)
 {
@@ -881,32 +1446,16 @@ bool CryptoECDSA::ECVerifyPoint(BinaryData const & x,
 ////////////////////////////////////////////////////////////////////////////////
 CryptoPP::ECP CryptoECDSA::Get_secp256k1_ECP(void)
 {
-   static bool firstRun = true;
-   static CryptoPP::Integer intN;
-   static CryptoPP::Integer inta;
-   static CryptoPP::Integer intb;
+   // The curve is built once, callers get a copy
+   static const BinaryData N = BinaryData::CreateFromHex(
+         "fffffffffffffffffffffffffffffffffffffffffffffffffffffffefffffc2f");
 
-   static BinaryData N;
-   static BinaryData a;
-   static BinaryData b;
+   static const CryptoPP::ECP ecp(
+      CryptoPP::Integer(N.getPtr(), N.getSize(), UNSIGNED),
+      CryptoPP::Integer::Zero(),
+      CryptoPP::Integer(7L));
 
-   if(firstRun)
-   {
-      firstRun = false;
-      N = BinaryData::CreateFromHex(
-            "fffffffffffffffffffffffffffffffffffffffffffffffffffffffefffffc2f");
-      a = BinaryData::CreateFromHex(
-            "0000000000000000000000000000000000000000000000000000000000000000");
-      b = BinaryData::CreateFromHex(
-            "0000000000000000000000000000000000000000000000000000000000000007");
-
-      intN.Decode( N.getPtr(),  N.getSize(),  UNSIGNED);
-      inta.Decode( a.getPtr(),  a.getSize(),  UNSIGNED);
-      intb.Decode( b.getPtr(),  b.getSize(),  UNSIGNED);
-   }
-
-   
-   return CryptoPP::ECP(intN, inta, intb);
+   return ecp;
 }
 
 
@@ -936,6 +1485,22 @@ BinaryData CryptoECDSA::ECMultiplyPoint(BinaryData const & A,
                                         BinaryData const & Bx,
                                         BinaryData const & By)
 {
+   if(A.getSize() <= 32 && Bx.getSize() == 32 && By.getSize() == 32)
+   {
+      uint8_t scalar[32];
+      memset(scalar, 0, 32);
+      memcpy(scalar + 32 - A.getSize(), A.getPtr(), A.getSize());
+
+      uint8_t point[65];
+      point[0] = 0x04;
+      memcpy(point + 1,  Bx.getPtr(), 32);
+      memcpy(point + 33, By.getPtr(), 32);
+
+      uint8_t result[65];
+      if(Secp256k1::multiplyPoint(scalar, point, result))
+         return BinaryData(result + 1, 64);
+   }
+
    CryptoPP::ECP ecp = Get_secp256k1_ECP();
    CryptoPP::Integer intA, intBx, intBy, intCx, intCy;
 
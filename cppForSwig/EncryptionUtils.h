@@ -136,21 +136,27 @@ using namespace std;
 class SecureBinaryData : public BinaryData
 {
 public:
-   // We want regular BinaryData, but page-locked and secure destruction
-   SecureBinaryData(void) : BinaryData() 
-                   { lockData(); }
-   SecureBinaryData(size_t sz) : BinaryData(sz) 
-                   { lockData(); }
-   SecureBinaryData(BinaryData const & data) : BinaryData(data) 
-                   { lockData(); }
-   SecureBinaryData(uint8_t const * inData, size_t sz) : BinaryData(inData, sz)
-                   { lockData(); }
-   SecureBinaryData(uint8_t const * d0, uint8_t const * d1) : BinaryData(d0, d1)
-                   { lockData(); }
-   SecureBinaryData(string const & str) : BinaryData(str)
-                   { lockData(); }
-   SecureBinaryData(BinaryDataRef const & bdRef) : BinaryData(bdRef)
-                   { lockData(); }
+   // We want regular BinaryData, but page-locked and secure destruction.
+   // The bytes live in the SecureMemoryPool, which is locked and wipes
+   // every buffer it gets back, including the ones vector reallocations
+   // leave behind.
+   SecureBinaryData(void) : BinaryData(secureAllocator()) 
+                   { }
+   SecureBinaryData(size_t sz) : BinaryData(secureAllocator()) 
+                   { BinaryData::resize(sz); }
+   SecureBinaryData(BinaryData const & data) : BinaryData(secureAllocator()) 
+                   { copyFrom(data); }
+   SecureBinaryData(uint8_t const * inData, size_t sz) : 
+                   BinaryData(secureAllocator())
+                   { copyFrom(inData, sz); }
+   SecureBinaryData(uint8_t const * d0, uint8_t const * d1) : 
+                   BinaryData(secureAllocator())
+                   { copyFrom(d0, d1); }
+   SecureBinaryData(string const & str) : BinaryData(secureAllocator())
+                   { copyFrom(str); }
+   SecureBinaryData(BinaryDataRef const & bdRef) : 
+                   BinaryData(secureAllocator())
+                   { copyFrom(bdRef); }
 
    ~SecureBinaryData(void) { destroy(); }
 
@@ -165,11 +171,12 @@ public:
    string toBinStr(void) const          { return BinaryData::toBinStr();  }
 
    SecureBinaryData(SecureBinaryData const & sbd2) : 
-           BinaryData(sbd2.getPtr(), sbd2.getSize()) { lockData(); }
+           BinaryData(secureAllocator()) 
+           { copyFrom(sbd2.getPtr(), sbd2.getSize()); }
 
 
-   void resize(size_t sz)  { BinaryData::resize(sz);  lockData(); }
-   void reserve(size_t sz) { BinaryData::reserve(sz); lockData(); }
+   void resize(size_t sz)  { BinaryData::resize(sz);  }
+   void reserve(size_t sz) { BinaryData::reserve(sz); }
 
 
    BinaryData    getRawCopy(void) const { return BinaryData(getPtr(), getSize()); }
@@ -192,22 +199,19 @@ public:
    SecureBinaryData GenerateRandom(uint32_t numBytes, 
                               SecureBinaryData extraEntropy=SecureBinaryData());
 
-   void lockData(void)
-   {
-      if(getSize() > 0)
-         mlock(getPtr(), getSize());
-   }
-
    void destroy(void)
    {
+      // Wipe now, the buffer itself is wiped again when it's released
       if(getSize() > 0)
-      {
          fill(0x00);
-         munlock(getPtr(), getSize());
-      }
       resize(0);
    }
 
+private:
+   static BinaryDataAllocator<uint8_t> secureAllocator(void)
+   {
+      return BinaryDataAllocator<uint8_t>(true);
+   }
 };
 
 
@@ -220,6 +224,13 @@ public:
 // The computeKdfParams method takes in a target time, T, for computation
 // on the computer executing the test.  The final KDF should take somewhere
 // between T/2 and T seconds.
+//
+// numLanes selects the parameter set.  With 1 lane (all existing wallets)
+// this is the original single ROMix chain.  With N > 1 lanes the memory is
+// split into N independent chains, each seeded with the lane index appended
+// to password+salt, run on their own threads and combined with SHA512.
+// The two give different keys, so the lane count has to be stored with the
+// other KDF params.
 class KdfRomix
 {
 public:
@@ -228,18 +239,21 @@ public:
    KdfRomix(void);
 
    /////////////////////////////////////////////////////////////////////////////
-   KdfRomix(uint32_t memReqts, uint32_t numIter, SecureBinaryData salt);
+   KdfRomix(uint32_t memReqts, uint32_t numIter, SecureBinaryData salt,
+            uint32_t numLanes=1);
 
 
    /////////////////////////////////////////////////////////////////////////////
    // Default max-memory reqt will 
    void computeKdfParams(double   targetComputeSec=0.25, 
-                         uint32_t maxMemReqtsBytes=DEFAULT_KDF_MAX_MEMORY);
+                         uint32_t maxMemReqtsBytes=DEFAULT_KDF_MAX_MEMORY,
+                         uint32_t numLanes=1);
 
    /////////////////////////////////////////////////////////////////////////////
    void usePrecomputedKdfParams(uint32_t memReqts, 
                                 uint32_t numIter, 
-                                SecureBinaryData salt);
+                                SecureBinaryData salt,
+                                uint32_t numLanes=1);
 
    /////////////////////////////////////////////////////////////////////////////
    void printKdfParams(void);
@@ -254,17 +268,30 @@ public:
    string       getHashFunctionName(void) const { return hashFunctionName_; }
    uint32_t     getMemoryReqtBytes(void) const  { return memoryReqtBytes_; }
    uint32_t     getNumIterations(void) const    { return numIterations_; }
+   uint32_t     getNumLanes(void) const         { return numLanes_; }
    SecureBinaryData   getSalt(void) const       { return salt_; }
    
 private:
 
+   /////////////////////////////////////////////////////////////////////////////
+   // One iteration over a caller provided lookup table, so DeriveKey can
+   // reuse it across iterations.  The table holds sequenceCount_ 64 byte
+   // slots per lane.
+   SecureBinaryData deriveKey_OneIter(SecureBinaryData const & password,
+                                      uint64_t* lookupTable);
+
+   /////////////////////////////////////////////////////////////////////////////
+   // Sets numLanes_ and sequenceCount_ for the current memoryReqtBytes_.
+   // A lane needs at least 2 slots: numLanes is lowered to fit the memory.
+   void setLanes(uint32_t numLanes);
+
    string   hashFunctionName_;  // name of hash function to use (only one)
    uint32_t hashOutputBytes_;
    uint32_t kdfOutputBytes_;    // size of final key data
 
    uint32_t memoryReqtBytes_;
-   uint32_t sequenceCount_;
-   SecureBinaryData lookupTable_;
+   uint32_t sequenceCount_;     // lookup table slots per lane
+   uint32_t numLanes_;
    SecureBinaryData salt_;            // prob not necessary amidst numIter, memReqts
                                 // but I guess it can't hurt
 
@@ -300,6 +327,37 @@ public:
    SecureBinaryData DecryptCBC(SecureBinaryData & data, 
                                SecureBinaryData & key,
                                SecureBinaryData   iv);
+
+   /////////////////////////////////////////////////////////////////////////////
+   // Bulk CFB for many small blobs (wallet private keys) under a single key.
+   // The key schedule is expanded once and shared by nThreads threads (0 for
+   // one per core), and the blocks of different blobs go through AES side by
+   // side, so the AES-NI path can pipeline them.  Blob i uses the 16 byte
+   // ivs[i] and goes to out[i], which is only reallocated if its size does
+   // not match.  Returns false, leaving out untouched, on mismatched sizes.
+   bool EncryptCFB_Bulk(vector<SecureBinaryData> const & data,
+                        SecureBinaryData const & key,
+                        vector<SecureBinaryData> const & ivs,
+                        vector<SecureBinaryData> & out,
+                        uint32_t nThreads=0);
+
+   /////////////////////////////////////////////////////////////////////////////
+   bool DecryptCFB_Bulk(vector<SecureBinaryData> const & data,
+                        SecureBinaryData const & key,
+                        vector<SecureBinaryData> const & ivs,
+                        vector<SecureBinaryData> & out,
+                        uint32_t nThreads=0);
+
+   /////////////////////////////////////////////////////////////////////////////
+   // Passphrase change: decrypts under oldKey/oldIVs and encrypts under
+   // newKey/newIVs in one pass, the plaintext never leaves this call
+   bool ReencryptCFB_Bulk(vector<SecureBinaryData> const & data,
+                          SecureBinaryData const & oldKey,
+                          vector<SecureBinaryData> const & oldIVs,
+                          SecureBinaryData const & newKey,
+                          vector<SecureBinaryData> const & newIVs,
+                          vector<SecureBinaryData> & out,
+                          uint32_t nThreads=0);
 };
 
 
@@ -395,6 +453,18 @@ public:
                    SecureBinaryData const & binSignature,
                    SecureBinaryData const & pubkey65B);
 
+   /////////////////////////////////////////////////////////////////////////////
+   // Verifies messages[i] against signatures[i] and pubKeys[i] for all i in
+   // one go, result i is what VerifyData would return. Messages are UN-HASHED
+   // like VerifyData's. Signatures are raw 64 byte r|s, or DER encoded (as 
+   // found in tx scripts, trailing sighash byte allowed) if derEncoded is set.
+   // Malformed entries and mismatched vector sizes verify as false.
+   vector<bool> VerifyDataBatch(vector<BinaryData> const & messages,
+                                vector<BinaryData> const & signatures,
+                                vector<BinaryData> const & pubKeys,
+                                bool derEncoded=false,
+                                uint32_t nThreads=0);
+
    /////////////////////////////////////////////////////////////////////////////
    // Deterministically generate new private key using a chaincode
    // Changed:  Added using the hash of the public key to the mix
@@ -415,6 +485,27 @@ public:
                            SecureBinaryData const & chainCode,
                            SecureBinaryData* multiplierOut=NULL);
 
+   /////////////////////////////////////////////////////////////////////////////
+   // Chains count public keys in one call, for filling address pools: entry
+   // i is what ComputeChainedPublicKey returns when fed entry i-1, the first
+   // one is chained off binPubKey. Their hash160s go in hash160Out and the
+   // multiplier of each step in multiplierOut, if set.
+   vector<BinaryData> ComputeChainedPublicKeys(
+                           SecureBinaryData const & binPubKey,
+                           SecureBinaryData const & chainCode,
+                           uint32_t count,
+                           vector<BinaryData>* hash160Out=NULL,
+                           vector<BinaryData>* multiplierOut=NULL);
+
+   /////////////////////////////////////////////////////////////////////////////
+   // Same walk, returning { keys, hash160s, multipliers }. SWIG can't hand
+   // back the out arguments above, this is the Python entry point.
+   vector<vector<BinaryData> > 
+      ComputeChainedPublicKeysHash160sAndMults(
+                           SecureBinaryData const & binPubKey,
+                           SecureBinaryData const & chainCode,
+                           uint32_t count);
+
    /////////////////////////////////////////////////////////////////////////////
    // We need some direct access to Crypto++ math functions
    SecureBinaryData InvMod(const SecureBinaryData& m);
@@ -0,0 +1,361 @@
+////////////////////////////////////////////////////////////////////////////////
+//                                                                            //
+//  Copyright (C) 2011-2015, Armory Technologies, Inc.                        //
+//  Distributed under the GNU Affero General Public License (AGPL v3)         //
+//  See LICENSE or http://www.gnu.org/licenses/agpl.html                      //
+//                                                                            //
+////////////////////////////////////////////////////////////////////////////////
+
+#ifndef _FLAT_HASH_MAP_H_
+#define _FLAT_HASH_MAP_H_
+
+#include <stdint.h>
+#include <stddef.h>
+#include <vector>
+#include <utility>
+#include <iterator>
+#include <type_traits>
+
+#include "BinaryData.h"
+
+////////////////////////////////////////////////////////////////////////////////
+// Open addressing hash map with Robin Hood probing, for the big registries
+// that get hammered with lookups while scanning (scrAddr -> last scanned
+// height and the like).
+//
+// Entries sit in one flat array, no node per entry like unordered_map.
+// Each slot remembers its distance to its home bucket, and inserts take the
+// slot of any entry closer to home than themselves, so probe sequences stay
+// short even at 7/8 load and a lookup can stop as soon as it runs into an
+// entry closer to home than the key it is looking for. Erasing shifts the
+// following entries back instead of leaving tombstones.
+//
+// It covers the parts of the std::unordered_map interface this codebase
+// uses. Differences:
+//  - keys and values must be default constructible, empty slots hold
+//    default constructed pairs
+//  - inserting or erasing invalidates all iterators and references
+//  - value_type is pair<Key, Value>: don't modify the keys through iterators
+template <typename Key, typename Value, typename Hash = BinaryDataHash>
+class FlatHashMap
+{
+public:
+   typedef Key                key_type;
+   typedef Value              mapped_type;
+   typedef std::pair<Key, Value> value_type;
+
+private:
+   struct Slot
+   {
+      value_type kv_;
+      uint32_t   hash_ = 0;
+
+      //1 + distance to the home bucket, 0 for an empty slot
+      uint32_t   dist_ = 0;
+   };
+
+   /////////////////////////////////////////////////////////////////////////////
+   template <typename SlotT, typename ValueT>
+   class IteratorBase
+   {
+      friend class FlatHashMap;
+      template <typename S, typename V> friend class IteratorBase;
+
+   public:
+      typedef std::forward_iterator_tag                iterator_category;
+      typedef typename std::remove_const<ValueT>::type value_type;
+      typedef ptrdiff_t                                difference_type;
+      typedef ValueT*                                  pointer;
+      typedef ValueT&                                  reference;
+
+      IteratorBase(void) : slot_(nullptr), end_(nullptr) {}
+
+      //iterator -> const_iterator
+      template <typename S, typename V>
+      IteratorBase(IteratorBase<S, V> const & it) :
+         slot_(it.slot_), end_(it.end_) {}
+
+      reference operator*(void) const  { return slot_->kv_; }
+      pointer   operator->(void) const { return &slot_->kv_; }
+
+      IteratorBase& operator++(void)
+      {
+         ++slot_;
+         skipEmpty();
+         return *this;
+      }
+
+      IteratorBase operator++(int)
+      {
+         IteratorBase it(*this);
+         ++(*this);
+         return it;
+      }
+
+      template <typename S, typename V>
+      bool operator==(IteratorBase<S, V> const & rhs) const
+      { return slot_ == rhs.slot_; }
+
+      template <typename S, typename V>
+      bool operator!=(IteratorBase<S, V> const & rhs) const
+      { return slot_ != rhs.slot_; }
+
+   private:
+      IteratorBase(SlotT* slot, SlotT* end) : slot_(slot), end_(end) {}
+
+      void skipEmpty(void)
+      {
+         while (slot_ != end_ && slot_->dist_ == 0)
+            ++slot_;
+      }
+
+   private:
+      SlotT* slot_;
+      SlotT* end_;
+   };
+
+public:
+   typedef IteratorBase<Slot, value_type>             iterator;
+   typedef IteratorBase<Slot const, value_type const> const_iterator;
+
+   /////////////////////////////////////////////////////////////////////////////
+   FlatHashMap(void) {}
+   explicit FlatHashMap(Hash const & hasher) : hasher_(hasher) {}
+
+   /////////////////////////////////////////////////////////////////////////////
+   size_t size(void) const  { return size_; }
+   bool   empty(void) const { return size_ == 0; }
+
+   // Keeps the slot array, like unordered_map keeps its buckets
+   void clear(void)
+   {
+      for (auto& slot : slots_)
+      {
+         if (slot.dist_ != 0)
+            slot = Slot();
+      }
+      size_ = 0;
+   }
+
+   void reserve(size_t count)
+   {
+      size_t capacity = MIN_CAPACITY;
+      while (count > maxLoad(capacity))
+         capacity <<= 1;
+
+      if (capacity > slots_.size())
+         rehash(capacity);
+   }
+
+   void swap(FlatHashMap& rhs)
+   {
+      slots_.swap(rhs.slots_);
+      std::swap(size_, rhs.size_);
+      std::swap(hasher_, rhs.hasher_);
+   }
+
+   /////////////////////////////////////////////////////////////////////////////
+   iterator begin(void)
+   {
+      iterator it(slots_.data(), slots_.data() + slots_.size());
+      it.skipEmpty();
+      return it;
+   }
+
+   iterator end(void)
+   { return iterator(slots_.data() + slots_.size(), slots_.data() + slots_.size()); }
+
+   const_iterator begin(void) const
+   {
+      const_iterator it(slots_.data(), slots_.data() + slots_.size());
+      it.skipEmpty();
+      return it;
+   }
+
+   const_iterator end(void) const
+   {
+      return const_iterator(
+         slots_.data() + slots_.size(), slots_.data() + slots_.size());
+   }
+
+   /////////////////////////////////////////////////////////////////////////////
+   iterator find(Key const & key)
+   {
+      size_t pos = findSlot(key, getHash(key));
+      if (pos == SIZE_MAX)
+         return end();
+      return iterator(slots_.data() + pos, slots_.data() + slots_.size());
+   }
+
+   const_iterator find(Key const & key) const
+   {
+      size_t pos = findSlot(key, getHash(key));
+      if (pos == SIZE_MAX)
+         return end();
+      return const_iterator(slots_.data() + pos, slots_.data() + slots_.size());
+   }
+
+   size_t count(Key const & key) const
+   { return (findSlot(key, getHash(key)) == SIZE_MAX ? 0 : 1); }
+
+   /////////////////////////////////////////////////////////////////////////////
+   // Doesn't overwrite the value of an existing key, same as unordered_map
+   std::pair<iterator, bool> insert(value_type const & kv)
+   {
+      uint32_t hash = getHash(kv.first);
+      size_t pos = findSlot(kv.first, hash);
+      if (pos != SIZE_MAX)
+      {
+         return std::make_pair(
+            iterator(slots_.data() + pos, slots_.data() + slots_.size()),
+            false);
+      }
+
+      pos = insertNew(value_type(kv), hash);
+      return std::make_pair(
+         iterator(slots_.data() + pos, slots_.data() + slots_.size()), true);
+   }
+
+   template <typename InputIt>
+   void insert(InputIt first, InputIt last)
+   {
+      for (; first != last; ++first)
+         insert(value_type(first->first, first->second));
+   }
+
+   Value& operator[](Key const & key)
+   {
+      uint32_t hash = getHash(key);
+      size_t pos = findSlot(key, hash);
+      if (pos == SIZE_MAX)
+         pos = insertNew(value_type(key, Value()), hash);
+
+      return slots_[pos].kv_.second;
+   }
+
+   /////////////////////////////////////////////////////////////////////////////
+   size_t erase(Key const & key)
+   {
+      size_t pos = findSlot(key, getHash(key));
+      if (pos == SIZE_MAX)
+         return 0;
+
+      //shift the rest of the probe sequence back by one
+      size_t mask = slots_.size() - 1;
+      size_t next = (pos + 1) & mask;
+      while (slots_[next].dist_ > 1)
+      {
+         slots_[pos] = std::move(slots_[next]);
+         slots_[pos].dist_--;
+         pos = next;
+         next = (next + 1) & mask;
+      }
+
+      slots_[pos] = Slot();
+      size_--;
+      return 1;
+   }
+
+private:
+   static const size_t MIN_CAPACITY = 16;
+
+   static size_t maxLoad(size_t capacity)
+   { return capacity - (capacity >> 3); }
+
+   uint32_t getHash(Key const & key) const
+   { return (uint32_t)hasher_(key); }
+
+   /////////////////////////////////////////////////////////////////////////////
+   size_t findSlot(Key const & key, uint32_t hash) const
+   {
+      if (size_ == 0)
+         return SIZE_MAX;
+
+      size_t mask = slots_.size() - 1;
+      size_t pos = hash & mask;
+      uint32_t dist = 1;
+
+      while (true)
+      {
+         Slot const & slot = slots_[pos];
+
+         //an empty slot or an entry closer to home ends the probe sequence
+         if (slot.dist_ < dist)
+            return SIZE_MAX;
+
+         if (slot.hash_ == hash && slot.kv_.first == key)
+            return pos;
+
+         pos = (pos + 1) & mask;
+         dist++;
+      }
+   }
+
+   /////////////////////////////////////////////////////////////////////////////
+   // Returns where kv ended up. The key must not be in the map already.
+   size_t insertNew(value_type&& kv, uint32_t hash)
+   {
+      if (size_ + 1 > maxLoad(slots_.size()))
+         rehash(slots_.empty() ? MIN_CAPACITY : slots_.size() * 2);
+
+      Slot entry;
+      entry.kv_ = std::move(kv);
+      entry.hash_ = hash;
+
+      size_t pos = place(std::move(entry));
+      size_++;
+      return pos;
+   }
+
+   /////////////////////////////////////////////////////////////////////////////
+   // Robin Hood placement: entry takes over the first slot whose occupant is
+   // closer to its home bucket, which then carries on looking. Returns the
+   // position the original entry landed in.
+   size_t place(Slot&& entry)
+   {
+      size_t mask = slots_.size() - 1;
+      size_t pos = entry.hash_ & mask;
+      size_t landedAt = SIZE_MAX;
+      entry.dist_ = 1;
+
+      while (true)
+      {
+         Slot& slot = slots_[pos];
+         if (slot.dist_ == 0)
+         {
+            slot = std::move(entry);
+            return (landedAt == SIZE_MAX ? pos : landedAt);
+         }
+
+         if (slot.dist_ < entry.dist_)
+         {
+            std::swap(slot, entry);
+            if (landedAt == SIZE_MAX)
+               landedAt = pos;
+         }
+
+         pos = (pos + 1) & mask;
+         entry.dist_++;
+      }
+   }
+
+   /////////////////////////////////////////////////////////////////////////////
+   void rehash(size_t capacity)
+   {
+      std::vector<Slot> oldSlots(capacity);
+      oldSlots.swap(slots_);
+
+      for (auto& slot : oldSlots)
+      {
+         if (slot.dist_ != 0)
+            place(std::move(slot));
+      }
+   }
+
+private:
+   std::vector<Slot> slots_;
+   size_t            size_ = 0;
+   Hash              hasher_;
+};
+
+#endif
@@ -0,0 +1,128 @@
+////////////////////////////////////////////////////////////////////////////////
+//                                                                            //
+//  Copyright (C) 2011-2015, Armory Technologies, Inc.                        //
+//  Distributed under the GNU Affero General Public License (AGPL v3)         //
+//  See LICENSE or http://www.gnu.org/licenses/agpl.html                      //
+//                                                                            //
+////////////////////////////////////////////////////////////////////////////////
+
+#ifndef _MPSC_QUEUE_H_
+#define _MPSC_QUEUE_H_
+
+#include <stdint.h>
+#include <stddef.h>
+#include <atomic>
+#include <memory>
+#include <utility>
+
+////////////////////////////////////////////////////////////////////////////////
+// Bounded lock-free queue, any number of producers and a single consumer.
+//
+// A ring of cells, each with a sequence number telling whose turn it is:
+// seq == pos means the cell is free for the producer that claims pos,
+// seq == pos + 1 means it holds the value for the consumer at pos. Producers
+// claim a position with a CAS on the enqueue counter, the consumer owns the
+// dequeue counter. Neither side ever waits on the other: tryPush fails when
+// the ring is full and tryPop when it's empty, what to do then is up to the
+// caller.
+template <typename T>
+class BoundedMPSCQueue
+{
+private:
+   struct Cell
+   {
+      std::atomic<size_t> seq_;
+      T val_;
+   };
+
+public:
+   // capacity is rounded up to a power of 2
+   explicit BoundedMPSCQueue(size_t capacity)
+   {
+      size_t size = 2;
+      while (size < capacity)
+         size <<= 1;
+
+      cells_.reset(new Cell[size]);
+      mask_ = size - 1;
+      for (size_t i = 0; i < size; i++)
+         cells_[i].seq_.store(i, std::memory_order_relaxed);
+
+      enqueuePos_.store(0, std::memory_order_relaxed);
+   }
+
+   size_t capacity(void) const { return mask_ + 1; }
+
+   /////////////////////////////////////////////////////////////////////////////
+   // false if the queue is full, val is left untouched then
+   bool tryPush(T&& val)
+   {
+      size_t pos = enqueuePos_.load(std::memory_order_relaxed);
+      Cell* cell;
+
+      while (true)
+      {
+         cell = &cells_[pos & mask_];
+         size_t seq = cell->seq_.load(std::memory_order_acquire);
+         intptr_t diff = (intptr_t)seq - (intptr_t)pos;
+
+         if (diff == 0)
+         {
+            //the cell is free, claim pos. On failure pos is reloaded
+            if (enqueuePos_.compare_exchange_weak(
+               pos, pos + 1, std::memory_order_relaxed))
+               break;
+         }
+         else if (diff < 0)
+         {
+            //the consumer hasn't freed this cell yet, we're a lap ahead
+            return false;
+         }
+         else
+         {
+            pos = enqueuePos_.load(std::memory_order_relaxed);
+         }
+      }
+
+      cell->val_ = std::move(val);
+      cell->seq_.store(pos + 1, std::memory_order_release);
+      return true;
+   }
+
+   /////////////////////////////////////////////////////////////////////////////
+   // consumer only
+   bool tryPop(T& val)
+   {
+      Cell& cell = cells_[dequeuePos_ & mask_];
+      if (cell.seq_.load(std::memory_order_acquire) != dequeuePos_ + 1)
+         return false;
+
+      val = std::move(cell.val_);
+      cell.val_ = T();
+      cell.seq_.store(dequeuePos_ + mask_ + 1, std::memory_order_release);
+      dequeuePos_++;
+      return true;
+   }
+
+   // consumer only. A push that is halfway through doesn't count yet.
+   bool hasData(void) const
+   {
+      const Cell& cell = cells_[dequeuePos_ & mask_];
+      return cell.seq_.load(std::memory_order_acquire) == dequeuePos_ + 1;
+   }
+
+private:
+   std::unique_ptr<Cell[]> cells_;
+   size_t mask_;
+
+   //keep the producers' counter and the consumer's on separate cache lines
+   std::atomic<size_t> enqueuePos_;
+   char pad_[64];
+   size_t dequeuePos_ = 0;
+
+private:
+   BoundedMPSCQueue(const BoundedMPSCQueue&);
+   BoundedMPSCQueue& operator=(const BoundedMPSCQueue&);
+};
+
+#endif
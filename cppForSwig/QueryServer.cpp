@@ -0,0 +1,852 @@
+////////////////////////////////////////////////////////////////////////////////
+//                                                                            //
+//  Copyright (C) 2011-2015, Armory Technologies, Inc.                        //
+//  Distributed under the GNU Affero General Public License (AGPL v3)         //
+//  See LICENSE or http://www.gnu.org/licenses/agpl.html                      //
+//                                                                            //
+////////////////////////////////////////////////////////////////////////////////
+
+#include <string.h>
+#include <sstream>
+#include <chrono>
+#include <algorithm>
+
+#include "QueryServer.h"
+#include "lmdb_wrapper.h"
+#include "Blockchain.h"
+#include "BtcUtils.h"
+#include "LedgerEntry.h"
+#include "HistoryPager.h"
+#include "Stats.h"
+#include "log.h"
+
+#if !defined(_WIN32)
+   #define QUERYSERVER_UNIX_SOCKET
+   #include <unistd.h>
+   #include <errno.h>
+   #include <poll.h>
+   #include <fcntl.h>
+   #include <sys/types.h>
+   #include <sys/stat.h>
+   #include <sys/socket.h>
+   #include <sys/un.h>
+#endif
+
+using namespace std;
+
+//each worker holds a reader slot in every env, LMDB has 126 of them
+#define MAX_QUERY_THREADS 32
+
+//longest request line a client may send
+#define MAX_REQUEST_SIZE 4096
+
+static const StatId statRequest = Stats::registerHistogram(
+   "queryd_request_seconds", "Answering a QueryServer request");
+static const StatId statRequestErrors = Stats::registerCounter(
+   "queryd_request_errors_total", "QueryServer requests answered an error");
+
+namespace
+{
+   /////////////////////////////////////////////////////////////////////////////
+   string jsonEscape(const string& str)
+   {
+      string result;
+      result.reserve(str.size());
+
+      for (auto c : str)
+      {
+         switch (c)
+         {
+         case '"':  result.append("\\\""); break;
+         case '\\': result.append("\\\\"); break;
+         case '\n': result.append("\\n");  break;
+         case '\r': result.append("\\r");  break;
+         case '\t': result.append("\\t");  break;
+         default:
+            if ((unsigned char)c < 0x20)
+            {
+               static const char hexChars[] = "0123456789abcdef";
+               result.append("\\u00");
+               result.push_back(hexChars[(c >> 4) & 0x0F]);
+               result.push_back(hexChars[c & 0x0F]);
+            }
+            else
+               result.push_back(c);
+         }
+      }
+
+      return result;
+   }
+
+   /////////////////////////////////////////////////////////////////////////////
+   string jsonError(const string& msg)
+   {
+      return "{\"error\":\"" + jsonEscape(msg) + "\"}";
+   }
+
+   /////////////////////////////////////////////////////////////////////////////
+   BinaryData readHexArg(const string& arg, size_t size = 0)
+   {
+      if (arg.size() == 0 || arg.size() % 2 != 0 ||
+         arg.find_first_not_of("0123456789abcdefABCDEF") != string::npos)
+         throw runtime_error("invalid hex argument");
+
+      BinaryData bd = READHEX(arg);
+      if (size != 0 && bd.getSize() != size)
+         throw runtime_error("invalid argument size");
+
+      return bd;
+   }
+
+   /////////////////////////////////////////////////////////////////////////////
+   string displayHash(const BinaryData& hash)
+   {
+      return hash.copySwapEndian().toHexStr();
+   }
+}
+
+////////////////////////////////////////////////////////////////////////////////
+QueryServer::QueryServer(LMDBBlockDatabase* db,
+   const string& blkFileLocation, unsigned nThreads) :
+   db_(db), blkFileLocation_(blkFileLocation),
+   nThreads_([nThreads](void)->unsigned
+   {
+      unsigned n = nThreads;
+      if (n == 0)
+         n = thread::hardware_concurrency();
+      return max(1U, min(n, (unsigned)MAX_QUERY_THREADS));
+   }()),
+   topHeight_(0), requestCount_(0), run_(false)
+{
+   wakePipe_[0] = wakePipe_[1] = -1;
+   refreshChainState();
+}
+
+////////////////////////////////////////////////////////////////////////////////
+QueryServer::~QueryServer()
+{
+   stop();
+}
+
+////////////////////////////////////////////////////////////////////////////////
+bool QueryServer::refreshChainState(void)
+{
+   lock_guard<mutex> refreshLock(refreshMutex_);
+
+   StoredDBInfo sdbi;
+   {
+      LMDBEnv::Transaction tx(db_->dbEnv_[HEADERS].get(), LMDB::ReadOnly);
+      db_->getStoredDBInfo(HEADERS, sdbi, false);
+   }
+
+   if (sdbi.topBlkHash_ == topHash_)
+      return false;
+
+   //build the new state while requests keep going on the old one
+   shared_ptr<Blockchain> bc = make_shared<Blockchain>(
+      db_->getGenesisBlockHash());
+   shared_ptr<vector<BlkFile>> blkFiles = make_shared<vector<BlkFile>>();
+
+   try
+   {
+      db_->readAllHeaders(
+         [&bc](const BlockHeader& h, uint32_t height, uint8_t dup)->void
+         { bc->addBlock(h.getThisHash(), h, height, dup); });
+      bc->forceOrganize();
+   }
+   catch (exception& e)
+   {
+      LOGERR << "failed to load the headers: " << e.what();
+      return false;
+   }
+
+   uint64_t totalSize = 0;
+   for (uint32_t fnum = 0; fnum < UINT16_MAX; fnum++)
+   {
+      string path = BtcUtils::getBlkFilename(blkFileLocation_, fnum);
+      uint64_t filesize = BtcUtils::GetFileSize(path);
+      if (filesize == FILE_DOES_NOT_EXIST)
+         break;
+
+      BlkFile f;
+      f.fnum = fnum;
+      f.path = path;
+      f.filesize = filesize;
+      f.filesizeCumul = totalSize;
+      blkFiles->push_back(f);
+
+      totalSize += filesize;
+   }
+
+   {
+      unique_lock<mutex> lock(stateMutex_);
+      reloading_ = true;
+      stateCV_.wait(lock, [this](void)->bool
+         { return activeRequests_ == 0; });
+
+      bc->setDuplicateIDinRAM(db_, true);
+      db_->setBlkFiles(blkFiles);
+      blockchain_ = bc;
+
+      topHash_ = sdbi.topBlkHash_;
+      topHeight_.store(bc->top().getBlockHeight());
+      reloading_ = false;
+   }
+   stateCV_.notify_all();
+
+   LOGINFO << "query server at block " << topHeight_.load();
+   return true;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+void QueryServer::beginRequest(void)
+{
+   unique_lock<mutex> lock(stateMutex_);
+   stateCV_.wait(lock, [this](void)->bool { return !reloading_; });
+   activeRequests_++;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+void QueryServer::endRequest(void)
+{
+   bool notify;
+   {
+      lock_guard<mutex> lock(stateMutex_);
+      notify = (--activeRequests_ == 0 && reloading_);
+   }
+
+   if (notify)
+      stateCV_.notify_all();
+}
+
+////////////////////////////////////////////////////////////////////////////////
+string QueryServer::processRequest(const string& request)
+{
+   stringstream ss(request);
+   string command;
+   vector<string> args;
+
+   ss >> command;
+   string arg;
+   while (ss >> arg)
+      args.push_back(arg);
+
+   requestCount_.fetch_add(1, memory_order_relaxed);
+   StatTimer timer(statRequest);
+
+   beginRequest();
+
+   string reply;
+   try
+   {
+      //the whole request reads from the same snapshot
+      DBSnapshot snapshot(db_);
+      LMDBEnv::Transaction txHeaders(
+         db_->dbEnv_[HEADERS].get(), LMDB::ReadOnly);
+
+      if (command == "getTx")
+         reply = getTx(args);
+      else if (command == "getBalance")
+         reply = getBalance(args);
+      else if (command == "getUTXOs")
+         reply = getUTXOs(args);
+      else if (command == "getHistoryPage")
+         reply = getHistoryPage(args);
+      else
+         reply = jsonError("unknown command: " + command);
+   }
+   catch (exception& e)
+   {
+      reply = jsonError(e.what());
+   }
+
+   endRequest();
+
+   if (reply.compare(0, 9, "{\"error\":") == 0)
+      Stats::add(statRequestErrors);
+   return reply;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+string QueryServer::getTx(const vector<string>& args)
+{
+   if (args.size() != 1)
+      return jsonError("usage: getTx <txHash>");
+
+   BinaryData txHash = readHexArg(args[0], 32).copySwapEndian();
+
+   StoredTx stx;
+   bool found;
+   if (db_->getDbType() == ARMORY_DB_SUPER)
+      found = db_->getStoredTx_byHashSuper(txHash, &stx);
+   else
+      found = db_->getStoredTx_byHash(txHash, &stx);
+
+   if (!found)
+      return jsonError("tx not found");
+
+   Tx tx = stx.getTxCopy();
+   if (!tx.isInitialized())
+      return jsonError("tx not found");
+
+   stringstream reply;
+   reply << "{\"txHash\":\"" << displayHash(txHash) << "\"" <<
+      ",\"height\":" << stx.blockHeight_ <<
+      ",\"txIndex\":" << stx.txIndex_ <<
+      ",\"raw\":\"" << tx.serialize().toHexStr() << "\"}";
+   return reply.str();
+}
+
+////////////////////////////////////////////////////////////////////////////////
+string QueryServer::getBalance(const vector<string>& args)
+{
+   if (args.size() != 1)
+      return jsonError("usage: getBalance <scrAddr>");
+
+   BinaryData scrAddr = readHexArg(args[0]);
+
+   StoredScriptHistory ssh;
+   db_->getStoredScriptHistorySummary(ssh, scrAddr);
+
+   uint64_t balance = 0, txioCount = 0;
+   if (ssh.isInitialized())
+   {
+      balance = ssh.totalUnspent_;
+      txioCount = ssh.totalTxioCount_;
+   }
+
+   stringstream reply;
+   reply << "{\"scrAddr\":\"" << scrAddr.toHexStr() << "\"" <<
+      ",\"balance\":" << balance <<
+      ",\"txioCount\":" << txioCount << "}";
+   return reply.str();
+}
+
+////////////////////////////////////////////////////////////////////////////////
+string QueryServer::getUTXOs(const vector<string>& args)
+{
+   if (args.size() != 1)
+      return jsonError("usage: getUTXOs <scrAddr>");
+
+   BinaryData scrAddr = readHexArg(args[0]);
+
+   StoredScriptHistory ssh;
+   map<BinaryData, UnspentTxOut> utxoMap;
+   db_->getStoredScriptHistory(ssh, scrAddr);
+   if (ssh.isInitialized())
+      db_->getFullUTXOMapForSSH(ssh, utxoMap, false);
+
+   stringstream reply;
+   reply << "{\"scrAddr\":\"" << scrAddr.toHexStr() << "\",\"utxos\":[";
+
+   bool first = true;
+   for (const auto& utxoPair : utxoMap)
+   {
+      const UnspentTxOut& utxo = utxoPair.second;
+      if (!first)
+         reply << ",";
+      first = false;
+
+      reply << "{\"txHash\":\"" << displayHash(utxo.getTxHash()) << "\"" <<
+         ",\"txOutIndex\":" << utxo.getTxOutIndex() <<
+         ",\"value\":" << utxo.getValue() <<
+         ",\"height\":" << utxo.getTxHeight() <<
+         ",\"script\":\"" << utxo.getScript().toHexStr() << "\"}";
+   }
+
+   reply << "]}";
+   return reply.str();
+}
+
+////////////////////////////////////////////////////////////////////////////////
+string QueryServer::getHistoryPage(const vector<string>& args)
+{
+   if (args.size() != 2)
+      return jsonError("usage: getHistoryPage <scrAddr> <pageId>");
+
+   BinaryData scrAddr = readHexArg(args[0]);
+
+   char* end = nullptr;
+   unsigned long pageId = strtoul(args[1].c_str(), &end, 10);
+   if (end == args[1].c_str() || *end != 0)
+      return jsonError("invalid page id");
+
+   Blockchain* bc = blockchain_.get();
+   if (bc == nullptr)
+      return jsonError("no headers in the DB yet");
+
+   HistoryPager pager;
+   pager.mapHistory([this, &scrAddr](bool)->map<uint32_t, uint32_t>
+      { return db_->getSSHSummary(scrAddr, UINT32_MAX); });
+
+   if (pageId >= pager.getPageCount())
+      return jsonError("no such page");
+
+   //the history can be ahead of the headers we have loaded, leave what's
+   //past our top for after the next reload
+   const uint32_t topHeight = topHeight_.load();
+   const bool withMultisig = scrAddr[0] == SCRIPT_PREFIX_MULTISIG;
+
+   auto getTxio = [&](uint32_t start, uint32_t end,
+      map<BinaryData, TxIOPair>& outMap)->void
+   {
+      end = min(end, topHeight);
+      if (start > end)
+         return;
+
+      StoredScriptHistory ssh;
+      db_->getStoredScriptHistory(ssh, scrAddr, start, end);
+
+      for (const auto& subSSH : ssh.subHistMap_)
+      {
+         for (const auto& txioPair : subSSH.second.txioMap_)
+         {
+            if (withMultisig || !txioPair.second.isMultisig())
+               outMap[txioPair.first] = txioPair.second;
+         }
+      }
+   };
+
+   auto buildLedgers = [&](map<BinaryData, LedgerEntry>& leMap,
+      const map<BinaryData, TxIOPair>& txioMap,
+      uint32_t start, uint32_t end)->void
+   {
+      LedgerEntry::computeLedgerMap(leMap, txioMap, start,
+         min(end, topHeight), scrAddr, db_, bc, false);
+   };
+
+   map<BinaryData, LedgerEntry> leMap;
+   pager.getPageLedgerMap(getTxio, buildLedgers, pageId, leMap);
+
+   stringstream reply;
+   reply << "{\"scrAddr\":\"" << scrAddr.toHexStr() << "\"" <<
+      ",\"pageId\":" << pageId <<
+      ",\"pageCount\":" << pager.getPageCount() << ",\"ledger\":[";
+
+   bool first = true;
+   for (auto leIter = leMap.rbegin(); leIter != leMap.rend(); ++leIter)
+   {
+      const LedgerEntry& le = leIter->second;
+      if (!first)
+         reply << ",";
+      first = false;
+
+      reply << "{\"txHash\":\"" << displayHash(le.getTxHash()) << "\"" <<
+         ",\"height\":" << le.getBlockNum() <<
+         ",\"txIndex\":" << le.getIndex() <<
+         ",\"value\":" << le.getValue() <<
+         ",\"time\":" << le.getTxTime() <<
+         ",\"coinbase\":" << (le.isCoinbase() ? "true" : "false") <<
+         ",\"sentToSelf\":" << (le.isSentToSelf() ? "true" : "false") <<
+         ",\"changeBack\":" << (le.isChangeBack() ? "true" : "false") << "}";
+   }
+
+   reply << "]}";
+   return reply.str();
+}
+
+#ifdef QUERYSERVER_UNIX_SOCKET
+////////////////////////////////////////////////////////////////////////////////
+// Clears the way for bind(). Only a socket nobody is listening on, left over
+// from a previous run, is removed. Anything else at that path is an error.
+static bool removeStaleSocket(const string& socketPath, const sockaddr_un& addr)
+{
+   struct stat st;
+   if (lstat(socketPath.c_str(), &st) != 0)
+   {
+      if (errno == ENOENT)
+         return true;
+
+      LOGERR << "can't stat " << socketPath << ": " << strerror(errno);
+      return false;
+   }
+
+   if (!S_ISSOCK(st.st_mode))
+   {
+      LOGERR << socketPath << " exists and is not a socket";
+      return false;
+   }
+
+   int probe = socket(AF_UNIX, SOCK_STREAM, 0);
+   if (probe < 0)
+   {
+      LOGERR << "socket() failed: " << strerror(errno);
+      return false;
+   }
+
+   int rc = connect(probe, (const sockaddr*)&addr, sizeof(addr));
+   int err = errno;
+   close(probe);
+
+   if (rc == 0)
+   {
+      LOGERR << "another query server is listening on " << socketPath;
+      return false;
+   }
+
+   if (err != ECONNREFUSED)
+   {
+      LOGERR << "can't probe " << socketPath << ": " << strerror(err);
+      return false;
+   }
+
+   if (unlink(socketPath.c_str()) != 0)
+   {
+      LOGERR << "can't remove " << socketPath << ": " << strerror(errno);
+      return false;
+   }
+
+   return true;
+}
+#endif
+
+////////////////////////////////////////////////////////////////////////////////
+bool QueryServer::start(const string& socketPath)
+{
+#ifdef QUERYSERVER_UNIX_SOCKET
+   if (listenThread_.joinable())
+      return true;
+
+   sockaddr_un addr;
+   memset(&addr, 0, sizeof(addr));
+   if (socketPath.size() >= sizeof(addr.sun_path))
+   {
+      LOGERR << "socket path is too long: " << socketPath;
+      return false;
+   }
+
+   addr.sun_family = AF_UNIX;
+   strncpy(addr.sun_path, socketPath.c_str(), sizeof(addr.sun_path) - 1);
+
+   int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+   if (fd < 0)
+   {
+      LOGERR << "socket() failed: " << strerror(errno);
+      return false;
+   }
+
+   if (!removeStaleSocket(socketPath, addr))
+   {
+      close(fd);
+      return false;
+   }
+
+   //the replies are wallet history, keep other local users out
+   mode_t prevMask = umask(0077);
+   int rc = ::bind(fd, (sockaddr*)&addr, sizeof(addr));
+   int err = errno;
+   umask(prevMask);
+
+   if (rc != 0)
+   {
+      LOGERR << "can't bind " << socketPath << ": " << strerror(err);
+      close(fd);
+      return false;
+   }
+
+   if (::listen(fd, 64) != 0)
+   {
+      LOGERR << "can't listen on " << socketPath << ": " << strerror(errno);
+      close(fd);
+      unlink(socketPath.c_str());
+      return false;
+   }
+
+   if (pipe(wakePipe_) != 0)
+   {
+      close(fd);
+      unlink(socketPath.c_str());
+      wakePipe_[0] = wakePipe_[1] = -1;
+      return false;
+   }
+
+   //workers wake the listener every time they hand a connection back, never
+   //block on a full pipe
+   fcntl(wakePipe_[1], F_SETFL, fcntl(wakePipe_[1], F_GETFL) | O_NONBLOCK);
+
+   listenFd_ = fd;
+   socketPath_ = socketPath;
+   run_.store(true);
+
+   for (unsigned i = 0; i < nThreads_; i++)
+      workers_.push_back(thread(&QueryServer::workerThread, this));
+   listenThread_ = thread(&QueryServer::listenThread, this);
+
+   LOGINFO << "serving queries on " << socketPath << " with " <<
+      nThreads_ << " threads";
+   return true;
+#else
+   LOGERR << "the query server can't listen on this platform";
+   return false;
+#endif
+}
+
+////////////////////////////////////////////////////////////////////////////////
+void QueryServer::stop(void)
+{
+#ifdef QUERYSERVER_UNIX_SOCKET
+   if (!listenThread_.joinable())
+      return;
+
+   run_.store(false);
+   wakeListener();
+   listenThread_.join();
+
+   {
+      //wake the workers up from their sends, drop what's still waiting
+      lock_guard<mutex> lock(connMutex_);
+      for (auto& connPair : connections_)
+      {
+         if (connPair.second.busy_)
+            shutdown(connPair.first, SHUT_RDWR);
+      }
+      readyConnections_.clear();
+   }
+   connCV_.notify_all();
+
+   for (auto& worker : workers_)
+      worker.join();
+   workers_.clear();
+
+   for (auto& connPair : connections_)
+      close(connPair.first);
+   connections_.clear();
+
+   close(listenFd_);
+   close(wakePipe_[0]);
+   close(wakePipe_[1]);
+   listenFd_ = -1;
+   wakePipe_[0] = wakePipe_[1] = -1;
+
+   unlink(socketPath_.c_str());
+#endif
+}
+
+////////////////////////////////////////////////////////////////////////////////
+void QueryServer::wakeListener(void)
+{
+#ifdef QUERYSERVER_UNIX_SOCKET
+   //a full pipe will wake it all the same
+   char c = 0;
+   if (write(wakePipe_[1], &c, 1) != 1 && errno != EAGAIN)
+      LOGWARN << "failed to wake the query listener";
+#endif
+}
+
+////////////////////////////////////////////////////////////////////////////////
+void QueryServer::listenThread(void)
+{
+#ifdef QUERYSERVER_UNIX_SOCKET
+   auto lastRefresh = chrono::steady_clock::now();
+   vector<pollfd> fds;
+
+   while (run_.load())
+   {
+      //the listening socket, the wake pipe and every idle connection, the 
+      //ones a worker is serving come back once it's done
+      fds.resize(2);
+      fds[0].fd = listenFd_;
+      fds[0].events = POLLIN;
+      fds[1].fd = wakePipe_[0];
+      fds[1].events = POLLIN;
+      {
+         lock_guard<mutex> lock(connMutex_);
+         for (auto& connPair : connections_)
+         {
+            if (connPair.second.busy_)
+               continue;
+
+            pollfd pfd;
+            pfd.fd = connPair.first;
+            pfd.events = POLLIN;
+            fds.push_back(pfd);
+         }
+      }
+
+      for (auto& pfd : fds)
+         pfd.revents = 0;
+
+      int rc = poll(&fds[0], fds.size(), 1000);
+      if (rc < 0 && errno != EINTR)
+      {
+         LOGERR << "query listener poll() failed: " << strerror(errno);
+         break;
+      }
+
+      if (rc > 0 && (fds[1].revents & POLLIN))
+      {
+         char drain[64];
+         if (read(wakePipe_[0], drain, sizeof(drain)) < 0)
+            LOGWARN << "failed to drain the query listener pipe";
+      }
+
+      if (!run_.load())
+         break;
+
+      if (rc > 0 && (fds[0].revents & POLLIN))
+      {
+         int fd = accept(listenFd_, nullptr, nullptr);
+         if (fd >= 0)
+         {
+            lock_guard<mutex> lock(connMutex_);
+            connections_[fd];
+         }
+      }
+
+      for (size_t i = 2; rc > 0 && i < fds.size(); i++)
+      {
+         if (fds[i].revents != 0)
+            readConnection(fds[i].fd);
+      }
+
+      //pick up the blocks the writer added
+      auto now = chrono::steady_clock::now();
+      if (now - lastRefresh >= chrono::seconds(1))
+      {
+         lastRefresh = now;
+         try
+         {
+            refreshChainState();
+         }
+         catch (exception& e)
+         {
+            LOGERR << "failed to refresh the query server: " << e.what();
+         }
+      }
+   }
+#endif
+}
+
+////////////////////////////////////////////////////////////////////////////////
+void QueryServer::readConnection(int fd)
+{
+#ifdef QUERYSERVER_UNIX_SOCKET
+   char readBuf[4096];
+   ssize_t nRead = recv(fd, readBuf, sizeof(readBuf), 0);
+   if (nRead < 0 && errno == EINTR)
+      return;
+
+   lock_guard<mutex> lock(connMutex_);
+   auto connIter = connections_.find(fd);
+   if (connIter == connections_.end())
+      return;
+
+   if (nRead <= 0)
+   {
+      close(fd);
+      connections_.erase(connIter);
+      return;
+   }
+
+   auto& buffer = connIter->second.buffer_;
+   buffer.append(readBuf, nRead);
+
+   //only the bytes past the last full line are still a request in the making
+   size_t lineEnd = buffer.rfind('\n');
+   size_t partial = (lineEnd == string::npos ? 
+      buffer.size() : buffer.size() - lineEnd - 1);
+   if (partial > MAX_REQUEST_SIZE)
+   {
+      LOGWARN << "dropping query client, request too long";
+      close(fd);
+      connections_.erase(connIter);
+      return;
+   }
+
+   if (lineEnd == string::npos)
+      return;
+
+   //a worker owns the connection until it hands it back
+   connIter->second.busy_ = true;
+   readyConnections_.push_back(fd);
+   connCV_.notify_one();
+#endif
+}
+
+////////////////////////////////////////////////////////////////////////////////
+void QueryServer::workerThread(void)
+{
+#ifdef QUERYSERVER_UNIX_SOCKET
+   while (true)
+   {
+      int fd;
+      string requests;
+      {
+         unique_lock<mutex> lock(connMutex_);
+         connCV_.wait(lock, [this](void)->bool
+            { return !run_.load() || !readyConnections_.empty(); });
+
+         if (!run_.load())
+            return;
+
+         fd = readyConnections_.front();
+         readyConnections_.pop_front();
+
+         //take the full lines, leave the partial one for the listener
+         auto& buffer = connections_[fd].buffer_;
+         size_t lineEnd = buffer.rfind('\n');
+         requests = buffer.substr(0, lineEnd + 1);
+         buffer.erase(0, lineEnd + 1);
+      }
+
+      bool keep = serveRequests(fd, requests);
+
+      {
+         lock_guard<mutex> lock(connMutex_);
+         auto connIter = connections_.find(fd);
+         if (keep)
+         {
+            connIter->second.busy_ = false;
+         }
+         else
+         {
+            close(fd);
+            connections_.erase(connIter);
+         }
+      }
+
+      wakeListener();
+   }
+#endif
+}
+
+////////////////////////////////////////////////////////////////////////////////
+bool QueryServer::serveRequests(int fd, const string& requests)
+{
+#ifdef QUERYSERVER_UNIX_SOCKET
+   size_t start = 0;
+   size_t pos;
+   while (run_.load() && (pos = requests.find('\n', start)) != string::npos)
+   {
+      string request = requests.substr(start, pos - start);
+      start = pos + 1;
+
+      if (request.size() > 0 && request.back() == '\r')
+         request.pop_back();
+      if (request.size() == 0)
+         continue;
+
+      string reply = processRequest(request);
+      reply.push_back('\n');
+
+      size_t sent = 0;
+      while (sent < reply.size())
+      {
+#ifdef MSG_NOSIGNAL
+         ssize_t n = send(fd, reply.c_str() + sent,
+            reply.size() - sent, MSG_NOSIGNAL);
+#else
+         ssize_t n = send(fd, reply.c_str() + sent,
+            reply.size() - sent, 0);
+#endif
+         if (n < 0 && errno == EINTR)
+            continue;
+         if (n <= 0)
+            return false;
+         sent += n;
+      }
+   }
+#endif
+
+   return true;
+}
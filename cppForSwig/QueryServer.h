@@ -0,0 +1,138 @@
+////////////////////////////////////////////////////////////////////////////////
+//                                                                            //
+//  Copyright (C) 2011-2015, Armory Technologies, Inc.                        //
+//  Distributed under the GNU Affero General Public License (AGPL v3)         //
+//  See LICENSE or http://www.gnu.org/licenses/agpl.html                      //
+//                                                                            //
+////////////////////////////////////////////////////////////////////////////////
+
+#ifndef _QUERY_SERVER_H_
+#define _QUERY_SERVER_H_
+
+#include <string>
+#include <vector>
+#include <deque>
+#include <map>
+#include <memory>
+#include <atomic>
+#include <mutex>
+#include <thread>
+#include <condition_variable>
+
+#include "BinaryData.h"
+
+class LMDBBlockDatabase;
+class Blockchain;
+
+////////////////////////////////////////////////////////////////////////////////
+// Serves history, UTXO and tx queries straight out of the LMDB databases,
+// without a BDM. The databases are meant to be opened read-only
+// (LMDBBlockDatabase::openDatabasesReadOnly) while an Armory instance keeps
+// them up to date, so any number of these can run next to it.
+//
+// Requests are one line of text, the reply one line of JSON:
+//
+//    getTx <txHash>                   -> the raw tx, its height and index
+//    getBalance <scrAddr>             -> unspent total and txio count
+//    getUTXOs <scrAddr>               -> the unspent outputs
+//    getHistoryPage <scrAddr> <page>  -> one page of ledger entries, newest
+//                                        first, and the page count
+//
+// Arguments are hex. Tx hashes are in the usual (big endian) display order,
+// scrAddr are Armory's: prefix byte + hash160. Errors come back as
+// {"error":"..."}.
+//
+// Each request reads from its own DBSnapshot, without waiting on the writer
+// or on other requests.
+// The headers are loaded in RAM and reloaded when the writer moves the top
+// of the chain.
+//
+// start() listens on a Unix domain socket. The listener polls every idle
+// connection and hands the ones with a full request line to a pool of
+// threads, so idle clients don't hold a thread. The socket is only
+// accessible to its owner. start() fails if something other than a stale
+// socket is in the way. There is no listener on Windows, processRequest()
+// can still be called directly.
+class QueryServer
+{
+public:
+   QueryServer(LMDBBlockDatabase* db, const std::string& blkFileLocation,
+      unsigned nThreads = 0);
+   ~QueryServer();
+
+   bool start(const std::string& socketPath);
+   void stop(void);
+
+   // thread safe
+   std::string processRequest(const std::string& request);
+
+   // reloads the headers and blk file list if the writer moved the top of the
+   // chain since the last call, true if it did
+   bool refreshChainState(void);
+
+   uint32_t getTopBlockHeight(void) const { return topHeight_.load(); }
+   unsigned getThreadCount(void) const { return nThreads_; }
+   uint64_t getRequestCount(void) const { return requestCount_.load(); }
+
+private:
+   std::string getTx(const std::vector<std::string>& args);
+   std::string getBalance(const std::vector<std::string>& args);
+   std::string getUTXOs(const std::vector<std::string>& args);
+   std::string getHistoryPage(const std::vector<std::string>& args);
+
+   void beginRequest(void);
+   void endRequest(void);
+
+   void listenThread(void);
+   void wakeListener(void);
+   void readConnection(int fd);
+   void workerThread(void);
+   bool serveRequests(int fd, const std::string& requests);
+
+private:
+   LMDBBlockDatabase* const db_;
+   const std::string blkFileLocation_;
+   const unsigned nThreads_;
+
+   //only swapped while no request is running
+   std::mutex refreshMutex_;
+   std::shared_ptr<Blockchain> blockchain_;
+   BinaryData topHash_;
+   std::atomic<uint32_t> topHeight_;
+
+   //requests in flight, and the chain state reload waiting on them
+   std::mutex stateMutex_;
+   std::condition_variable stateCV_;
+   unsigned activeRequests_ = 0;
+   bool reloading_ = false;
+
+   std::atomic<uint64_t> requestCount_;
+
+   //socket side
+   std::atomic<bool> run_;
+   int listenFd_ = -1;
+   int wakePipe_[2];
+   std::string socketPath_;
+
+   //a busy connection is being served by a worker, the listener leaves it 
+   //out of its poll until it's handed back
+   struct Connection
+   {
+      std::string buffer_;
+      bool busy_ = false;
+   };
+
+   std::mutex connMutex_;
+   std::condition_variable connCV_;
+   std::map<int, Connection> connections_;
+   std::deque<int> readyConnections_;
+
+   std::thread listenThread_;
+   std::vector<std::thread> workers_;
+
+private:
+   QueryServer(const QueryServer&);
+   QueryServer& operator=(const QueryServer&);
+};
+
+#endif
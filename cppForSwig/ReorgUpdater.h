@@ -190,6 +190,8 @@ private:
       BlockWriteBatcher blockWrites(config_, iface_, *scrAddrData_, true);
       blockWrites.scanBlocks(progressFilter, oldTopPtr_->getBlockHeight(),
          branchPtr_->getBlockHeight()+1, *scrAddrData_);
+
+      iface_->txHashCache().eraseFromHeight(branchPtr_->getBlockHeight() + 1);
    }
 
    void updateBlockDupIDs(void)
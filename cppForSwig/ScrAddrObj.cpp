@@ -470,6 +470,41 @@ bool ScrAddrObj::getMoreUTXOs(function<bool(BinaryData)> spentByZC)
    return utxos_.fetchMoreUTXO(spentByZC);
 }
 
+////////////////////////////////////////////////////////////////////////////////
+uint32_t ScrAddrObj::fetchUTXOPage(uint32_t height, 
+   map<BinaryData, TxIOPair>& page,
+   function<bool(const BinaryData&)> spentByZC) const
+{
+   if (height == UINT32_MAX || height > bc_->top().getBlockHeight())
+      return UINT32_MAX;
+
+   uint32_t end = hist_.getRangeForHeightAndCount(
+      height, pagedUTXOs::UTXOperFetch);
+
+   StoredScriptHistory ssh;
+   db_->getStoredScriptHistory(ssh, scrAddr_, height, end);
+
+   for (const auto& subsshPair : ssh.subHistMap_)
+   {
+      for (const auto& txioPair : subsshPair.second.txioMap_)
+      {
+         const auto& txio = txioPair.second;
+         if (!txio.isUTXO() || txio.isMultisig())
+            continue;
+
+         if (spentByZC(txio.getDBKeyOfOutput()))
+            continue;
+
+         page.insert(txioPair);
+      }
+   }
+
+   if (end == UINT32_MAX)
+      return UINT32_MAX;
+
+   return end + 1;
+}
+
 ////////////////////////////////////////////////////////////////////////////////
 vector<UnspentTxOut> ScrAddrObj::getFullTxOutList(uint32_t currBlk,
    bool ignoreZc) const
@@ -508,10 +543,13 @@ vector<UnspentTxOut> ScrAddrObj::getSpendableTxOutList(
 
 
 
-   StoredScriptHistory ssh;
    map<BinaryData, UnspentTxOut> utxoMap;
-   db_->getStoredScriptHistory(ssh, scrAddr_);
-   db_->getFullUTXOMapForSSH(ssh, utxoMap, false);
+   if (!db_->getUtxosForScrAddr(scrAddr_, utxoMap))
+   {
+      StoredScriptHistory ssh;
+      db_->getStoredScriptHistory(ssh, scrAddr_);
+      db_->getFullUTXOMapForSSH(ssh, utxoMap, false);
+   }
 
    vector<UnspentTxOut> utxoVec;
 
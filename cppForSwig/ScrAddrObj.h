@@ -292,6 +292,11 @@ public:
    
    bool getMoreUTXOs(function<bool(BinaryData)> hasTxOutInZC);
 
+   //grabs the next page of spendable DB UTXOs starting at height, in block 
+   //order. Returns the height to resume from, UINT32_MAX once exhausted
+   uint32_t fetchUTXOPage(uint32_t height, map<BinaryData, TxIOPair>& page,
+      function<bool(const BinaryData&)> spentByZC) const;
+
    uint64_t getLoadedTxOutsValue(void) const { return utxos_.getValue(); }
    uint32_t getLoadedTxOutsCount(void) const { return utxos_.getCount(); }
 
@@ -0,0 +1,1089 @@
+////////////////////////////////////////////////////////////////////////////////
+//                                                                            //
+//  Copyright (C) 2011-2015, Armory Technologies, Inc.                        //
+//  Distributed under the GNU Affero General Public License (AGPL v3)         //
+//  See LICENSE or http://www.gnu.org/licenses/agpl.html                      //
+//                                                                            //
+////////////////////////////////////////////////////////////////////////////////
+
+#include <string.h>
+#include <vector>
+#include <mutex>
+#include <map>
+#include <atomic>
+#include <thread>
+#include <algorithm>
+
+#include "Secp256k1.h"
+#include "BtcUtils.h"
+#include "integer.h"
+
+#if defined(_MSC_VER) && defined(_M_X64)
+   #include <intrin.h>
+#endif
+
+using namespace std;
+
+namespace
+{
+
+////////////////////////////////////////////////////////////////////////////////
+// 64x64 -> 128 bit multiplication, returns the low word
+#if defined(_MSC_VER) && defined(_M_X64)
+inline uint64_t mulWide(uint64_t a, uint64_t b, uint64_t* hi)
+{
+   return _umul128(a, b, hi);
+}
+#elif defined(__SIZEOF_INT128__)
+inline uint64_t mulWide(uint64_t a, uint64_t b, uint64_t* hi)
+{
+   unsigned __int128 r = (unsigned __int128)a * b;
+   *hi = (uint64_t)(r >> 64);
+   return (uint64_t)r;
+}
+#else
+inline uint64_t mulWide(uint64_t a, uint64_t b, uint64_t* hi)
+{
+   uint64_t aL = (uint32_t)a, aH = a >> 32;
+   uint64_t bL = (uint32_t)b, bH = b >> 32;
+   uint64_t ll = aL * bL, lh = aL * bH, hl = aH * bL, hh = aH * bH;
+   uint64_t mid = (ll >> 32) + (uint32_t)lh + (uint32_t)hl;
+   *hi = hh + (lh >> 32) + (hl >> 32) + (mid >> 32);
+   return (mid << 32) | (uint32_t)ll;
+}
+#endif
+
+////////////////////////////////////////////////////////////////////////////////
+// 192 bit accumulator for product scanning
+struct Acc
+{
+   uint64_t c0, c1, c2;
+
+   Acc(void) : c0(0), c1(0), c2(0) {}
+
+   void mulAdd(uint64_t a, uint64_t b)
+   {
+      uint64_t hi;
+      uint64_t lo = mulWide(a, b, &hi);
+      c0 += lo;
+      hi += (c0 < lo); //hi <= 2^64-2, can't overflow
+      c1 += hi;
+      c2 += (c1 < hi);
+   }
+
+   void add(uint64_t a)
+   {
+      c0 += a;
+      uint64_t carry = (c0 < a);
+      c1 += carry;
+      c2 += (c1 < carry);
+   }
+
+   uint64_t extract(void)
+   {
+      uint64_t r = c0;
+      c0 = c1;
+      c1 = c2;
+      c2 = 0;
+      return r;
+   }
+};
+
+////////////////////////////////////////////////////////////////////////////////
+// Field elements mod p = 2^256 - 2^32 - 977, 4 little endian limbs, always
+// fully reduced so equality is a limb compare
+struct Fe
+{
+   uint64_t n[4];
+};
+
+//2^256 mod p
+const uint64_t FE_C = 0x1000003D1ULL;
+
+const Fe FE_P = {{ 0xFFFFFFFEFFFFFC2FULL, 0xFFFFFFFFFFFFFFFFULL,
+                   0xFFFFFFFFFFFFFFFFULL, 0xFFFFFFFFFFFFFFFFULL }};
+
+////////////////////////////////////////////////////////////////////////////////
+inline bool feIsZero(Fe const & a)
+{
+   return (a.n[0] | a.n[1] | a.n[2] | a.n[3]) == 0;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+inline bool feEqual(Fe const & a, Fe const & b)
+{
+   return ((a.n[0] ^ b.n[0]) | (a.n[1] ^ b.n[1]) |
+           (a.n[2] ^ b.n[2]) | (a.n[3] ^ b.n[3])) == 0;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+inline bool feGeP(Fe const & a)
+{
+   return a.n[3] == FE_P.n[3] && a.n[2] == FE_P.n[2] &&
+          a.n[1] == FE_P.n[1] && a.n[0] >= FE_P.n[0];
+}
+
+////////////////////////////////////////////////////////////////////////////////
+// r = a + FE_C mod 2^256, the carry out is dropped
+inline void feAddC(Fe & r)
+{
+   uint64_t carry = FE_C;
+   for (unsigned i = 0; i < 4 && carry; i++)
+   {
+      r.n[i] += carry;
+      carry = (r.n[i] < carry);
+   }
+}
+
+////////////////////////////////////////////////////////////////////////////////
+inline void feSetInt(Fe & r, uint64_t v)
+{
+   r.n[0] = v;
+   r.n[1] = r.n[2] = r.n[3] = 0;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+// big endian bytes in, returns false for values >= p
+bool feFromBytes(Fe & r, uint8_t const * b32)
+{
+   for (unsigned i = 0; i < 4; i++)
+   {
+      uint64_t limb = 0;
+      for (unsigned j = 0; j < 8; j++)
+         limb = (limb << 8) | b32[(3 - i) * 8 + j];
+      r.n[i] = limb;
+   }
+
+   return !feGeP(r);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+void feToBytes(uint8_t* b32, Fe const & a)
+{
+   for (unsigned i = 0; i < 4; i++)
+   {
+      uint64_t limb = a.n[i];
+      for (int j = 7; j >= 0; j--)
+      {
+         b32[(3 - i) * 8 + j] = (uint8_t)limb;
+         limb >>= 8;
+      }
+   }
+}
+
+////////////////////////////////////////////////////////////////////////////////
+void feAdd(Fe & r, Fe const & a, Fe const & b)
+{
+   uint64_t carry = 0;
+   for (unsigned i = 0; i < 4; i++)
+   {
+      uint64_t s = a.n[i] + carry;
+      carry = (s < carry);
+      r.n[i] = s + b.n[i];
+      carry += (r.n[i] < s);
+   }
+
+   //a + b < 2p: either wrapped past 2^256 or landed in [p, 2^256)
+   if (carry || feGeP(r))
+      feAddC(r);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+void feSub(Fe & r, Fe const & a, Fe const & b)
+{
+   uint64_t borrow = 0;
+   for (unsigned i = 0; i < 4; i++)
+   {
+      uint64_t d = a.n[i] - borrow;
+      borrow = (a.n[i] < borrow);
+      borrow += (d < b.n[i]);
+      r.n[i] = d - b.n[i];
+   }
+
+   //went below 0: r holds a - b + 2^256, we want a - b + p, so take C off
+   if (borrow)
+   {
+      uint64_t sub = FE_C;
+      for (unsigned i = 0; i < 4 && sub; i++)
+      {
+         uint64_t prev = r.n[i];
+         r.n[i] -= sub;
+         sub = (prev < sub);
+      }
+   }
+}
+
+////////////////////////////////////////////////////////////////////////////////
+inline void feNeg(Fe & r, Fe const & a)
+{
+   Fe zero = {{ 0, 0, 0, 0 }};
+   feSub(r, zero, a);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+// 512 bit product t, reduced with 2^256 = C mod p
+void feReduce(Fe & r, uint64_t const * t)
+{
+   Acc acc;
+   uint64_t s[4];
+   for (unsigned i = 0; i < 4; i++)
+   {
+      acc.add(t[i]);
+      acc.mulAdd(t[i + 4], FE_C);
+      s[i] = acc.extract();
+   }
+
+   //what's left is < 2^34, fold it once more
+   uint64_t hi;
+   uint64_t lo = mulWide(acc.c0, FE_C, &hi);
+
+   s[0] += lo;
+   uint64_t carry = (s[0] < lo);
+   uint64_t add1 = hi + carry;
+   s[1] += add1;
+   carry = (s[1] < add1);
+   s[2] += carry;
+   carry = (s[2] < carry);
+   s[3] += carry;
+   carry = (s[3] < carry);
+
+   memcpy(r.n, s, sizeof(s));
+   if (carry || feGeP(r))
+      feAddC(r);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+void feMul(Fe & r, Fe const & a, Fe const & b)
+{
+   uint64_t t[8];
+   Acc acc;
+
+   for (unsigned k = 0; k < 7; k++)
+   {
+      unsigned iMin = (k < 4 ? 0 : k - 3);
+      unsigned iMax = (k < 4 ? k : 3);
+      for (unsigned i = iMin; i <= iMax; i++)
+         acc.mulAdd(a.n[i], b.n[k - i]);
+      t[k] = acc.extract();
+   }
+   t[7] = acc.extract();
+
+   feReduce(r, t);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+inline void feSqr(Fe & r, Fe const & a)
+{
+   feMul(r, a, a);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+inline void feSqrN(Fe & r, Fe const & a, unsigned n)
+{
+   r = a;
+   for (unsigned i = 0; i < n; i++)
+      feSqr(r, r);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+// a^(p-2). The exponent is 223 ones, a zero, 22 ones, then 0000101101; the
+// chain builds runs of ones and shifts them into place
+void feInv(Fe & r, Fe const & a)
+{
+   Fe x2, x3, x6, x9, x11, x22, x44, x88, x176, x220, x223, t;
+
+   feSqr(x2, a);          feMul(x2, x2, a);
+   feSqr(x3, x2);         feMul(x3, x3, a);
+   feSqrN(x6, x3, 3);     feMul(x6, x6, x3);
+   feSqrN(x9, x6, 3);     feMul(x9, x9, x3);
+   feSqrN(x11, x9, 2);    feMul(x11, x11, x2);
+   feSqrN(x22, x11, 11);  feMul(x22, x22, x11);
+   feSqrN(x44, x22, 22);  feMul(x44, x44, x22);
+   feSqrN(x88, x44, 44);  feMul(x88, x88, x44);
+   feSqrN(x176, x88, 88); feMul(x176, x176, x88);
+   feSqrN(x220, x176, 44);feMul(x220, x220, x44);
+   feSqrN(x223, x220, 3); feMul(x223, x223, x3);
+
+   feSqrN(t, x223, 23);   feMul(t, t, x22);
+   feSqrN(t, t, 5);       feMul(t, t, a);
+   feSqrN(t, t, 3);       feMul(t, t, x2);
+   feSqrN(t, t, 2);       feMul(r, t, a);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+// Points
+struct AffinePoint
+{
+   Fe x, y;
+   bool infinity;
+};
+
+struct JacobianPoint
+{
+   Fe x, y, z;
+   bool infinity;
+};
+
+const AffinePoint G_AFFINE =
+{
+   {{ 0x59F2815B16F81798ULL, 0x029BFCDB2DCE28D9ULL,
+      0x55A06295CE870B07ULL, 0x79BE667EF9DCBBACULL }},
+   {{ 0x9C47D08FFB10D4B8ULL, 0xFD17B448A6855419ULL,
+      0x5DA4FBFC0E1108A8ULL, 0x483ADA7726A3C465ULL }},
+   false
+};
+
+////////////////////////////////////////////////////////////////////////////////
+inline void setInfinity(JacobianPoint & r)
+{
+   memset(&r, 0, sizeof(r));
+   r.infinity = true;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+inline void fromAffine(JacobianPoint & r, AffinePoint const & a)
+{
+   r.x = a.x;
+   r.y = a.y;
+   feSetInt(r.z, 1);
+   r.infinity = a.infinity;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+// dbl-2009-l (a = 0)
+void pointDouble(JacobianPoint & r, JacobianPoint const & p)
+{
+   if (p.infinity || feIsZero(p.y))
+   {
+      setInfinity(r);
+      return;
+   }
+
+   Fe A, B, C, D, E, F, t;
+   feSqr(A, p.x);
+   feSqr(B, p.y);
+   feSqr(C, B);
+
+   feAdd(t, p.x, B);
+   feSqr(t, t);
+   feSub(t, t, A);
+   feSub(t, t, C);
+   feAdd(D, t, t);
+
+   feAdd(E, A, A);
+   feAdd(E, E, A);
+   feSqr(F, E);
+
+   //Z3 first, p and r may alias
+   Fe z3;
+   feMul(z3, p.y, p.z);
+   feAdd(z3, z3, z3);
+
+   Fe x3;
+   feSub(x3, F, D);
+   feSub(x3, x3, D);
+
+   Fe y3, c8;
+   feSub(y3, D, x3);
+   feMul(y3, E, y3);
+   feAdd(c8, C, C);
+   feAdd(c8, c8, c8);
+   feAdd(c8, c8, c8);
+   feSub(y3, y3, c8);
+
+   r.x = x3;
+   r.y = y3;
+   r.z = z3;
+   r.infinity = false;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+// Jacobian + affine
+void pointAddMixed(JacobianPoint & r, JacobianPoint const & p,
+                   AffinePoint const & q)
+{
+   if (q.infinity)
+   {
+      r = p;
+      return;
+   }
+
+   if (p.infinity)
+   {
+      fromAffine(r, q);
+      return;
+   }
+
+   Fe z1z1, u2, s2, h, rr;
+   feSqr(z1z1, p.z);
+   feMul(u2, q.x, z1z1);
+   feMul(s2, q.y, p.z);
+   feMul(s2, s2, z1z1);
+   feSub(h, u2, p.x);
+   feSub(rr, s2, p.y);
+
+   if (feIsZero(h))
+   {
+      if (feIsZero(rr))
+         pointDouble(r, p);
+      else
+         setInfinity(r);
+      return;
+   }
+
+   Fe hh, hhh, v, x3, y3, z3, t;
+   feSqr(hh, h);
+   feMul(hhh, h, hh);
+   feMul(v, p.x, hh);
+
+   feSqr(x3, rr);
+   feSub(x3, x3, hhh);
+   feSub(x3, x3, v);
+   feSub(x3, x3, v);
+
+   feSub(y3, v, x3);
+   feMul(y3, rr, y3);
+   feMul(t, p.y, hhh);
+   feSub(y3, y3, t);
+
+   feMul(z3, p.z, h);
+
+   r.x = x3;
+   r.y = y3;
+   r.z = z3;
+   r.infinity = false;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+// Jacobian + Jacobian
+void pointAdd(JacobianPoint & r, JacobianPoint const & p,
+              JacobianPoint const & q)
+{
+   if (q.infinity)
+   {
+      r = p;
+      return;
+   }
+
+   if (p.infinity)
+   {
+      r = q;
+      return;
+   }
+
+   Fe z1z1, z2z2, u1, u2, s1, s2, h, rr;
+   feSqr(z1z1, p.z);
+   feSqr(z2z2, q.z);
+   feMul(u1, p.x, z2z2);
+   feMul(u2, q.x, z1z1);
+   feMul(s1, p.y, q.z);
+   feMul(s1, s1, z2z2);
+   feMul(s2, q.y, p.z);
+   feMul(s2, s2, z1z1);
+   feSub(h, u2, u1);
+   feSub(rr, s2, s1);
+
+   if (feIsZero(h))
+   {
+      if (feIsZero(rr))
+         pointDouble(r, p);
+      else
+         setInfinity(r);
+      return;
+   }
+
+   Fe hh, hhh, v, x3, y3, z3, t;
+   feSqr(hh, h);
+   feMul(hhh, h, hh);
+   feMul(v, u1, hh);
+
+   feSqr(x3, rr);
+   feSub(x3, x3, hhh);
+   feSub(x3, x3, v);
+   feSub(x3, x3, v);
+
+   feSub(y3, v, x3);
+   feMul(y3, rr, y3);
+   feMul(t, s1, hhh);
+   feSub(y3, y3, t);
+
+   feMul(z3, p.z, q.z);
+   feMul(z3, z3, h);
+
+   r.x = x3;
+   r.y = y3;
+   r.z = z3;
+   r.infinity = false;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+// Montgomery's trick: one inversion for the whole batch
+void toAffineBatch(JacobianPoint const * in, AffinePoint* out, size_t count)
+{
+   vector<Fe> prefix(count);
+   Fe acc;
+   feSetInt(acc, 1);
+
+   for (size_t i = 0; i < count; i++)
+   {
+      prefix[i] = acc;
+      if (!in[i].infinity)
+         feMul(acc, acc, in[i].z);
+   }
+
+   Fe inv;
+   feInv(inv, acc);
+
+   for (size_t i = count; i-- > 0;)
+   {
+      if (in[i].infinity)
+      {
+         memset(&out[i], 0, sizeof(AffinePoint));
+         out[i].infinity = true;
+         continue;
+      }
+
+      //inv holds 1/(z_0*...*z_i) here
+      Fe zInv, zInv2, zInv3;
+      feMul(zInv, inv, prefix[i]);
+      feMul(inv, inv, in[i].z);
+
+      feSqr(zInv2, zInv);
+      feMul(zInv3, zInv2, zInv);
+      feMul(out[i].x, in[i].x, zInv2);
+      feMul(out[i].y, in[i].y, zInv3);
+      out[i].infinity = false;
+   }
+}
+
+////////////////////////////////////////////////////////////////////////////////
+inline void toAffine(JacobianPoint const & in, AffinePoint & out)
+{
+   toAffineBatch(&in, &out, 1);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+// Scalars, 32 bytes big endian to 4 little endian limbs
+void scalarFromBytes(uint64_t* k, uint8_t const * b32)
+{
+   for (unsigned i = 0; i < 4; i++)
+   {
+      uint64_t limb = 0;
+      for (unsigned j = 0; j < 8; j++)
+         limb = (limb << 8) | b32[(3 - i) * 8 + j];
+      k[i] = limb;
+   }
+}
+
+////////////////////////////////////////////////////////////////////////////////
+// Fixed base tables: row i holds j*16^i*P for j in 1..15
+const unsigned FB_TABLE_ROWS = 64;
+const unsigned FB_TABLE_COLS = 15;
+const unsigned FB_TABLE_SIZE = FB_TABLE_ROWS * FB_TABLE_COLS;
+
+//building a table costs about as much as 8 wNAF multiplications
+const size_t FB_TABLE_MIN_USES = 16;
+
+////////////////////////////////////////////////////////////////////////////////
+void buildFixedBaseTable(vector<AffinePoint> & table, AffinePoint const & p)
+{
+   vector<JacobianPoint> jac(FB_TABLE_SIZE);
+   JacobianPoint base;
+   fromAffine(base, p);
+
+   for (unsigned i = 0; i < FB_TABLE_ROWS; i++)
+   {
+      JacobianPoint* row = &jac[i * FB_TABLE_COLS];
+      row[0] = base;
+      for (unsigned j = 1; j < FB_TABLE_COLS; j++)
+         pointAdd(row[j], row[j - 1], base);
+
+      //16 * base for the next window
+      pointAdd(base, row[FB_TABLE_COLS - 1], base);
+   }
+
+   table.resize(jac.size());
+   toAffineBatch(&jac[0], &table[0], jac.size());
+}
+
+////////////////////////////////////////////////////////////////////////////////
+void multiplyFixedBase(JacobianPoint & r, AffinePoint const * table,
+                       uint64_t const * k)
+{
+   setInfinity(r);
+
+   for (unsigned i = 0; i < FB_TABLE_ROWS; i++)
+   {
+      unsigned nibble = (unsigned)(k[i / 16] >> (4 * (i % 16))) & 0x0F;
+      if (nibble != 0)
+         pointAddMixed(r, r, table[i * FB_TABLE_COLS + nibble - 1]);
+   }
+}
+
+////////////////////////////////////////////////////////////////////////////////
+vector<AffinePoint> gTable_;
+once_flag gTableFlag_;
+
+void buildGTable(void)
+{
+   buildFixedBaseTable(gTable_, G_AFFINE);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+void multiplyG(JacobianPoint & r, uint64_t const * k)
+{
+   call_once(gTableFlag_, buildGTable);
+   multiplyFixedBase(r, &gTable_[0], k);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+// Width 5 NAF: digits are 0 or odd in [-15, 15], at most one non zero digit
+// in any 5 consecutive ones. Returns the digit count.
+const int WNAF_WINDOW = 5;
+const unsigned WNAF_TABLE_SIZE = 1 << (WNAF_WINDOW - 2);
+
+unsigned scalarToWnaf(int* wnaf, uint64_t const * k)
+{
+   //one extra limb, k + 15 can carry past 256 bits
+   uint64_t n[5] = { k[0], k[1], k[2], k[3], 0 };
+   unsigned len = 0;
+
+   while ((n[0] | n[1] | n[2] | n[3] | n[4]) != 0)
+   {
+      int digit = 0;
+      if (n[0] & 1)
+      {
+         digit = (int)(n[0] & ((1 << WNAF_WINDOW) - 1));
+         if (digit >= (1 << (WNAF_WINDOW - 1)))
+            digit -= (1 << WNAF_WINDOW);
+
+         if (digit > 0)
+         {
+            //low bits equal digit, no borrow
+            n[0] -= (uint64_t)digit;
+         }
+         else
+         {
+            uint64_t carry = (uint64_t)(-digit);
+            for (unsigned i = 0; i < 5 && carry; i++)
+            {
+               n[i] += carry;
+               carry = (n[i] < carry);
+            }
+         }
+      }
+
+      wnaf[len++] = digit;
+
+      for (unsigned i = 0; i < 4; i++)
+         n[i] = (n[i] >> 1) | (n[i + 1] << 63);
+      n[4] >>= 1;
+   }
+
+   return len;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+void multiplyPointWnaf(JacobianPoint & r, AffinePoint const & p,
+                       uint64_t const * k)
+{
+   //odd multiples P, 3P, ... 15P, batch converted to affine
+   JacobianPoint jacTable[WNAF_TABLE_SIZE];
+   AffinePoint table[WNAF_TABLE_SIZE];
+   JacobianPoint p2;
+
+   fromAffine(jacTable[0], p);
+   pointDouble(p2, jacTable[0]);
+   for (unsigned i = 1; i < WNAF_TABLE_SIZE; i++)
+      pointAdd(jacTable[i], jacTable[i - 1], p2);
+   toAffineBatch(jacTable, table, WNAF_TABLE_SIZE);
+
+   int wnaf[258];
+   unsigned len = scalarToWnaf(wnaf, k);
+
+   setInfinity(r);
+   for (unsigned i = len; i-- > 0;)
+   {
+      pointDouble(r, r);
+
+      int digit = wnaf[i];
+      if (digit > 0)
+      {
+         pointAddMixed(r, r, table[(digit - 1) / 2]);
+      }
+      else if (digit < 0)
+      {
+         AffinePoint neg = table[(-digit - 1) / 2];
+         feNeg(neg.y, neg.y);
+         pointAddMixed(r, r, neg);
+      }
+   }
+}
+
+////////////////////////////////////////////////////////////////////////////////
+bool parsePoint(AffinePoint & p, uint8_t const * pubKey65)
+{
+   if (!feFromBytes(p.x, pubKey65 + 1) || !feFromBytes(p.y, pubKey65 + 33))
+      return false;
+
+   //y^2 == x^3 + 7
+   Fe lhs, rhs, seven;
+   feSqr(lhs, p.y);
+   feSqr(rhs, p.x);
+   feMul(rhs, rhs, p.x);
+   feSetInt(seven, 7);
+   feAdd(rhs, rhs, seven);
+
+   p.infinity = false;
+   return feEqual(lhs, rhs);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+void serializePoint(uint8_t* pubKey65, JacobianPoint const & p)
+{
+   AffinePoint a;
+   toAffine(p, a);
+
+   pubKey65[0] = 0x04;
+   if (a.infinity)
+   {
+      memset(pubKey65 + 1, 0, 64);
+      return;
+   }
+
+   feToBytes(pubKey65 + 1, a.x);
+   feToBytes(pubKey65 + 33, a.y);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+// group order n, big endian
+const uint8_t ORDER_BE[32] =
+{
+   0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF,
+   0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFE,
+   0xBA, 0xAE, 0xDC, 0xE6, 0xAF, 0x48, 0xA0, 0x3B,
+   0xBF, 0xD2, 0x5E, 0x8C, 0xD0, 0x36, 0x41, 0x41
+};
+
+////////////////////////////////////////////////////////////////////////////////
+// Verification scalars for a run of signatures: range checks on r and s, then
+// u1 = e/s and u2 = r/s mod n. All the s values are inverted with a single
+// InverseMod (prefix products), the rest of the mod n math stays on Crypto++,
+// it's a small part of the cost.
+void computeVerifyScalars(Secp256k1::VerifyItem const * items, size_t count,
+                          uint64_t (*u1)[4], uint64_t (*u2)[4], bool* valid)
+{
+   CryptoPP::Integer n(ORDER_BE, 32);
+   vector<CryptoPP::Integer> prefix(count + 1);
+   prefix[0] = CryptoPP::Integer::One();
+
+   for (size_t i = 0; i < count; i++)
+   {
+      CryptoPP::Integer r(items[i].sigRS64, 32);
+      CryptoPP::Integer s(items[i].sigRS64 + 32, 32);
+
+      valid[i] = (r >= CryptoPP::Integer::One() && r < n &&
+                  s >= CryptoPP::Integer::One() && s < n);
+
+      //invalid entries contribute 1 to the product
+      if (valid[i])
+         prefix[i + 1] = a_times_b_mod_c(prefix[i], s, n);
+      else
+         prefix[i + 1] = prefix[i];
+   }
+
+   CryptoPP::Integer inv = prefix[count].InverseMod(n);
+
+   for (size_t i = count; i-- > 0;)
+   {
+      if (!valid[i])
+         continue;
+
+      CryptoPP::Integer s(items[i].sigRS64 + 32, 32);
+      CryptoPP::Integer w = a_times_b_mod_c(inv, prefix[i], n);
+      inv = a_times_b_mod_c(inv, s, n);
+
+      CryptoPP::Integer r(items[i].sigRS64, 32);
+      CryptoPP::Integer e(items[i].hash32, 32);
+
+      uint8_t uBE[32];
+      a_times_b_mod_c(e, w, n).Encode(uBE, 32);
+      scalarFromBytes(u1[i], uBE);
+      a_times_b_mod_c(r, w, n).Encode(uBE, 32);
+      scalarFromBytes(u2[i], uBE);
+   }
+}
+
+////////////////////////////////////////////////////////////////////////////////
+// R = u1*G + u2*Q, then R.x mod n == r, checked projectively: X == r*Z^2, or
+// (r+n)*Z^2 when r+n is still below p. qTable is Q's fixed base table or NULL.
+bool verifyWithScalars(AffinePoint const & q, AffinePoint const * qTable,
+                       uint64_t const * u1, uint64_t const * u2,
+                       uint8_t const * r32)
+{
+   JacobianPoint R, Q2;
+   multiplyG(R, u1);
+   if (qTable != NULL)
+      multiplyFixedBase(Q2, qTable, u2);
+   else
+      multiplyPointWnaf(Q2, q, u2);
+   pointAdd(R, R, Q2);
+
+   if (R.infinity)
+      return false;
+
+   Fe rFe, zz, t;
+   feFromBytes(rFe, r32);
+   feSqr(zz, R.z);
+   feMul(t, rFe, zz);
+   if (feEqual(t, R.x))
+      return true;
+
+   //r + n
+   uint64_t n[4];
+   scalarFromBytes(n, ORDER_BE);
+   uint64_t carry = 0;
+   for (unsigned i = 0; i < 4; i++)
+   {
+      uint64_t sum = rFe.n[i] + carry;
+      carry = (sum < carry);
+      rFe.n[i] = sum + n[i];
+      carry += (rFe.n[i] < sum);
+   }
+
+   if (carry != 0 || feGeP(rFe))
+      return false;
+
+   feMul(t, rFe, zz);
+   return feEqual(t, R.x);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+// Runs job(0) .. job(nJobs-1) over nThreads threads, the calling thread
+// included. Jobs are handed out one at a time off a shared counter.
+template <typename JOB>
+void runJobs(size_t nJobs, unsigned nThreads, JOB const & job)
+{
+   atomic<size_t> next(0);
+   auto worker = [&](void)->void
+   {
+      size_t i;
+      while ((i = next.fetch_add(1)) < nJobs)
+         job(i);
+   };
+
+   if (nThreads > nJobs)
+      nThreads = (unsigned)nJobs;
+
+   vector<thread> workers;
+   for (unsigned i = 1; i < nThreads; i++)
+      workers.push_back(thread(worker));
+
+   worker();
+
+   for (auto& t : workers)
+      t.join();
+}
+
+//signatures per batch inversion and per job
+const size_t VERIFY_CHUNK_SIZE = 64;
+
+} //namespace
+
+
+////////////////////////////////////////////////////////////////////////////////
+void Secp256k1::computePublicKey(uint8_t const * privKey32, uint8_t* pubKey65)
+{
+   uint64_t k[4];
+   scalarFromBytes(k, privKey32);
+
+   JacobianPoint r;
+   multiplyG(r, k);
+   serializePoint(pubKey65, r);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+bool Secp256k1::multiplyPoint(uint8_t const * scalar32,
+                              uint8_t const * pubKey65,
+                              uint8_t*        result65)
+{
+   AffinePoint p;
+   if (!parsePoint(p, pubKey65))
+      return false;
+
+   uint64_t k[4];
+   scalarFromBytes(k, scalar32);
+
+   JacobianPoint r;
+   multiplyPointWnaf(r, p, k);
+   serializePoint(result65, r);
+   return true;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+bool Secp256k1::computeChainedPublicKeys(uint8_t const * pubKey65,
+                                         uint8_t const * chainCode32,
+                                         size_t          count,
+                                         uint8_t*        pubKeysOut,
+                                         uint8_t*        multipliersOut)
+{
+   AffinePoint root;
+   if (!parsePoint(root, pubKey65))
+      return false;
+
+   //key i is M_i*root, M_i being the product of the first i multipliers
+   //mod n. Every step multiplies the same base, so long walks build a 
+   //fixed base table for the root once and skip all the doublings
+   vector<AffinePoint> table;
+   bool useTable = (count >= FB_TABLE_MIN_USES);
+   if (useTable)
+      buildFixedBaseTable(table, root);
+
+   CryptoPP::Integer n(ORDER_BE, 32);
+   CryptoPP::Integer M = CryptoPP::Integer::One();
+
+   uint8_t const * prevKey = pubKey65;
+   for (size_t i = 0; i < count; i++)
+   {
+      uint8_t mult[32];
+      BtcUtils::getHash256_Batch(prevKey, 65, 1, mult);
+      for (unsigned j = 0; j < 32; j++)
+         mult[j] ^= chainCode32[j];
+      if (multipliersOut != NULL)
+         memcpy(multipliersOut + 32 * i, mult, 32);
+
+      M = a_times_b_mod_c(M, CryptoPP::Integer(mult, 32), n);
+
+      uint8_t mBE[32];
+      M.Encode(mBE, 32);
+      uint64_t k[4];
+      scalarFromBytes(k, mBE);
+
+      JacobianPoint r;
+      if (useTable)
+         multiplyFixedBase(r, &table[0], k);
+      else
+         multiplyPointWnaf(r, root, k);
+
+      uint8_t* key = pubKeysOut + 65 * i;
+      serializePoint(key, r);
+      prevKey = key;
+   }
+
+   return true;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+bool Secp256k1::isValidPoint(uint8_t const * pubKey65)
+{
+   AffinePoint p;
+   return parsePoint(p, pubKey65);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+bool Secp256k1::verify(uint8_t const * hash32,
+                       uint8_t const * sigRS64,
+                       uint8_t const * pubKey65)
+{
+   AffinePoint q;
+   if (!parsePoint(q, pubKey65))
+      return false;
+
+   VerifyItem item = { hash32, sigRS64, pubKey65 };
+   uint64_t u1[1][4], u2[1][4];
+   bool valid;
+   computeVerifyScalars(&item, 1, u1, u2, &valid);
+   if (!valid)
+      return false;
+
+   return verifyWithScalars(q, NULL, u1[0], u2[0], sigRS64);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+void Secp256k1::verifyBatch(VerifyItem const * items,
+                            size_t            count,
+                            bool*             results,
+                            unsigned          nThreads)
+{
+   if (count == 0)
+      return;
+
+   if (nThreads == 0)
+      nThreads = thread::hardware_concurrency();
+   if (nThreads == 0)
+      nThreads = 1;
+
+   //parse every distinct public key once
+   struct BatchKey
+   {
+      AffinePoint point;
+      bool valid;
+      size_t uses;
+      vector<AffinePoint> table;
+   };
+
+   map<BinaryData, size_t> keyIndex;
+   vector<BatchKey> keys;
+   vector<size_t> itemKey(count);
+
+   for (size_t i = 0; i < count; i++)
+   {
+      BinaryData pubKey(items[i].pubKey65, 65);
+      auto keyIter = keyIndex.find(pubKey);
+      if (keyIter == keyIndex.end())
+      {
+         keyIter = keyIndex.insert(make_pair(pubKey, keys.size())).first;
+         keys.push_back(BatchKey());
+         keys.back().valid = parsePoint(keys.back().point, items[i].pubKey65);
+         keys.back().uses = 0;
+      }
+
+      itemKey[i] = keyIter->second;
+      keys[keyIter->second].uses++;
+   }
+
+   //keys signing often enough get their own fixed base table
+   vector<size_t> tableKeys;
+   for (size_t i = 0; i < keys.size(); i++)
+   {
+      if (keys[i].valid && keys[i].uses >= FB_TABLE_MIN_USES)
+         tableKeys.push_back(i);
+   }
+
+   //the G table is shared, get it built before the workers need it
+   call_once(gTableFlag_, buildGTable);
+
+   runJobs(tableKeys.size(), nThreads, [&](size_t i)->void
+   {
+      BatchKey& key = keys[tableKeys[i]];
+      buildFixedBaseTable(key.table, key.point);
+   });
+
+   size_t nChunks = (count + VERIFY_CHUNK_SIZE - 1) / VERIFY_CHUNK_SIZE;
+   runJobs(nChunks, nThreads, [&](size_t chunk)->void
+   {
+      size_t start = chunk * VERIFY_CHUNK_SIZE;
+      size_t len = min(VERIFY_CHUNK_SIZE, count - start);
+
+      uint64_t u1[VERIFY_CHUNK_SIZE][4], u2[VERIFY_CHUNK_SIZE][4];
+      bool valid[VERIFY_CHUNK_SIZE];
+      computeVerifyScalars(items + start, len, u1, u2, valid);
+
+      for (size_t i = 0; i < len; i++)
+      {
+         BatchKey const & key = keys[itemKey[start + i]];
+         if (!valid[i] || !key.valid)
+         {
+            results[start + i] = false;
+            continue;
+         }
+
+         AffinePoint const * table = NULL;
+         if (!key.table.empty())
+            table = &key.table[0];
+
+         results[start + i] = verifyWithScalars(key.point, table, 
+            u1[i], u2[i], items[start + i].sigRS64);
+      }
+   });
+}
@@ -0,0 +1,91 @@
+////////////////////////////////////////////////////////////////////////////////
+//                                                                            //
+//  Copyright (C) 2011-2015, Armory Technologies, Inc.                        //
+//  Distributed under the GNU Affero General Public License (AGPL v3)         //
+//  See LICENSE or http://www.gnu.org/licenses/agpl.html                      //
+//                                                                            //
+////////////////////////////////////////////////////////////////////////////////
+
+#ifndef _SECP256K1_H_
+#define _SECP256K1_H_
+
+#include <stdint.h>
+#include <stddef.h>
+
+////////////////////////////////////////////////////////////////////////////////
+// Dedicated secp256k1 arithmetic for the hot CryptoECDSA paths (public key
+// computation, chained key derivation, point multiplication, verification).
+// Crypto++ goes through its generic Integer/ECP code and rebuilds the curve
+// for every call; this works on fixed 4x64 bit field elements instead:
+//
+//  - points are kept in Jacobian coordinates, and converted back to affine
+//    in batches sharing a single field inversion
+//  - k*G walks a table of precomputed multiples of G (64 rows of 15 points,
+//    one row per 4 bit window of k), so it costs no doublings at all
+//  - k*P for arbitrary P uses a width 5 NAF of k over the odd multiples of P
+//
+// All methods take and return the same serializations CryptoECDSA uses:
+// 32 byte big endian scalars and 65 byte uncompressed points (04|X|Y). The
+// point at infinity serializes as 04 followed by zeros, as Crypto++ does.
+//
+// None of this is constant time, same as the Crypto++ code it stands in for.
+class Secp256k1
+{
+public:
+   /////////////////////////////////////////////////////////////////////////////
+   // One signature check for verifyBatch, same layout as verify's arguments
+   struct VerifyItem
+   {
+      uint8_t const * hash32;
+      uint8_t const * sigRS64;
+      uint8_t const * pubKey65;
+   };
+
+   /////////////////////////////////////////////////////////////////////////////
+   // privKey * G
+   static void computePublicKey(uint8_t const * privKey32, uint8_t* pubKey65);
+
+   /////////////////////////////////////////////////////////////////////////////
+   // scalar * point. Returns false without touching the output if the point
+   // is not on the curve, so callers can fall back to Crypto++ behavior.
+   static bool multiplyPoint(uint8_t const * scalar32,
+                             uint8_t const * pubKey65,
+                             uint8_t*        result65);
+
+   /////////////////////////////////////////////////////////////////////////////
+   // Walks count steps of the Armory public key chain starting at pubKey65:
+   // each step multiplies the previous key by chainCode ^ hash256(previous 
+   // key). Keys are written back to back in pubKeysOut (65*count bytes), the
+   // multipliers in multipliersOut (32*count bytes) if set.
+   // Returns false if the root key is not on the curve.
+   static bool computeChainedPublicKeys(uint8_t const * pubKey65,
+                                        uint8_t const * chainCode32,
+                                        size_t          count,
+                                        uint8_t*        pubKeysOut,
+                                        uint8_t*        multipliersOut=NULL);
+
+   /////////////////////////////////////////////////////////////////////////////
+   // ECDSA verification of a raw r|s signature against an already hashed
+   // message (the integer e, 32 bytes big endian). A public key that is not
+   // on the curve fails verification.
+   static bool verify(uint8_t const * hash32,
+                      uint8_t const * sigRS64,
+                      uint8_t const * pubKey65);
+
+   /////////////////////////////////////////////////////////////////////////////
+   // Verifies count signatures, results[i] gets items[i]'s outcome. Each 
+   // distinct public key is parsed once, and keys used often enough in the
+   // batch get a fixed base table like G's. Signatures are processed in 
+   // chunks sharing one mod n inversion, spread over nThreads threads 
+   // (0 for one per core).
+   static void verifyBatch(VerifyItem const * items,
+                           size_t             count,
+                           bool*              results,
+                           unsigned           nThreads = 0);
+
+   /////////////////////////////////////////////////////////////////////////////
+   // Checks 04|X|Y is a point on the curve, with X and Y below the field prime
+   static bool isValidPoint(uint8_t const * pubKey65);
+};
+
+#endif
@@ -0,0 +1,241 @@
+////////////////////////////////////////////////////////////////////////////////
+//                                                                            //
+//  Copyright (C) 2011-2015, Armory Technologies, Inc.                        //
+//  Distributed under the GNU Affero General Public License (AGPL v3)         //
+//  See LICENSE or http://www.gnu.org/licenses/agpl.html                      //
+//                                                                            //
+////////////////////////////////////////////////////////////////////////////////
+
+#include <string.h>
+#include <mutex>
+#include <atomic>
+
+#include "SecureAllocator.h"
+
+#if defined(_MSC_VER) || defined(__MINGW32__)
+   #include <windows.h>
+#else
+   #include <sys/mman.h>
+#endif
+
+using namespace std;
+
+namespace
+{
+
+////////////////////////////////////////////////////////////////////////////////
+// Size classes 16, 32 ... 4096 bytes
+const size_t   MIN_CLASS_BYTES  = 16;
+const unsigned NUM_SIZE_CLASSES = 9;
+const size_t   MAX_CLASS_BYTES  = MIN_CLASS_BYTES << (NUM_SIZE_CLASSES - 1);
+const size_t   SLAB_BYTES       = 64 * 1024;
+
+struct FreeChunk
+{
+   FreeChunk* next;
+};
+
+struct SizeClass
+{
+   mutex      lock;
+   FreeChunk* freeList;
+};
+
+struct PoolState
+{
+   SizeClass classes[NUM_SIZE_CLASSES];
+
+   atomic<size_t> bytesInUse;
+   atomic<size_t> bytesMapped;
+   atomic<size_t> lockFailures;
+};
+
+////////////////////////////////////////////////////////////////////////////////
+// Created on first use and never deleted: SecureBinaryData statics may be
+// destroyed after anything we'd register for cleanup
+PoolState* pool_ = NULL;
+once_flag poolFlag_;
+
+void createPool(void)
+{
+   pool_ = new PoolState;
+   for (unsigned i = 0; i < NUM_SIZE_CLASSES; i++)
+      pool_->classes[i].freeList = NULL;
+
+   pool_->bytesInUse.store(0);
+   pool_->bytesMapped.store(0);
+   pool_->lockFailures.store(0);
+}
+
+PoolState& getPool(void)
+{
+   call_once(poolFlag_, createPool);
+   return *pool_;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+void* mapLocked(PoolState& pool, size_t nBytes)
+{
+#if defined(_MSC_VER) || defined(__MINGW32__)
+   void* ptr = VirtualAlloc(NULL, nBytes, MEM_COMMIT | MEM_RESERVE,
+                            PAGE_READWRITE);
+   if (ptr == NULL)
+      throw bad_alloc();
+
+   if (!VirtualLock(ptr, nBytes))
+      pool.lockFailures++;
+#else
+   void* ptr = mmap(NULL, nBytes, PROT_READ | PROT_WRITE,
+                    MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+   if (ptr == MAP_FAILED)
+      throw bad_alloc();
+
+   if (mlock(ptr, nBytes) != 0)
+      pool.lockFailures++;
+
+   #ifdef MADV_DONTDUMP
+   //keep keys out of core dumps too
+   madvise(ptr, nBytes, MADV_DONTDUMP);
+   #endif
+#endif
+
+   pool.bytesMapped += nBytes;
+   return ptr;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+void unmapLocked(PoolState& pool, void* ptr, size_t nBytes)
+{
+#if defined(_MSC_VER) || defined(__MINGW32__)
+   VirtualUnlock(ptr, nBytes);
+   VirtualFree(ptr, 0, MEM_RELEASE);
+#else
+   munlock(ptr, nBytes);
+   munmap(ptr, nBytes);
+#endif
+
+   pool.bytesMapped -= nBytes;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+unsigned getSizeClass(size_t nBytes)
+{
+   unsigned sizeClass = 0;
+   size_t classBytes = MIN_CLASS_BYTES;
+   while (classBytes < nBytes)
+   {
+      classBytes <<= 1;
+      sizeClass++;
+   }
+
+   return sizeClass;
+}
+
+} //namespace
+
+
+////////////////////////////////////////////////////////////////////////////////
+void* SecureMemoryPool::allocate(size_t nBytes)
+{
+   PoolState& pool = getPool();
+
+   if (nBytes > MAX_CLASS_BYTES)
+   {
+      void* ptr = mapLocked(pool, nBytes);
+      pool.bytesInUse += nBytes;
+      return ptr;
+   }
+
+   unsigned sizeClass = getSizeClass(nBytes);
+   size_t chunkBytes = MIN_CLASS_BYTES << sizeClass;
+   SizeClass& sc = pool.classes[sizeClass];
+
+   FreeChunk* chunk;
+   {
+      lock_guard<mutex> lock(sc.lock);
+
+      if (sc.freeList == NULL)
+      {
+         //carve a fresh slab into chunks, mmap hands it out zeroed
+         uint8_t* slab = static_cast<uint8_t*>(mapLocked(pool, SLAB_BYTES));
+         for (size_t offset = SLAB_BYTES; offset > 0; offset -= chunkBytes)
+         {
+            FreeChunk* newChunk =
+               reinterpret_cast<FreeChunk*>(slab + offset - chunkBytes);
+            newChunk->next = sc.freeList;
+            sc.freeList = newChunk;
+         }
+      }
+
+      chunk = sc.freeList;
+      sc.freeList = chunk->next;
+   }
+
+   //the rest of the chunk was wiped when it came back
+   chunk->next = NULL;
+   pool.bytesInUse += chunkBytes;
+   return chunk;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+void SecureMemoryPool::deallocate(void* ptr, size_t nBytes)
+{
+   if (ptr == NULL)
+      return;
+
+   PoolState& pool = getPool();
+
+   if (nBytes > MAX_CLASS_BYTES)
+   {
+      wipe(ptr, nBytes);
+      unmapLocked(pool, ptr, nBytes);
+      pool.bytesInUse -= nBytes;
+      return;
+   }
+
+   unsigned sizeClass = getSizeClass(nBytes);
+   size_t chunkBytes = MIN_CLASS_BYTES << sizeClass;
+   SizeClass& sc = pool.classes[sizeClass];
+
+   wipe(ptr, chunkBytes);
+
+   FreeChunk* chunk = static_cast<FreeChunk*>(ptr);
+   {
+      lock_guard<mutex> lock(sc.lock);
+      chunk->next = sc.freeList;
+      sc.freeList = chunk;
+   }
+
+   pool.bytesInUse -= chunkBytes;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+void SecureMemoryPool::wipe(void* ptr, size_t nBytes)
+{
+#if defined(_MSC_VER)
+   SecureZeroMemory(ptr, nBytes);
+#else
+   memset(ptr, 0, nBytes);
+
+   //the memset is a dead store as far as the optimizer can tell
+   __asm__ __volatile__("" : : "r"(ptr) : "memory");
+#endif
+}
+
+////////////////////////////////////////////////////////////////////////////////
+size_t SecureMemoryPool::getBytesInUse(void)
+{
+   return getPool().bytesInUse.load();
+}
+
+////////////////////////////////////////////////////////////////////////////////
+size_t SecureMemoryPool::getBytesMapped(void)
+{
+   return getPool().bytesMapped.load();
+}
+
+////////////////////////////////////////////////////////////////////////////////
+size_t SecureMemoryPool::getLockFailures(void)
+{
+   return getPool().lockFailures.load();
+}
@@ -0,0 +1,116 @@
+////////////////////////////////////////////////////////////////////////////////
+//                                                                            //
+//  Copyright (C) 2011-2015, Armory Technologies, Inc.                        //
+//  Distributed under the GNU Affero General Public License (AGPL v3)         //
+//  See LICENSE or http://www.gnu.org/licenses/agpl.html                      //
+//                                                                            //
+////////////////////////////////////////////////////////////////////////////////
+
+#ifndef _SECURE_ALLOCATOR_H_
+#define _SECURE_ALLOCATOR_H_
+
+#include <stdint.h>
+#include <stddef.h>
+#include <new>
+#include <utility>
+
+////////////////////////////////////////////////////////////////////////////////
+// Page locked memory for keying material (SecureBinaryData).
+//
+// Requests up to 4kB are served from size classes (16, 32 ... 4096 bytes)
+// carved out of 64kB slabs, which are locked once when they are mapped and
+// never handed back to the OS. Bigger requests get their own locked mapping.
+// Everything is zeroed on the way back in, so nothing freed from here ever
+// leaves key material lying around in the regular heap or in swap.
+//
+// Locking can fail (RLIMIT_MEMLOCK), in which case the memory is still
+// handed out, same as the mlock calls this replaces. getLockFailures()
+// counts those.
+class SecureMemoryPool
+{
+public:
+   static void* allocate(size_t nBytes);
+   static void  deallocate(void* ptr, size_t nBytes);
+
+   // memset that the optimizer can't drop
+   static void wipe(void* ptr, size_t nBytes);
+
+   static size_t getBytesInUse(void);
+   static size_t getBytesMapped(void);
+   static size_t getLockFailures(void);
+};
+
+////////////////////////////////////////////////////////////////////////////////
+// Allocator behind BinaryData's storage: the regular heap by default, the
+// SecureMemoryPool when constructed with secure=true. The flag stays with
+// the buffer, so assigning a regular BinaryData into a SecureBinaryData
+// copies the bytes into locked memory rather than taking over the heap
+// buffer.
+template <typename T>
+class BinaryDataAllocator
+{
+public:
+   typedef T           value_type;
+   typedef T*          pointer;
+   typedef T const *   const_pointer;
+   typedef T&          reference;
+   typedef T const &   const_reference;
+   typedef size_t      size_type;
+   typedef ptrdiff_t   difference_type;
+
+   template <typename U> struct rebind { typedef BinaryDataAllocator<U> other; };
+
+   BinaryDataAllocator(void) : secure_(false) {}
+   explicit BinaryDataAllocator(bool secure) : secure_(secure) {}
+
+   template <typename U>
+   BinaryDataAllocator(BinaryDataAllocator<U> const & other) :
+      secure_(other.isSecure()) {}
+
+   T* allocate(size_t n, void const * = NULL)
+   {
+      if (secure_)
+         return static_cast<T*>(SecureMemoryPool::allocate(n * sizeof(T)));
+      return static_cast<T*>(::operator new(n * sizeof(T)));
+   }
+
+   void deallocate(T* ptr, size_t n)
+   {
+      if (secure_)
+         SecureMemoryPool::deallocate(ptr, n * sizeof(T));
+      else
+         ::operator delete(ptr);
+   }
+
+   size_t max_size(void) const { return size_t(-1) / sizeof(T); }
+
+   template <typename U, typename... Args>
+   void construct(U* ptr, Args&&... args)
+   {
+      ::new((void*)ptr) U(std::forward<Args>(args)...);
+   }
+
+   template <typename U>
+   void destroy(U* ptr) { ptr->~U(); }
+
+   bool isSecure(void) const { return secure_; }
+
+private:
+   bool secure_;
+};
+
+template <typename T, typename U>
+inline bool operator==(BinaryDataAllocator<T> const & a,
+                       BinaryDataAllocator<U> const & b)
+{
+   return a.isSecure() == b.isSecure();
+}
+
+template <typename T, typename U>
+inline bool operator!=(BinaryDataAllocator<T> const & a,
+                       BinaryDataAllocator<U> const & b)
+{
+   return !(a == b);
+}
+
+#endif
@@ -0,0 +1,398 @@
+////////////////////////////////////////////////////////////////////////////////
+//                                                                            //
+//  Copyright (C) 2011-2015, Armory Technologies, Inc.                        //
+//  Distributed under the GNU Affero General Public License (AGPL v3)         //
+//  See LICENSE or http://www.gnu.org/licenses/agpl.html                      //
+//                                                                            //
+////////////////////////////////////////////////////////////////////////////////
+
+#include <stdio.h>
+#include <fstream>
+#include <sstream>
+#include <iomanip>
+#include <stdexcept>
+#include <algorithm>
+
+#include "Stats.h"
+#include "log.h"
+
+using namespace std;
+
+namespace
+{
+   struct StatDescriptor
+   {
+      string name_;
+      string help_;
+      string labels_;
+      Stats::StatType type_;
+      StatId id_;
+   };
+
+   struct StatRegistry
+   {
+      mutex mu_;
+      vector<StatDescriptor> stats_;
+      StatId nextSlot_ = 0;
+   };
+
+   //stats register during static initialization, this can't be a global
+   StatRegistry& getRegistry(void)
+   {
+      static StatRegistry registry;
+      return registry;
+   }
+
+   //static storage, zero initialized
+   atomic<uint64_t> statSlots[Stats::SHARD_COUNT][Stats::SLOTS_PER_SHARD];
+
+   ////
+   string withLabels(const string& name, const string& labels,
+      const string& extraLabel = "")
+   {
+      if (labels.size() == 0 && extraLabel.size() == 0)
+         return name;
+
+      string result = name + "{" + labels;
+      if (labels.size() > 0 && extraLabel.size() > 0)
+         result.append(",");
+      result.append(extraLabel);
+      result.append("}");
+      return result;
+   }
+
+   ////
+   string formatSeconds(double seconds)
+   {
+      stringstream ss;
+      ss << setprecision(3);
+      if (seconds < 0.001)
+         ss << seconds * 1000000.0 << " us";
+      else if (seconds < 1.0)
+         ss << seconds * 1000.0 << " ms";
+      else
+         ss << seconds << " s";
+      return ss.str();
+   }
+
+   ////
+   //upper bound of the bucket the q quantile falls in
+   string quantileBound(const Stats::Value& value, double q)
+   {
+      uint64_t target = (uint64_t)(q * value.count_);
+      if (target == 0)
+         target = 1;
+
+      uint64_t cumulated = 0;
+      for (unsigned i = 0; i < value.buckets_.size(); i++)
+      {
+         cumulated += value.buckets_[i];
+         if (cumulated >= target)
+         {
+            if (i == Stats::BUCKET_COUNT - 1)
+               return "> " + formatSeconds(Stats::getBucketBound(i - 1));
+            return "<= " + formatSeconds(Stats::getBucketBound(i));
+         }
+      }
+
+      return "-";
+   }
+}
+
+////////////////////////////////////////////////////////////////////////////////
+StatId Stats::registerCounter(const string& name, const string& help,
+   const string& labels)
+{
+   return registerStat(name, help, labels, StatType_Counter);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+StatId Stats::registerHistogram(const string& name, const string& help,
+   const string& labels)
+{
+   return registerStat(name, help, labels, StatType_Histogram);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+StatId Stats::registerStat(const string& name, const string& help,
+   const string& labels, StatType type)
+{
+   auto& registry = getRegistry();
+   lock_guard<mutex> lock(registry.mu_);
+
+   for (auto& stat : registry.stats_)
+   {
+      if (stat.name_ == name && stat.labels_ == labels)
+      {
+         if (stat.type_ != type)
+            throw runtime_error("stat " + name + " registered twice");
+         return stat.id_;
+      }
+   }
+
+   //counters take one slot, histograms their buckets, a count and a sum
+   StatId slotCount = 1;
+   if (type == StatType_Histogram)
+      slotCount = BUCKET_COUNT + 2;
+
+   if (registry.nextSlot_ + slotCount > SLOTS_PER_SHARD)
+      throw runtime_error("out of stat slots, can't register " + name);
+
+   StatDescriptor stat;
+   stat.name_ = name;
+   stat.help_ = help;
+   stat.labels_ = labels;
+   stat.type_ = type;
+   stat.id_ = registry.nextSlot_;
+   registry.stats_.push_back(stat);
+
+   registry.nextSlot_ += slotCount;
+   return stat.id_;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+atomic<uint64_t>* Stats::getShard(void)
+{
+   //thread ids tend to be aligned addresses, mix the bits before picking
+   uint64_t threadHash =
+      (uint64_t)hash<thread::id>()(this_thread::get_id());
+   threadHash *= 0x9E3779B97F4A7C15ULL;
+
+   return statSlots[(threadHash >> 32) % SHARD_COUNT];
+}
+
+////////////////////////////////////////////////////////////////////////////////
+void Stats::recordDuration(StatId id, uint64_t nanoseconds)
+{
+   unsigned bucket = 0;
+   uint64_t bound = 1000;
+   while (bucket < BUCKET_COUNT - 1 && nanoseconds >= bound)
+   {
+      bound <<= 1;
+      bucket++;
+   }
+
+   auto shard = getShard();
+   shard[id + bucket].fetch_add(1, memory_order_relaxed);
+   shard[id + BUCKET_COUNT].fetch_add(1, memory_order_relaxed);
+   shard[id + BUCKET_COUNT + 1].fetch_add(nanoseconds, memory_order_relaxed);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+uint64_t Stats::readCounter(StatId id)
+{
+   uint64_t total = 0;
+   for (unsigned i = 0; i < SHARD_COUNT; i++)
+      total += statSlots[i][id].load(memory_order_relaxed);
+
+   return total;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+vector<Stats::Value> Stats::read(void)
+{
+   vector<StatDescriptor> stats;
+   {
+      auto& registry = getRegistry();
+      lock_guard<mutex> lock(registry.mu_);
+      stats = registry.stats_;
+   }
+
+   vector<Value> values;
+   for (auto& stat : stats)
+   {
+      Value value;
+      value.name_ = stat.name_;
+      value.help_ = stat.help_;
+      value.labels_ = stat.labels_;
+      value.type_ = stat.type_;
+
+      if (stat.type_ == StatType_Counter)
+      {
+         value.count_ = readCounter(stat.id_);
+      }
+      else
+      {
+         value.buckets_.resize(BUCKET_COUNT);
+         for (unsigned i = 0; i < BUCKET_COUNT; i++)
+            value.buckets_[i] = readCounter(stat.id_ + i);
+
+         value.count_ = readCounter(stat.id_ + BUCKET_COUNT);
+         value.sumNs_ = readCounter(stat.id_ + BUCKET_COUNT + 1);
+      }
+
+      values.push_back(move(value));
+   }
+
+   return values;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+double Stats::getBucketBound(unsigned bucket)
+{
+   return double(1000ULL << bucket) / 1000000000.0;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+void Stats::print(ostream& os)
+{
+   auto values = read();
+
+   for (auto& value : values)
+   {
+      os << withLabels(value.name_, value.labels_) << ": ";
+
+      if (value.type_ == StatType_Counter)
+      {
+         os << value.count_ << endl;
+         continue;
+      }
+
+      os << value.count_ << " in " << formatSeconds(value.sumNs_ / 1e9);
+      if (value.count_ > 0)
+      {
+         os << ", avg " << formatSeconds(value.sumNs_ / 1e9 / value.count_)
+            << ", p50 " << quantileBound(value, 0.5)
+            << ", p99 " << quantileBound(value, 0.99);
+      }
+      os << endl;
+   }
+}
+
+////////////////////////////////////////////////////////////////////////////////
+void Stats::writePrometheus(ostream& os)
+{
+   auto values = read();
+
+   //a metric's samples have to be grouped, whatever order they registered in
+   stable_sort(values.begin(), values.end(),
+      [](const Value& lhs, const Value& rhs)->bool
+      { return lhs.name_ < rhs.name_; });
+
+   string lastName;
+   for (auto& value : values)
+   {
+      string name = "armory_" + value.name_;
+
+      //labelled stats share their HELP and TYPE lines
+      if (name != lastName)
+      {
+         os << "# HELP " << name << " " << value.help_ << "\n";
+         os << "# TYPE " << name << " " <<
+            (value.type_ == StatType_Counter ? "counter" : "histogram") << "\n";
+         lastName = name;
+      }
+
+      if (value.type_ == StatType_Counter)
+      {
+         os << withLabels(name, value.labels_) << " " << value.count_ << "\n";
+         continue;
+      }
+
+      uint64_t cumulated = 0;
+      for (unsigned i = 0; i < BUCKET_COUNT - 1; i++)
+      {
+         cumulated += value.buckets_[i];
+
+         stringstream le;
+         le << "le=\"" << getBucketBound(i) << "\"";
+         os << withLabels(name + "_bucket", value.labels_, le.str()) <<
+            " " << cumulated << "\n";
+      }
+
+      os << withLabels(name + "_bucket", value.labels_, "le=\"+Inf\"") <<
+         " " << value.count_ << "\n";
+      os << withLabels(name + "_sum", value.labels_) << " " <<
+         value.sumNs_ / 1e9 << "\n";
+      os << withLabels(name + "_count", value.labels_) << " " <<
+         value.count_ << "\n";
+   }
+}
+
+////////////////////////////////////////////////////////////////////////////////
+bool Stats::writeToFile(const string& path, bool prometheus)
+{
+   string tmpPath = path + ".tmp";
+
+   {
+      ofstream os(tmpPath, ios::trunc);
+      if (!os.is_open())
+         return false;
+
+      if (prometheus)
+         writePrometheus(os);
+      else
+         print(os);
+
+      if (!os.good())
+         return false;
+   }
+
+#ifdef _WIN32
+   //rename doesn't replace an existing file on Windows
+   remove(path.c_str());
+#endif
+
+   return rename(tmpPath.c_str(), path.c_str()) == 0;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+////////////////////////////////////////////////////////////////////////////////
+StatsDumper::StatsDumper(const string& path, unsigned intervalSec) :
+   path_(path), intervalSec_(intervalSec > 0 ? intervalSec : 1),
+   prometheus_(path.size() >= 5 &&
+      path.compare(path.size() - 5, 5, ".prom") == 0)
+{}
+
+////////////////////////////////////////////////////////////////////////////////
+StatsDumper::~StatsDumper()
+{
+   stop();
+}
+
+////////////////////////////////////////////////////////////////////////////////
+void StatsDumper::start(void)
+{
+   if (thread_.joinable())
+      return;
+
+   run_ = true;
+   thread_ = thread(&StatsDumper::dumpThread, this);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+void StatsDumper::stop(void)
+{
+   if (!thread_.joinable())
+      return;
+
+   {
+      lock_guard<mutex> lock(mu_);
+      run_ = false;
+      cv_.notify_all();
+   }
+
+   thread_.join();
+}
+
+////////////////////////////////////////////////////////////////////////////////
+void StatsDumper::dumpThread(void)
+{
+   unique_lock<mutex> lock(mu_);
+
+   while (run_)
+   {
+      cv_.wait_for(lock, chrono::seconds(intervalSec_));
+
+      lock.unlock();
+      dump();
+      lock.lock();
+   }
+}
+
+////////////////////////////////////////////////////////////////////////////////
+void StatsDumper::dump(void)
+{
+   if (!Stats::writeToFile(path_, prometheus_))
+      LOGWARN << "Failed to write stats to " << path_;
+}
@@ -244,7 +244,8 @@ void StoredHeader::unserializeFullBlock(BinaryRefReader brr,
    uint32_t height = blockHeight_;
    uint8_t  dupid  = duplicateID_;
 
-   vector<BinaryData> allTxHashes;
+   //tx hashes back to back, for the in place merkle root
+   BinaryData allTxHashes;
    BlockHeader bh(brr); 
    uint32_t nTx = (uint32_t)brr.get_var_int();
 
@@ -279,7 +280,7 @@ void StoredHeader::unserializeFullBlock(BinaryRefReader brr,
       numBytes_ += thisTx.getSize();
 
       //save the hash for merkle computation
-      allTxHashes.push_back(thisTx.getThisHash());
+      allTxHashes.append(thisTx.getThisHash());
 
       // Now add it to the map
       stxMap_[tx] = StoredTx();
@@ -1281,6 +1282,97 @@ void StoredTxOut::pprintOneLine(uint32_t indent)
 }
 
 
+////////////////////////////////////////////////////////////////////////////////
+// StoredUTXO
+////////////////////////////////////////////////////////////////////////////////
+StoredUTXO::StoredUTXO(const StoredTxOut& stxo, const BinaryData& txHash)
+   : txHash_(txHash)
+{
+   scrAddr_  = stxo.getScrAddress();
+   txOutKey_ = stxo.getDBKey(false);
+   value_    = stxo.getValue();
+   script_   = stxo.getScriptRef();
+}
+
+////////////////////////////////////////////////////////////////////////////////
+void StoredUTXO::unserializeDBValue(BinaryRefReader & brr)
+{
+   value_ = brr.get_uint64_t();
+   brr.get_BinaryData(txHash_, 32);
+
+   uint32_t scriptSize = (uint32_t)brr.get_var_int();
+   brr.get_BinaryData(script_, scriptSize);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+void StoredUTXO::serializeDBValue(BinaryWriter & bw) const
+{
+   bw.put_uint64_t(value_);
+   bw.put_BinaryData(txHash_);
+   bw.put_var_int(script_.getSize());
+   bw.put_BinaryData(script_);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+void StoredUTXO::unserializeDBValue(BinaryDataRef bdr)
+{
+   BinaryRefReader brr(bdr);
+   unserializeDBValue(brr);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+void StoredUTXO::unserializeDBKey(BinaryDataRef key, bool withPrefix)
+{
+   uint32_t offset = withPrefix ? 1 : 0;
+   if (key.getSize() < offset + 8)
+   {
+      LOGERR << "UTXO key is too short";
+      return;
+   }
+
+   uint32_t scrAddrSize = key.getSize() - offset - 8;
+   scrAddr_  = key.getSliceCopy(offset, scrAddrSize);
+   txOutKey_ = key.getSliceCopy(offset + scrAddrSize, 8);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+BinaryData StoredUTXO::getDBKey(const BinaryData& scrAddr,
+   const BinaryData& txOutKey8B, bool withPrefix)
+{
+   BinaryWriter bw(1 + scrAddr.getSize() + 8);
+   if (withPrefix)
+      bw.put_uint8_t((uint8_t)DB_PREFIX_SCRIPT);
+
+   bw.put_BinaryData(scrAddr);
+   bw.put_BinaryData(txOutKey8B);
+   return bw.getData();
+}
+
+////////////////////////////////////////////////////////////////////////////////
+BinaryData StoredUTXO::getDBKey(bool withPrefix) const
+{
+   return getDBKey(scrAddr_, txOutKey_, withPrefix);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+uint32_t StoredUTXO::getHeight(void) const
+{
+   return DBUtils::hgtxToHeight(txOutKey_.getSliceCopy(0, 4));
+}
+
+////////////////////////////////////////////////////////////////////////////////
+uint16_t StoredUTXO::getTxOutIndex(void) const
+{
+   return READ_UINT16_BE(txOutKey_.getPtr() + 6);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+UnspentTxOut StoredUTXO::getUnspentTxOut(void) const
+{
+   return UnspentTxOut(
+      txHash_, getTxOutIndex(), getHeight(), value_, script_);
+}
+
 ////////////////////////////////////////////////////////////////////////////////
 // The list of spent/unspent txOuts is exactly what is needed to construct 
 // a full vector<TxIOPair> for each address.  Keep in mind that this list
@@ -1315,6 +1407,17 @@ void StoredScriptHistory::unserializeDBValue(BinaryRefReader & brr)
    subHistMap_.clear();
    totalUnspent_ = brr.get_uint64_t();
 
+   //legacy SSH entries end here, they carry no UTXO summary
+   if (brr.getSizeRemaining() == 0)
+   {
+      hasUtxoSummary_ = false;
+      return;
+   }
+
+   utxoCount_ = brr.get_var_int();
+   totalMultisigUnspent_ = brr.get_uint64_t();
+   multisigUtxoCount_ = brr.get_var_int();
+   hasUtxoSummary_ = true;
 }
 
 ////////////////////////////////////////////////////////////////////////////////
@@ -1337,6 +1440,14 @@ void StoredScriptHistory::serializeDBValue(BinaryWriter & bw,
    bw.put_uint32_t(alreadyScannedUpToBlk_); 
    bw.put_var_int(totalTxioCount_); 
    bw.put_uint64_t(totalUnspent_);
+
+   //do not write a summary we can't vouch for
+   if (!hasUtxoSummary_)
+      return;
+
+   bw.put_var_int(utxoCount_);
+   bw.put_uint64_t(totalMultisigUnspent_);
+   bw.put_var_int(multisigUtxoCount_);
 }
 
 
@@ -1516,6 +1627,9 @@ uint64_t StoredScriptHistory::getScriptBalance(bool withMultisig)
    if(!withMultisig)
       return totalUnspent_;
 
+   if (hasUtxoSummary_)
+      return totalUnspent_ + totalMultisigUnspent_;
+
    // If with multisig we have to load and count everything
    if(!haveFullHistoryLoaded())
       return UINT64_MAX;
@@ -1528,6 +1642,34 @@ uint64_t StoredScriptHistory::getScriptBalance(bool withMultisig)
    return bal;
 }
 
+////////////////////////////////////////////////////////////////////////////////
+uint64_t StoredScriptHistory::getScriptUtxoCount(bool withMultisig)
+{
+   if (hasUtxoSummary_)
+   {
+      if (!withMultisig)
+         return utxoCount_;
+
+      return utxoCount_ + multisigUtxoCount_;
+   }
+
+   if (!haveFullHistoryLoaded())
+      return UINT64_MAX;
+
+   uint64_t count = 0;
+   for (const auto& subsshPair : subHistMap_)
+   {
+      for (const auto& txioPair : subsshPair.second.txioMap_)
+      {
+         const TxIOPair& txio = txioPair.second;
+         if (txio.isUTXO() && (withMultisig || !txio.isMultisig()))
+            count++;
+      }
+   }
+
+   return count;
+}
+
 ////////////////////////////////////////////////////////////////////////////////
 bool StoredScriptHistory::getFullTxioMap( map<BinaryData, TxIOPair> & mapToFill,
                                           bool withMultisig)
@@ -1592,8 +1734,19 @@ void StoredScriptHistory::insertTxio(const TxIOPair& txio)
 
    if (wasInserted.second == true)
    {
-      if (!txio.hasTxIn() && !txio.isMultisig())
-         totalUnspent_ += txio.getValue();
+      if (!txio.hasTxIn())
+      {
+         if (!txio.isMultisig())
+         {
+            totalUnspent_ += txio.getValue();
+            utxoCount_++;
+         }
+         else
+         {
+            totalMultisigUnspent_ += txio.getValue();
+            multisigUtxoCount_++;
+         }
+      }
       totalTxioCount_++;
    }
 }
@@ -1607,8 +1760,19 @@ void StoredScriptHistory::eraseTxio(const TxIOPair& txio)
 
    if (wasRemoved == 1)
    {
-      if (!txio.hasTxIn() && !txio.isMultisig())
-         totalUnspent_ -= txio.getValue();
+      if (!txio.hasTxIn())
+      {
+         if (!txio.isMultisig())
+         {
+            totalUnspent_ -= txio.getValue();
+            utxoCount_--;
+         }
+         else
+         {
+            totalMultisigUnspent_ -= txio.getValue();
+            multisigUtxoCount_--;
+         }
+      }
       totalTxioCount_--;
    }
 }
@@ -2503,6 +2667,16 @@ BinaryData DBUtils::getBlkMetaKey( uint32_t height,
    return bw.getData();
 }
 
+/////////////////////////////////////////////////////////////////////////////
+BinaryData DBUtils::getBlkFilterKey( uint32_t height, 
+                                             uint8_t  dup)
+{
+   BinaryWriter bw(5);
+   bw.put_uint8_t(    DB_PREFIX_BLKFILTER );
+   bw.put_BinaryData( heightAndDupToHgtx(height,dup) );
+   return bw.getData();
+}
+
 /////////////////////////////////////////////////////////////////////////////
 BinaryData DBUtils::getBlkDataKey( uint32_t height, 
                                              uint8_t  dup,
@@ -46,7 +46,8 @@ enum DB_PREFIX
   DB_PREFIX_TRIENODES,
   DB_PREFIX_COUNT,
   DB_PREFIX_ZCDATA,
-  DB_PREFIX_BLKMETA
+  DB_PREFIX_BLKMETA,
+  DB_PREFIX_BLKFILTER
 };
 
 // In ARMORY_DB_PARTIAL and LITE, we may not store full tx, but we will know 
@@ -67,6 +68,7 @@ enum DB_SELECT
    SPENTNESS,
    TXHINTS,
    ZEROCONF,
+   UTXO,
    COUNT
 };
 
@@ -136,6 +138,10 @@ public:
    static BinaryData getBlkMetaKey(uint32_t height,
       uint8_t  dup);
 
+   /////////////////////////////////////////////////////////////////////////////
+   static BinaryData getBlkFilterKey(uint32_t height,
+      uint8_t  dup);
+
    /////////////////////////////////////////////////////////////////////////////
    static BinaryData getBlkDataKey(uint32_t height, 
                             uint8_t  dup);
@@ -322,6 +328,43 @@ public:
    uint32_t          unserDbType_;
 };
 
+////////////////////////////////////////////////////////////////////////////////
+// Entry of the optional UTXO index DB. The key is the scrAddr followed by the 
+// 8 byte DB key of the TxOut, so that all UTXOs of a given scrAddr can be 
+// grabbed with a single prefix scan. The value carries everything needed to 
+// build an UnspentTxOut without going back to STXO, TXHINTS and BLKDATA:
+//
+//    Key:   DB_PREFIX_SCRIPT | scrAddr | hgtX(4) | txIdx(2) | txOutIdx(2)
+//    Value: value(8) | txHash(32) | var_int scriptSize | script
+class StoredUTXO
+{
+public:
+   StoredUTXO(void) {}
+   StoredUTXO(const StoredTxOut& stxo, const BinaryData& txHash);
+
+   bool isInitialized(void) const { return txHash_.getSize() == 32; }
+
+   void       unserializeDBValue(BinaryRefReader & brr);
+   void         serializeDBValue(BinaryWriter    & bw ) const;
+   void       unserializeDBValue(BinaryDataRef      bd);
+   void       unserializeDBKey(BinaryDataRef key, bool withPrefix=true);
+
+   BinaryData getDBKey(bool withPrefix=true) const;
+   static BinaryData getDBKey(const BinaryData& scrAddr, 
+                              const BinaryData& txOutKey8B,
+                              bool withPrefix=true);
+
+   uint32_t getHeight(void) const;
+   uint16_t getTxOutIndex(void) const;
+   UnspentTxOut getUnspentTxOut(void) const;
+
+   BinaryData scrAddr_;
+   BinaryData txOutKey_; //hgtX | txIdx | txOutIdx, BE
+   BinaryData txHash_;
+   uint64_t   value_ = 0;
+   BinaryData script_;
+};
+
 ////////////////////////////////////////////////////////////////////////////////
 class DBTx
 {
@@ -656,6 +699,7 @@ public:
 
    uint64_t getScriptReceived(bool withMultisig=false);
    uint64_t getScriptBalance(bool withMultisig=false);
+   uint64_t getScriptUtxoCount(bool withMultisig=false);
 
    bool     haveFullHistoryLoaded(void) const;
 
@@ -675,6 +719,18 @@ public:
    uint32_t       alreadyScannedUpToBlk_;
    uint64_t       totalTxioCount_;
    uint64_t       totalUnspent_;
+
+   // Running UTXO summary, maintained alongside totalUnspent_ by the
+   // BlockWriteBatcher so that balance and UTXO count queries only need the 
+   // SSH entry itself. Multisig refs (TxIOs added to the individual scrAddr of
+   // a multisig script) are tallied separately, like the rest of the SSH does.
+   // SSH entries written before these fields existed unserialize with
+   // hasUtxoSummary_ set to false, in which case callers have to fall back to
+   // walking the sub-histories.
+   uint64_t       totalMultisigUnspent_ = 0;
+   uint64_t       utxoCount_ = 0;
+   uint64_t       multisigUtxoCount_ = 0;
+   bool           hasUtxoSummary_ = true;
    
    uint8_t        dbPrefix_ = 0;
    uint8_t        keyLength_ = 0;
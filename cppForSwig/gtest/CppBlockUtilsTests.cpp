@@ -5,6 +5,14 @@
 
 #include "../log.h"
 #include "../BinaryData.h"
+#include "../FlatHashMap.h"
+#include "../BlockFilter.h"
+#include "../BlkFileWatcher.h"
+#include "../MPSCQueue.h"
+#include "../BDM_CallbackDispatcher.h"
+#include "../QueryServer.h"
+#include "../Stats.h"
+#include "../BDM_mainthread.h"
 #include "../BtcUtils.h"
 #include "../BlockObj.h"
 #include "../StoredBlockObj.h"
@@ -22,6 +30,14 @@
 #include "../txio.h"
 
 #include <thread>
+#include <chrono>
+
+#ifndef _WIN32
+   #include <unistd.h>
+   #include <sys/stat.h>
+   #include <sys/socket.h>
+   #include <sys/un.h>
+#endif
 
 
 #ifdef _MSC_VER
@@ -940,255 +956,1300 @@ TEST_F(BinaryDataTest, Contains)
 }
 
 ////////////////////////////////////////////////////////////////////////////////
-//TEST_F(BinaryDataTest, GenerateRandom)
-//{
-    // Yeah, this would be a fun one to try to test...
-//}
+TEST_F(BinaryDataTest, InlineStorage)
+{
+   BinaryData hash = READHEX(
+      "f32c9ea2d54f60d73fe6ee5e0ff5c5da09d3e0ee0ab70b35e87fb86b9e08fa1a");
 
+   // hashes sit in the object itself
+   auto isInline = [](BinaryData const & bd)->bool
+   {
+      uint8_t const * objStart = reinterpret_cast<uint8_t const *>(&bd);
+      return bd.getPtr() >= objStart && 
+             bd.getPtr() <  objStart + sizeof(BinaryData);
+   };
+   EXPECT_LE(sizeof(BinaryData), 48);
+   EXPECT_TRUE(isInline(hash));
+
+   // crossing over to the heap keeps the bytes, resize zeroes the new ones
+   BinaryData bd(hash);
+   bd.append(hash);
+   EXPECT_FALSE(isInline(bd));
+   EXPECT_EQ(bd.getSliceCopy(0, 32), hash);
+   EXPECT_EQ(bd.getSliceCopy(32, 32), hash);
+
+   BinaryData grown(hash);
+   grown.resize(100);
+   EXPECT_EQ(grown.getSliceCopy(0, 32), hash);
+   EXPECT_EQ(grown.getSliceCopy(32, 68), BinaryData(68));
+
+   // appending a slice of itself
+   BinaryData self(hash);
+   self.append(self);
+   self.append(self);
+   EXPECT_EQ(self.getSize(), 128);
+   EXPECT_EQ(self.getSliceCopy(96, 32), hash);
+
+   BinaryData bytes;
+   for (uint32_t i = 0; i < 100; i++)
+      bytes.append((uint8_t)i);
+   for (uint32_t i = 0; i < 100; i++)
+      EXPECT_EQ(bytes[i], (uint8_t)i);
+
+   // moves and swaps between inline and heap buffers
+   BinaryData small(hash);
+   BinaryData large(bd);
+   small = move(large);
+   EXPECT_EQ(small, bd);
+   EXPECT_EQ(large, hash);
+
+   BinaryData moved(move(small));
+   EXPECT_EQ(moved, bd);
+   EXPECT_EQ(small.getSize(), 0);
+
+   BinaryData shortBd = hash.getSliceCopy(0, 4);
+   BinaryData longBd(hash);
+   shortBd = move(longBd);
+   EXPECT_EQ(shortBd, hash);
+   EXPECT_EQ(longBd, hash.getSliceCopy(0, 4));
+
+   BinaryData heapA(bd);
+   BinaryData heapB(self);
+   heapA = move(heapB);
+   EXPECT_EQ(heapA, self);
+   EXPECT_EQ(heapB, bd);
+
+   large = moved;
+   large.resize(8);
+   EXPECT_EQ(large, hash.getSliceCopy(0, 8));
+   EXPECT_EQ(moved, bd);
+
+   large.clear();
+   EXPECT_EQ(large.getSize(), 0);
+   EXPECT_TRUE(large.getPtr() == NULL);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+TEST_F(BinaryDataTest, DISABLED_InlineStorage_Benchmark)
+{
+   const uint32_t nKeys = 1000000;
+
+   // the kind of map the scanning code keeps: hash160s and db keys
+   vector<BinaryData> keys;
+   keys.reserve(nKeys);
+   for (uint32_t i = 0; i < nKeys; i++)
+      keys.push_back(BtcUtils::getHash160(WRITE_UINT32_BE(i)));
+
+   auto start = chrono::steady_clock::now();
+   map<BinaryData, BinaryData> keyMap;
+   for (uint32_t i = 0; i < nKeys; i++)
+   {
+      BinaryData val(WRITE_UINT32_BE(i));
+      val.append(WRITE_UINT16_BE(i & 0xFFFF));
+      keyMap[keys[i]] = val;
+   }
+   auto insertTime = chrono::steady_clock::now() - start;
 
-////////////////////////////////////////////////////////////////////////////////
-//TEST_F(BinaryDataTest, ReadFile)
-//{
-   //ofstream os("test
-//}
+   start = chrono::steady_clock::now();
+   uint32_t found = 0;
+   for (uint32_t i = 0; i < nKeys; i++)
+   {
+      BinaryData key(keys[i]);
+      found += (keyMap.find(key) != keyMap.end());
+   }
+   auto findTime = chrono::steady_clock::now() - start;
+   EXPECT_EQ(found, nKeys);
 
+   start = chrono::steady_clock::now();
+   keyMap.clear();
+   keys.clear();
+   auto clearTime = chrono::steady_clock::now() - start;
 
+   typedef chrono::duration<double, milli> ms;
+   cout << nKeys << " hash160 -> 6 byte entries" << endl;
+   cout << "   insert:        " << ms(insertTime).count() << " ms" << endl;
+   cout << "   copy and find: " << ms(findTime).count() << " ms" << endl;
+   cout << "   destroy:       " << ms(clearTime).count() << " ms" << endl;
+}
 
 ////////////////////////////////////////////////////////////////////////////////
-class BinaryDataRefTest : public ::testing::Test
+TEST_F(BinaryDataTest, Hash)
 {
-protected:
-   virtual void SetUp(void) 
-   {
-      str0_ = "";
-      str4_ = "1234abcd";
-      str5_ = "1234abcdef";
+   BinaryDataHash hasher;
 
-      bd0_ = READHEX(str0_);
-      bd4_ = READHEX(str4_);
-      bd5_ = READHEX(str5_);
+   // same bytes, same hash, whatever holds them
+   BinaryData hash160 = READHEX("00f32c9ea2d54f60d73fe6ee5e0ff5c5da09d3e0ee");
+   EXPECT_EQ(hasher(hash160), hasher(hash160.getRef()));
+   EXPECT_EQ(hasher(hash160), hasher(BinaryData(hash160)));
+   EXPECT_EQ(hasher(BinaryData()), hasher(BinaryData()));
 
-      bdr__ = BinaryDataRef();
-      bdr0_ = BinaryDataRef(bd0_);
-      bdr4_ = BinaryDataRef(bd4_);
-      bdr5_ = BinaryDataRef(bd5_);
+   // seeded
+   EXPECT_NE(hasher(hash160), BinaryDataHash(1)(hash160));
+
+   // scrAddrs only differing past the first 8 bytes, and keys of every
+   // length up to a few 16 byte blocks, don't collide
+   set<size_t> hashes;
+   for (uint32_t i = 0; i < 1000; i++)
+   {
+      BinaryData scrAddr(hash160);
+      memcpy(scrAddr.getPtr() + 17, &i, 4);
+      hashes.insert(hasher(scrAddr));
    }
+   EXPECT_EQ(hashes.size(), 1000);
 
-   string str0_;
-   string str4_;
-   string str5_;
+   hashes.clear();
+   BinaryData bytes;
+   for (uint32_t i = 0; i < 100; i++)
+   {
+      hashes.insert(hasher(bytes));
+      bytes.append((uint8_t)0);
+   }
+   EXPECT_EQ(hashes.size(), 100);
+}
 
-   BinaryData bd0_;
-   BinaryData bd4_;
-   BinaryData bd5_;
+////////////////////////////////////////////////////////////////////////////////
+TEST_F(BinaryDataTest, FlatHashMap)
+{
+   FlatHashMap<BinaryData, uint32_t> flatMap;
+   map<BinaryData, uint32_t> refMap;
 
-   BinaryDataRef bdr__;
-   BinaryDataRef bdr0_;
-   BinaryDataRef bdr4_;
-   BinaryDataRef bdr5_;
-};
+   EXPECT_TRUE(flatMap.empty());
+   EXPECT_TRUE(flatMap.find(bd4_) == flatMap.end());
+   EXPECT_EQ(flatMap.erase(bd4_), 0);
 
+   // enough entries to go through a few rehashes, interleaved with erases
+   for (uint32_t i = 0; i < 5000; i++)
+   {
+      BinaryData key = WRITE_UINT8_LE(0x00) + WRITE_UINT32_BE(i);
+      auto result = flatMap.insert(make_pair(key, i));
+      EXPECT_TRUE(result.second);
+      EXPECT_EQ(result.first->first, key);
+      refMap[key] = i;
 
+      if (i % 3 == 0)
+      {
+         BinaryData toErase = WRITE_UINT8_LE(0x00) + WRITE_UINT32_BE(i / 2);
+         EXPECT_EQ(flatMap.erase(toErase), refMap.erase(toErase));
+      }
+   }
 
-////////////////////////////////////////////////////////////////////////////////
-TEST_F(BinaryDataRefTest, Constructor)
-{
-   BinaryDataRef a;
-   BinaryDataRef b((uint8_t*)bd0_.getPtr(), bd0_.getSize());
-   BinaryDataRef c((uint8_t*)bd0_.getPtr(), (uint8_t*)bd0_.getPtr());
-   BinaryDataRef d((uint8_t*)bd4_.getPtr(), bd4_.getSize());
-   BinaryDataRef e((uint8_t*)bd4_.getPtr(), (uint8_t*)bd4_.getPtr()+4);
-   BinaryDataRef f(bd0_);
-   BinaryDataRef g(bd4_);
-   BinaryDataRef h(str0_);
-   BinaryDataRef i(str4_);
+   ASSERT_EQ(flatMap.size(), refMap.size());
+   for (auto& entry : refMap)
+   {
+      auto iter = flatMap.find(entry.first);
+      ASSERT_TRUE(iter != flatMap.end());
+      EXPECT_EQ(iter->second, entry.second);
+   }
 
-   EXPECT_TRUE(a.getPtr()==NULL);
-   EXPECT_EQ(a.getSize(), 0);
+   // iteration visits every entry once
+   map<BinaryData, uint32_t> visited(flatMap.begin(), flatMap.end());
+   EXPECT_EQ(visited, refMap);
 
-   EXPECT_TRUE(b.getPtr()==NULL);
-   EXPECT_EQ(b.getSize(), 0);
+   // insert doesn't overwrite, operator[] does
+   BinaryData key = refMap.begin()->first;
+   EXPECT_FALSE(flatMap.insert(make_pair(key, 12345)).second);
+   EXPECT_EQ(flatMap[key], refMap.begin()->second);
+   flatMap[key] = 12345;
+   EXPECT_EQ(flatMap.find(key)->second, 12345);
+   EXPECT_EQ(flatMap.count(bd4_), 0);
+   EXPECT_EQ(flatMap[bd4_], 0);
+   EXPECT_EQ(flatMap.count(bd4_), 1);
 
-   EXPECT_TRUE(c.getPtr()==NULL);
-   EXPECT_EQ(c.getSize(), 0);
+   // const access and clearing
+   FlatHashMap<BinaryData, uint32_t> const & constMap = flatMap;
+   size_t count = 0;
+   for (auto& entry : constMap)
+      count += (constMap.find(entry.first) != constMap.end());
+   EXPECT_EQ(count, refMap.size() + 1);
 
-   EXPECT_FALSE(d.getPtr()==NULL);
-   EXPECT_EQ(d.getSize(), 4);
+   flatMap.clear();
+   EXPECT_EQ(flatMap.size(), 0);
+   EXPECT_TRUE(flatMap.begin() == flatMap.end());
+   EXPECT_TRUE(flatMap.find(key) == flatMap.end());
+}
 
-   EXPECT_FALSE(e.getPtr()==NULL);
-   EXPECT_EQ(e.getSize(), 4);
+////////////////////////////////////////////////////////////////////////////////
+TEST_F(BinaryDataTest, DISABLED_FlatHashMap_Benchmark)
+{
+   // what ScrAddrFilter used to hash on: the prefix and 7 hash bytes
+   struct prefixHash
+   {
+      size_t operator()(const BinaryData& bd) const
+      {
+         size_t val;
+         memcpy(&val, bd.getPtr(), sizeof(size_t));
+         return val;
+      }
+   };
 
-   EXPECT_TRUE(f.getPtr()==NULL);
-   EXPECT_EQ(f.getSize(), 0);
+   const uint32_t nScrAddr = 500000;
+   const uint32_t nLookups = 5000000;
 
-   EXPECT_FALSE(g.getPtr()==NULL);
-   EXPECT_EQ(g.getSize(), 4);
+   vector<BinaryData> scrAddrs;
+   for (uint32_t i = 0; i < nScrAddr; i++)
+   {
+      BinaryData scrAddr = 
+         HASH160PREFIX + BtcUtils::getHash160(WRITE_UINT32_BE(i));
+      scrAddrs.push_back(scrAddr);
+   }
 
-   EXPECT_TRUE(h.getPtr()==NULL);
-   EXPECT_EQ(h.getSize(), 0);
+   // half the lookups miss, as most txouts in a scan aren't ours
+   vector<BinaryData> lookups;
+   for (uint32_t i = 0; i < 100000; i++)
+   {
+      BinaryData miss = 
+         HASH160PREFIX + BtcUtils::getHash160(WRITE_UINT32_BE(nScrAddr + i));
+      lookups.push_back(miss);
+      lookups.push_back(scrAddrs[(i * 7919) % nScrAddr]);
+   }
 
-   EXPECT_FALSE(i.getPtr()==NULL);
-   EXPECT_EQ(i.getSize(), 8);
+   typedef chrono::duration<double, milli> ms;
+   auto run = [&](string const & name, function<void(void)> insert, 
+      function<bool(BinaryData const &)> find)->void
+   {
+      auto start = chrono::steady_clock::now();
+      insert();
+      auto insertTime = chrono::steady_clock::now() - start;
+
+      start = chrono::steady_clock::now();
+      uint32_t found = 0;
+      for (uint32_t i = 0; i < nLookups; i++)
+         found += find(lookups[i % lookups.size()]);
+      auto findTime = chrono::steady_clock::now() - start;
+      EXPECT_EQ(found, nLookups / 2);
+
+      cout << name << ms(insertTime).count() << " ms insert, " 
+           << ms(findTime).count() << " ms lookups" << endl;
+   };
 
-   EXPECT_TRUE( a.isNull());
-   EXPECT_TRUE( b.isNull());
-   EXPECT_TRUE( c.isNull());
-   EXPECT_FALSE(d.isNull());
-   EXPECT_FALSE(e.isNull());
-   EXPECT_TRUE( f.isNull());
-   EXPECT_FALSE(g.isNull());
-   EXPECT_TRUE( h.isNull());
-   EXPECT_FALSE(i.isNull());
+   cout << nScrAddr << " scrAddrs, " << nLookups << " lookups" << endl;
+   {
+      unordered_map<BinaryData, uint32_t, prefixHash> prefixMap;
+      run("   unordered_map, prefix hash: ", 
+         [&](void)->void { for (auto& sa : scrAddrs) prefixMap[sa] = 0; },
+         [&](BinaryData const & sa)->bool 
+         { return prefixMap.find(sa) != prefixMap.end(); });
+   }
+   {
+      unordered_map<BinaryData, uint32_t, BinaryDataHash> hashMap;
+      run("   unordered_map, BinaryDataHash: ",
+         [&](void)->void { for (auto& sa : scrAddrs) hashMap[sa] = 0; },
+         [&](BinaryData const & sa)->bool 
+         { return hashMap.find(sa) != hashMap.end(); });
+   }
+   {
+      FlatHashMap<BinaryData, uint32_t> flatMap;
+      run("   FlatHashMap:                   ",
+         [&](void)->void { for (auto& sa : scrAddrs) flatMap[sa] = 0; },
+         [&](BinaryData const & sa)->bool 
+         { return flatMap.find(sa) != flatMap.end(); });
+   }
 }
 
-
-
 ////////////////////////////////////////////////////////////////////////////////
-TEST_F(BinaryDataRefTest, PostConstruct)
+TEST(ScrAddrPrefilterTest, MayContain)
 {
-   BinaryDataRef a,b,c,d,e,f,g,h,i;
+   const uint32_t nKeys = 20000;
 
-   b.setRef((uint8_t*)bd0_.getPtr(), bd0_.getSize());
-   c.setRef((uint8_t*)bd0_.getPtr(), (uint8_t*)bd0_.getPtr());
-   d.setRef((uint8_t*)bd4_.getPtr(), bd4_.getSize());
-   e.setRef((uint8_t*)bd4_.getPtr(), (uint8_t*)bd4_.getPtr()+4);
-   f.setRef(bd0_);
-   g.setRef(bd4_);
-   h.setRef(str0_);
-   i.setRef(str4_);
+   ScrAddrPrefilter prefilter;
+   EXPECT_EQ(prefilter.capacity(), 0);
+   EXPECT_FALSE(prefilter.mayContain(READHEX("00")));
 
-   EXPECT_TRUE(a.getPtr()==NULL);
-   EXPECT_EQ(a.getSize(), 0);
+   // no false negatives, growing past the sizing included
+   prefilter.rebuild(nKeys / 4);
+   for (uint32_t i = 0; i < nKeys; i++)
+      prefilter.add(HASH160PREFIX + BtcUtils::getHash160(WRITE_UINT32_BE(i)));
 
-   EXPECT_TRUE(b.getPtr()==NULL);
-   EXPECT_EQ(b.getSize(), 0);
+   for (uint32_t i = 0; i < nKeys; i++)
+   {
+      BinaryData scrAddr = 
+         HASH160PREFIX + BtcUtils::getHash160(WRITE_UINT32_BE(i));
+      ASSERT_TRUE(prefilter.mayContain(scrAddr));
+   }
 
-   EXPECT_TRUE(c.getPtr()==NULL);
-   EXPECT_EQ(c.getSize(), 0);
+   // few false positives when sized right
+   prefilter.rebuild(nKeys);
+   EXPECT_GE(prefilter.capacity(), nKeys);
+   for (uint32_t i = 0; i < nKeys; i++)
+      prefilter.add(HASH160PREFIX + BtcUtils::getHash160(WRITE_UINT32_BE(i)));
 
-   EXPECT_FALSE(d.getPtr()==NULL);
-   EXPECT_EQ(d.getSize(), 4);
+   uint32_t falsePositives = 0;
+   for (uint32_t i = nKeys; i < 2 * nKeys; i++)
+   {
+      BinaryData scrAddr = 
+         HASH160PREFIX + BtcUtils::getHash160(WRITE_UINT32_BE(i));
+      falsePositives += prefilter.mayContain(scrAddr);
+   }
+   EXPECT_LT(falsePositives, nKeys / 100);
+}
 
-   EXPECT_FALSE(e.getPtr()==NULL);
-   EXPECT_EQ(e.getSize(), 4);
+////////////////////////////////////////////////////////////////////////////////
+TEST(ScrAddrPrefilterTest, DISABLED_Benchmark)
+{
+   const uint32_t nScrAddr = 1000000;
+   const uint32_t nLookups = 5000000;
 
-   EXPECT_TRUE(f.getPtr()==NULL);
-   EXPECT_EQ(f.getSize(), 0);
+   FlatHashMap<BinaryData, uint32_t> scrAddrMap;
+   ScrAddrPrefilter prefilter;
+   prefilter.rebuild(nScrAddr);
+   for (uint32_t i = 0; i < nScrAddr; i++)
+   {
+      BinaryData scrAddr = 
+         HASH160PREFIX + BtcUtils::getHash160(WRITE_UINT32_BE(i));
+      scrAddrMap[scrAddr] = 0;
+      prefilter.add(scrAddr);
+   }
 
-   EXPECT_FALSE(g.getPtr()==NULL);
-   EXPECT_EQ(g.getSize(), 4);
+   // txouts of a scan: nearly none of them are ours
+   vector<BinaryData> txOutScrAddrs;
+   for (uint32_t i = 0; i < 200000; i++)
+   {
+      txOutScrAddrs.push_back(
+         HASH160PREFIX + BtcUtils::getHash160(WRITE_UINT32_BE(nScrAddr + i)));
+   }
 
-   EXPECT_FALSE(h.getPtr()==NULL);
-   EXPECT_EQ(h.getSize(), 0);
+   typedef chrono::duration<double, milli> ms;
+   uint32_t found = 0;
+   auto start = chrono::steady_clock::now();
+   for (uint32_t i = 0; i < nLookups; i++)
+   {
+      auto& scrAddr = txOutScrAddrs[i % txOutScrAddrs.size()];
+      found += (scrAddrMap.find(scrAddr) != scrAddrMap.end());
+   }
+   auto mapTime = chrono::steady_clock::now() - start;
 
-   EXPECT_FALSE(i.getPtr()==NULL);
-   EXPECT_EQ(i.getSize(), 8);
+   start = chrono::steady_clock::now();
+   for (uint32_t i = 0; i < nLookups; i++)
+   {
+      auto& scrAddr = txOutScrAddrs[i % txOutScrAddrs.size()];
+      if (prefilter.mayContain(scrAddr))
+         found += (scrAddrMap.find(scrAddr) != scrAddrMap.end());
+   }
+   auto filterTime = chrono::steady_clock::now() - start;
+   EXPECT_EQ(found, 0);
 
-   EXPECT_TRUE( a.isNull());
-   EXPECT_TRUE( b.isNull());
-   EXPECT_TRUE( c.isNull());
-   EXPECT_FALSE(d.isNull());
-   EXPECT_FALSE(e.isNull());
-   EXPECT_TRUE( f.isNull());
-   EXPECT_FALSE(g.isNull());
-   EXPECT_FALSE(h.isNull());
-   EXPECT_FALSE(i.isNull());
+   cout << nScrAddr << " registered scrAddrs, " << nLookups 
+        << " unregistered lookups" << endl;
+   cout << "   map only:        " << ms(mapTime).count() << " ms" << endl;
+   cout << "   prefilter + map: " << ms(filterTime).count() << " ms" << endl;
 }
 
-
-
 ////////////////////////////////////////////////////////////////////////////////
-TEST_F(BinaryDataRefTest, CopyTo)
+TEST(BlockFilterTest, MatchAny)
 {
-   BinaryData a,b,c,d,e,f,g,h;
-   bdr0_.copyTo(a);
-   bdr4_.copyTo(b);
+   const uint32_t nItems = 5000;
 
-   c.resize(bdr5_.getSize());
-   bdr5_.copyTo(c.getPtr());
+   vector<BinaryData> items;
+   for (uint32_t i = 0; i < nItems; i++)
+      items.push_back(HASH160PREFIX + BtcUtils::getHash160(WRITE_UINT32_BE(i)));
 
-   size_t sz = 2;
-   d.resize(sz);
-   e.resize(sz);
-   bdr5_.copyTo(d.getPtr(), sz);
-   bdr5_.copyTo(e.getPtr(), bdr5_.getSize()-sz, sz);
+   //duplicates don't count
+   items.push_back(items[0]);
 
-   f.copyFrom(bdr5_.getPtr(), bdr5_.getPtr()+sz);
+   vector<BinaryDataRef> itemRefs;
+   for (auto& item : items)
+      itemRefs.push_back(item.getRef());
 
-   EXPECT_TRUE(a==bdr0_);
-   EXPECT_TRUE(b==bdr4_);
-   EXPECT_TRUE(c==bdr5_);
-   EXPECT_TRUE(bdr5_.startsWith(d));
-   EXPECT_TRUE(bdr5_.endsWith(e));
-   EXPECT_TRUE(d==f);
+   BinaryData blockHash = BtcUtils::getHash256(READHEX("01"));
+   BinaryData filter = BlockFilter::build(blockHash, itemRefs);
+   EXPECT_LT(filter.getSize(), nItems * (BlockFilter::P + 3) / 8);
+   EXPECT_EQ(BinaryRefReader(filter).get_var_int(), nItems);
 
-   EXPECT_EQ(a.getSize(), 0);
-   EXPECT_EQ(b.getSize(), 4);
-   EXPECT_EQ(c.getSize(), 5);
-   EXPECT_EQ(d.getSize(), 2);
-   EXPECT_NE(b,c);
+   // every item matches, alone or in a query with others
+   for (uint32_t i = 0; i < nItems; i++)
+   {
+      vector<BinaryDataRef> query;
+      query.push_back(items[i].getRef());
+      ASSERT_TRUE(BlockFilter::matchAny(
+         filter, blockHash, BlockFilter::Query(query)));
+   }
 
-   g = bdr0_.copy();
-   h = bdr4_.copy();
+   vector<BinaryData> others;
+   for (uint32_t i = nItems; i < 2 * nItems; i++)
+      others.push_back(HASH160PREFIX + BtcUtils::getHash160(WRITE_UINT32_BE(i)));
 
-   EXPECT_EQ(g, bdr0_);
-   EXPECT_EQ(h, bdr4_);
-   EXPECT_EQ(g, bdr0_.copy());
-   EXPECT_EQ(h, bdr4_.copy());
+   vector<BinaryDataRef> mixedQuery;
+   for (auto& other : others)
+      mixedQuery.push_back(other.getRef());
+   mixedQuery.push_back(items[nItems / 2].getRef());
+   EXPECT_TRUE(BlockFilter::matchAny(
+      filter, blockHash, BlockFilter::Query(mixedQuery)));
 
-   EXPECT_EQ(bdr0_, g);
-   EXPECT_EQ(bdr4_, h);
-   EXPECT_EQ(bdr0_.copy(), g);
-   EXPECT_EQ(bdr4_.copy(), h);
-}
+   // false positive rate is about 1/M per queried item
+   uint32_t falsePositives = 0;
+   for (auto& other : others)
+   {
+      vector<BinaryDataRef> query;
+      query.push_back(other.getRef());
+      falsePositives += BlockFilter::matchAny(
+         filter, blockHash, BlockFilter::Query(query));
+   }
+   EXPECT_LT(falsePositives, 3);
+
+   // the hash is keyed with the block's, another block's key misses
+   BinaryData otherHash = BtcUtils::getHash256(READHEX("02"));
+   uint32_t otherKeyMatches = 0;
+   for (uint32_t i = 0; i < 100; i++)
+   {
+      vector<BinaryDataRef> query;
+      query.push_back(items[i].getRef());
+      otherKeyMatches += BlockFilter::matchAny(
+         filter, otherHash, BlockFilter::Query(query));
+   }
+   EXPECT_LT(otherKeyMatches, 3);
+
+   // empty block, empty query
+   vector<BinaryDataRef> noItems;
+   BinaryData emptyFilter = BlockFilter::build(blockHash, noItems);
+   EXPECT_EQ(emptyFilter.getSize(), 1);
+   EXPECT_FALSE(BlockFilter::matchAny(
+      emptyFilter, blockHash, BlockFilter::Query(itemRefs)));
+   EXPECT_FALSE(BlockFilter::matchAny(
+      filter, blockHash, BlockFilter::Query(noItems)));
+
+   // missing, truncated or otherwise broken filters match anything, so the 
+   // block gets pulled
+   vector<BinaryDataRef> unknown;
+   unknown.push_back(others[0].getRef());
+   BlockFilter::Query unknownQuery(unknown);
+   ASSERT_FALSE(BlockFilter::matchAny(filter, blockHash, unknownQuery));
+
+   EXPECT_TRUE(BlockFilter::matchAny(
+      BinaryDataRef(), blockHash, unknownQuery));
+   EXPECT_TRUE(BlockFilter::matchAny(filter, BinaryDataRef(), unknownQuery));
+
+   for (size_t size = 1; size < 5; size++)
+   {
+      BinaryDataRef truncated(filter.getPtr(), size);
+      EXPECT_TRUE(BlockFilter::matchAny(truncated, blockHash, unknownQuery));
+   }
 
+   // a filter cut short still matches every item it had, either the walk 
+   // gets to it or it runs out of bits
+   size_t truncatedSizes[] = { filter.getSize() / 2, filter.getSize() - 1 };
+   for (auto size : truncatedSizes)
+   {
+      BinaryDataRef truncated(filter.getPtr(), size);
+      for (uint32_t i = 0; i < nItems; i += 7)
+      {
+         vector<BinaryDataRef> query;
+         query.push_back(items[i].getRef());
+         ASSERT_TRUE(BlockFilter::matchAny(
+            truncated, blockHash, BlockFilter::Query(query)));
+      }
+   }
 
+   EXPECT_TRUE(BlockFilter::matchAny(
+      READHEX("00ff"), blockHash, unknownQuery));
+}
 
 ////////////////////////////////////////////////////////////////////////////////
-TEST_F(BinaryDataRefTest, ToString)
+TEST(BlockFilterTest, SipHash)
 {
-   EXPECT_EQ(bdr0_.toHexStr(), str0_);
-   EXPECT_EQ(bdr4_.toHexStr(), str4_);
-   EXPECT_EQ(bdr4_.toHexStr(), str4_);
-
-   string a,b;
-   bdr0_.copyTo(a);
-   bdr4_.copyTo(b);
-   EXPECT_EQ(bd0_.toBinStr(), a);
-   EXPECT_EQ(bd4_.toBinStr(), b);
+   // reference vectors: key 00..0f, message 00..(len - 1)
+   uint64_t k0 = 0x0706050403020100ULL;
+   uint64_t k1 = 0x0f0e0d0c0b0a0908ULL;
 
-   string stra("cdab3412");
-   BinaryData bda = READHEX(stra);
+   uint8_t msg[16];
+   for (uint8_t i = 0; i < 16; i++)
+      msg[i] = i;
 
-   EXPECT_EQ(bdr4_.toHexStr(true), stra);
-   EXPECT_EQ(bdr4_.toBinStr(true), bda.toBinStr());
+   EXPECT_EQ(BlockFilter::sipHash24(k0, k1, msg, 0), 0x726fdb47dd0e0e31ULL);
+   EXPECT_EQ(BlockFilter::sipHash24(k0, k1, msg, 8), 0x93f5f5799a932462ULL);
+   EXPECT_EQ(BlockFilter::sipHash24(k0, k1, msg, 15), 0xa129ca6149be45e5ULL);
 
+   // keyed with the first 16 bytes of the block hash, read little endian
+   BinaryData blockHash = READHEX(
+      "000102030405060708090a0b0c0d0e0f00000000000000000000000000000000");
+   EXPECT_EQ(BlockFilter::hashItem(blockHash, BinaryDataRef(msg, 15)),
+      0xa129ca6149be45e5ULL);
 }
 
-
 ////////////////////////////////////////////////////////////////////////////////
-TEST_F(BinaryDataRefTest, Find)
+TEST(BlockFilterTest, DISABLED_Benchmark)
 {
-   BinaryData a = READHEX("12");
-   BinaryData b = READHEX("34");
-   BinaryData c = READHEX("abcd");
-   BinaryData d = READHEX("ff");
+   //a wallet side scan over blocks of ~2000 txs
+   const uint32_t nBlocks = 1000;
+   const uint32_t nItemsPerBlock = 8000;
+   const uint32_t nScrAddr = 1000;
 
-   EXPECT_EQ(bdr0_.find(bdr0_),     0);
-   EXPECT_EQ(bdr0_.find(bdr4_),    -1);
-   EXPECT_EQ(bdr0_.find(bdr4_, 2), -1);
-   EXPECT_EQ(bdr4_.find(bdr0_),     0);
-   EXPECT_EQ(bdr4_.find(bdr0_, 2),  2);
+   vector<BinaryData> filters;
+   vector<BinaryData> blockHashes;
+   uint64_t filterBytes = 0;
+   for (uint32_t b = 0; b < nBlocks; b++)
+   {
+      vector<BinaryData> items;
+      for (uint32_t i = 0; i < nItemsPerBlock; i++)
+      {
+         items.push_back(HASH160PREFIX + 
+            BtcUtils::getHash160(WRITE_UINT32_BE(b * nItemsPerBlock + i)));
+      }
 
-   EXPECT_EQ(bdr4_.find(a),  0);
-   EXPECT_EQ(bdr4_.find(b),  1);
-   EXPECT_EQ(bdr4_.find(c),  2);
-   EXPECT_EQ(bdr4_.find(d), -1);
+      vector<BinaryDataRef> itemRefs;
+      for (auto& item : items)
+         itemRefs.push_back(item.getRef());
 
-   EXPECT_EQ(bdr4_.find(a, 0),  0);
-   EXPECT_EQ(bdr4_.find(b, 0),  1);
-   EXPECT_EQ(bdr4_.find(c, 0),  2);
-   EXPECT_EQ(bdr4_.find(d, 0), -1);
+      blockHashes.push_back(BtcUtils::getHash256(WRITE_UINT32_BE(b)));
+      filters.push_back(BlockFilter::build(blockHashes.back(), itemRefs));
+      filterBytes += filters.back().getSize();
+   }
+
+   vector<BinaryData> scrAddrs;
+   vector<BinaryDataRef> scrAddrRefs;
+   for (uint32_t i = 0; i < nScrAddr; i++)
+   {
+      scrAddrs.push_back(HASH160PREFIX + 
+         BtcUtils::getHash256(WRITE_UINT32_BE(i)).getSliceCopy(0, 20));
+   }
+   for (auto& scrAddr : scrAddrs)
+      scrAddrRefs.push_back(scrAddr.getRef());
+
+   typedef chrono::duration<double, milli> ms;
+   auto start = chrono::steady_clock::now();
+   BlockFilter::Query query(scrAddrRefs);
+   uint32_t hits = 0;
+   for (uint32_t b = 0; b < nBlocks; b++)
+      hits += BlockFilter::matchAny(filters[b], blockHashes[b], query);
+   auto matchTime = chrono::steady_clock::now() - start;
+
+   cout << nBlocks << " blocks of " << nItemsPerBlock << " items, " 
+        << filterBytes / nBlocks << " bytes per filter" << endl;
+   cout << "   " << nScrAddr << " scrAddr query: " << ms(matchTime).count() 
+        << " ms, " << hits << " blocks to pull" << endl;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+TEST(BlkFileWatcherTest, WakesOnAppend)
+{
+   const string watchDir("./blkwatchtest");
+   rmdir(watchDir);
+   mkdir(watchDir);
+
+   atomic<unsigned> wakeUps(0);
+   BlkFileWatcher watcher(watchDir, [&wakeUps](void)->void { wakeUps++; });
+
+   //polls when it isn't running
+   EXPECT_TRUE(watcher.hasChanges());
+   if (!watcher.start())
+   {
+      //no inotify on this platform
+      EXPECT_TRUE(watcher.hasChanges());
+      rmdir(watchDir);
+      return;
+   }
+
+   //first call always reads
+   EXPECT_TRUE(watcher.isActive());
+   EXPECT_TRUE(watcher.hasChanges());
+   EXPECT_FALSE(watcher.hasChanges());
+
+   //files other than blkXXXXX.dat don't count
+   {
+      std::ofstream o(watchDir + "/peers.dat", ios::app | ios::binary);
+      o << "peers";
+   }
+   usleep(100000);
+   EXPECT_EQ(wakeUps.load(), 0);
+   EXPECT_FALSE(watcher.hasChanges());
+
+   auto start = chrono::steady_clock::now();
+   {
+      std::ofstream o(watchDir + "/blk00000.dat", ios::app | ios::binary);
+      o << "block";
+   }
+
+   while (wakeUps.load() == 0 && 
+      chrono::steady_clock::now() - start < chrono::seconds(5))
+      usleep(100);
+
+   typedef chrono::duration<double, milli> ms;
+   auto latency = chrono::steady_clock::now() - start;
+
+   EXPECT_GT(wakeUps.load(), 0);
+   EXPECT_LT(ms(latency).count(), 1000.0);
+   EXPECT_TRUE(watcher.hasChanges());
+   EXPECT_FALSE(watcher.hasChanges());
+
+   watcher.stop();
+   EXPECT_FALSE(watcher.isActive());
+   EXPECT_TRUE(watcher.hasChanges());
+
+   rmdir(watchDir);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+class CountingInject : public BDM_Inject
+{
+public:
+   virtual void run(void) { runs_++; }
+   atomic<unsigned> runs_;
+};
+
+////////////////////////////////////////////////////////////////////////////////
+TEST(BDM_InjectTest, WakeDoesntRun)
+{
+   CountingInject inject;
+   inject.runs_ = 0;
+
+   typedef chrono::duration<double, milli> ms;
+
+   //blk file changes cut the wait short, without going through run()
+   auto start = chrono::steady_clock::now();
+   thread waker([&inject](void)->void
+   {
+      usleep(50000);
+      inject.wake();
+   });
+   inject.wait(5000);
+   waker.join();
+
+   EXPECT_LT(ms(chrono::steady_clock::now() - start).count(), 2000.0);
+   EXPECT_EQ(inject.runs_.load(), 0);
+
+   //notify() still does
+   inject.notify();
+   inject.wait(5000);
+   EXPECT_EQ(inject.runs_.load(), 1);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+TEST(MPSCQueueTest, ManyProducers)
+{
+   const unsigned nProducers = 4;
+   const unsigned nPerProducer = 100000;
+
+   BoundedMPSCQueue<uint64_t> queue(100);
+   EXPECT_EQ(queue.capacity(), 128);
+
+   //fills up, then refuses
+   uint64_t val;
+   for (unsigned i = 0; i < queue.capacity(); i++)
+   {
+      val = i;
+      EXPECT_TRUE(queue.tryPush(move(val)));
+   }
+   val = 0;
+   EXPECT_FALSE(queue.tryPush(move(val)));
+   for (unsigned i = 0; i < queue.capacity(); i++)
+   {
+      ASSERT_TRUE(queue.tryPop(val));
+      EXPECT_EQ(val, i);
+   }
+   EXPECT_FALSE(queue.hasData());
+   EXPECT_FALSE(queue.tryPop(val));
+
+   //producer id in the high bits, sequence in the low bits
+   vector<thread> producers;
+   for (unsigned p = 0; p < nProducers; p++)
+   {
+      producers.push_back(thread([&queue, p](void)->void
+      {
+         for (uint64_t i = 0; i < nPerProducer; i++)
+         {
+            uint64_t item = (uint64_t(p) << 32) | i;
+            while (!queue.tryPush(move(item)))
+               this_thread::yield();
+         }
+      }));
+   }
+
+   vector<uint64_t> next(nProducers, 0);
+   unsigned popped = 0;
+   while (popped < nProducers * nPerProducer)
+   {
+      if (!queue.tryPop(val))
+      {
+         this_thread::yield();
+         continue;
+      }
+
+      unsigned p = unsigned(val >> 32);
+      ASSERT_LT(p, nProducers);
+      ASSERT_EQ(val & 0xFFFFFFFF, next[p]);
+      next[p]++;
+      popped++;
+   }
+
+   for (auto& producer : producers)
+      producer.join();
+
+   EXPECT_FALSE(queue.hasData());
+   for (auto& count : next)
+      EXPECT_EQ(count, nPerProducer);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+// holds on to every notification until released, like a busy Python client
+class SlowCallback : public BDM_CallBack
+{
+public:
+   virtual void run(BDMAction action, void* ptr, int block)
+   {
+      unique_lock<mutex> lock(mu_);
+      while (blocked_)
+         cv_.wait(lock);
+
+      actions_.push_back(action);
+      if (action == BDMAction_NewBlock)
+         newBlocks_.push_back(*static_cast<int*>(ptr));
+      else if (action == BDMAction_Refresh)
+         refreshIDs_.push_back(*static_cast<vector<BinaryData>*>(ptr));
+      else if (action == BDMAction_ZC)
+         nZC_ += static_cast<vector<LedgerEntry>*>(ptr)->size();
+   }
+
+   virtual void progress(BDMPhase, const vector<string>&,
+      float, unsigned, unsigned)
+   {
+      unique_lock<mutex> lock(mu_);
+      nProgress_++;
+   }
+
+   void release(void)
+   {
+      unique_lock<mutex> lock(mu_);
+      blocked_ = false;
+      cv_.notify_all();
+   }
+
+   mutex mu_;
+   condition_variable cv_;
+   bool blocked_ = true;
+
+   vector<BDMAction> actions_;
+   vector<int> newBlocks_;
+   vector<vector<BinaryData>> refreshIDs_;
+   size_t nZC_ = 0;
+   unsigned nProgress_ = 0;
+};
+
+////////////////////////////////////////////////////////////////////////////////
+TEST(BDM_CallbackDispatcherTest, SlowClient)
+{
+   SlowCallback callback;
+
+   {
+      BDM_CallbackDispatcher dispatcher(&callback, 4);
+      dispatcher.start();
+
+      //the client sits on the first one, nothing we post below may block
+      auto start = chrono::steady_clock::now();
+
+      dispatcher.postNewBlock(1, 100);
+      usleep(10000);
+
+      const BinaryData idA = READHEX("aa");
+      const BinaryData idB = READHEX("bb");
+      dispatcher.postRefresh(set<BinaryData>{ idA });
+      dispatcher.postNewBlock(2, 102);
+      dispatcher.postRefresh(set<BinaryData>{ idB });
+      dispatcher.postRefresh(set<BinaryData>{ idA });
+
+      vector<LedgerEntry> zc(3);
+      dispatcher.postZC(move(zc));
+
+      //the queue is full by now: progress goes away, the rest overflows
+      for (unsigned i = 0; i < 10; i++)
+         dispatcher.postProgress(BDMPhase_Rescan, vector<string>(), 
+            0.5f, 10, 0);
+      dispatcher.postNewBlock(1, 103);
+
+      typedef chrono::duration<double, milli> ms;
+      EXPECT_LT(ms(chrono::steady_clock::now() - start).count(), 1000.0);
+      EXPECT_GT(dispatcher.getDroppedProgressCount(), 0);
+      EXPECT_GT(dispatcher.getOverflowCount(), 0);
+
+      callback.release();
+
+      //the destructor delivers what's left
+   }
+
+   //all the refreshes went out as one, with every ID
+   ASSERT_EQ(callback.refreshIDs_.size(), 1);
+   ASSERT_EQ(callback.refreshIDs_[0].size(), 2);
+   EXPECT_EQ(callback.refreshIDs_[0][0], READHEX("aa"));
+   EXPECT_EQ(callback.refreshIDs_[0][1], READHEX("bb"));
+
+   //and nothing got out of order
+   vector<BDMAction> expected = { BDMAction_NewBlock, BDMAction_Refresh,
+      BDMAction_NewBlock, BDMAction_ZC, BDMAction_NewBlock };
+   EXPECT_EQ(callback.actions_, expected);
+
+   vector<int> expectedBlocks = { 1, 2, 1 };
+   EXPECT_EQ(callback.newBlocks_, expectedBlocks);
+   EXPECT_EQ(callback.nZC_, 3);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+// lets notifications through one at a time
+class GatedCallback : public BDM_CallBack
+{
+public:
+   virtual void run(BDMAction action, void* ptr, int)
+   {
+      unique_lock<mutex> lock(mu_);
+      entered_++;
+      cv_.notify_all();
+      while (permits_ == 0)
+         cv_.wait(lock);
+      permits_--;
+
+      if (action == BDMAction_NewBlock)
+         newBlocks_.push_back(*static_cast<int*>(ptr));
+   }
+
+   virtual void progress(BDMPhase, const vector<string>&,
+      float, unsigned, unsigned)
+   {}
+
+   void waitEntered(unsigned count)
+   {
+      unique_lock<mutex> lock(mu_);
+      while (entered_ < count)
+         cv_.wait(lock);
+   }
+
+   void allow(unsigned count)
+   {
+      unique_lock<mutex> lock(mu_);
+      permits_ += count;
+      cv_.notify_all();
+   }
+
+   mutex mu_;
+   condition_variable cv_;
+   unsigned entered_ = 0;
+   unsigned permits_ = 0;
+
+   vector<int> newBlocks_;
+};
+
+////////////////////////////////////////////////////////////////////////////////
+TEST(BDM_CallbackDispatcherTest, OverflowKeepsOrder)
+{
+   GatedCallback callback;
+
+   {
+      BDM_CallbackDispatcher dispatcher(&callback, 4);
+      dispatcher.start();
+
+      //the client sits on 1, 2 to 5 fill the queue, 6 overflows
+      dispatcher.postNewBlock(1, 0);
+      callback.waitEntered(1);
+      for (int i = 2; i <= 6; i++)
+         dispatcher.postNewBlock(i, 0);
+      EXPECT_EQ(dispatcher.getOverflowCount(), 1);
+
+      //the dispatcher takes 2 off the queue, 7 still has to go after 6
+      callback.allow(1);
+      callback.waitEntered(2);
+      dispatcher.postNewBlock(7, 0);
+      EXPECT_EQ(dispatcher.getOverflowCount(), 2);
+
+      callback.allow(UINT32_MAX / 2);
+   }
+
+   vector<int> expected = { 1, 2, 3, 4, 5, 6, 7 };
+   EXPECT_EQ(callback.newBlocks_, expected);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+TEST(StatsTest, CountersAndHistograms)
+{
+   const StatId counter = Stats::registerCounter(
+      "test_items_total", "Test counter", "kind=\"a\"");
+   const StatId histogram = Stats::registerHistogram(
+      "test_op_seconds", "Test histogram");
+
+   //registering again hands back the same stat
+   EXPECT_EQ(Stats::registerCounter(
+      "test_items_total", "Test counter", "kind=\"a\""), counter);
+   EXPECT_NE(Stats::registerCounter(
+      "test_items_total", "Test counter", "kind=\"b\""), counter);
+   EXPECT_THROW(Stats::registerHistogram(
+      "test_items_total", "Test counter", "kind=\"a\""), runtime_error);
+
+   const unsigned nThreads = 8;
+   const unsigned nPerThread = 100000;
+
+   vector<thread> threads;
+   for (unsigned t = 0; t < nThreads; t++)
+   {
+      threads.push_back(thread([&](void)->void
+      {
+         for (unsigned i = 0; i < nPerThread; i++)
+            Stats::add(counter, 2);
+
+         //one in the first bucket, one in the second, one past the last
+         Stats::recordDuration(histogram, 500);
+         Stats::recordDuration(histogram, 1500);
+         Stats::recordDuration(histogram, 3600ULL * 1000000000ULL);
+      }));
+   }
+
+   for (auto& thr : threads)
+      thr.join();
+
+   EXPECT_EQ(Stats::readCounter(counter), 2 * nThreads * nPerThread);
+
+   bool found = false;
+   for (auto& value : Stats::read())
+   {
+      if (value.name_ != "test_op_seconds")
+         continue;
+
+      found = true;
+      EXPECT_EQ(value.type_, Stats::StatType_Histogram);
+      ASSERT_EQ(value.buckets_.size(), size_t(Stats::BUCKET_COUNT));
+      EXPECT_EQ(value.count_, 3 * nThreads);
+      EXPECT_EQ(value.buckets_[0], nThreads);
+      EXPECT_EQ(value.buckets_[1], nThreads);
+      EXPECT_EQ(value.buckets_[Stats::BUCKET_COUNT - 1], nThreads);
+      EXPECT_EQ(value.sumNs_, 
+         nThreads * (2000ULL + 3600ULL * 1000000000ULL));
+   }
+   EXPECT_TRUE(found);
+
+   stringstream ss;
+   Stats::writePrometheus(ss);
+   string prom = ss.str();
+   EXPECT_NE(prom.find("# TYPE armory_test_items_total counter\n"), 
+      string::npos);
+   EXPECT_NE(prom.find("armory_test_items_total{kind=\"a\"} 1600000\n"), 
+      string::npos);
+   EXPECT_NE(prom.find("armory_test_items_total{kind=\"b\"} 0\n"), 
+      string::npos);
+   EXPECT_NE(prom.find("armory_test_op_seconds_bucket{le=\"1e-06\"} 8\n"), 
+      string::npos);
+   EXPECT_NE(prom.find("armory_test_op_seconds_bucket{le=\"+Inf\"} 24\n"), 
+      string::npos);
+   EXPECT_NE(prom.find("armory_test_op_seconds_count 24\n"), string::npos);
+
+   //the HELP and TYPE lines only show once for labelled stats
+   size_t pos = prom.find("# HELP armory_test_items_total");
+   ASSERT_NE(pos, string::npos);
+   EXPECT_EQ(prom.find("# HELP armory_test_items_total", pos + 1), 
+      string::npos);
+
+   const string path("./statstest.prom");
+   ASSERT_TRUE(Stats::writeToFile(path, true));
+   ifstream is(path);
+   stringstream fileContent;
+   fileContent << is.rdbuf();
+   is.close();
+   EXPECT_NE(fileContent.str().find("armory_test_op_seconds_count"), 
+      string::npos);
+   remove(path.c_str());
+
+   {
+      StatTimer timer(histogram);
+   }
+   EXPECT_EQ(Stats::readCounter(histogram + Stats::BUCKET_COUNT), 
+      3 * nThreads + 1);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+TEST(StatsTest, DISABLED_Benchmark)
+{
+   const StatId histogram = Stats::registerHistogram(
+      "bench_op_seconds", "Benchmark histogram");
+   const unsigned nTimings = 5000000;
+
+   typedef chrono::duration<double, milli> ms;
+
+   auto start = chrono::steady_clock::now();
+   for (unsigned i = 0; i < nTimings; i++)
+   {
+      TIMER_START("bench_op");
+      TIMER_STOP("bench_op");
+   }
+   auto universalTime = chrono::steady_clock::now() - start;
+
+   start = chrono::steady_clock::now();
+   for (unsigned i = 0; i < nTimings; i++)
+   {
+      StatTimer timer(histogram);
+   }
+   auto statTime = chrono::steady_clock::now() - start;
+
+   //the same, from every core at once
+   unsigned nThreads = thread::hardware_concurrency();
+   if (nThreads == 0)
+      nThreads = 4;
+
+   start = chrono::steady_clock::now();
+   vector<thread> threads;
+   for (unsigned t = 0; t < nThreads; t++)
+   {
+      threads.push_back(thread([&](void)->void
+      {
+         for (unsigned i = 0; i < nTimings; i++)
+         {
+            StatTimer timer(histogram);
+         }
+      }));
+   }
+   for (auto& thr : threads)
+      thr.join();
+   auto concurrentTime = chrono::steady_clock::now() - start;
+
+   cout << nTimings << " timings" << endl;
+   cout << "   UniversalTimer:  " << ms(universalTime).count() << " ms" << endl;
+   cout << "   StatTimer:       " << ms(statTime).count() << " ms" << endl;
+   cout << "   StatTimer x " << nThreads << ": " 
+        << ms(concurrentTime).count() << " ms" << endl;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//TEST_F(BinaryDataTest, GenerateRandom)
+//{
+    // Yeah, this would be a fun one to try to test...
+//}
+
+
+////////////////////////////////////////////////////////////////////////////////
+//TEST_F(BinaryDataTest, ReadFile)
+//{
+   //ofstream os("test
+//}
+
+
+
+////////////////////////////////////////////////////////////////////////////////
+class BinaryDataRefTest : public ::testing::Test
+{
+protected:
+   virtual void SetUp(void) 
+   {
+      str0_ = "";
+      str4_ = "1234abcd";
+      str5_ = "1234abcdef";
+
+      bd0_ = READHEX(str0_);
+      bd4_ = READHEX(str4_);
+      bd5_ = READHEX(str5_);
+
+      bdr__ = BinaryDataRef();
+      bdr0_ = BinaryDataRef(bd0_);
+      bdr4_ = BinaryDataRef(bd4_);
+      bdr5_ = BinaryDataRef(bd5_);
+   }
+
+   string str0_;
+   string str4_;
+   string str5_;
+
+   BinaryData bd0_;
+   BinaryData bd4_;
+   BinaryData bd5_;
+
+   BinaryDataRef bdr__;
+   BinaryDataRef bdr0_;
+   BinaryDataRef bdr4_;
+   BinaryDataRef bdr5_;
+};
+
+
+
+////////////////////////////////////////////////////////////////////////////////
+TEST_F(BinaryDataRefTest, Constructor)
+{
+   BinaryDataRef a;
+   BinaryDataRef b((uint8_t*)bd0_.getPtr(), bd0_.getSize());
+   BinaryDataRef c((uint8_t*)bd0_.getPtr(), (uint8_t*)bd0_.getPtr());
+   BinaryDataRef d((uint8_t*)bd4_.getPtr(), bd4_.getSize());
+   BinaryDataRef e((uint8_t*)bd4_.getPtr(), (uint8_t*)bd4_.getPtr()+4);
+   BinaryDataRef f(bd0_);
+   BinaryDataRef g(bd4_);
+   BinaryDataRef h(str0_);
+   BinaryDataRef i(str4_);
+
+   EXPECT_TRUE(a.getPtr()==NULL);
+   EXPECT_EQ(a.getSize(), 0);
+
+   EXPECT_TRUE(b.getPtr()==NULL);
+   EXPECT_EQ(b.getSize(), 0);
+
+   EXPECT_TRUE(c.getPtr()==NULL);
+   EXPECT_EQ(c.getSize(), 0);
+
+   EXPECT_FALSE(d.getPtr()==NULL);
+   EXPECT_EQ(d.getSize(), 4);
+
+   EXPECT_FALSE(e.getPtr()==NULL);
+   EXPECT_EQ(e.getSize(), 4);
+
+   EXPECT_TRUE(f.getPtr()==NULL);
+   EXPECT_EQ(f.getSize(), 0);
+
+   EXPECT_FALSE(g.getPtr()==NULL);
+   EXPECT_EQ(g.getSize(), 4);
+
+   EXPECT_TRUE(h.getPtr()==NULL);
+   EXPECT_EQ(h.getSize(), 0);
+
+   EXPECT_FALSE(i.getPtr()==NULL);
+   EXPECT_EQ(i.getSize(), 8);
+
+   EXPECT_TRUE( a.isNull());
+   EXPECT_TRUE( b.isNull());
+   EXPECT_TRUE( c.isNull());
+   EXPECT_FALSE(d.isNull());
+   EXPECT_FALSE(e.isNull());
+   EXPECT_TRUE( f.isNull());
+   EXPECT_FALSE(g.isNull());
+   EXPECT_TRUE( h.isNull());
+   EXPECT_FALSE(i.isNull());
+}
+
+
+
+////////////////////////////////////////////////////////////////////////////////
+TEST_F(BinaryDataRefTest, PostConstruct)
+{
+   BinaryDataRef a,b,c,d,e,f,g,h,i;
+
+   b.setRef((uint8_t*)bd0_.getPtr(), bd0_.getSize());
+   c.setRef((uint8_t*)bd0_.getPtr(), (uint8_t*)bd0_.getPtr());
+   d.setRef((uint8_t*)bd4_.getPtr(), bd4_.getSize());
+   e.setRef((uint8_t*)bd4_.getPtr(), (uint8_t*)bd4_.getPtr()+4);
+   f.setRef(bd0_);
+   g.setRef(bd4_);
+   h.setRef(str0_);
+   i.setRef(str4_);
+
+   EXPECT_TRUE(a.getPtr()==NULL);
+   EXPECT_EQ(a.getSize(), 0);
+
+   EXPECT_TRUE(b.getPtr()==NULL);
+   EXPECT_EQ(b.getSize(), 0);
+
+   EXPECT_TRUE(c.getPtr()==NULL);
+   EXPECT_EQ(c.getSize(), 0);
+
+   EXPECT_FALSE(d.getPtr()==NULL);
+   EXPECT_EQ(d.getSize(), 4);
+
+   EXPECT_FALSE(e.getPtr()==NULL);
+   EXPECT_EQ(e.getSize(), 4);
+
+   EXPECT_TRUE(f.getPtr()==NULL);
+   EXPECT_EQ(f.getSize(), 0);
+
+   EXPECT_FALSE(g.getPtr()==NULL);
+   EXPECT_EQ(g.getSize(), 4);
+
+   EXPECT_FALSE(h.getPtr()==NULL);
+   EXPECT_EQ(h.getSize(), 0);
+
+   EXPECT_FALSE(i.getPtr()==NULL);
+   EXPECT_EQ(i.getSize(), 8);
+
+   EXPECT_TRUE( a.isNull());
+   EXPECT_TRUE( b.isNull());
+   EXPECT_TRUE( c.isNull());
+   EXPECT_FALSE(d.isNull());
+   EXPECT_FALSE(e.isNull());
+   EXPECT_TRUE( f.isNull());
+   EXPECT_FALSE(g.isNull());
+   EXPECT_FALSE(h.isNull());
+   EXPECT_FALSE(i.isNull());
+}
+
+
+
+////////////////////////////////////////////////////////////////////////////////
+TEST_F(BinaryDataRefTest, CopyTo)
+{
+   BinaryData a,b,c,d,e,f,g,h;
+   bdr0_.copyTo(a);
+   bdr4_.copyTo(b);
+
+   c.resize(bdr5_.getSize());
+   bdr5_.copyTo(c.getPtr());
+
+   size_t sz = 2;
+   d.resize(sz);
+   e.resize(sz);
+   bdr5_.copyTo(d.getPtr(), sz);
+   bdr5_.copyTo(e.getPtr(), bdr5_.getSize()-sz, sz);
+
+   f.copyFrom(bdr5_.getPtr(), bdr5_.getPtr()+sz);
+
+   EXPECT_TRUE(a==bdr0_);
+   EXPECT_TRUE(b==bdr4_);
+   EXPECT_TRUE(c==bdr5_);
+   EXPECT_TRUE(bdr5_.startsWith(d));
+   EXPECT_TRUE(bdr5_.endsWith(e));
+   EXPECT_TRUE(d==f);
+
+   EXPECT_EQ(a.getSize(), 0);
+   EXPECT_EQ(b.getSize(), 4);
+   EXPECT_EQ(c.getSize(), 5);
+   EXPECT_EQ(d.getSize(), 2);
+   EXPECT_NE(b,c);
+
+   g = bdr0_.copy();
+   h = bdr4_.copy();
+
+   EXPECT_EQ(g, bdr0_);
+   EXPECT_EQ(h, bdr4_);
+   EXPECT_EQ(g, bdr0_.copy());
+   EXPECT_EQ(h, bdr4_.copy());
+
+   EXPECT_EQ(bdr0_, g);
+   EXPECT_EQ(bdr4_, h);
+   EXPECT_EQ(bdr0_.copy(), g);
+   EXPECT_EQ(bdr4_.copy(), h);
+}
+
+
+
+////////////////////////////////////////////////////////////////////////////////
+TEST_F(BinaryDataRefTest, ToString)
+{
+   EXPECT_EQ(bdr0_.toHexStr(), str0_);
+   EXPECT_EQ(bdr4_.toHexStr(), str4_);
+   EXPECT_EQ(bdr4_.toHexStr(), str4_);
+
+   string a,b;
+   bdr0_.copyTo(a);
+   bdr4_.copyTo(b);
+   EXPECT_EQ(bd0_.toBinStr(), a);
+   EXPECT_EQ(bd4_.toBinStr(), b);
+
+   string stra("cdab3412");
+   BinaryData bda = READHEX(stra);
+
+   EXPECT_EQ(bdr4_.toHexStr(true), stra);
+   EXPECT_EQ(bdr4_.toBinStr(true), bda.toBinStr());
+
+}
+
+
+////////////////////////////////////////////////////////////////////////////////
+TEST_F(BinaryDataRefTest, Find)
+{
+   BinaryData a = READHEX("12");
+   BinaryData b = READHEX("34");
+   BinaryData c = READHEX("abcd");
+   BinaryData d = READHEX("ff");
+
+   EXPECT_EQ(bdr0_.find(bdr0_),     0);
+   EXPECT_EQ(bdr0_.find(bdr4_),    -1);
+   EXPECT_EQ(bdr0_.find(bdr4_, 2), -1);
+   EXPECT_EQ(bdr4_.find(bdr0_),     0);
+   EXPECT_EQ(bdr4_.find(bdr0_, 2),  2);
+
+   EXPECT_EQ(bdr4_.find(a),  0);
+   EXPECT_EQ(bdr4_.find(b),  1);
+   EXPECT_EQ(bdr4_.find(c),  2);
+   EXPECT_EQ(bdr4_.find(d), -1);
+
+   EXPECT_EQ(bdr4_.find(a, 0),  0);
+   EXPECT_EQ(bdr4_.find(b, 0),  1);
+   EXPECT_EQ(bdr4_.find(c, 0),  2);
+   EXPECT_EQ(bdr4_.find(d, 0), -1);
 
    EXPECT_EQ(bdr4_.find(a, 1), -1);
    EXPECT_EQ(bdr4_.find(b, 1),  1);
@@ -1903,6 +2964,171 @@ TEST_F(BtcUtilsTest, SimpleHash)
    EXPECT_EQ(hashOut, satoshiHash160_);
 }
 
+////////////////////////////////////////////////////////////////////////////////
+// context per call, allocating output: the getHash256 path before the batch 
+// API, kept as the reference
+static BinaryData hash256_CryptoPP(uint8_t const * ptr, size_t nBytes)
+{
+   CryptoPP::SHA256 sha256_;
+   BinaryData hashOutput(32);
+   sha256_.CalculateDigest(hashOutput.getPtr(), ptr, nBytes);
+   sha256_.CalculateDigest(hashOutput.getPtr(), hashOutput.getPtr(), 32);
+   return hashOutput;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+TEST_F(BtcUtilsTest, Hash256Batch)
+{
+   // every padding case: empty, single block, length spilling into a 
+   // second block, multi block
+   BinaryData input(300);
+   for (uint32_t i = 0; i < input.getSize(); i++)
+      input[i] = (uint8_t)(i * 7 + 3);
+
+   for (size_t nBytes = 0; nBytes <= 150; nBytes++)
+   {
+      size_t count = input.getSize() / (nBytes == 0 ? 1 : nBytes);
+      if (count > 4) count = 4;
+
+      BinaryData out(32 * count);
+      BtcUtils::getHash256_Batch(input.getPtr(), nBytes, count, out.getPtr());
+      for (size_t i = 0; i < count; i++)
+         EXPECT_EQ(out.getSliceCopy(i * 32, 32),
+                   hash256_CryptoPP(input.getPtr() + i*nBytes, nBytes));
+   }
+
+   // 80 byte headers
+   BinaryData twoHeads = rawHead_ + rawHead_;
+   BinaryData out(64);
+   BtcUtils::getHash256_Batch(twoHeads.getPtr(), HEADER_SIZE, 2, out.getPtr());
+   EXPECT_EQ(out.getSliceCopy(0, 32), headHashLE_);
+   EXPECT_EQ(out.getSliceCopy(32, 32), headHashLE_);
+
+   // 64 byte merkle nodes, hashed in place
+   BinaryData nodes = headHashLE_ + satoshiPubKey_.getSliceCopy(0, 32) +
+                      satoshiPubKey_.getSliceCopy(32, 32) + headHashLE_;
+   BinaryData node0 = hash256_CryptoPP(nodes.getPtr(), 64);
+   BinaryData node1 = hash256_CryptoPP(nodes.getPtr() + 64, 64);
+   BtcUtils::getHash256_Batch(nodes.getPtr(), 64, 2, nodes.getPtr());
+   EXPECT_EQ(nodes.getSliceCopy(0, 32), node0);
+   EXPECT_EQ(nodes.getSliceCopy(32, 32), node1);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+TEST_F(BtcUtilsTest, DISABLED_Hash256Batch_Benchmark)
+{
+   const size_t nHeaders = 1000000;
+   BinaryData headers(nHeaders * HEADER_SIZE);
+   for (size_t i = 0; i < nHeaders; i++)
+   {
+      memcpy(headers.getPtr() + i*HEADER_SIZE, rawHead_.getPtr(), HEADER_SIZE);
+      memcpy(headers.getPtr() + i*HEADER_SIZE + 76, &i, 4); //nonce
+   }
+
+   BinaryData batchOut(nHeaders * 32);
+   vector<BinaryData> refOut(nHeaders);
+
+   auto start = chrono::steady_clock::now();
+   for (size_t i = 0; i < nHeaders; i++)
+      refOut[i] = hash256_CryptoPP(headers.getPtr() + i*HEADER_SIZE, HEADER_SIZE);
+   auto refTime = chrono::steady_clock::now() - start;
+
+   start = chrono::steady_clock::now();
+   for (size_t i = 0; i < nHeaders; i++)
+      refOut[i] = BtcUtils::getHash256(
+         headers.getPtr() + i*HEADER_SIZE, HEADER_SIZE);
+   auto singleTime = chrono::steady_clock::now() - start;
+
+   start = chrono::steady_clock::now();
+   BtcUtils::getHash256_Batch(
+      headers.getPtr(), HEADER_SIZE, nHeaders, batchOut.getPtr());
+   auto batchTime = chrono::steady_clock::now() - start;
+
+   for (size_t i = 0; i < nHeaders; i += 9973)
+      EXPECT_EQ(batchOut.getSliceCopy(i * 32, 32), refOut[i]);
+
+   typedef chrono::duration<double, milli> ms;
+   cout << nHeaders << " headers, SHA extensions: " 
+        << (BtcUtils::hasHardwareSha256() ? "yes" : "no") << endl;
+   cout << "   context per call: " << ms(refTime).count() << " ms" << endl;
+   cout << "   getHash256:       " << ms(singleTime).count() << " ms" << endl;
+   cout << "   getHash256_Batch: " << ms(batchTime).count() << " ms" << endl;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+TEST_F(BtcUtilsTest, MerkleRoot)
+{
+   // odd and even levels, powers of 2 and their neighbours
+   vector<BinaryData> txHashes;
+   BinaryData hashBuffer;
+   for (uint32_t nTx = 1; nTx <= 70; nTx++)
+   {
+      BinaryData leaf = BtcUtils::getHash256(WRITE_UINT32_LE(nTx));
+      txHashes.push_back(leaf);
+      hashBuffer.append(leaf);
+
+      vector<BinaryData> mtree = BtcUtils::calculateMerkleTree(txHashes);
+      BinaryData const & treeRoot = mtree.back();
+
+      EXPECT_EQ(BtcUtils::calculateMerkleRoot(txHashes), treeRoot);
+      EXPECT_EQ(BtcUtils::calculateMerkleRoot(hashBuffer), treeRoot);
+
+      BinaryData inPlace(hashBuffer);
+      BtcUtils::calculateMerkleRoot_InPlace(inPlace.getPtr(), nTx);
+      EXPECT_EQ(inPlace.getSliceCopy(0, 32), treeRoot);
+   }
+
+   EXPECT_EQ(BtcUtils::calculateMerkleRoot(vector<BinaryData>()).getSize(), 0);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+TEST_F(BtcUtilsTest, DISABLED_MerkleRoot_Benchmark)
+{
+   const uint32_t nTx = 4000;
+   const uint32_t nBlocks = 500;
+
+   vector<BinaryData> txHashes(nTx);
+   BinaryData hashBuffer(32 * nTx);
+   for (uint32_t i = 0; i < nTx; i++)
+   {
+      txHashes[i] = BtcUtils::getHash256(WRITE_UINT32_LE(i));
+      txHashes[i].copyTo(hashBuffer.getPtr() + 32 * i, 32);
+   }
+
+   BinaryData treeRoot, listRoot;
+   BinaryData scratch(hashBuffer.getSize());
+
+   auto start = chrono::steady_clock::now();
+   for (uint32_t i = 0; i < nBlocks; i++)
+      treeRoot = BtcUtils::calculateMerkleTree(txHashes).back();
+   auto treeTime = chrono::steady_clock::now() - start;
+
+   start = chrono::steady_clock::now();
+   for (uint32_t i = 0; i < nBlocks; i++)
+      listRoot = BtcUtils::calculateMerkleRoot(txHashes);
+   auto listTime = chrono::steady_clock::now() - start;
+
+   start = chrono::steady_clock::now();
+   for (uint32_t i = 0; i < nBlocks; i++)
+   {
+      memcpy(scratch.getPtr(), hashBuffer.getPtr(), hashBuffer.getSize());
+      BtcUtils::calculateMerkleRoot_InPlace(scratch.getPtr(), nTx);
+   }
+   auto inPlaceTime = chrono::steady_clock::now() - start;
+
+   EXPECT_EQ(listRoot, treeRoot);
+   EXPECT_EQ(scratch.getSliceCopy(0, 32), treeRoot);
+
+   typedef chrono::duration<double, milli> ms;
+   cout << nBlocks << " blocks of " << nTx << " tx" << endl;
+   cout << "   calculateMerkleTree:         " 
+        << ms(treeTime).count() << " ms" << endl;
+   cout << "   calculateMerkleRoot:         " 
+        << ms(listTime).count() << " ms" << endl;
+   cout << "   calculateMerkleRoot_InPlace: " 
+        << ms(inPlaceTime).count() << " ms" << endl;
+}
+
 
 
 ////////////////////////////////////////////////////////////////////////////////
@@ -4256,7 +5482,8 @@ TEST_F(StoredBlockObjTest, SScriptHistorySer)
    /////////////////////////////////////////////////////////////////////////////
    // Empty SSH (shouldn't be written in supernode, should be in full node)
    BinaryData expect, expSub1, expSub2;
-   expect = READHEX("0400""0004""ffff0000""00""0000000000000000");
+   expect = READHEX("0400""0004""ffff0000""00""0000000000000000"
+                    "00""0000000000000000""00");
    EXPECT_EQ(serializeDBValue(ssh, ARMORY_DB_BARE, DB_PRUNE_NONE), expect);
 
    /////////////////////////////////////////////////////////////////////////////
@@ -4267,14 +5494,16 @@ TEST_F(StoredBlockObjTest, SScriptHistorySer)
    txio0.setMultisig(false);
    ssh.insertTxio(txio0);
 
-   expect = READHEX("0400""0004""ffff0000""01""0100000000000000");
+   expect = READHEX("0400""0004""ffff0000""01""0100000000000000"
+                    "01""0000000000000000""00");
    EXPECT_EQ(serializeDBValue(ssh, ARMORY_DB_BARE, DB_PRUNE_NONE), expect);
 
    /////////////////////////////////////////////////////////////////////////////
    // Added a second one, different subSSH
    TxIOPair txio1(READHEX("00010000""0002""0002"), READ_UINT64_HEX_LE("0002000000000000"));
    ssh.insertTxio(txio1);
-   expect  = READHEX("0400""0004""ffff0000""02""0102000000000000");
+   expect  = READHEX("0400""0004""ffff0000""02""0102000000000000"
+                     "02""0000000000000000""00");
    expSub1 = READHEX("01""00""0100000000000000""0001""0001");
    expSub2 = READHEX("01""00""0002000000000000""0002""0002");
    EXPECT_EQ(serializeDBValue(ssh, ARMORY_DB_BARE, DB_PRUNE_NONE), expect);
@@ -4285,7 +5514,8 @@ TEST_F(StoredBlockObjTest, SScriptHistorySer)
    // Added another TxIO to the second subSSH
    TxIOPair txio2(READHEX("00010000""0004""0004"), READ_UINT64_HEX_LE("0000030000000000"));
    ssh.insertTxio(txio2);
-   expect  = READHEX("0400""0004""ffff0000""03""0102030000000000");
+   expect  = READHEX("0400""0004""ffff0000""03""0102030000000000"
+                     "03""0000000000000000""00");
    expSub1 = READHEX("01"
                        "00""0100000000000000""0001""0001");
    expSub2 = READHEX("02"
@@ -4300,7 +5530,8 @@ TEST_F(StoredBlockObjTest, SScriptHistorySer)
    // equivalent to marking it spent, but we are DB-mode-agnostic here, testing
    // just the base insert/erase operations)
    ssh.eraseTxio(txio1);
-   expect  = READHEX("0400""0004""ffff0000""02""0100030000000000");
+   expect  = READHEX("0400""0004""ffff0000""02""0100030000000000"
+                     "02""0000000000000000""00");
    expSub1 = READHEX("01"
                        "00""0100000000000000""0001""0001");
    expSub2 = READHEX("01"
@@ -4315,7 +5546,8 @@ TEST_F(StoredBlockObjTest, SScriptHistorySer)
    TxIOPair txio3(READHEX("00010000""0006""0006"), READ_UINT64_HEX_LE("0000000400000000"));
    txio3.setMultisig(true);
    ssh.insertTxio(txio3);
-   expect  = READHEX("0400""0004""ffff0000""03""0100030000000000");
+   expect  = READHEX("0400""0004""ffff0000""03""0100030000000000"
+                     "02""0000000400000000""01");
    expSub1 = READHEX("01"
                        "00""0100000000000000""0001""0001");
    expSub2 = READHEX("02"
@@ -4328,7 +5560,8 @@ TEST_F(StoredBlockObjTest, SScriptHistorySer)
    /////////////////////////////////////////////////////////////////////////////
    // Remove the multisig
    ssh.eraseTxio(txio3);
-   expect  = READHEX("0400""0004""ffff0000""02""0100030000000000");
+   expect  = READHEX("0400""0004""ffff0000""02""0100030000000000"
+                     "02""0000000000000000""00");
    expSub1 = READHEX("01"
                        "00""0100000000000000""0001""0001");
    expSub2 = READHEX("01"
@@ -4341,7 +5574,8 @@ TEST_F(StoredBlockObjTest, SScriptHistorySer)
    // Remove a full subSSH (it shouldn't be deleted, though, that will be done
    // by BlockUtils in a post-processing step
    ssh.eraseTxio(txio0);
-   expect  = READHEX("0400""0004""ffff0000""01""0000030000000000");
+   expect  = READHEX("0400""0004""ffff0000""01""0000030000000000"
+                     "01""0000000000000000""00");
    expSub1 = READHEX("00");
    expSub2 = READHEX("01"
                        "00""0000030000000000""0004""0004");
@@ -4389,6 +5623,25 @@ TEST_F(StoredBlockObjTest, SScriptHistoryUnser)
    EXPECT_EQ(   ssh.alreadyScannedUpToBlk_, 65535);
    EXPECT_EQ(   ssh.totalTxioCount_, 1);
    EXPECT_EQ(   ssh.totalUnspent_, READ_UINT64_HEX_LE("0100000000000000"));
+   EXPECT_FALSE(ssh.hasUtxoSummary_);
+
+   /////////////////////////////////////////////////////////////////////////////
+   // Same entry, with the UTXO summary appended
+   ssh = sshorig;
+   toUnser = READHEX("0400""0004""ffff0000""02""0100000000000000"
+                     "01""0000000400000000""01");
+   ssh.unserializeDBKey(DBPREF + uniq);
+   ssh.unserializeDBValue(toUnser);
+
+   EXPECT_EQ(   ssh.totalTxioCount_, 2);
+   EXPECT_EQ(   ssh.totalUnspent_, READ_UINT64_HEX_LE("0100000000000000"));
+   EXPECT_TRUE( ssh.hasUtxoSummary_);
+   EXPECT_EQ(   ssh.utxoCount_, 1);
+   EXPECT_EQ(   ssh.totalMultisigUnspent_, READ_UINT64_HEX_LE("0000000400000000"));
+   EXPECT_EQ(   ssh.multisigUtxoCount_, 1);
+   EXPECT_EQ(   ssh.getScriptBalance(true), 
+      READ_UINT64_HEX_LE("0100000400000000"));
+   EXPECT_EQ(   ssh.getScriptUtxoCount(true), 2);
 
 
    /////////////////////////////////////////////////////////////////////////////
@@ -7165,6 +8418,58 @@ TEST_F(LMDBTest_Super, DISABLED_PutGetStoredScriptHistory)
    EXPECT_TRUE(txioptr->isMultisig());
 }
 
+////////////////////////////////////////////////////////////////////////////////
+TEST(TxHashCacheTest, PutGetEvictErase)
+{
+   //one entry per shard
+   TxHashCache cache(TxHashCache::SHARD_COUNT);
+   BinaryData hash0 = READHEX(
+      "00112233445566778899aabbccddeeff00112233445566778899aabbccddeeff");
+   BinaryData hash1 = READHEX(
+      "ffeeddccbbaa99887766554433221100ffeeddccbbaa99887766554433221100");
+
+   BinaryData key0 = DBUtils::getBlkDataKeyNoPrefix(100, 0, 1);
+   BinaryData key1 = DBUtils::getBlkDataKeyNoPrefix(200, 0, 2);
+   BinaryData txHash;
+
+   EXPECT_FALSE(cache.get(key0, txHash));
+   cache.put(key0, hash0, cache.getGeneration());
+   cache.put(key1, hash1, cache.getGeneration());
+   ASSERT_TRUE(cache.get(key0, txHash));
+   EXPECT_EQ(txHash, hash0);
+   ASSERT_TRUE(cache.get(key1, txHash));
+   EXPECT_EQ(txHash, hash1);
+   EXPECT_EQ(cache.getHitCount(), 2);
+   EXPECT_EQ(cache.getMissCount(), 1);
+
+   //same shard as key0, evicts it
+   BinaryData key2 = DBUtils::getBlkDataKeyNoPrefix(100 + 256, 0, 1);
+   cache.put(key2, hash1, cache.getGeneration());
+   EXPECT_FALSE(cache.get(key0, txHash));
+   EXPECT_TRUE(cache.get(key2, txHash));
+
+   //reorg at 200 drops key1 and key2
+   cache.eraseFromHeight(200);
+   EXPECT_FALSE(cache.get(key1, txHash));
+   EXPECT_FALSE(cache.get(key2, txHash));
+   EXPECT_EQ(cache.size(), 0);
+
+   //a hash read before the reorg doesn't make it in after
+   auto generation = cache.getGeneration();
+   cache.eraseFromHeight(100);
+   cache.put(key0, hash0, generation);
+   EXPECT_FALSE(cache.get(key0, txHash));
+   cache.put(key0, hash0, cache.getGeneration());
+   EXPECT_TRUE(cache.get(key0, txHash));
+
+   //same for a clear
+   generation = cache.getGeneration();
+   cache.clear();
+   cache.put(key1, hash1, generation);
+   EXPECT_FALSE(cache.get(key1, txHash));
+   EXPECT_EQ(cache.size(), 0);
+}
+
 ////////////////////////////////////////////////////////////////////////////////
 ////////////////////////////////////////////////////////////////////////////////
 class TxRefTest : public ::testing::Test
@@ -7923,29 +9228,280 @@ TEST_F(BlockDir, BlockFileSplitUpdate)
    
    const std::vector<BinaryData> scraddrs
    {
-      TestChain::scrAddrA, TestChain::scrAddrB, TestChain::scrAddrC
-   };
+      TestChain::scrAddrA, TestChain::scrAddrB, TestChain::scrAddrC
+   };
+
+   BlockDataViewer bdv(&bdm);
+   BtcWallet& wlt = *bdv.registerWallet(scraddrs, "wallet1", false);
+   
+   bdm.doInitialSyncOnLoad( nullProgress ); 
+   bdv.scanWallets();
+ 
+   std::string blk1dat = BtcUtils::getBlkFilename(blkdir_, 1);
+   appendBlocks({ "2", "4", "3", "5" }, blk0dat_);
+   bdm.readBlkFileUpdate();
+   bdv.scanWallets();
+
+   // we should get the same balance as we do for test 'Load5Blocks'
+   const ScrAddrObj *scrobj;
+   
+   scrobj = wlt.getScrAddrObjByKey(scraddrs[0]);
+   EXPECT_EQ(scrobj->getFullBalance(), 50*COIN);
+   scrobj = wlt.getScrAddrObjByKey(scraddrs[1]);
+   EXPECT_EQ(scrobj->getFullBalance(), 70*COIN);
+   scrobj = wlt.getScrAddrObjByKey(scraddrs[2]);
+   EXPECT_EQ(scrobj->getFullBalance(), 20*COIN);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+TEST_F(BlockDir, UpdateOneBlockAtATime)
+{
+   BlockDataManagerConfig config;
+   config.armoryDbType = ARMORY_DB_BARE;
+   config.pruneType = DB_PRUNE_NONE;
+   config.blkFileLocation = blkdir_;
+   config.levelDBLocation = ldbdir_;
+   
+   config.genesisBlockHash = READHEX(MAINNET_GENESIS_HASH_HEX);
+   config.genesisTxHash = READHEX(MAINNET_GENESIS_TX_HASH_HEX);
+   config.magicBytes = READHEX(MAINNET_MAGIC_BYTES);
+      
+   setBlocks({ "0", "1", "2" }, blk0dat_);
+   
+   BlockDataManager_LevelDB bdm(config);
+   bdm.openDatabase();
+   
+   const std::vector<BinaryData> scraddrs
+   {
+      TestChain::scrAddrA, TestChain::scrAddrB, TestChain::scrAddrC
+   };
+
+   BlockDataViewer bdv(&bdm);
+   BtcWallet& wlt = *bdv.registerWallet(scraddrs, "wallet1", false);
+   
+   bdm.doInitialSyncOnLoad( nullProgress ); 
+   bdv.scanWallets();
+
+   //nothing new
+   EXPECT_EQ(bdm.readBlkFileUpdate(), 0);
+
+   appendBlocks({ "3" }, blk0dat_);
+   EXPECT_EQ(bdm.readBlkFileUpdate(), 3);
+   EXPECT_EQ(bdm.getTopBlockHeight(), 3);
+   bdv.scanWallets(3);
+
+   appendBlocks({ "4" }, blk0dat_);
+   EXPECT_EQ(bdm.readBlkFileUpdate(), 4);
+   EXPECT_EQ(bdm.getTopBlockHeight(), 4);
+   bdv.scanWallets(4);
+
+   //block 5 shows up in 2 writes
+   BinaryData blk5;
+   {
+      std::ifstream is("../reorgTest/blk_5.dat", ios::binary | ios::ate);
+      blk5.resize((size_t)is.tellg());
+      is.seekg(0, ios::beg);
+      is.read(blk5.getCharPtr(), blk5.getSize());
+   }
+
+   size_t half = blk5.getSize() / 2;
+   {
+      std::ofstream o(blk0dat_, ios::app | ios::binary);
+      o.write(blk5.getCharPtr(), half);
+   }
+   EXPECT_EQ(bdm.readBlkFileUpdate(), 0);
+   EXPECT_EQ(bdm.getTopBlockHeight(), 4);
+
+   {
+      std::ofstream o(blk0dat_, ios::app | ios::binary);
+      o.write(blk5.getCharPtr() + half, blk5.getSize() - half);
+   }
+   EXPECT_EQ(bdm.readBlkFileUpdate(), 5);
+   EXPECT_EQ(bdm.getTopBlockHeight(), 5);
+   bdv.scanWallets(5);
+
+   // we should get the same balance as we do for test 'Load5Blocks'
+   const ScrAddrObj *scrobj;
+   
+   scrobj = wlt.getScrAddrObjByKey(scraddrs[0]);
+   EXPECT_EQ(scrobj->getFullBalance(), 50*COIN);
+   scrobj = wlt.getScrAddrObjByKey(scraddrs[1]);
+   EXPECT_EQ(scrobj->getFullBalance(), 70*COIN);
+   scrobj = wlt.getScrAddrObjByKey(scraddrs[2]);
+   EXPECT_EQ(scrobj->getFullBalance(), 20*COIN);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+TEST_F(BlockDir, UpdateOneBlockAtATime_Preallocated)
+{
+   BlockDataManagerConfig config;
+   config.armoryDbType = ARMORY_DB_BARE;
+   config.pruneType = DB_PRUNE_NONE;
+   config.blkFileLocation = blkdir_;
+   config.levelDBLocation = ldbdir_;
+   
+   config.genesisBlockHash = READHEX(MAINNET_GENESIS_HASH_HEX);
+   config.genesisTxHash = READHEX(MAINNET_GENESIS_TX_HASH_HEX);
+   config.magicBytes = READHEX(MAINNET_MAGIC_BYTES);
+
+   //Core preallocates blk files in zero filled chunks and writes blocks 
+   //over the padding. Pad with more than the tail reader buffers
+   setBlocks({ "0", "1", "2" }, blk0dat_);
+   uint64_t dataEnd = BtcUtils::GetFileSize(blk0dat_);
+   {
+      std::ofstream o(blk0dat_, ios::app | ios::binary);
+      const std::string padding(6 * 1024 * 1024, '\0');
+      o.write(padding.c_str(), padding.size());
+   }
+
+   BlockDataManager_LevelDB bdm(config);
+   bdm.openDatabase();
+   
+   const std::vector<BinaryData> scraddrs
+   {
+      TestChain::scrAddrA, TestChain::scrAddrB, TestChain::scrAddrC
+   };
+
+   BlockDataViewer bdv(&bdm);
+   BtcWallet& wlt = *bdv.registerWallet(scraddrs, "wallet1", false);
+   
+   bdm.doInitialSyncOnLoad( nullProgress ); 
+   bdv.scanWallets();
+   EXPECT_EQ(bdm.getTopBlockHeight(), 2);
+
+   //nothing but padding
+   EXPECT_EQ(bdm.readBlkFileUpdate(), 0);
+
+   //write all but the last missingBytes of the block
+   auto writeBlock = [&](const std::string& name, size_t missingBytes)->void
+   {
+      BinaryData blk;
+      std::ifstream is("../reorgTest/blk_" + name + ".dat", 
+         ios::binary | ios::ate);
+      blk.resize((size_t)is.tellg());
+      is.seekg(0, ios::beg);
+      is.read(blk.getCharPtr(), blk.getSize());
+
+      std::fstream o(blk0dat_, ios::in | ios::out | ios::binary);
+      o.seekp(dataEnd, ios::beg);
+      o.write(blk.getCharPtr(), blk.getSize() - missingBytes);
+      if (missingBytes == 0)
+         dataEnd += blk.getSize();
+   };
+
+   writeBlock("3", 0);
+   EXPECT_EQ(bdm.readBlkFileUpdate(), 3);
+   EXPECT_EQ(bdm.getTopBlockHeight(), 3);
+   bdv.scanWallets(3);
+
+   //the size field is in but the txs are still partly zeros
+   writeBlock("4", 40);
+   EXPECT_EQ(bdm.readBlkFileUpdate(), 0);
+   EXPECT_EQ(bdm.getTopBlockHeight(), 3);
+
+   writeBlock("4", 0);
+   EXPECT_EQ(bdm.readBlkFileUpdate(), 4);
+   EXPECT_EQ(bdm.getTopBlockHeight(), 4);
+   bdv.scanWallets(4);
+
+   writeBlock("5", 0);
+   EXPECT_EQ(bdm.readBlkFileUpdate(), 5);
+   EXPECT_EQ(bdm.getTopBlockHeight(), 5);
+   bdv.scanWallets(5);
+
+   EXPECT_EQ(bdm.readBlkFileUpdate(), 0);
+
+   const ScrAddrObj *scrobj;
+   
+   scrobj = wlt.getScrAddrObjByKey(scraddrs[0]);
+   EXPECT_EQ(scrobj->getFullBalance(), 50*COIN);
+   scrobj = wlt.getScrAddrObjByKey(scraddrs[1]);
+   EXPECT_EQ(scrobj->getFullBalance(), 70*COIN);
+   scrobj = wlt.getScrAddrObjByKey(scraddrs[2]);
+   EXPECT_EQ(scrobj->getFullBalance(), 20*COIN);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+TEST_F(BlockDir, DISABLED_SingleBlockUpdateLatency)
+{
+   BlockDataManagerConfig config;
+   config.armoryDbType = ARMORY_DB_BARE;
+   config.pruneType = DB_PRUNE_NONE;
+   config.blkFileLocation = blkdir_;
+   config.levelDBLocation = ldbdir_;
+   
+   config.genesisBlockHash = READHEX(MAINNET_GENESIS_HASH_HEX);
+   config.genesisTxHash = READHEX(MAINNET_GENESIS_TX_HASH_HEX);
+   config.magicBytes = READHEX(MAINNET_MAGIC_BYTES);
+
+   const std::vector<BinaryData> scraddrs
+   {
+      TestChain::scrAddrA, TestChain::scrAddrB, TestChain::scrAddrC
+   };
+
+   //The test chain is only 6 blocks long. Give organize() a header map to go
+   //over with a stale branch off block 1, at minimum difficulty so that it
+   //never overtakes the main chain
+   const unsigned nForks = 100000;
+   BinaryData rawFork;
+   {
+      std::ifstream is("../reorgTest/blk_1.dat", ios::binary);
+      rawFork.resize(HEADER_SIZE);
+      is.seekg(8, ios::beg);
+      is.read(rawFork.getCharPtr(), HEADER_SIZE);
+   }
+
+   vector<BlockHeader> forks;
+   BinaryData prevHash = BtcUtils::getHash256(rawFork);
+   for (unsigned i = 0; i < nForks; i++)
+   {
+      memcpy(rawFork.getPtr() + 4, prevHash.getPtr(), 32);
+      memcpy(rawFork.getPtr() + 72, READHEX("ffff7f20").getPtr(), 4);
+      forks.push_back(BlockHeader(rawFork));
+      prevHash = forks.back().getThisHash();
+   }
+
+   //setting a test callback forces the full update
+   const unsigned nRuns = 10;
+   typedef chrono::duration<double, milli> ms;
+   for (unsigned fullUpdate = 0; fullUpdate < 2; fullUpdate++)
+   {
+      BlockDataManager_LevelDB::BlkFileUpdateCallbacks callbacks;
+      if (fullUpdate)
+         callbacks.headersRead = [](void)->void {};
 
-   BlockDataViewer bdv(&bdm);
-   BtcWallet& wlt = *bdv.registerWallet(scraddrs, "wallet1", false);
-   
-   bdm.doInitialSyncOnLoad( nullProgress ); 
-   bdv.scanWallets();
- 
-   std::string blk1dat = BtcUtils::getBlkFilename(blkdir_, 1);
-   appendBlocks({ "2", "4", "3", "5" }, blk0dat_);
-   bdm.readBlkFileUpdate();
-   bdv.scanWallets();
+      double total = 0, worst = 0;
+      for (unsigned i = 0; i < nRuns; i++)
+      {
+         rmdir(ldbdir_ + "/*");
+         setBlocks({ "0", "1", "2", "3", "4" }, blk0dat_);
 
-   // we should get the same balance as we do for test 'Load5Blocks'
-   const ScrAddrObj *scrobj;
-   
-   scrobj = wlt.getScrAddrObjByKey(scraddrs[0]);
-   EXPECT_EQ(scrobj->getFullBalance(), 50*COIN);
-   scrobj = wlt.getScrAddrObjByKey(scraddrs[1]);
-   EXPECT_EQ(scrobj->getFullBalance(), 70*COIN);
-   scrobj = wlt.getScrAddrObjByKey(scraddrs[2]);
-   EXPECT_EQ(scrobj->getFullBalance(), 20*COIN);
+         BlockDataManager_LevelDB bdm(config);
+         bdm.openDatabase();
+
+         BlockDataViewer bdv(&bdm);
+         bdv.registerWallet(scraddrs, "wallet1", false);
+         bdm.doInitialSyncOnLoad(nullProgress);
+         bdv.scanWallets();
+
+         for (auto& fork : forks)
+            bdm.blockchain().addBlock(fork.getThisHash(), fork, true);
+         bdm.blockchain().organize();
+
+         appendBlocks({ "5" }, blk0dat_);
+
+         auto start = chrono::steady_clock::now();
+         EXPECT_EQ(bdm.readBlkFileUpdate(callbacks), 5);
+         double elapsed = ms(chrono::steady_clock::now() - start).count();
+
+         total += elapsed;
+         worst = max(worst, elapsed);
+      }
+
+      cout << (fullUpdate ? "full update: " : "tail update: ")
+           << total / nRuns << " ms avg, " << worst << " ms worst, "
+           << nForks << " stale headers" << endl;
+   }
 }
 
 
@@ -7996,6 +9552,124 @@ TEST_F(BlockUtilsBare, Load6Blocks)
    EXPECT_EQ(wltLB2->getFullBalance(), 30*COIN);
 }
 
+////////////////////////////////////////////////////////////////////////////////
+TEST_F(BlockUtilsBare, Load6Blocks_UTXOCursor)
+{
+   vector<BinaryData> scrAddrVec;
+   scrAddrVec.push_back(TestChain::scrAddrA);
+   scrAddrVec.push_back(TestChain::scrAddrB);
+   scrAddrVec.push_back(TestChain::scrAddrC);
+   scrAddrVec.push_back(TestChain::scrAddrD);
+   scrAddrVec.push_back(TestChain::scrAddrE);
+   scrAddrVec.push_back(TestChain::scrAddrF);
+   BtcWallet* wlt;
+   regWallet(scrAddrVec, "wallet1", theBDV, &wlt);
+
+   TheBDM.doInitialSyncOnLoad(nullProgress);
+   theBDV->scanWallets();
+
+   size_t utxoCount = wlt->getSpendableTxOutListForValue().size();
+   ASSERT_GT(utxoCount, 2);
+
+   //oldest first
+   UTXOCursor ageCursor(wlt, UTXOCursor::UTXO_ORDER_AGE, 2);
+   UnspentTxOut utxo;
+   uint32_t lastHeight = 0;
+   while (ageCursor.getNext(utxo))
+   {
+      EXPECT_GE(utxo.getTxHeight(), lastHeight);
+      lastHeight = utxo.getTxHeight();
+   }
+   EXPECT_EQ(ageCursor.getStreamedCount(), utxoCount);
+   EXPECT_EQ(ageCursor.getStreamedValue(), 240 * COIN);
+
+   //biggest first, over several batches
+   UTXOCursor valueCursor(wlt, UTXOCursor::UTXO_ORDER_VALUE, 2);
+   uint64_t lastValue = UINT64_MAX;
+   uint64_t topValue = 0;
+   while (valueCursor.getNext(utxo))
+   {
+      EXPECT_LE(utxo.getValue(), lastValue);
+      lastValue = utxo.getValue();
+      topValue = max(topValue, lastValue);
+   }
+   EXPECT_EQ(valueCursor.getStreamedCount(), utxoCount);
+   EXPECT_EQ(valueCursor.getStreamedValue(), 240 * COIN);
+
+   //the window size doesn't change the order
+   UTXOCursor oneCursor(wlt, UTXOCursor::UTXO_ORDER_VALUE, 1);
+   UTXOCursor allCursor(wlt, UTXOCursor::UTXO_ORDER_VALUE, 1000);
+   auto&& oneBatch = oneCursor.getUTXOsForValue(UINT64_MAX);
+   auto&& allBatch = allCursor.getUTXOsForValue(UINT64_MAX);
+   ASSERT_EQ(oneBatch.size(), utxoCount);
+   ASSERT_EQ(allBatch.size(), utxoCount);
+   for (size_t i = 0; i < utxoCount; i++)
+   {
+      EXPECT_EQ(oneBatch[i].getTxHash(), allBatch[i].getTxHash());
+      EXPECT_EQ(oneBatch[i].getTxOutIndex(), allBatch[i].getTxOutIndex());
+   }
+
+   //coin selection stops once the target is covered
+   valueCursor.reset();
+   auto&& utxoVec = valueCursor.getUTXOsForValue(topValue + 1);
+   ASSERT_EQ(utxoVec.size(), 2);
+   EXPECT_EQ(utxoVec[0].getValue(), topValue);
+   EXPECT_LT(valueCursor.getStreamedCount(), utxoCount);
+
+   //scrAddr dropped from the wallet mid iteration: its UTXOs past the pages 
+   //already fetched are skipped, the cursor doesn't hold on to it
+   ageCursor.reset();
+   ASSERT_TRUE(ageCursor.getNext(utxo));
+   wlt->getScrAddrMap().erase(TestChain::scrAddrB);
+   while (ageCursor.getNext(utxo));
+   EXPECT_LE(ageCursor.getStreamedCount(), utxoCount);
+   EXPECT_GT(ageCursor.getStreamedCount(), 0);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+TEST_F(BlockUtilsBare, Load6Blocks_BlockFilters)
+{
+   vector<BinaryData> scrAddrVec;
+   scrAddrVec.push_back(TestChain::scrAddrA);
+   BtcWallet* wlt;
+   regWallet(scrAddrVec, "wallet1", theBDV, &wlt);
+
+   TheBDM.doInitialSyncOnLoad(nullProgress);
+   theBDV->scanWallets();
+
+   vector<BinaryDataRef> scrAddrB;
+   scrAddrB.push_back(TestChain::scrAddrB.getRef());
+   BlockFilter::Query queryB(scrAddrB);
+
+   BinaryData unknownScrAddr = 
+      HASH160PREFIX + BtcUtils::getHash160(READHEX("deadbeef"));
+   vector<BinaryDataRef> scrAddrUnknown;
+   scrAddrUnknown.push_back(unknownScrAddr.getRef());
+   BlockFilter::Query queryUnknown(scrAddrUnknown);
+
+   //the scan filters every block, whether it was relevant to wallet1 or not
+   uint32_t top = TheBDM.blockchain().top().getBlockHeight();
+   uint32_t blocksWithB = 0;
+
+   LMDBEnv::Transaction tx(iface_->dbEnv_[BLKDATA].get(), LMDB::ReadOnly);
+   LMDBEnv::Transaction txHeaders(
+      iface_->dbEnv_[HEADERS].get(), LMDB::ReadOnly);
+   for (uint32_t height = 0; height <= top; height++)
+   {
+      uint8_t dup = iface_->getValidDupIDForHeight(height);
+      BinaryDataRef filter = iface_->getValueNoCopy(
+         BLKDATA, DBUtils::getBlkFilterKey(height, dup));
+      BinaryData blockHash = iface_->getHashForDBKey(height, dup);
+
+      ASSERT_NE(filter.getSize(), 0);
+      blocksWithB += BlockFilter::matchAny(filter, blockHash, queryB);
+      EXPECT_FALSE(BlockFilter::matchAny(filter, blockHash, queryUnknown));
+   }
+
+   EXPECT_GT(blocksWithB, 0);
+   EXPECT_LT(blocksWithB, top + 1);
+}
+
 ////////////////////////////////////////////////////////////////////////////////
 TEST_F(BlockUtilsBare, Load5Blocks_DamagedBlkFile)
 {
@@ -8062,44 +9736,539 @@ TEST_F(BlockUtilsBare, Load4Blocks_Plus2)
    scrObj = wlt->getScrAddrObjByKey(TestChain::scrAddrF);
    EXPECT_EQ(scrObj->getFullBalance(),  5*COIN);
 
-   scrObj = wltLB1->getScrAddrObjByKey(TestChain::lb1ScrAddr);
-   EXPECT_EQ(scrObj->getFullBalance(), 10*COIN);
-   scrObj = wltLB1->getScrAddrObjByKey(TestChain::lb1ScrAddrP2SH);
-   EXPECT_EQ(scrObj->getFullBalance(),  0*COIN);
-   scrObj = wltLB2->getScrAddrObjByKey(TestChain::lb2ScrAddr);
-   EXPECT_EQ(scrObj->getFullBalance(), 10*COIN);
-   scrObj = wltLB2->getScrAddrObjByKey(TestChain::lb2ScrAddrP2SH);
-   EXPECT_EQ(scrObj->getFullBalance(),  5*COIN);
+   scrObj = wltLB1->getScrAddrObjByKey(TestChain::lb1ScrAddr);
+   EXPECT_EQ(scrObj->getFullBalance(), 10*COIN);
+   scrObj = wltLB1->getScrAddrObjByKey(TestChain::lb1ScrAddrP2SH);
+   EXPECT_EQ(scrObj->getFullBalance(),  0*COIN);
+   scrObj = wltLB2->getScrAddrObjByKey(TestChain::lb2ScrAddr);
+   EXPECT_EQ(scrObj->getFullBalance(), 10*COIN);
+   scrObj = wltLB2->getScrAddrObjByKey(TestChain::lb2ScrAddrP2SH);
+   EXPECT_EQ(scrObj->getFullBalance(),  5*COIN);
+
+   // Load the remaining blocks.
+   setBlocks({ "0", "1", "2", "3", "4", "5" }, blk0dat_);
+   TheBDM.readBlkFileUpdate();
+   theBDV->scanWallets();
+   EXPECT_EQ(iface_->getTopBlockHeight(HEADERS), 5);
+   EXPECT_EQ(iface_->getTopBlockHash(HEADERS), TestChain::blkHash5);
+   EXPECT_TRUE(TheBDM.blockchain().getHeaderByHash(TestChain::blkHash5).isMainBranch());
+
+   scrObj = wlt->getScrAddrObjByKey(TestChain::scrAddrA);
+   EXPECT_EQ(scrObj->getFullBalance(), 50*COIN);
+   scrObj = wlt->getScrAddrObjByKey(TestChain::scrAddrB);
+   EXPECT_EQ(scrObj->getFullBalance(), 70*COIN);
+   scrObj = wlt->getScrAddrObjByKey(TestChain::scrAddrC);
+   EXPECT_EQ(scrObj->getFullBalance(), 20*COIN);
+   scrObj = wlt->getScrAddrObjByKey(TestChain::scrAddrD);
+   EXPECT_EQ(scrObj->getFullBalance(), 65*COIN);
+   scrObj = wlt->getScrAddrObjByKey(TestChain::scrAddrE);
+   EXPECT_EQ(scrObj->getFullBalance(), 30*COIN);
+   scrObj = wlt->getScrAddrObjByKey(TestChain::scrAddrF);
+   EXPECT_EQ(scrObj->getFullBalance(),  5*COIN);
+
+   scrObj = wltLB1->getScrAddrObjByKey(TestChain::lb1ScrAddr);
+   EXPECT_EQ(scrObj->getFullBalance(), 5*COIN);
+   scrObj = wltLB1->getScrAddrObjByKey(TestChain::lb1ScrAddrP2SH);
+   EXPECT_EQ(scrObj->getFullBalance(), 25*COIN);
+   scrObj = wltLB2->getScrAddrObjByKey(TestChain::lb2ScrAddr);
+   EXPECT_EQ(scrObj->getFullBalance(), 30*COIN);
+   scrObj = wltLB2->getScrAddrObjByKey(TestChain::lb2ScrAddrP2SH);
+   EXPECT_EQ(scrObj->getFullBalance(), 0*COIN);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+TEST_F(BlockUtilsBare, Load4Blocks_Plus2_OnlyTouchedWallets)
+{
+   vector<BinaryData> scrAddrVec1;
+   scrAddrVec1.push_back(TestChain::scrAddrB);
+   scrAddrVec1.push_back(TestChain::scrAddrC);
+   scrAddrVec1.push_back(TestChain::scrAddrD);
+
+   vector<BinaryData> scrAddrVec2;
+   scrAddrVec2.push_back(TestChain::scrAddrA);
+   scrAddrVec2.push_back(TestChain::scrAddrE);
+
+   BtcWallet* wlt1;
+   BtcWallet* wlt2;
+   regWallet(scrAddrVec1, "wallet1", theBDV, &wlt1);
+   regWallet(scrAddrVec2, "wallet2", theBDV, &wlt2);
+
+   setBlocks({ "0", "1", "2", "3" }, blk0dat_);
+   TheBDM.doInitialSyncOnLoad(nullProgress);
+   theBDV->scanWallets();
+
+   EXPECT_EQ(wlt1->getFullBalance(), 90 * COIN);
+   EXPECT_EQ(wlt2->getFullBalance(), 80 * COIN);
+   const size_t wlt2LedgerSize = wlt2->getHistoryPage(0).size();
+
+   //nothing applied yet
+   EXPECT_EQ(TheBDM.getScrAddrTouchedByUpdate(4, 6), nullptr);
+
+   //blocks 4 and 5 pay to and spend from B, C and D, A and E are left alone
+   setBlocks({ "0", "1", "2", "3", "4", "5" }, blk0dat_);
+   uint32_t prevTopBlk = TheBDM.readBlkFileUpdate();
+   EXPECT_EQ(prevTopBlk, 4);
+
+   EXPECT_EQ(TheBDM.getScrAddrTouchedByUpdate(4, 5), nullptr);
+   const set<BinaryData>* touched = TheBDM.getScrAddrTouchedByUpdate(4, 6);
+   ASSERT_NE(touched, nullptr);
+   EXPECT_EQ(touched->count(TestChain::scrAddrB), 1);
+   EXPECT_EQ(touched->count(TestChain::scrAddrC), 1);
+   EXPECT_EQ(touched->count(TestChain::scrAddrD), 1);
+   EXPECT_EQ(touched->count(TestChain::scrAddrA), 0);
+   EXPECT_EQ(touched->count(TestChain::scrAddrE), 0);
+
+   theBDV->scanWallets(prevTopBlk);
+
+   const ScrAddrObj* scrObj;
+   scrObj = wlt1->getScrAddrObjByKey(TestChain::scrAddrB);
+   EXPECT_EQ(scrObj->getFullBalance(), 70 * COIN);
+   scrObj = wlt1->getScrAddrObjByKey(TestChain::scrAddrC);
+   EXPECT_EQ(scrObj->getFullBalance(), 20 * COIN);
+   scrObj = wlt1->getScrAddrObjByKey(TestChain::scrAddrD);
+   EXPECT_EQ(scrObj->getFullBalance(), 65 * COIN);
+   EXPECT_EQ(wlt1->getFullBalance(), 155 * COIN);
+
+   scrObj = wlt2->getScrAddrObjByKey(TestChain::scrAddrA);
+   EXPECT_EQ(scrObj->getFullBalance(), 50 * COIN);
+   scrObj = wlt2->getScrAddrObjByKey(TestChain::scrAddrE);
+   EXPECT_EQ(scrObj->getFullBalance(), 30 * COIN);
+   EXPECT_EQ(wlt2->getFullBalance(), 80 * COIN);
+   EXPECT_EQ(wlt2->getHistoryPage(0).size(), wlt2LedgerSize);
+
+   //nothing new on the next update
+   EXPECT_EQ(TheBDM.readBlkFileUpdate(), 0);
+   EXPECT_EQ(TheBDM.getScrAddrTouchedByUpdate(4, 6), nullptr);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+TEST_F(BlockUtilsBare, Load4Blocks_Plus2_ManyWallets)
+{
+   //one wallet per scrAddr, scanned side by side
+   BlockDataManagerConfig scanConfig = TheBDM.config();
+   scanConfig.walletScanThreads = 4;
+   TheBDM.setConfig(scanConfig);
+
+   const vector<BinaryData> scrAddrVec = {
+      TestChain::scrAddrA, TestChain::scrAddrB, TestChain::scrAddrC,
+      TestChain::scrAddrD, TestChain::scrAddrE, TestChain::scrAddrF };
+
+   vector<BtcWallet*> wallets(scrAddrVec.size());
+   for (size_t i = 0; i < scrAddrVec.size(); i++)
+   {
+      regWallet(vector<BinaryData>{ scrAddrVec[i] }, 
+         "wallet" + to_string(i), theBDV, &wallets[i]);
+   }
+
+   setBlocks({ "0", "1", "2", "3" }, blk0dat_);
+   TheBDM.doInitialSyncOnLoad(nullProgress);
+   theBDV->scanWallets();
+
+   vector<uint64_t> balances3 = { 50, 30, 55, 5, 30, 5 };
+   for (size_t i = 0; i < wallets.size(); i++)
+      EXPECT_EQ(wallets[i]->getFullBalance(), balances3[i] * COIN);
+
+   setBlocks({ "0", "1", "2", "3", "4", "5" }, blk0dat_);
+   uint32_t prevTopBlk = TheBDM.readBlkFileUpdate();
+   theBDV->scanWallets(prevTopBlk);
+
+   vector<uint64_t> balances5 = { 50, 70, 20, 65, 30, 5 };
+   for (size_t i = 0; i < wallets.size(); i++)
+      EXPECT_EQ(wallets[i]->getFullBalance(), balances5[i] * COIN);
+
+   //the global ledger has every wallet's entries, sorted
+   size_t nEntries = 0;
+   for (auto wlt : wallets)
+      nEntries += wlt->getHistoryPage(0).size();
+
+   auto globalLedger = theBDV->getWalletsHistoryPage(0, false, false);
+   EXPECT_EQ(globalLedger.size(), nEntries);
+   EXPECT_TRUE(is_sorted(globalLedger.begin(), globalLedger.end(),
+      LedgerEntry_DescendingOrder()));
+
+   //and is the same on a rescan
+   theBDV->scanWallets(0);
+   auto globalLedger2 = theBDV->getWalletsHistoryPage(0, false, false);
+   ASSERT_EQ(globalLedger2.size(), globalLedger.size());
+   for (size_t i = 0; i < globalLedger.size(); i++)
+   {
+      EXPECT_EQ(globalLedger2[i].getTxHash(), globalLedger[i].getTxHash());
+      EXPECT_EQ(globalLedger2[i].getValue(), globalLedger[i].getValue());
+   }
+}
+
+////////////////////////////////////////////////////////////////////////////////
+TEST_F(BlockUtilsBare, Load4Blocks_Plus2_Snapshot)
+{
+   BtcWallet* wlt;
+   regWallet(vector<BinaryData>{ TestChain::scrAddrB }, "wallet1", theBDV, &wlt);
+
+   setBlocks({ "0", "1", "2", "3" }, blk0dat_);
+   TheBDM.doInitialSyncOnLoad(nullProgress);
+   theBDV->scanWallets();
+   EXPECT_EQ(wlt->getFullBalance(), 30 * COIN);
+
+   mutex mu;
+   condition_variable cv;
+   bool pinned = false, updated = false;
+   BinaryData newTxHash;
+
+   struct SnapshotReads
+   {
+      uint32_t appliedToHgt_ = 0;
+      uint64_t unspent_ = 0;
+      bool foundNewTx_ = false;
+   };
+   SnapshotReads before, during, after;
+
+   auto read = [this, &newTxHash](SnapshotReads& reads)->void
+   {
+      StoredDBInfo sdbi;
+      iface_->getStoredDBInfo(HISTORY, sdbi);
+      reads.appliedToHgt_ = sdbi.appliedToHgt_;
+
+      StoredScriptHistory ssh;
+      iface_->getStoredScriptHistorySummary(ssh, TestChain::scrAddrB);
+      reads.unspent_ = ssh.totalUnspent_;
+
+      BinaryData dbKey;
+      if (newTxHash.getSize() > 0)
+         reads.foundNewTx_ = 
+            iface_->getStoredTx_byHash(newTxHash, nullptr, &dbKey);
+   };
+
+   //a reader holds a snapshot while the next blocks are committed
+   thread reader([&](void)->void
+   {
+      {
+         DBSnapshot snapshot(iface_);
+         read(before);
+
+         unique_lock<mutex> lock(mu);
+         pinned = true;
+         cv.notify_all();
+         while (!updated)
+            cv.wait(lock);
+         lock.unlock();
+
+         read(during);
+      }
+
+      read(after);
+   });
+
+   {
+      unique_lock<mutex> lock(mu);
+      while (!pinned)
+         cv.wait(lock);
+   }
+
+   setBlocks({ "0", "1", "2", "3", "4", "5" }, blk0dat_);
+   uint32_t prevTopBlk = TheBDM.readBlkFileUpdate();
+   theBDV->scanWallets(prevTopBlk);
+   EXPECT_EQ(wlt->getFullBalance(), 70 * COIN);
+
+   const ScrAddrObj* scrObj = wlt->getScrAddrObjByKey(TestChain::scrAddrB);
+   ASSERT_GT(scrObj->getTxLedger().size(), 0);
+   const LedgerEntry& le = scrObj->getTxLedger().rbegin()->second;
+   EXPECT_EQ(le.getBlockNum(), 5);
+
+   {
+      lock_guard<mutex> lock(mu);
+      newTxHash = le.getTxHash();
+      updated = true;
+      cv.notify_all();
+   }
+   reader.join();
+
+   EXPECT_EQ(before.appliedToHgt_, 4);
+   EXPECT_EQ(before.unspent_, 30 * COIN);
+
+   //the snapshot didn't move
+   EXPECT_EQ(during.appliedToHgt_, before.appliedToHgt_);
+   EXPECT_EQ(during.unspent_, before.unspent_);
+   EXPECT_FALSE(during.foundNewTx_);
+
+   EXPECT_EQ(after.appliedToHgt_, 6);
+   EXPECT_EQ(after.unspent_, 70 * COIN);
+   EXPECT_TRUE(after.foundNewTx_);
+
+   //a narrow snapshot only pins the envs it was given
+   {
+      DBSnapshot snapshot(iface_, { BLKDATA, TXHINTS });
+      BinaryData dbKey;
+      EXPECT_TRUE(iface_->getStoredTx_byHash(newTxHash, nullptr, &dbKey));
+      EXPECT_EQ(theBDV->getTxByHash(newTxHash).getThisHash(), newTxHash);
+
+      EXPECT_THROW(LMDBEnv::Transaction(
+         iface_->dbEnv_[TXHINTS].get(), LMDB::ReadWrite), LMDBException);
+      LMDBEnv::Transaction tx(iface_->dbEnv_[HISTORY].get(), LMDB::ReadWrite);
+   }
+}
+
+////////////////////////////////////////////////////////////////////////////////
+TEST_F(BlockUtilsBare, Load6Blocks_QueryServer)
+{
+   const vector<BinaryData> scrAddrVec = {
+      TestChain::scrAddrA, TestChain::scrAddrB, TestChain::scrAddrC,
+      TestChain::scrAddrD, TestChain::scrAddrE, TestChain::scrAddrF };
+
+   BtcWallet* wlt;
+   regWallet(scrAddrVec, "wallet1", theBDV, &wlt);
+
+   TheBDM.doInitialSyncOnLoad(nullProgress);
+   theBDV->scanWallets();
+
+   //what the BDV has to say, to check the query server against
+   vector<uint64_t> balances;
+   vector<size_t> ledgerSizes;
+   for (auto& scrAddr : scrAddrVec)
+   {
+      const ScrAddrObj* scrObj = wlt->getScrAddrObjByKey(scrAddr);
+      balances.push_back(scrObj->getFullBalance());
+      ledgerSizes.push_back(scrObj->getTxLedger().size());
+   }
+
+   const ScrAddrObj* scrObjB = wlt->getScrAddrObjByKey(TestChain::scrAddrB);
+   ASSERT_GT(scrObjB->getTxLedger().size(), 1);
+   const LedgerEntry& leB = scrObjB->getTxLedger().rbegin()->second;
+   BinaryData txHash = leB.getTxHash();
+   BinaryData rawTx = theBDV->getTxByHash(txHash).serialize();
+   size_t utxoCountB = scrObjB->getFullTxOutList(UINT32_MAX).size();
+
+   //the databases are closed by the writer, the query server opens them read
+   //only
+   delete theBDV;
+   delete theBDM;
+   theBDV = nullptr;
+   theBDM = nullptr;
+
+   LMDBBlockDatabase db([](void)->bool { return true; },
+      make_shared<vector<BlkFile>>());
+   db.openDatabasesReadOnly(ldbdir_, ghash_, gentx_, magic_);
+   EXPECT_EQ(db.getDbType(), ARMORY_DB_BARE);
+   EXPECT_THROW(LMDBEnv::Transaction(
+      db.dbEnv_[HISTORY].get(), LMDB::ReadWrite), LMDBException);
+
+   auto countOf = [](const string& str, const string& what)->size_t
+   {
+      size_t count = 0;
+      for (size_t pos = str.find(what); pos != string::npos;
+         pos = str.find(what, pos + what.size()))
+         count++;
+      return count;
+   };
+
+   {
+      QueryServer server(&db, blkdir_, 4);
+      EXPECT_EQ(server.getTopBlockHeight(), 5);
+      EXPECT_FALSE(server.refreshChainState());
+
+      vector<string> requests;
+      for (size_t i = 0; i < scrAddrVec.size(); i++)
+      {
+         const string scrAddrHex = scrAddrVec[i].toHexStr();
+
+         string reply = server.processRequest("getBalance " + scrAddrHex);
+         requests.push_back("getBalance " + scrAddrHex);
+         EXPECT_NE(reply.find("\"balance\":" + to_string(balances[i])),
+            string::npos) << reply;
+
+         reply = server.processRequest("getHistoryPage " + scrAddrHex + " 0");
+         requests.push_back("getHistoryPage " + scrAddrHex + " 0");
+         EXPECT_EQ(countOf(reply, "\"txHash\""), ledgerSizes[i]) << reply;
+         EXPECT_NE(reply.find("\"pageCount\":1"), string::npos);
+      }
+
+      string reply = server.processRequest(
+         "getUTXOs " + TestChain::scrAddrB.toHexStr());
+      EXPECT_EQ(countOf(reply, "\"txOutIndex\""), utxoCountB);
+
+      const string txHashHex = txHash.copySwapEndian().toHexStr();
+      reply = server.processRequest("getTx " + txHashHex);
+      EXPECT_NE(reply.find("\"raw\":\"" + rawTx.toHexStr() + "\""),
+         string::npos) << reply;
+      requests.push_back("getTx " + txHashHex);
+
+      //bad requests get an error back
+      EXPECT_EQ(server.processRequest("getTx zz").find("{\"error\""), 0);
+      EXPECT_EQ(server.processRequest("getBlock 00").find("{\"error\""), 0);
+      EXPECT_EQ(server.processRequest("getHistoryPage " + 
+         TestChain::scrAddrB.toHexStr() + " 1").find("{\"error\""), 0);
+      EXPECT_EQ(server.processRequest("getTx " +
+         BtcUtils::EmptyHash().toHexStr()).find("{\"error\""), 0);
+
+      //the same replies from several threads at once
+      vector<string> expected;
+      for (auto& request : requests)
+         expected.push_back(server.processRequest(request));
+
+      atomic<unsigned> mismatches(0);
+      vector<thread> threads;
+      for (unsigned i = 0; i < 4; i++)
+      {
+         threads.push_back(thread([&, i](void)->void
+         {
+            for (size_t y = 0; y < 50; y++)
+            {
+               size_t id = (y + i) % requests.size();
+               if (server.processRequest(requests[id]) != expected[id])
+                  mismatches.fetch_add(1);
+            }
+         }));
+      }
+
+      for (auto& t : threads)
+         t.join();
+      EXPECT_EQ(mismatches.load(), 0);
+
+#ifndef _WIN32
+      //a file that isn't a socket is left alone
+      const string filePath = ldbdir_ + "/queryd.notsock";
+      {
+         ofstream os(filePath);
+         os << "not a socket";
+      }
+      EXPECT_FALSE(server.start(filePath));
+      EXPECT_NE(BtcUtils::GetFileSize(filePath), FILE_DOES_NOT_EXIST);
+      unlink(filePath.c_str());
+
+      //and over the socket
+      const string socketPath = ldbdir_ + "/queryd.sock";
+      ASSERT_TRUE(server.start(socketPath));
+
+      //only the owner gets in, and a running server keeps its socket
+      struct stat st;
+      ASSERT_EQ(stat(socketPath.c_str(), &st), 0);
+      EXPECT_EQ(st.st_mode & 077, 0);
+      {
+         QueryServer other(&db, blkdir_, 1);
+         EXPECT_FALSE(other.start(socketPath));
+      }
+
+      sockaddr_un addr;
+      memset(&addr, 0, sizeof(addr));
+      addr.sun_family = AF_UNIX;
+      strncpy(addr.sun_path, socketPath.c_str(), sizeof(addr.sun_path) - 1);
+
+      //more idle clients than threads don't keep the next one waiting
+      vector<int> idleFds;
+      for (unsigned i = 0; i < 8; i++)
+      {
+         int idleFd = socket(AF_UNIX, SOCK_STREAM, 0);
+         ASSERT_GE(idleFd, 0);
+         ASSERT_EQ(connect(idleFd, (sockaddr*)&addr, sizeof(addr)), 0);
+         idleFds.push_back(idleFd);
+      }
+
+      int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+      ASSERT_GE(fd, 0);
+      ASSERT_EQ(connect(fd, (sockaddr*)&addr, sizeof(addr)), 0);
+
+      //fail rather than hang if it is starved
+      timeval timeout = { 10, 0 };
+      setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+
+      const string lines = requests[0] + "\n" + requests.back() + "\r\n";
+      ASSERT_EQ(send(fd, lines.c_str(), lines.size(), 0), (ssize_t)lines.size());
+
+      string replies;
+      char buf[4096];
+      while (countOf(replies, "\n") < 2)
+      {
+         ssize_t n = recv(fd, buf, sizeof(buf), 0);
+         ASSERT_GT(n, 0);
+         replies.append(buf, n);
+      }
+      EXPECT_EQ(replies, expected[0] + "\n" + expected.back() + "\n");
+
+      //the same connection keeps being served
+      const string again = requests[1] + "\n";
+      ASSERT_EQ(send(fd, again.c_str(), again.size(), 0), (ssize_t)again.size());
+      replies.clear();
+      while (countOf(replies, "\n") < 1)
+      {
+         ssize_t n = recv(fd, buf, sizeof(buf), 0);
+         ASSERT_GT(n, 0);
+         replies.append(buf, n);
+      }
+      EXPECT_EQ(replies, expected[1] + "\n");
+
+      close(fd);
+      for (auto idleFd : idleFds)
+         close(idleFd);
+      server.stop();
+
+      //a socket left over by a server that died gets replaced
+      fd = socket(AF_UNIX, SOCK_STREAM, 0);
+      ASSERT_GE(fd, 0);
+      ASSERT_EQ(::bind(fd, (sockaddr*)&addr, sizeof(addr)), 0);
+      close(fd);
+      EXPECT_TRUE(server.start(socketPath));
+      server.stop();
+#endif
+   }
+
+   db.closeDatabases();
+}
+
+////////////////////////////////////////////////////////////////////////////////
+// Throughput of processRequest from several threads, no sockets involved
+TEST_F(BlockUtilsBare, DISABLED_Load6Blocks_QueryServerLoad)
+{
+   const vector<BinaryData> scrAddrVec = {
+      TestChain::scrAddrA, TestChain::scrAddrB, TestChain::scrAddrC,
+      TestChain::scrAddrD, TestChain::scrAddrE, TestChain::scrAddrF };
+
+   BtcWallet* wlt;
+   regWallet(scrAddrVec, "wallet1", theBDV, &wlt);
 
-   // Load the remaining blocks.
-   setBlocks({ "0", "1", "2", "3", "4", "5" }, blk0dat_);
-   TheBDM.readBlkFileUpdate();
+   TheBDM.doInitialSyncOnLoad(nullProgress);
    theBDV->scanWallets();
-   EXPECT_EQ(iface_->getTopBlockHeight(HEADERS), 5);
-   EXPECT_EQ(iface_->getTopBlockHash(HEADERS), TestChain::blkHash5);
-   EXPECT_TRUE(TheBDM.blockchain().getHeaderByHash(TestChain::blkHash5).isMainBranch());
 
-   scrObj = wlt->getScrAddrObjByKey(TestChain::scrAddrA);
-   EXPECT_EQ(scrObj->getFullBalance(), 50*COIN);
-   scrObj = wlt->getScrAddrObjByKey(TestChain::scrAddrB);
-   EXPECT_EQ(scrObj->getFullBalance(), 70*COIN);
-   scrObj = wlt->getScrAddrObjByKey(TestChain::scrAddrC);
-   EXPECT_EQ(scrObj->getFullBalance(), 20*COIN);
-   scrObj = wlt->getScrAddrObjByKey(TestChain::scrAddrD);
-   EXPECT_EQ(scrObj->getFullBalance(), 65*COIN);
-   scrObj = wlt->getScrAddrObjByKey(TestChain::scrAddrE);
-   EXPECT_EQ(scrObj->getFullBalance(), 30*COIN);
-   scrObj = wlt->getScrAddrObjByKey(TestChain::scrAddrF);
-   EXPECT_EQ(scrObj->getFullBalance(),  5*COIN);
+   delete theBDV;
+   delete theBDM;
+   theBDV = nullptr;
+   theBDM = nullptr;
 
-   scrObj = wltLB1->getScrAddrObjByKey(TestChain::lb1ScrAddr);
-   EXPECT_EQ(scrObj->getFullBalance(), 5*COIN);
-   scrObj = wltLB1->getScrAddrObjByKey(TestChain::lb1ScrAddrP2SH);
-   EXPECT_EQ(scrObj->getFullBalance(), 25*COIN);
-   scrObj = wltLB2->getScrAddrObjByKey(TestChain::lb2ScrAddr);
-   EXPECT_EQ(scrObj->getFullBalance(), 30*COIN);
-   scrObj = wltLB2->getScrAddrObjByKey(TestChain::lb2ScrAddrP2SH);
-   EXPECT_EQ(scrObj->getFullBalance(), 0*COIN);
+   LMDBBlockDatabase db([](void)->bool { return true; },
+      make_shared<vector<BlkFile>>());
+   db.openDatabasesReadOnly(ldbdir_, ghash_, gentx_, magic_);
+
+   vector<string> requests;
+   for (auto& scrAddr : scrAddrVec)
+   {
+      requests.push_back("getBalance " + scrAddr.toHexStr());
+      requests.push_back("getUTXOs " + scrAddr.toHexStr());
+      requests.push_back("getHistoryPage " + scrAddr.toHexStr() + " 0");
+   }
+
+   const size_t nRequests = 20000;
+   for (unsigned nThreads = 1; nThreads <= 8; nThreads *= 2)
+   {
+      QueryServer server(&db, blkdir_, nThreads);
+
+      auto start = chrono::steady_clock::now();
+      vector<thread> threads;
+      for (unsigned i = 0; i < nThreads; i++)
+      {
+         threads.push_back(thread([&, i](void)->void
+         {
+            for (size_t y = i; y < nRequests; y += nThreads)
+               server.processRequest(requests[y % requests.size()]);
+         }));
+      }
+
+      for (auto& t : threads)
+         t.join();
+
+      double seconds = chrono::duration_cast<chrono::duration<double>>(
+         chrono::steady_clock::now() - start).count();
+      cout << nThreads << " threads: " << nRequests / seconds << 
+         " req/s" << endl;
+   }
+
+   db.closeDatabases();
 }
 
 ////////////////////////////////////////////////////////////////////////////////
@@ -9174,6 +11343,63 @@ TEST_F(BlockUtilsBare, Load5Blocks_ForceFullRewhatever)
    EXPECT_EQ(scrObj->getFullBalance(), 0*COIN);
 }
 
+////////////////////////////////////////////////////////////////////////////////
+TEST_F(BlockUtilsBare, Load5Blocks_CoalescedSideScans)
+{
+   BtcWallet* wlt;
+   vector<BinaryData> scrAddrVec;
+   scrAddrVec.push_back(TestChain::scrAddrA);
+   regWallet(scrAddrVec, "wallet1", theBDV, &wlt);
+
+   TheBDM.doInitialSyncOnLoad(nullProgress);
+   theBDV->scanWallets();
+
+   //post initial load registrations, both queue up for a side scan
+   vector<BinaryData> scrAddrVec2;
+   scrAddrVec2.push_back(TestChain::scrAddrB);
+   scrAddrVec2.push_back(TestChain::scrAddrC);
+   BtcWallet* wlt2 = theBDV->registerWallet(scrAddrVec2, "wallet2", false);
+
+   vector<BinaryData> scrAddrVec3;
+   scrAddrVec3.push_back(TestChain::scrAddrE);
+   BtcWallet* wlt3 = theBDV->registerWallet(scrAddrVec3, "wallet3", false);
+
+   EXPECT_EQ(TheBDM.sideScanFlag_, true);
+
+   //a single side scan covers both wallets
+   vector<string> scannedIDs;
+   theBDM->startSideScan(
+      [&scannedIDs](const vector<string>& wltIDs, double prog, unsigned time)
+      { scannedIDs = wltIDs; });
+   EXPECT_EQ(theBDM->getNextWalletIDToScan().size(), 2);
+
+   while (wlt2->getMergeFlag() == false || wlt3->getMergeFlag() == false)
+      usleep(100);
+
+   //nothing left in the queue
+   EXPECT_FALSE(theBDM->startSideScan(
+      [](const vector<string>&, double prog, unsigned time){}));
+   EXPECT_EQ(theBDM->getNextWalletIDToScan().size(), 0);
+   EXPECT_EQ(scannedIDs.size(), 2);
+
+   TheBDM.getScrAddrFilter()->checkForMerge();
+   theBDV->scanWallets();
+
+   const ScrAddrObj* scrObj;
+   scrObj = wlt->getScrAddrObjByKey(TestChain::scrAddrA);
+   EXPECT_EQ(scrObj->getFullBalance(), 50*COIN);
+   scrObj = wlt2->getScrAddrObjByKey(TestChain::scrAddrB);
+   EXPECT_EQ(scrObj->getFullBalance(), 70*COIN);
+   scrObj = wlt2->getScrAddrObjByKey(TestChain::scrAddrC);
+   EXPECT_EQ(scrObj->getFullBalance(), 20*COIN);
+   scrObj = wlt3->getScrAddrObjByKey(TestChain::scrAddrE);
+   EXPECT_EQ(scrObj->getFullBalance(), 30*COIN);
+
+   //each wallet only got its own addresses
+   EXPECT_EQ(wlt2->getScrAddrMap().size(), 2);
+   EXPECT_EQ(wlt3->getScrAddrMap().size(), 1);
+}
+
 ////////////////////////////////////////////////////////////////////////////////
 TEST_F(BlockUtilsBare, Load5Blocks_ScanWhatIsNeeded)
 {
@@ -10329,6 +12555,129 @@ TEST_F(BlockUtilsSuper, Load5Blocks_FullReorg)
       EXPECT_EQ(subssh.second.txioCount_, subssh.second.txioMap_.size());
 }
 
+////////////////////////////////////////////////////////////////////////////////
+TEST_F(BlockUtilsSuper, Load5Blocks_UtxoSummary)
+{
+   vector<BinaryData> scrAddrVec = {
+      TestChain::scrAddrA, TestChain::scrAddrB, TestChain::scrAddrC,
+      TestChain::scrAddrD, TestChain::scrAddrE, TestChain::scrAddrF,
+      TestChain::lb1ScrAddr, TestChain::lb1ScrAddrP2SH,
+      TestChain::lb2ScrAddr, TestChain::lb2ScrAddrP2SH };
+
+   //the running summary has to match what walking the history yields
+   auto checkSummary = [this](const BinaryData& scrAddr)->void
+   {
+      StoredScriptHistory ssh;
+      iface_->getStoredScriptHistory(ssh, scrAddr);
+      ASSERT_TRUE(ssh.hasUtxoSummary_);
+
+      uint64_t value = 0, count = 0, msValue = 0, msCount = 0;
+      for (auto& subssh : ssh.subHistMap_)
+      {
+         for (auto& txio : subssh.second.txioMap_)
+         {
+            if (!txio.second.isUTXO())
+               continue;
+
+            if (txio.second.isMultisig())
+            {
+               msValue += txio.second.getValue();
+               msCount++;
+            }
+            else
+            {
+               value += txio.second.getValue();
+               count++;
+            }
+         }
+      }
+
+      EXPECT_EQ(ssh.totalUnspent_, value);
+      EXPECT_EQ(ssh.utxoCount_, count);
+      EXPECT_EQ(ssh.totalMultisigUnspent_, msValue);
+      EXPECT_EQ(ssh.multisigUtxoCount_, msCount);
+
+      EXPECT_EQ(iface_->getBalanceForScrAddr(scrAddr, true), value + msValue);
+      EXPECT_EQ(iface_->getUtxoCountForScrAddr(scrAddr), count);
+      EXPECT_EQ(iface_->getUtxoCountForScrAddr(scrAddr, true), 
+         count + msCount);
+   };
+
+   TheBDM.doInitialSyncOnLoad(nullProgress);
+   for (auto& scrAddr : scrAddrVec)
+      checkSummary(scrAddr);
+
+   //undo blocks 4 and 5, then apply 4A and 5A
+   setBlocks({ "0", "1", "2", "3", "4", "5", "4A" }, blk0dat_);
+   TheBDM.readBlkFileUpdate();
+   appendBlocks({ "5A" }, blk0dat_);
+   TheBDM.readBlkFileUpdate();
+   for (auto& scrAddr : scrAddrVec)
+      checkSummary(scrAddr);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+TEST_F(BlockUtilsSuper, Load5Blocks_UtxoIndex)
+{
+   delete theBDM;
+   config_.maintainUtxoIndex = true;
+   theBDM = new BlockDataManager_LevelDB(config_);
+   theBDM->openDatabase();
+   iface_ = theBDM->getIFace();
+
+   vector<BinaryData> scrAddrVec = {
+      TestChain::scrAddrA, TestChain::scrAddrB, TestChain::scrAddrC,
+      TestChain::scrAddrD, TestChain::scrAddrE, TestChain::scrAddrF,
+      TestChain::lb1ScrAddr, TestChain::lb1ScrAddrP2SH,
+      TestChain::lb2ScrAddr, TestChain::lb2ScrAddrP2SH };
+
+   //the index has to carry exactly the UTXOs found in the history
+   auto checkIndex = [this](const BinaryData& scrAddr)->void
+   {
+      map<BinaryData, UnspentTxOut> utxoMap;
+      ASSERT_TRUE(iface_->getUtxosForScrAddr(scrAddr, utxoMap));
+
+      StoredScriptHistory ssh;
+      iface_->getStoredScriptHistory(ssh, scrAddr);
+
+      uint32_t count = 0;
+      for (auto& subssh : ssh.subHistMap_)
+      {
+         for (auto& txio : subssh.second.txioMap_)
+         {
+            if (!txio.second.isUTXO())
+               continue;
+
+            count++;
+            auto utxoIter = utxoMap.find(txio.second.getDBKeyOfOutput());
+            ASSERT_TRUE(utxoIter != utxoMap.end());
+
+            auto& utxo = utxoIter->second;
+            EXPECT_EQ(utxo.getValue(), txio.second.getValue());
+            EXPECT_EQ(utxo.getTxOutIndex(), txio.second.getIndexOfOutput());
+            EXPECT_EQ(utxo.getTxHash(), iface_->getTxHashForLdbKey(
+               txio.second.getTxRefOfOutput().getDBKey()));
+         }
+      }
+
+      EXPECT_EQ(utxoMap.size(), count);
+   };
+
+   TheBDM.doInitialSyncOnLoad(nullProgress);
+   EXPECT_TRUE(iface_->isUtxoIndexUsable());
+   for (auto& scrAddr : scrAddrVec)
+      checkIndex(scrAddr);
+
+   //undo blocks 4 and 5, then apply 4A and 5A
+   setBlocks({ "0", "1", "2", "3", "4", "5", "4A" }, blk0dat_);
+   TheBDM.readBlkFileUpdate();
+   appendBlocks({ "5A" }, blk0dat_);
+   TheBDM.readBlkFileUpdate();
+   EXPECT_TRUE(iface_->isUtxoIndexUsable());
+   for (auto& scrAddr : scrAddrVec)
+      checkIndex(scrAddr);
+}
+
 ////////////////////////////////////////////////////////////////////////////////
 TEST_F(BlockUtilsSuper, Load5Blocks_ReloadBDM_Reorg)
 {
@@ -11018,6 +13367,620 @@ TEST_F(TestCryptoECDSA, VerifyPubKeyValidity)
    EXPECT_TRUE(CryptoECDSA().VerifyPublicKeyValid(uncompPointPub2));
 }
 
+// Multiply a point by a scalar and check the result.
+////////////////////////////////////////////////////////////////////////////////
+TEST_F(TestCryptoECDSA, SECP256K1MultPoint)
+{
+   BinaryData testRes = CryptoECDSA().ECMultiplyPoint(multScalar,
+                                                      multPointX,
+                                                      multPointY);
+   EXPECT_EQ(multPointRes, testRes);
+}
+
+// The Secp256k1 engine against the plain Crypto++ code paths
+////////////////////////////////////////////////////////////////////////////////
+TEST_F(TestCryptoECDSA, Secp256k1Differential)
+{
+   CryptoECDSA ecdsa;
+   CryptoPP::ECP ecp = CryptoECDSA::Get_secp256k1_ECP();
+   SecureBinaryData order = SecureBinaryData::CreateFromHex(
+      "fffffffffffffffffffffffffffffffebaaedce6af48a03bbfd25e8cd0364141");
+   SecureBinaryData chaincode = SecureBinaryData::CreateFromHex(
+      "f32c9ea2d54f60d73fe6ee5e0ff5c5da09d3e0ee0ab70b35e87fb86b9e08fa1a");
+
+   // edge scalars, then a hash chain for the rest
+   vector<SecureBinaryData> privKeys;
+   privKeys.push_back(SecureBinaryData::CreateFromHex(
+      "0000000000000000000000000000000000000000000000000000000000000001"));
+   privKeys.push_back(SecureBinaryData::CreateFromHex(
+      "0000000000000000000000000000000000000000000000000000000000000003"));
+   privKeys.push_back(SecureBinaryData::CreateFromHex(
+      "fffffffffffffffffffffffffffffffebaaedce6af48a03bbfd25e8cd0364140"));
+   privKeys.push_back(SecureBinaryData::CreateFromHex(
+      "8000000000000000000000000000000000000000000000000000000000000000"));
+   privKeys.push_back(SecureBinaryData::CreateFromHex(
+      "00000000000000000000000000000000ffffffffffffffffffffffffffffffff"));
+
+   SecureBinaryData seed = compPointPrv2.getSliceCopy(1, 32);
+   for (uint32_t i = 0; i < 100; i++)
+   {
+      seed = seed.getHash256();
+      privKeys.push_back(seed);
+   }
+
+   for (auto& privKey : privKeys)
+   {
+      // k*G
+      SecureBinaryData pubKey = ecdsa.ComputePublicKey(privKey);
+      BTC_PUBKEY cppPub = 
+         CryptoECDSA::ComputePublicKey(CryptoECDSA::ParsePrivateKey(privKey));
+      ASSERT_EQ(pubKey, CryptoECDSA::SerializePublicKey(cppPub));
+
+      // chained key: k*P
+      SecureBinaryData mult;
+      SecureBinaryData chained = 
+         ecdsa.ComputeChainedPublicKey(pubKey, chaincode, &mult);
+
+      CryptoPP::Integer intMult;
+      intMult.Decode(mult.getPtr(), mult.getSize(), UNSIGNED);
+      BTC_PUBKEY cppChained = CryptoECDSA::ParsePublicKey(pubKey);
+      cppChained.SetPublicElement(
+         cppPub.ExponentiatePublicElement(intMult));
+      ASSERT_EQ(chained, CryptoECDSA::SerializePublicKey(cppChained));
+
+      // chained private key matches the chained public key
+      SecureBinaryData chainedPriv = 
+         ecdsa.ComputeChainedPrivateKey(privKey, chaincode, pubKey);
+      EXPECT_EQ(ecdsa.ComputePublicKey(chainedPriv), chained);
+
+      // sign with Crypto++, verify with both
+      SecureBinaryData msg = privKey.getHash256();
+      SecureBinaryData sig = ecdsa.SignData(msg, privKey);
+      EXPECT_TRUE(ecdsa.VerifyData(msg, sig, pubKey));
+      EXPECT_TRUE(CryptoECDSA::VerifyData(msg, sig, cppPub));
+
+      SecureBinaryData badMsg = msg;
+      badMsg[0] ^= 0x01;
+      EXPECT_FALSE(ecdsa.VerifyData(badMsg, sig, pubKey));
+      EXPECT_FALSE(CryptoECDSA::VerifyData(badMsg, sig, cppPub));
+
+      SecureBinaryData badSig = sig;
+      badSig[40] ^= 0x01;
+      EXPECT_FALSE(ecdsa.VerifyData(msg, badSig, pubKey));
+      EXPECT_FALSE(CryptoECDSA::VerifyData(msg, badSig, cppPub));
+
+      EXPECT_FALSE(ecdsa.VerifyData(msg, sig, chained));
+   }
+
+   // raw point multiplication, including scalars that land on infinity
+   vector<SecureBinaryData> scalars;
+   scalars.push_back(order);
+   scalars.push_back(SecureBinaryData::CreateFromHex("02"));
+   scalars.push_back(SecureBinaryData::CreateFromHex(
+      "ffffffffffffffffffffffffffffffffffffffffffffffffffffffffffffffff"));
+   scalars.push_back(privKeys[10]);
+
+   for (auto& scalar : scalars)
+   {
+      BinaryData res = ecdsa.ECMultiplyPoint(scalar, multPointX, multPointY);
+
+      CryptoPP::Integer intA, intX, intY;
+      intA.Decode(scalar.getPtr(), scalar.getSize(), UNSIGNED);
+      intX.Decode(multPointX.getPtr(), 32, UNSIGNED);
+      intY.Decode(multPointY.getPtr(), 32, UNSIGNED);
+      BTC_ECPOINT C = ecp.ScalarMultiply(BTC_ECPOINT(intX, intY), intA);
+
+      BinaryData cppRes(64);
+      C.x.Encode(cppRes.getPtr(),      32, UNSIGNED);
+      C.y.Encode(cppRes.getPtr() + 32, 32, UNSIGNED);
+      EXPECT_EQ(res, cppRes);
+   }
+}
+
+// Batch chain derivation against one ComputeChainedPublicKey call per key
+////////////////////////////////////////////////////////////////////////////////
+TEST_F(TestCryptoECDSA, ComputeChainedPublicKeys)
+{
+   CryptoECDSA ecdsa;
+   SecureBinaryData chaincode = SecureBinaryData::CreateFromHex(
+      "f32c9ea2d54f60d73fe6ee5e0ff5c5da09d3e0ee0ab70b35e87fb86b9e08fa1a");
+
+   // short walks multiply each key directly, long ones go through a table
+   uint32_t counts[] = { 0, 1, 3, 40 };
+   for (uint32_t count : counts)
+   {
+      vector<BinaryData> hash160s, mults;
+      vector<BinaryData> batch = ecdsa.ComputeChainedPublicKeys(
+         uncompPointPub1, chaincode, count, &hash160s, &mults);
+      ASSERT_EQ(batch.size(), count);
+      ASSERT_EQ(hash160s.size(), count);
+      ASSERT_EQ(mults.size(), count);
+
+      SecureBinaryData prevKey = uncompPointPub1;
+      for (uint32_t i = 0; i < count; i++)
+      {
+         SecureBinaryData mult;
+         prevKey = ecdsa.ComputeChainedPublicKey(prevKey, chaincode, &mult);
+         EXPECT_EQ(batch[i], prevKey);
+         EXPECT_EQ(hash160s[i], BtcUtils::getHash160(prevKey));
+         EXPECT_EQ(mults[i], mult);
+      }
+
+      //the Python entry point returns the same lists
+      auto keysHashesMults = ecdsa.ComputeChainedPublicKeysHash160sAndMults(
+         uncompPointPub1, chaincode, count);
+      ASSERT_EQ(keysHashesMults.size(), 3);
+      EXPECT_EQ(keysHashesMults[0], batch);
+      EXPECT_EQ(keysHashesMults[1], hash160s);
+      EXPECT_EQ(keysHashesMults[2], mults);
+   }
+}
+
+// raw r|s to DER, with a SIGHASH_ALL byte as found in tx scripts
+static BinaryData derEncodeSignature(BinaryData const & rs)
+{
+   BinaryWriter body;
+   for (uint32_t i = 0; i < 2; i++)
+   {
+      BinaryData intBytes = rs.getSliceCopy(32 * i, 32);
+      uint32_t start = 0;
+      while (start < 31 && intBytes[start] == 0)
+         start++;
+      intBytes = intBytes.getSliceCopy(start, 32 - start);
+      if (intBytes[0] & 0x80)
+         intBytes = READHEX("00") + intBytes;
+
+      body.put_uint8_t(0x02);
+      body.put_uint8_t((uint8_t)intBytes.getSize());
+      body.put_BinaryData(intBytes);
+   }
+
+   BinaryWriter der;
+   der.put_uint8_t(0x30);
+   der.put_uint8_t((uint8_t)body.getSize());
+   der.put_BinaryData(body.getData());
+   der.put_uint8_t(0x01);
+   return der.getData();
+}
+
+// Batch verification against one VerifyData call per signature
+////////////////////////////////////////////////////////////////////////////////
+TEST_F(TestCryptoECDSA, VerifyDataBatch)
+{
+   CryptoECDSA ecdsa;
+
+   // key 0 signs enough to get its own table, the others go through wNAF
+   uint32_t sigsPerKey[] = { 40, 3, 1 };
+   vector<BinaryData> msgs, sigs, derSigs, pubKeys;
+   SecureBinaryData privKey = compPointPrv1.getSliceCopy(1, 32);
+   for (uint32_t nSigs : sigsPerKey)
+   {
+      privKey = privKey.getHash256();
+      SecureBinaryData pubKey = ecdsa.ComputePublicKey(privKey);
+      for (uint32_t i = 0; i < nSigs; i++)
+      {
+         SecureBinaryData msg = BtcUtils::getHash256(
+            pubKey.getRawCopy() + WRITE_UINT32_LE(i));
+         SecureBinaryData sig = ecdsa.SignData(msg, privKey);
+
+         // every third one gets tampered with
+         if (i % 3 == 1)
+            msg[i % 32] ^= 0x01;
+         else if (i % 3 == 2)
+            sig[i % 64] ^= 0x80;
+
+         msgs.push_back(msg);
+         sigs.push_back(sig);
+         derSigs.push_back(derEncodeSignature(sig));
+         pubKeys.push_back(pubKey);
+      }
+   }
+
+   vector<bool> expected;
+   for (size_t i = 0; i < msgs.size(); i++)
+      expected.push_back(ecdsa.VerifyData(msgs[i], sigs[i], pubKeys[i]));
+   EXPECT_TRUE(expected[0]);
+   EXPECT_FALSE(expected[1]);
+   EXPECT_FALSE(expected[2]);
+
+   uint32_t threadCounts[] = { 1, 4 };
+   for (uint32_t nThreads : threadCounts)
+   {
+      EXPECT_EQ(ecdsa.VerifyDataBatch(msgs, sigs, pubKeys, false, nThreads),
+                expected);
+      EXPECT_EQ(ecdsa.VerifyDataBatch(msgs, derSigs, pubKeys, true, nThreads),
+                expected);
+   }
+
+   // malformed entries fail on their own
+   vector<BinaryData> badSigs = sigs;
+   badSigs[0] = sigs[0].getSliceCopy(0, 63);
+   vector<BinaryData> badDerSigs = derSigs;
+   badDerSigs[0][0] = 0x31;
+   vector<BinaryData> badKeys = pubKeys;
+   badKeys[0][64] ^= 0x01;
+   vector<bool> badFirst = expected;
+   badFirst[0] = false;
+
+   EXPECT_EQ(ecdsa.VerifyDataBatch(msgs, badSigs, pubKeys), badFirst);
+   EXPECT_EQ(ecdsa.VerifyDataBatch(msgs, badDerSigs, pubKeys, true), badFirst);
+   EXPECT_EQ(ecdsa.VerifyDataBatch(msgs, sigs, badKeys), badFirst);
+
+   // mismatched inputs fail as a whole
+   vector<BinaryData> shortKeys(pubKeys.begin(), pubKeys.end() - 1);
+   EXPECT_EQ(ecdsa.VerifyDataBatch(msgs, sigs, shortKeys),
+             vector<bool>(msgs.size(), false));
+   EXPECT_TRUE(ecdsa.VerifyDataBatch(
+      vector<BinaryData>(), vector<BinaryData>(), vector<BinaryData>()).empty());
+}
+
+////////////////////////////////////////////////////////////////////////////////
+TEST_F(TestCryptoECDSA, DISABLED_VerifyDataBatch_Benchmark)
+{
+   CryptoECDSA ecdsa;
+   const uint32_t nSigs = 2000;
+
+   // a few busy keys, then one key per signature
+   uint32_t keyCounts[] = { 10, nSigs };
+   for (uint32_t nKeys : keyCounts)
+   {
+      vector<SecureBinaryData> privKeys;
+      vector<BinaryData> keys;
+      SecureBinaryData privKey = compPointPrv2.getSliceCopy(1, 32);
+      for (uint32_t i = 0; i < nKeys; i++)
+      {
+         privKey = privKey.getHash256();
+         privKeys.push_back(privKey);
+         keys.push_back(ecdsa.ComputePublicKey(privKey));
+      }
+
+      vector<BinaryData> msgs, sigs, pubKeys;
+      for (uint32_t i = 0; i < nSigs; i++)
+      {
+         BinaryData msg = BtcUtils::getHash256(WRITE_UINT32_LE(i));
+         msgs.push_back(msg);
+         sigs.push_back(ecdsa.SignData(msg, privKeys[i % nKeys]));
+         pubKeys.push_back(keys[i % nKeys]);
+      }
+
+      auto start = chrono::steady_clock::now();
+      for (uint32_t i = 0; i < nSigs; i++)
+         EXPECT_TRUE(ecdsa.VerifyData(msgs[i], sigs[i], pubKeys[i]));
+      auto loopTime = chrono::steady_clock::now() - start;
+
+      start = chrono::steady_clock::now();
+      vector<bool> single = ecdsa.VerifyDataBatch(msgs, sigs, pubKeys, false, 1);
+      auto singleTime = chrono::steady_clock::now() - start;
+
+      start = chrono::steady_clock::now();
+      vector<bool> multi = ecdsa.VerifyDataBatch(msgs, sigs, pubKeys);
+      auto multiTime = chrono::steady_clock::now() - start;
+
+      EXPECT_EQ(single, vector<bool>(nSigs, true));
+      EXPECT_EQ(multi, single);
+
+      typedef chrono::duration<double, milli> ms;
+      cout << nSigs << " signatures over " << nKeys << " keys" << endl;
+      cout << "   VerifyData loop:            "
+           << ms(loopTime).count() << " ms" << endl;
+      cout << "   VerifyDataBatch, 1 thread: "
+           << ms(singleTime).count() << " ms" << endl;
+      cout << "   VerifyDataBatch, " << thread::hardware_concurrency()
+           << " threads: " << ms(multiTime).count() << " ms" << endl;
+   }
+}
+
+// The original single lane ROMix, one CalculateDigest per step
+static SecureBinaryData kdfRomix_Reference(SecureBinaryData const & password,
+                                           SecureBinaryData const & salt,
+                                           uint32_t memReqts,
+                                           uint32_t numIter)
+{
+   CryptoPP::SHA512 sha512;
+   uint32_t const seqCount = memReqts / 64;
+   SecureBinaryData key = password;
+
+   for (uint32_t iter = 0; iter < numIter; iter++)
+   {
+      BinaryData salted = key.getRawCopy() + salt.getRawCopy();
+      BinaryData lut(memReqts);
+      sha512.CalculateDigest(lut.getPtr(), salted.getPtr(), salted.getSize());
+      for (uint32_t i = 1; i < seqCount; i++)
+         sha512.CalculateDigest(lut.getPtr() + 64 * i, 
+                                lut.getPtr() + 64 * (i - 1), 64);
+
+      BinaryData X = lut.getSliceCopy(memReqts - 64, 64);
+      BinaryData Y(64);
+      for (uint32_t n = 0; n < seqCount / 2; n++)
+      {
+         uint32_t index = READ_UINT32_LE(X.getPtr() + 60) % seqCount;
+         for (uint32_t i = 0; i < 64; i++)
+            Y[i] = X[i] ^ lut[64 * index + i];
+         sha512.CalculateDigest(X.getPtr(), Y.getPtr(), 64);
+      }
+
+      key = X.getSliceCopy(0, 32);
+   }
+
+   return key;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+TEST(KdfRomixTest, DeriveKey)
+{
+   SecureBinaryData password("This is an example password");
+   SecureBinaryData salt = SecureBinaryData::CreateFromHex(
+      "f32c9ea2d54f60d73fe6ee5e0ff5c5da09d3e0ee0ab70b35e87fb86b9e08fa1a");
+
+   // one lane is the original algorithm, existing wallets depend on it
+   uint32_t memSizes[] = { 1024, 32768, 4 * 1024 * 1024 };
+   for (uint32_t mem : memSizes)
+   {
+      KdfRomix kdf(mem, 3, salt);
+      EXPECT_EQ(kdf.DeriveKey(password), 
+                kdfRomix_Reference(password, salt, mem, 3));
+      EXPECT_EQ(kdf.DeriveKey_OneIter(password),
+                kdfRomix_Reference(password, salt, mem, 1));
+   }
+
+   // lanes are a different parameter set, and deterministic
+   KdfRomix kdf1(32768, 2, salt, 1);
+   KdfRomix kdf4(32768, 2, salt, 4);
+   SecureBinaryData key4 = kdf4.DeriveKey(password);
+   EXPECT_EQ(key4.getSize(), 32);
+   EXPECT_EQ(kdf4.getNumLanes(), 4);
+   EXPECT_FALSE(key4 == kdf1.DeriveKey(password));
+   EXPECT_EQ(key4, KdfRomix(32768, 2, salt, 4).DeriveKey(password));
+   EXPECT_FALSE(key4 == kdf4.DeriveKey(SecureBinaryData("Another password")));
+
+   // calibration keeps the lane count
+   KdfRomix kdfNew;
+   kdfNew.computeKdfParams(0.05, 1024 * 1024, 2);
+   EXPECT_EQ(kdfNew.getNumLanes(), 2);
+   EXPECT_GE(kdfNew.getNumIterations(), 1);
+   EXPECT_EQ(kdfNew.DeriveKey(password), 
+             KdfRomix(kdfNew.getMemoryReqtBytes(), kdfNew.getNumIterations(),
+                      kdfNew.getSalt(), 2).DeriveKey(password));
+
+   // 1kB only fits 8 lanes of 2 slots
+   KdfRomix kdfSmall;
+   kdfSmall.computeKdfParams(0, 1024, 32);
+   EXPECT_EQ(kdfSmall.getNumLanes(), 8);
+   EXPECT_EQ(kdfSmall.DeriveKey(password), 
+             KdfRomix(1024, 1, kdfSmall.getSalt(), 8).DeriveKey(password));
+
+   // stored params can't be changed to fit
+   EXPECT_THROW(KdfRomix(1024, 1, salt, 32), runtime_error);
+   EXPECT_THROW(KdfRomix(64, 1, salt), runtime_error);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+TEST(KdfRomixTest, DISABLED_DeriveKey_Benchmark)
+{
+   SecureBinaryData password("This is an example password");
+   SecureBinaryData salt = SecureBinaryData().GenerateRandom(32);
+   const uint32_t mem = 32 * 1024 * 1024;
+   const uint32_t numIter = 3;
+
+   auto start = chrono::steady_clock::now();
+   SecureBinaryData refKey = 
+      kdfRomix_Reference(password, salt, mem, numIter);
+   auto refTime = chrono::steady_clock::now() - start;
+
+   start = chrono::steady_clock::now();
+   SecureBinaryData key = KdfRomix(mem, numIter, salt).DeriveKey(password);
+   auto oneLaneTime = chrono::steady_clock::now() - start;
+
+   uint32_t nLanes = max(2U, thread::hardware_concurrency());
+   start = chrono::steady_clock::now();
+   KdfRomix(mem, numIter, salt, nLanes).DeriveKey(password);
+   auto lanesTime = chrono::steady_clock::now() - start;
+
+   EXPECT_EQ(key, refKey);
+
+   typedef chrono::duration<double, milli> ms;
+   cout << numIter << " iterations over " << mem << " bytes" << endl;
+   cout << "   reference:   " << ms(refTime).count() << " ms" << endl;
+   cout << "   1 lane:      " << ms(oneLaneTime).count() << " ms" << endl;
+   cout << "   " << nLanes << " lanes:     " 
+        << ms(lanesTime).count() << " ms" << endl;
+}
+
+// Bulk CFB against one EncryptCFB/DecryptCFB call per blob
+////////////////////////////////////////////////////////////////////////////////
+TEST(CryptoAESTest, CFB_Bulk)
+{
+   CryptoAES aes;
+   SecureBinaryData key = SecureBinaryData().GenerateRandom(32);
+   SecureBinaryData newKey = SecureBinaryData().GenerateRandom(32);
+
+   // wallet keys are 32 bytes, throw in partial blocks and empty blobs.
+   // Enough of them to get split over threads.
+   uint32_t sizes[] = { 32, 32, 7, 45, 0, 16, 32 };
+   vector<SecureBinaryData> plain, ivs, newIVs;
+   for (uint32_t i = 0; i < 7000; i++)
+   {
+      plain.push_back(SecureBinaryData().GenerateRandom(sizes[i % 7]));
+      ivs.push_back(SecureBinaryData().GenerateRandom(16));
+      newIVs.push_back(SecureBinaryData().GenerateRandom(16));
+   }
+
+   vector<SecureBinaryData> encr, decr, reencr;
+   ASSERT_TRUE(aes.EncryptCFB_Bulk(plain, key, ivs, encr, 4));
+   ASSERT_TRUE(aes.DecryptCFB_Bulk(encr, key, ivs, decr, 1));
+   ASSERT_TRUE(aes.ReencryptCFB_Bulk(encr, key, ivs, newKey, newIVs, reencr));
+   ASSERT_EQ(encr.size(), plain.size());
+   ASSERT_EQ(decr.size(), plain.size());
+   ASSERT_EQ(reencr.size(), plain.size());
+
+   for (uint32_t i = 0; i < plain.size(); i++)
+   {
+      SecureBinaryData iv = ivs[i];
+      SecureBinaryData newIV = newIVs[i];
+      EXPECT_EQ(encr[i], aes.EncryptCFB(plain[i], key, iv));
+      EXPECT_EQ(decr[i], plain[i]);
+      EXPECT_EQ(reencr[i], aes.EncryptCFB(plain[i], newKey, newIV));
+   }
+
+   // buffers of the right size are written in place
+   uint8_t const * firstBuf = decr[0].getPtr();
+   ASSERT_TRUE(aes.DecryptCFB_Bulk(reencr, newKey, newIVs, decr));
+   EXPECT_EQ(decr[0].getPtr(), firstBuf);
+   EXPECT_EQ(decr[0], plain[0]);
+
+   // bad IVs and keys are rejected without touching the output
+   vector<SecureBinaryData> badIVs = ivs;
+   badIVs[3] = SecureBinaryData().GenerateRandom(8);
+   EXPECT_FALSE(aes.EncryptCFB_Bulk(plain, key, badIVs, encr));
+   EXPECT_FALSE(aes.EncryptCFB_Bulk(plain, SecureBinaryData(20), ivs, encr));
+   vector<SecureBinaryData> shortIVs(ivs.begin(), ivs.end() - 1);
+   EXPECT_FALSE(aes.ReencryptCFB_Bulk(
+      encr, key, ivs, newKey, shortIVs, reencr));
+   EXPECT_EQ(decr[0], plain[0]);
+   EXPECT_EQ(reencr.size(), plain.size());
+}
+
+////////////////////////////////////////////////////////////////////////////////
+TEST(CryptoAESTest, DISABLED_CFB_Bulk_Benchmark)
+{
+   CryptoAES aes;
+   SecureBinaryData key = SecureBinaryData().GenerateRandom(32);
+   SecureBinaryData newKey = SecureBinaryData().GenerateRandom(32);
+   const uint32_t nKeys = 100000;
+
+   vector<SecureBinaryData> encr, ivs, newIVs;
+   for (uint32_t i = 0; i < nKeys; i++)
+   {
+      encr.push_back(SecureBinaryData().GenerateRandom(32));
+      ivs.push_back(SecureBinaryData().GenerateRandom(16));
+      newIVs.push_back(SecureBinaryData().GenerateRandom(16));
+   }
+
+   // what a passphrase change does now, one key at a time
+   vector<SecureBinaryData> loopOut;
+   auto start = chrono::steady_clock::now();
+   for (uint32_t i = 0; i < nKeys; i++)
+   {
+      SecureBinaryData plain = aes.DecryptCFB(encr[i], key, ivs[i]);
+      loopOut.push_back(aes.EncryptCFB(plain, newKey, newIVs[i]));
+   }
+   auto loopTime = chrono::steady_clock::now() - start;
+
+   vector<SecureBinaryData> singleOut;
+   start = chrono::steady_clock::now();
+   aes.ReencryptCFB_Bulk(encr, key, ivs, newKey, newIVs, singleOut, 1);
+   auto singleTime = chrono::steady_clock::now() - start;
+
+   vector<SecureBinaryData> multiOut;
+   start = chrono::steady_clock::now();
+   aes.ReencryptCFB_Bulk(encr, key, ivs, newKey, newIVs, multiOut);
+   auto multiTime = chrono::steady_clock::now() - start;
+
+   EXPECT_TRUE(singleOut == loopOut);
+   EXPECT_TRUE(multiOut == loopOut);
+
+   typedef chrono::duration<double, milli> ms;
+   cout << "re-encrypting " << nKeys << " keys" << endl;
+   cout << "   DecryptCFB/EncryptCFB loop:   " 
+        << ms(loopTime).count() << " ms" << endl;
+   cout << "   ReencryptCFB_Bulk, 1 thread:  " 
+        << ms(singleTime).count() << " ms" << endl;
+   cout << "   ReencryptCFB_Bulk, " << thread::hardware_concurrency()
+        << " threads: " << ms(multiTime).count() << " ms" << endl;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+TEST(SecureMemoryPoolTest, ZeroOnFree)
+{
+   // freed chunks are handed out again first, and come back wiped
+   size_t sizes[] = { 1, 32, 33, 4096, 10000 };
+   for (size_t size : sizes)
+   {
+      size_t inUse = SecureMemoryPool::getBytesInUse();
+      uint8_t* ptr = (uint8_t*)SecureMemoryPool::allocate(size);
+      EXPECT_GE(SecureMemoryPool::getBytesInUse(), inUse + size);
+      memset(ptr, 0xAB, size);
+      SecureMemoryPool::deallocate(ptr, size);
+      EXPECT_EQ(SecureMemoryPool::getBytesInUse(), inUse);
+
+      if (size > 4096)
+         continue;
+
+      uint8_t* ptr2 = (uint8_t*)SecureMemoryPool::allocate(size);
+      EXPECT_EQ(ptr2, ptr);
+      EXPECT_EQ(BinaryData(ptr2, size), BinaryData(size));
+      SecureMemoryPool::deallocate(ptr2, size);
+   }
+}
+
+////////////////////////////////////////////////////////////////////////////////
+TEST(SecureMemoryPoolTest, SecureBinaryData)
+{
+   size_t inUse = SecureMemoryPool::getBytesInUse();
+   BinaryData plain = READHEX("0102030405060708");
+
+   {
+      // secure data lives in the pool, regular data doesn't
+      SecureBinaryData sbd(plain);
+      BinaryData bd(plain);
+      EXPECT_GT(SecureMemoryPool::getBytesInUse(), inUse);
+      size_t withSbd = SecureMemoryPool::getBytesInUse();
+
+      // and stays on its own side through assignments and moves
+      SecureBinaryData sbd2;
+      sbd2 = SecureBinaryData(bd);
+      bd = move(sbd2);
+      EXPECT_EQ(bd, plain);
+      EXPECT_EQ(sbd, plain);
+
+      BinaryData moved(move(sbd2));
+      EXPECT_GE(SecureMemoryPool::getBytesInUse(), withSbd);
+
+      // growing reallocates inside the pool
+      SecureBinaryData chunk(plain);
+      for (uint32_t i = 0; i < 1000; i++)
+         sbd.append(chunk);
+      EXPECT_EQ(sbd.getSize(), 8 * 1001);
+      EXPECT_EQ(sbd.getSliceCopy(8000, 8), plain);
+   }
+
+   EXPECT_EQ(SecureMemoryPool::getBytesInUse(), inUse);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+TEST(SecureMemoryPoolTest, DISABLED_Benchmark)
+{
+   const uint32_t nObjects = 1000000;
+   BinaryData key = READHEX(
+      "f32c9ea2d54f60d73fe6ee5e0ff5c5da09d3e0ee0ab70b35e87fb86b9e08fa1a");
+
+   auto start = chrono::steady_clock::now();
+   for (uint32_t i = 0; i < nObjects; i++)
+   {
+      BinaryData bd(key);
+      BinaryData bd2(bd);
+      bd2.append(bd);
+   }
+   auto heapTime = chrono::steady_clock::now() - start;
+
+   start = chrono::steady_clock::now();
+   for (uint32_t i = 0; i < nObjects; i++)
+   {
+      SecureBinaryData sbd(key);
+      SecureBinaryData sbd2(sbd);
+      sbd2.append(sbd);
+   }
+   auto secureTime = chrono::steady_clock::now() - start;
+
+   typedef chrono::duration<double, milli> ms;
+   cout << nObjects << " create/copy/append/destroy of 32 byte keys" << endl;
+   cout << "   BinaryData:       " << ms(heapTime).count() << " ms" << endl;
+   cout << "   SecureBinaryData: " << ms(secureTime).count() << " ms" << endl;
+   cout << "   pool mapped " << SecureMemoryPool::getBytesMapped() 
+        << " bytes, " << SecureMemoryPool::getLockFailures() 
+        << " lock failures" << endl;
+}
+
 ////////////////////////////////////////////////////////////////////////////////
 /* Never got around to finishing this...
 class TestMainnetBlkchain: public ::testing::Test
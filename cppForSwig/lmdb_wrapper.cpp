@@ -18,9 +18,35 @@
 #include "StoredBlockObj.h"
 #include "lmdb_wrapper.h"
 #include "txio.h"
+#include "Stats.h"
 
 struct MDB_val;
 
+//point reads, per DB_SELECT
+static const StatId statReads[COUNT] = {
+   Stats::registerCounter("lmdb_reads_total", "LMDB point reads",
+      "db=\"headers\""),
+   Stats::registerCounter("lmdb_reads_total", "LMDB point reads",
+      "db=\"blkdata\""),
+   Stats::registerCounter("lmdb_reads_total", "LMDB point reads",
+      "db=\"history\""),
+   Stats::registerCounter("lmdb_reads_total", "LMDB point reads",
+      "db=\"stxo\""),
+   Stats::registerCounter("lmdb_reads_total", "LMDB point reads",
+      "db=\"spentness\""),
+   Stats::registerCounter("lmdb_reads_total", "LMDB point reads",
+      "db=\"txhints\""),
+   Stats::registerCounter("lmdb_reads_total", "LMDB point reads",
+      "db=\"zeroconf\""),
+   Stats::registerCounter("lmdb_reads_total", "LMDB point reads",
+      "db=\"utxo\"")
+};
+
+static const StatId statTxHashCacheHits = Stats::registerCounter(
+   "txhash_cache_hits_total", "TxHashCache lookups that hit");
+static const StatId statTxHashCacheMisses = Stats::registerCounter(
+   "txhash_cache_misses_total", "TxHashCache lookups that missed");
+
 ////////////////////////////////////////////////////////////////////////////////
 LDBIter::LDBIter(LMDB::Iterator&& mv)
    : iter_(std::move(mv))
@@ -337,6 +363,129 @@ bool LDBIter::checkKeyStartsWith(DB_PREFIX prefix, BinaryDataRef key)
 }
 
 
+////////////////////////////////////////////////////////////////////////////////
+// TxHashCache
+////////////////////////////////////////////////////////////////////////////////
+TxHashCache::TxHashCache(size_t maxEntries) :
+   maxPerShard_(max(maxEntries / SHARD_COUNT, (size_t)1))
+{
+   hits_.store(0, memory_order_relaxed);
+   misses_.store(0, memory_order_relaxed);
+   generation_.store(0, memory_order_relaxed);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+TxHashCache::Shard& TxHashCache::getShard(BinaryDataRef dbKey6) const
+{
+   //tx index and the low height byte vary the most between neighbouring keys
+   uint32_t shardId = 0;
+   if (dbKey6.getSize() >= 6)
+      shardId = dbKey6.getPtr()[2] ^ dbKey6.getPtr()[5];
+
+   return shards_[shardId % SHARD_COUNT];
+}
+
+////////////////////////////////////////////////////////////////////////////////
+bool TxHashCache::get(BinaryDataRef dbKey6, BinaryData& txHash) const
+{
+   auto& shard = getShard(dbKey6);
+
+   {
+      unique_lock<mutex> lock(shard.mu_);
+      auto hashIter = shard.hashes_.find(dbKey6);
+      if (hashIter != shard.hashes_.end())
+      {
+         txHash = hashIter->second;
+         hits_.fetch_add(1, memory_order_relaxed);
+         Stats::add(statTxHashCacheHits);
+         return true;
+      }
+   }
+
+   misses_.fetch_add(1, memory_order_relaxed);
+   Stats::add(statTxHashCacheMisses);
+   return false;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+void TxHashCache::put(BinaryDataRef dbKey6, BinaryDataRef txHash, 
+   uint64_t generation)
+{
+   auto& shard = getShard(dbKey6);
+   unique_lock<mutex> lock(shard.mu_);
+
+   //read before a reorg, the hash may be stale
+   if (generation != generation_.load(memory_order_acquire))
+      return;
+
+   auto insertResult = shard.hashes_.insert(make_pair(dbKey6, txHash));
+   if (!insertResult.second)
+   {
+      insertResult.first->second = txHash;
+      return;
+   }
+
+   shard.order_.push_back(dbKey6);
+
+   //order_ can carry keys already dropped by eraseFromHeight
+   while (shard.hashes_.size() > maxPerShard_ && shard.order_.size() > 0)
+   {
+      shard.hashes_.erase(shard.order_.front());
+      shard.order_.pop_front();
+   }
+}
+
+////////////////////////////////////////////////////////////////////////////////
+void TxHashCache::eraseFromHeight(uint32_t height)
+{
+   //keys lead with hgtX, so everything from height up sorts after this
+   BinaryData bottomKey = DBUtils::heightAndDupToHgtx(height, 0);
+
+   //bump first, a put that saw the old generation is swept below
+   generation_.fetch_add(1, memory_order_acq_rel);
+
+   for (auto& shard : shards_)
+   {
+      unique_lock<mutex> lock(shard.mu_);
+
+      auto eraseIter = shard.hashes_.lower_bound(bottomKey);
+      shard.hashes_.erase(eraseIter, shard.hashes_.end());
+
+      auto orderIter = remove_if(shard.order_.begin(), shard.order_.end(),
+         [&bottomKey](const BinaryData& key)->bool
+         { return !(key < bottomKey); });
+      shard.order_.erase(orderIter, shard.order_.end());
+   }
+}
+
+////////////////////////////////////////////////////////////////////////////////
+void TxHashCache::clear(void)
+{
+   //same as eraseFromHeight, puts that started before the clear are dropped
+   generation_.fetch_add(1, memory_order_acq_rel);
+
+   for (auto& shard : shards_)
+   {
+      unique_lock<mutex> lock(shard.mu_);
+      shard.hashes_.clear();
+      shard.order_.clear();
+   }
+}
+
+////////////////////////////////////////////////////////////////////////////////
+size_t TxHashCache::size(void) const
+{
+   size_t total = 0;
+   for (auto& shard : shards_)
+   {
+      unique_lock<mutex> lock(shard.mu_);
+      total += shard.hashes_.size();
+   }
+
+   return total;
+}
+
+////////////////////////////////////////////////////////////////////////////////
 ////////////////////////////////////////////////////////////////////////////////
 LMDBBlockDatabase::LMDBBlockDatabase(function<bool(void)> isDBReady,
    shared_ptr<vector<BlkFile>> blkfiles) :
@@ -370,7 +519,8 @@ void LMDBBlockDatabase::openDatabases(
    BinaryData const & genesisTxHash,
    BinaryData const & magic,
    ARMORY_DB_TYPE     dbtype,
-   DB_PRUNE_TYPE      pruneType
+   DB_PRUNE_TYPE      pruneType,
+   bool               withUtxoIndex
    )
 {
    /***
@@ -406,6 +556,12 @@ void LMDBBlockDatabase::openDatabases(
    transactions and getting the hash, keeping ledger computation speed on 
    par with Supernode
 
+   Fullnode scans also save a compact filter of each block's output scrAddr
+   and spent outpoints in the BLKDATA DB, as:
+            DB_PREFIX_BLKFILTER | hgtx -> BlockFilter
+   Side scans of newly registered addresses use these to only pull the blocks
+   that may be relevant to them.
+
    In Supernode, BLKDATA sdbi sits in the BLKDATA DB.
    In Fullnode, BLDDATA sdbi goes in the HISTORY DB instead, while BLKDATA DB 
    has no sdbi
@@ -442,6 +598,7 @@ void LMDBBlockDatabase::openDatabases(
 
    armoryDbType_ = dbtype;
    dbPruneType_ = pruneType;
+   utxoIndexEnabled_ = withUtxoIndex;
 
    if (genesisBlkHash_.getSize() == 0 || magicBytes_.getSize() == 0)
    {
@@ -463,6 +620,7 @@ void LMDBBlockDatabase::openDatabases(
    dbEnv_[STXO]->open(dbStxoFilename());
    dbEnv_[SPENTNESS]->open(dbSpentnessFilename());
    dbEnv_[ZEROCONF]->open(dbZeroconfFilename());
+   dbEnv_[UTXO]->open(dbUtxoFilename());
 
    map<DB_SELECT, string> DB_NAMES;
    DB_NAMES[HEADERS]    = "headers";
@@ -472,6 +630,7 @@ void LMDBBlockDatabase::openDatabases(
    DB_NAMES[STXO]       = "stxo";
    DB_NAMES[SPENTNESS]  = "spentness";
    DB_NAMES[ZEROCONF]   = "zeroconf";
+   DB_NAMES[UTXO]       = "utxo";
 
    try
    {
@@ -482,7 +641,8 @@ void LMDBBlockDatabase::openDatabases(
 
          dbs_[CURRDB].open(dbEnv_[CURRDB].get(), db.second);
 
-         //no SDBI in TXHINTS, STXO, ZEROCONF and SPENTNESS
+         //no SDBI in TXHINTS, STXO, ZEROCONF and SPENTNESS, UTXO is seeded
+         //from HISTORY below
          if (CURRDB != HEADERS && CURRDB != BLKDATA && CURRDB != HISTORY)
             continue;
 
@@ -524,6 +684,30 @@ void LMDBBlockDatabase::openDatabases(
          }
       }
 
+      {
+         LMDBEnv::Transaction tx(dbEnv_[UTXO].get(), LMDB::ReadWrite);
+
+         StoredDBInfo sdbi;
+         getStoredDBInfo(UTXO, sdbi, false);
+         if (!sdbi.isInitialized())
+         {
+            //a fresh index is only in sync with a fresh history, otherwise
+            //it stays unused until the next rescan rebuilds it
+            StoredDBInfo sdbiHist;
+            getStoredDBInfo(HISTORY, sdbiHist);
+
+            if (sdbiHist.appliedToHgt_ != 0 ||
+                sdbiHist.topScannedBlkHash_.getSize() != 0)
+            {
+               if (utxoIndexEnabled_)
+                  LOGWARN << "UTXO index is out of date, rescan to rebuild it";
+               sdbiHist.appliedToHgt_ = UINT32_MAX;
+            }
+
+            putStoredDBInfo(UTXO, sdbiHist);
+         }
+      }
+
       for (uint32_t i = SUBSSHDB_PREFIX_MIN; i < SUBSSHDB_PREFIX_MAX; i++)
       {
          subSSHDBEnv_[i].open(getSubSSHDBFile(i));
@@ -554,6 +738,94 @@ void LMDBBlockDatabase::openDatabases(
    dbIsOpen_ = true;
 }
 
+/////////////////////////////////////////////////////////////////////////////
+void LMDBBlockDatabase::openDatabasesReadOnly(
+   const string& basedir,
+   BinaryData const & genesisBlkHash,
+   BinaryData const & genesisTxHash,
+   BinaryData const & magic)
+{
+   SCOPED_TIMER("openDatabasesReadOnly");
+   LOGINFO << "Opening databases (read only)...";
+
+   baseDir_ = basedir;
+   magicBytes_ = magic;
+   genesisTxHash_ = genesisTxHash;
+   genesisBlkHash_ = genesisBlkHash;
+
+   //the UTXO sdbi tells whether the index can be used
+   utxoIndexEnabled_ = true;
+
+   if (genesisBlkHash_.getSize() == 0 || magicBytes_.getSize() == 0)
+   {
+      LOGERR << " must set magic bytes and genesis block";
+      LOGERR << "           before opening databases.";
+      throw runtime_error("magic bytes not set");
+   }
+
+   closeDatabases();
+
+   map<DB_SELECT, string> DB_NAMES;
+   DB_NAMES[HEADERS]    = "headers";
+   DB_NAMES[HISTORY]    = "history";
+   DB_NAMES[BLKDATA]    = "blocks";
+   DB_NAMES[TXHINTS]    = "txhints";
+   DB_NAMES[STXO]       = "stxo";
+   DB_NAMES[SPENTNESS]  = "spentness";
+   DB_NAMES[ZEROCONF]   = "zeroconf";
+   DB_NAMES[UTXO]       = "utxo";
+
+   try
+   {
+      for (int i = 0; i < COUNT; i++)
+         dbEnv_[DB_SELECT(i)].reset(new LMDBEnv());
+
+      dbEnv_[BLKDATA]->open(dbBlkdataFilename(), true);
+      dbEnv_[HEADERS]->open(dbHeadersFilename(), true);
+      dbEnv_[HISTORY]->open(dbHistoryFilename(), true);
+      dbEnv_[TXHINTS]->open(dbTxhintsFilename(), true);
+      dbEnv_[STXO]->open(dbStxoFilename(), true);
+      dbEnv_[SPENTNESS]->open(dbSpentnessFilename(), true);
+      dbEnv_[ZEROCONF]->open(dbZeroconfFilename(), true);
+      dbEnv_[UTXO]->open(dbUtxoFilename(), true);
+
+      for (auto& db : DB_NAMES)
+         dbs_[db.first].open(dbEnv_[db.first].get(), db.second);
+
+      {
+         LMDBEnv::Transaction tx(dbEnv_[HEADERS].get(), LMDB::ReadOnly);
+
+         StoredDBInfo sdbi;
+         getStoredDBInfo(HEADERS, sdbi, false);
+         if (!sdbi.isInitialized())
+            throw runtime_error("Databases were never initialized");
+
+         if (magicBytes_ != sdbi.magic_)
+            throw runtime_error("Magic bytes mismatch!  Different blkchain?");
+
+         armoryDbType_ = sdbi.armoryType_;
+         dbPruneType_ = sdbi.pruneType_;
+      }
+
+      for (uint32_t i = SUBSSHDB_PREFIX_MIN; i < SUBSSHDB_PREFIX_MAX; i++)
+      {
+         subSSHDBEnv_[i].open(getSubSSHDBFile(i), true);
+         stringstream ss;
+         ss << "subssh" << i << std::ends;
+         subSSHDBs_[i].open(&subSSHDBEnv_[i], ss.str().c_str());
+      }
+   }
+   catch (exception &e)
+   {
+      LOGERR << "Exception thrown while opening database";
+      LOGERR << e.what();
+      closeDatabases();
+      throw;
+   }
+
+   dbIsOpen_ = true;
+}
+
 /////////////////////////////////////////////////////////////////////////////
 void LMDBBlockDatabase::nukeHeadersDB(void)
 {
@@ -602,6 +874,13 @@ void LMDBBlockDatabase::closeDatabases(void)
       subSSHDBEnv_[db].close();
    }
 
+   if (txHashCache_.getHitCount() + txHashCache_.getMissCount() > 0)
+   {
+      LOGINFO << "tx hash cache: " << txHashCache_.getHitCount() << 
+         " hits, " << txHashCache_.getMissCount() << " misses";
+   }
+
+   txHashCache_.clear();
    dbIsOpen_ = false;
 }
 
@@ -621,6 +900,7 @@ void LMDBBlockDatabase::destroyAndResetDatabases(void)
    remove(dbStxoFilename().c_str());
    remove(dbZeroconfFilename().c_str());
    remove(dbSpentnessFilename().c_str());
+   remove(dbUtxoFilename().c_str());
 
    for (uint32_t db = SUBSSHDB_PREFIX_MIN; db < SUBSSHDB_PREFIX_MAX; db++)
       remove(getSubSSHDBFile(db).c_str());
@@ -628,7 +908,7 @@ void LMDBBlockDatabase::destroyAndResetDatabases(void)
    // Reopen the databases with the exact same parameters as before
    // The close & destroy operations shouldn't have changed any of that.
    openDatabases(baseDir_, genesisBlkHash_, genesisTxHash_, 
-      magicBytes_, armoryDbType_, dbPruneType_);
+      magicBytes_, armoryDbType_, dbPruneType_, utxoIndexEnabled_);
 }
 
 ////////////////////////////////////////////////////////////////////////////////
@@ -636,6 +916,9 @@ void LMDBBlockDatabase::cleanUpHistoryInDB()
 {
    LOGWARN << "Clearing history";
 
+   //fullnode resolves tx hashes through the HISTORY DB
+   txHashCache_.clear();
+
 
    {
       StoredDBInfo sdbi;
@@ -657,6 +940,11 @@ void LMDBBlockDatabase::cleanUpHistoryInDB()
       LMDBEnv::Transaction txhist(dbEnv_[HISTORY].get(), LMDB::ReadWrite);
       dbs_[HISTORY].open(dbEnv_[HISTORY].get(), "history");
       putStoredDBInfo(HISTORY, sdbi);
+
+      //the rescan rebuilds the utxo index along with the history
+      LMDBEnv::Transaction txutxo(dbEnv_[UTXO].get(), LMDB::ReadWrite);
+      dbs_[UTXO].drop();
+      putStoredDBInfo(UTXO, sdbi);
    }
 
    {
@@ -727,6 +1015,7 @@ uint32_t LMDBBlockDatabase::getTopBlockHeight(DB_SELECT db)
 BinaryDataRef LMDBBlockDatabase::getValueNoCopy(DB_SELECT db, 
    BinaryDataRef keyWithPrefix) const
 {
+   Stats::add(statReads[db]);
    CharacterArrayRef data = dbs_[db].get_NoCopy(CharacterArrayRef(
       keyWithPrefix.getSize(), (char*)keyWithPrefix.getPtr()));
    if (data.data)
@@ -743,6 +1032,7 @@ BinaryDataRef LMDBBlockDatabase::getValueNoCopy(DB_SELECT db,
    keyFull[0] = (uint8_t)prefix;
    key.copyTo(keyFull.getPtr() + 1, key.getSize());
 
+   Stats::add(statReads[db]);
    CharacterArrayRef data = dbs_[db].get_NoCopy(CharacterArrayRef(
       keyFull.getSize(), (char*)keyFull.getPtr()));
    if (data.data)
@@ -1236,25 +1526,101 @@ bool LMDBBlockDatabase::fetchStoredSubHistory( StoredScriptHistory & ssh,
 uint64_t LMDBBlockDatabase::getBalanceForScrAddr(BinaryDataRef scrAddr, bool withMulti)
 {
    StoredScriptHistory ssh;
+   getStoredScriptHistorySummary(ssh, scrAddr); 
+
    if(!withMulti)
-   {
-      getStoredScriptHistorySummary(ssh, scrAddr); 
       return ssh.totalUnspent_;
-   }
-   else
-   {
-      getStoredScriptHistory(ssh, scrAddr);
-      uint64_t total = ssh.totalUnspent_;
-      map<BinaryData, UnspentTxOut> utxoList;
-      map<BinaryData, UnspentTxOut>::iterator iter;
-      getFullUTXOMapForSSH(ssh, utxoList, true);
-      for(iter = utxoList.begin(); iter != utxoList.end(); iter++)
-         if(iter->second.isMultisigRef())
-            total += iter->second.getValue();
-      return total;
-   }
+
+   //the SSH entry carries the multisig tally, no need to walk the history
+   if (ssh.hasUtxoSummary_)
+      return ssh.totalUnspent_ + ssh.totalMultisigUnspent_;
+
+   //legacy SSH entry, count the multisig refs by hand
+   getStoredScriptHistory(ssh, scrAddr);
+   uint64_t total = ssh.totalUnspent_;
+   map<BinaryData, UnspentTxOut> utxoList;
+   map<BinaryData, UnspentTxOut>::iterator iter;
+   getFullUTXOMapForSSH(ssh, utxoList, true);
+   for(iter = utxoList.begin(); iter != utxoList.end(); iter++)
+      if(iter->second.isMultisigRef())
+         total += iter->second.getValue();
+   return total;
+}
+
+
+////////////////////////////////////////////////////////////////////////////////
+uint64_t LMDBBlockDatabase::getUtxoCountForScrAddr(
+   BinaryDataRef scrAddr, bool withMulti)
+{
+   StoredScriptHistory ssh;
+   getStoredScriptHistorySummary(ssh, scrAddr);
+
+   if (!ssh.isInitialized())
+      return 0;
+
+   if (ssh.hasUtxoSummary_)
+      return ssh.getScriptUtxoCount(withMulti);
+
+   getStoredScriptHistory(ssh, scrAddr);
+   return ssh.getScriptUtxoCount(withMulti);
 }
 
+////////////////////////////////////////////////////////////////////////////////
+bool LMDBBlockDatabase::isUtxoIndexUsable(void) const
+{
+   if (!utxoIndexEnabled_)
+      return false;
+
+   StoredDBInfo sdbiHist, sdbiUtxo;
+   getStoredDBInfo(HISTORY, sdbiHist);
+   if (!getStoredDBInfo(UTXO, sdbiUtxo, false) || !sdbiUtxo.isInitialized())
+      return false;
+
+   return sdbiHist.appliedToHgt_ == sdbiUtxo.appliedToHgt_ &&
+      sdbiHist.topScannedBlkHash_ == sdbiUtxo.topScannedBlkHash_;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+void LMDBBlockDatabase::putUtxoIndexSDBI(StoredDBInfo const & historySdbi)
+{
+   LMDBEnv::Transaction tx(dbEnv_[UTXO].get(), LMDB::ReadWrite);
+   putStoredDBInfo(UTXO, historySdbi);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+bool LMDBBlockDatabase::getUtxosForScrAddr(BinaryDataRef scrAddr,
+   map<BinaryData, UnspentTxOut> & mapToFill) const
+{
+   if (!isUtxoIndexUsable())
+      return false;
+
+   LMDBEnv::Transaction tx(dbEnv_[UTXO].get(), LMDB::ReadOnly);
+
+   LDBIter ldbIter = getIterator(UTXO);
+   if (!ldbIter.seekToStartsWith(DB_PREFIX_SCRIPT, scrAddr))
+      return true;
+
+   //longer scrAddrs can share this one's leading bytes, skip their entries
+   const size_t keySize = 1 + scrAddr.getSize() + 8;
+
+   do
+   {
+      if (!ldbIter.checkKeyStartsWith(DB_PREFIX_SCRIPT, scrAddr))
+         break;
+
+      BinaryDataRef key = ldbIter.getKeyRef();
+      if (key.getSize() != keySize)
+         continue;
+
+      StoredUTXO utxo;
+      utxo.unserializeDBKey(key);
+      utxo.unserializeDBValue(ldbIter.getValueRef());
+
+      mapToFill[utxo.txOutKey_] = utxo.getUnspentTxOut();
+   } while (ldbIter.advanceAndRead(DB_PREFIX_SCRIPT));
+
+   return true;
+}
 
 ////////////////////////////////////////////////////////////////////////////////
 // We need the block hashes and scripts, which need to be retrieved from the
@@ -1267,6 +1633,10 @@ bool LMDBBlockDatabase::getFullUTXOMapForSSH(
    if(!ssh.haveFullHistoryLoaded())
       return false;
 
+   //the utxo index saves resolving each txio through STXO and the txhints
+   if (getUtxosForScrAddr(ssh.uniqueKey_, mapToFill))
+      return true;
+
    LMDBEnv::Transaction tx;
    beginDBTransaction(&tx, STXO, LMDB::ReadOnly);
 
@@ -2523,6 +2893,27 @@ TxIn LMDBBlockDatabase::getTxInCopy(
 BinaryData LMDBBlockDatabase::getTxHashForLdbKey( BinaryDataRef ldbKey6B ) const
 {
    SCOPED_TIMER("getTxHashForLdbKey");
+
+   //ZC keys are recycled, only cache mined tx
+   if (ldbKey6B.startsWith(ZCprefix_))
+      return getTxHashForLdbKey_NoCache(ldbKey6B);
+
+   BinaryData txHash;
+   auto generation = txHashCache_.getGeneration();
+   if (txHashCache_.get(ldbKey6B, txHash))
+      return txHash;
+
+   txHash = getTxHashForLdbKey_NoCache(ldbKey6B);
+   if (txHash.getSize() == 32)
+      txHashCache_.put(ldbKey6B, txHash, generation);
+
+   return txHash;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+BinaryData LMDBBlockDatabase::getTxHashForLdbKey_NoCache(
+   BinaryDataRef ldbKey6B) const
+{
    BinaryRefReader stxVal;
    
    if (!ldbKey6B.startsWith(ZCprefix_))
@@ -3765,6 +4156,53 @@ string LMDBBlockDatabase::getSubSSHDBFile(uint32_t prefixLength) const
    return ss.str();
 }
 
+////////////////////////////////////////////////////////////////////////////////
+////////////////////////////////////////////////////////////////////////////////
+DBSnapshot::DBSnapshot(const LMDBBlockDatabase* db)
+{
+   const vector<DB_SELECT> dbs = 
+      { BLKDATA, HISTORY, STXO, SPENTNESS, TXHINTS, UTXO };
+   begin(db, dbs, true);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+DBSnapshot::DBSnapshot(const LMDBBlockDatabase* db, 
+   const vector<DB_SELECT>& dbs)
+{
+   begin(db, dbs, false);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+void DBSnapshot::begin(const LMDBBlockDatabase* db, 
+   const vector<DB_SELECT>& dbs, bool withSubSsh)
+{
+   //the envs of a batch are committed under this lock, none of them can move
+   //while we begin ours
+   lock_guard<mutex> lock(db->getPublishMutex());
+
+   for (auto dbSelect : dbs)
+   {
+      dbTx_[dbSelect] = move(LMDBEnv::Transaction(
+         db->dbEnv_[dbSelect].get(), LMDB::ReadOnly));
+   }
+
+   if (!withSubSsh)
+      return;
+
+   for (uint32_t i = SUBSSHDB_PREFIX_MIN; i < SUBSSHDB_PREFIX_MAX; i++)
+      db->beginSubSSHDBTransaction(subSshTx_[i], i, LMDB::ReadOnly);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+void DBSnapshot::release(void)
+{
+   for (auto& tx : subSshTx_)
+      tx.commit();
+
+   for (auto& tx : dbTx_)
+      tx.commit();
+}
+
 /*
 ////////////////////////////////////////////////////////////////////////////////
 bool LMDBBlockDatabase::getUndoDataForTx( Tx const & tx,
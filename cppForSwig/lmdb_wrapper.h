@@ -11,6 +11,9 @@
 
 #include <list>
 #include <vector>
+#include <deque>
+#include <mutex>
+#include <atomic>
 #include "log.h"
 #include "BinaryData.h"
 #include "BtcUtils.h"
@@ -233,6 +236,58 @@ private:
 
 
 
+////////////////////////////////////////////////////////////////////////////////
+// Bounded dbKey6 -> txHash cache in front of getTxHashForLdbKey. Entries are
+// spread over shards by tx index and height so concurrent readers rarely 
+// wait on the same lock. A full shard drops its oldest entries first.
+//
+// A reader grabs getGeneration() before it goes to the DB and hands it back to
+// put(). eraseFromHeight() and clear() bump the generation, so a hash read 
+// before a reorg or a clear and put after it is dropped instead of cached.
+class TxHashCache
+{
+public:
+   static const uint32_t SHARD_COUNT = 16;
+
+   static const size_t DEFAULT_MAX_ENTRIES = 256 * 1024;
+
+   TxHashCache(size_t maxEntries = DEFAULT_MAX_ENTRIES);
+
+   bool get(BinaryDataRef dbKey6, BinaryData& txHash) const;
+   void put(BinaryDataRef dbKey6, BinaryDataRef txHash, uint64_t generation);
+
+   uint64_t getGeneration(void) const 
+   { return generation_.load(memory_order_acquire); }
+
+   //drops all entries for blocks at or above height
+   void eraseFromHeight(uint32_t height);
+   void clear(void);
+
+   uint64_t getHitCount(void) const { return hits_.load(memory_order_relaxed); }
+   uint64_t getMissCount(void) const 
+   { return misses_.load(memory_order_relaxed); }
+   size_t size(void) const;
+
+private:
+   struct Shard
+   {
+      mutable mutex                 mu_;
+      map<BinaryData, BinaryData>   hashes_;
+      deque<BinaryData>             order_;
+   };
+
+   Shard& getShard(BinaryDataRef dbKey6) const;
+
+private:
+   mutable Shard                    shards_[SHARD_COUNT];
+   size_t                           maxPerShard_;
+
+   mutable atomic<uint64_t>         hits_;
+   mutable atomic<uint64_t>         misses_;
+   atomic<uint64_t>                 generation_;
+};
+
+
 ////////////////////////////////////////////////////////////////////////////////
 class LMDBBlockDatabase
 {
@@ -249,7 +304,16 @@ public:
       BinaryData const & genesisTxHash,
       BinaryData const & magic,
       ARMORY_DB_TYPE     dbtype,
-      DB_PRUNE_TYPE      pruneType);
+      DB_PRUNE_TYPE      pruneType,
+      bool               withUtxoIndex = false);
+
+   /////////////////////////////////////////////////////////////////////////////
+   // Opens the DBs some other process maintains, for reading only. The DB and 
+   // prune types are whatever that process built them with.
+   void openDatabasesReadOnly(const string &basedir,
+      BinaryData const & genesisBlkHash,
+      BinaryData const & genesisTxHash,
+      BinaryData const & magic);
 
    /////////////////////////////////////////////////////////////////////////////
    void nukeHeadersDB(void);
@@ -557,6 +621,16 @@ public:
       bool withMultisig = false);
 
    uint64_t getBalanceForScrAddr(BinaryDataRef scrAddr, bool withMulti = false);
+   uint64_t getUtxoCountForScrAddr(BinaryDataRef scrAddr, bool withMulti = false);
+
+   // The UTXO DB is an optional index of unspent outputs keyed by scrAddr, 
+   // maintained by the BlockWriteBatcher when the BDM config asks for it.
+   // Its SDBI mirrors the HISTORY one, the index is only used when both agree
+   bool hasUtxoIndex(void) const { return utxoIndexEnabled_; }
+   bool isUtxoIndexUsable(void) const;
+   void putUtxoIndexSDBI(StoredDBInfo const & historySdbi);
+   bool getUtxosForScrAddr(BinaryDataRef scrAddr,
+      map<BinaryData, UnspentTxOut> & mapToFill) const;
 
    // TODO: We should probably implement some kind of method for accessing or 
    //       running calculations on an SSH without ever loading the entire
@@ -615,6 +689,13 @@ public:
 
    // Sometimes we already know where the Tx is, but we don't know its hash
    BinaryData getTxHashForLdbKey(BinaryDataRef ldbKey6B) const;
+   BinaryData getTxHashForLdbKey_NoCache(BinaryDataRef ldbKey6B) const;
+
+   TxHashCache& txHashCache(void) const { return txHashCache_; }
+
+   //the BlockWriteBatcher commits each batch under this lock, DBSnapshot
+   //begins its transactions under it
+   mutex& getPublishMutex(void) const { return publishMutex_; }
 
    BinaryData getTxHashForHeightAndIndex(uint32_t height,
       uint16_t txIndex);
@@ -673,6 +754,7 @@ private:
    string dbStxoFilename() const { return baseDir_ + "/stxo"; }
    string dbZeroconfFilename() const { return baseDir_ + "/zeroconf"; }
    string dbSpentnessFilename() const { return baseDir_ + "/spentness"; }
+   string dbUtxoFilename() const { return baseDir_ + "/utxo"; }
 
    string getSubSSHDBFile(uint32_t prefixLength) const;
 
@@ -682,6 +764,7 @@ private:
 
    ARMORY_DB_TYPE armoryDbType_;
    DB_PRUNE_TYPE dbPruneType_;
+   bool utxoIndexEnabled_ = false;
 
 public:
 
@@ -706,6 +789,11 @@ private:
 
    function<bool(void)> isDBReady_ = [](void)->bool{ return false; };
 
+   //mined tx keys never change hash, only reorgs and wipes invalidate this
+   mutable TxHashCache txHashCache_;
+
+   mutable mutex publishMutex_;
+
    //for fullnode accessor
    shared_ptr<vector<BlkFile>> blkFiles_;
    
@@ -714,5 +802,46 @@ private:
    mutable LMDB subSSHDBs_[SUBSSHDB_PREFIX_MAX];
 };
 
+////////////////////////////////////////////////////////////////////////////////
+// Pins one read-only transaction on each env the BlockWriteBatcher writes to:
+// BLKDATA, HISTORY, STXO, SPENTNESS, TXHINTS, UTXO and every sub-SSH shard.
+// They are all begun while no batch is being committed, so together they
+// show the DBs between two batches.
+//
+// lmdbpp nests the transactions a thread begins on an env, so every read
+// this thread does while the snapshot is alive goes through it, and never
+// waits on the writer. Take it before beginning other transactions on this
+// thread, release it on the same thread, and don't begin ReadWrite
+// transactions on these envs while holding it. Keep it short lived: LMDB
+// can't reuse the pages it sees until it is released.
+//
+// Batches are only committed together within a process. A reader in another
+// process (ArmoryQueryd) gets each env as of the same moment, which can fall
+// between the commits of a batch.
+//
+// A lookup that only reads a few envs can pin just those, the sub-SSH shards
+// are left out then. Reads on the other envs go through their own 
+// transactions, which may see a later batch.
+class DBSnapshot
+{
+public:
+   DBSnapshot(const LMDBBlockDatabase* db);
+   DBSnapshot(const LMDBBlockDatabase* db, const vector<DB_SELECT>& dbs);
+   ~DBSnapshot(void) { release(); }
+
+   void release(void);
+
+private:
+   void begin(const LMDBBlockDatabase* db, const vector<DB_SELECT>& dbs,
+      bool withSubSsh);
+
+   LMDBEnv::Transaction dbTx_[COUNT];
+   LMDBEnv::Transaction subSshTx_[SUBSSHDB_PREFIX_MAX];
+
+private:
+   DBSnapshot(const DBSnapshot&);
+   DBSnapshot& operator=(const DBSnapshot&);
+};
+
 #endif
 // kate: indent-width 3; replace-tabs on;
@@ -313,7 +313,7 @@ LMDBEnv::~LMDBEnv()
    close();
 }
 
-void LMDBEnv::open(const char *filename)
+void LMDBEnv::open(const char *filename, bool readOnly)
 {
    if (dbenv)
       throw std::logic_error("Database environment already open (close it first)");
@@ -330,9 +330,19 @@ void LMDBEnv::open(const char *filename)
    if (rc != MDB_SUCCESS)
       throw LMDBException("Failed to set max dbs (" + errorString(rc) + ")");
    
-   rc = mdb_env_open(dbenv, filename, MDB_NOSYNC|MDB_NOSUBDIR, 0600);
+   unsigned flags = MDB_NOSYNC|MDB_NOSUBDIR;
+   if (readOnly)
+      flags |= MDB_RDONLY;
+
+   rc = mdb_env_open(dbenv, filename, flags, 0600);
    if (rc != MDB_SUCCESS)
+   {
+      mdb_env_close(dbenv);
+      dbenv = nullptr;
       throw LMDBException("Failed to open db " + std::string(filename) + " (" + errorString(rc) + ")");
+   }
+
+   readOnly_ = readOnly;
 }
 
 void LMDBEnv::close()
@@ -373,6 +383,9 @@ void LMDBEnv::Transaction::begin()
 {
    if (began)
       return;
+
+   if (mode_ == LMDB::ReadWrite && env->readOnly_)
+      throw LMDBException("Cannot start a ReadWrite transaction in a read-only env");
    
    began = true;
 
@@ -400,7 +413,25 @@ void LMDBEnv::Transaction::begin()
       thTx.mode_ = LMDB::ReadWrite;
    }
 
-   int rc = mdb_txn_begin(env->dbenv, nullptr, modef, &thTx.txn_);
+   int rc;
+   if (modef == MDB_RDONLY)
+   {
+      std::lock_guard<std::mutex> mapLock(env->mapMutex_);
+      rc = mdb_txn_begin(env->dbenv, nullptr, modef, &thTx.txn_);
+
+      //the writer grew the file past our map, adopt its size and retry
+      if (rc == MDB_MAP_RESIZED && env->readOnly_)
+      {
+         rc = mdb_env_set_mapsize(env->dbenv, 0);
+         if (rc == MDB_SUCCESS)
+            rc = mdb_txn_begin(env->dbenv, nullptr, modef, &thTx.txn_);
+      }
+   }
+   else
+   {
+      rc = mdb_txn_begin(env->dbenv, nullptr, modef, &thTx.txn_);
+   }
+
    if (rc != MDB_SUCCESS)
    {
       lock.lock();
@@ -443,7 +474,16 @@ void LMDBEnv::Transaction::commit()
 
    if (thTx.transactionLevel_-- == 1)
    {
-      int rc = mdb_txn_commit(thTx.txn_);
+      int rc;
+      if (thTx.mode_ == LMDB::ReadOnly)
+      {
+         std::lock_guard<std::mutex> mapLock(env->mapMutex_);
+         rc = mdb_txn_commit(thTx.txn_);
+      }
+      else
+      {
+         rc = mdb_txn_commit(thTx.txn_);
+      }
       
       for (LMDB::Iterator *i : thTx.iterators_)
       {
@@ -504,7 +544,9 @@ void LMDB::open(LMDBEnv *env, const std::string &name)
    }
    this->env = env;
    
-   LMDBEnv::Transaction tx(env);
+   //a read-only env can only open what the writer created
+   LMDBEnv::Transaction tx(env, 
+      env->readOnly_ ? LMDB::ReadOnly : LMDB::ReadWrite);
    const pthread_t tID = pthread_self();
    std::unique_lock<std::mutex> lock(env->threadTxMutex_);
    auto txnIter = env->txForThreads_.find(tID);
@@ -513,7 +555,8 @@ void LMDB::open(LMDBEnv *env, const std::string &name)
       throw LMDBException("Failed to insert: need transaction");
    lock.unlock();
       
-   int rc = mdb_open(txnIter->second.txn_, name.c_str(), MDB_CREATE, &dbi);
+   int rc = mdb_open(txnIter->second.txn_, name.c_str(),
+      env->readOnly_ ? 0 : MDB_CREATE, &dbi);
    if (rc != MDB_SUCCESS)
    {
       // cleanup here
@@ -246,8 +246,13 @@ public:
 
 private:
    MDB_env *dbenv = nullptr;
+   bool readOnly_ = false;
 
    std::mutex threadTxMutex_;
+
+   //read-only txns count themselves on the map they use, and a read-only
+   //env swaps in a bigger map when another process grew the file
+   std::mutex mapMutex_;
    std::unordered_map<pthread_t, LMDBThreadTxInfo> txForThreads_;
 
    friend class LMDB;
@@ -291,11 +296,13 @@ public:
    LMDBEnv() { }
    ~LMDBEnv();
 
-   // open a database by filename
-   void open(const char *filename);
+   // open a database by filename. A read-only env only takes ReadOnly
+   // transactions and can be opened alongside the process writing to it
+   void open(const char *filename, bool readOnly = false);
    bool isOpen() { return (dbenv != nullptr); }
-   void open(const std::string &filename)
-      { open(filename.c_str()); }
+   bool isReadOnly() const { return readOnly_; }
+   void open(const std::string &filename, bool readOnly = false)
+      { open(filename.c_str(), readOnly); }
 
    // close a database, doing nothing if one is presently not open
    void close();
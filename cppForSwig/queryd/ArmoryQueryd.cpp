@@ -0,0 +1,154 @@
+////////////////////////////////////////////////////////////////////////////////
+//                                                                            //
+//  Copyright (C) 2011-2015, Armory Technologies, Inc.                        //
+//  Distributed under the GNU Affero General Public License (AGPL v3)         //
+//  See LICENSE or http://www.gnu.org/licenses/agpl.html                      //
+//                                                                            //
+////////////////////////////////////////////////////////////////////////////////
+//
+// Read-only query daemon. Opens the databases an Armory instance maintains
+// and answers QueryServer requests on a Unix domain socket:
+//
+//    ArmoryQueryd --dbdir=<armory databases dir> --blkdir=<bitcoin blocks dir>
+//       [--socket=<path>] [--threads=<n>] [--testnet] [--logfile=<path>]
+//       [--statsfile=<path>] [--statsinterval=<seconds>]
+//
+// --statsfile dumps the Stats periodically, see StatsDumper.
+//
+// Runs until SIGINT or SIGTERM.
+//
+
+#include <signal.h>
+#include <pthread.h>
+#include <iostream>
+
+#include "../BlockDataManagerConfig.h"
+#include "../lmdb_wrapper.h"
+#include "../QueryServer.h"
+#include "../Stats.h"
+#include "../log.h"
+
+using namespace std;
+
+////////////////////////////////////////////////////////////////////////////////
+static bool getArg(const string& arg, const string& name, string& value)
+{
+   const string prefix = "--" + name + "=";
+   if (arg.compare(0, prefix.size(), prefix) != 0)
+      return false;
+
+   value = arg.substr(prefix.size());
+   return true;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+static void usage(void)
+{
+   cerr << "usage: ArmoryQueryd --dbdir=<path> --blkdir=<path> "
+      "[--socket=<path>] [--threads=<n>] [--testnet] [--logfile=<path>] "
+      "[--statsfile=<path>] [--statsinterval=<seconds>]" << endl;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+int main(int argc, char* argv[])
+{
+   string dbDir, blkDir, socketPath, logFile, statsFile, value;
+   unsigned nThreads = 0;
+   unsigned statsInterval = 10;
+   bool testnet = false;
+
+   for (int i = 1; i < argc; i++)
+   {
+      const string arg(argv[i]);
+
+      if (getArg(arg, "dbdir", value))
+         dbDir = value;
+      else if (getArg(arg, "blkdir", value))
+         blkDir = value;
+      else if (getArg(arg, "socket", value))
+         socketPath = value;
+      else if (getArg(arg, "logfile", value))
+         logFile = value;
+      else if (getArg(arg, "threads", value))
+         nThreads = (unsigned)strtoul(value.c_str(), nullptr, 10);
+      else if (getArg(arg, "statsfile", value))
+         statsFile = value;
+      else if (getArg(arg, "statsinterval", value))
+         statsInterval = (unsigned)strtoul(value.c_str(), nullptr, 10);
+      else if (arg == "--testnet")
+         testnet = true;
+      else
+      {
+         usage();
+         return 1;
+      }
+   }
+
+   if (dbDir.size() == 0 || blkDir.size() == 0)
+   {
+      usage();
+      return 1;
+   }
+
+   if (socketPath.size() == 0)
+      socketPath = dbDir + "/armoryqueryd.sock";
+   if (logFile.size() == 0)
+      logFile = dbDir + "/armoryqueryd.log";
+
+   STARTLOGGING(logFile, LogLvlInfo);
+
+   //SIGINT and SIGTERM are waited on below, block them before any thread
+   //starts so they all inherit the mask
+   sigset_t sigs;
+   sigemptyset(&sigs);
+   sigaddset(&sigs, SIGINT);
+   sigaddset(&sigs, SIGTERM);
+   pthread_sigmask(SIG_BLOCK, &sigs, nullptr);
+   signal(SIGPIPE, SIG_IGN);
+
+   BlockDataManagerConfig config;
+   config.selectNetwork(testnet ? "Test" : "Main");
+
+   LMDBBlockDatabase db([](void)->bool { return true; },
+      make_shared<vector<BlkFile>>());
+
+   try
+   {
+      db.openDatabasesReadOnly(dbDir, config.genesisBlockHash,
+         config.genesisTxHash, config.magicBytes);
+   }
+   catch (exception& e)
+   {
+      cerr << "failed to open the databases in " << dbDir << ": " <<
+         e.what() << endl;
+      return 1;
+   }
+
+   shared_ptr<StatsDumper> statsDumper;
+   if (statsFile.size() > 0)
+   {
+      statsDumper = make_shared<StatsDumper>(statsFile, statsInterval);
+      statsDumper->start();
+   }
+
+   int sig = 0;
+   {
+      QueryServer server(&db, blkDir, nThreads);
+      if (!server.start(socketPath))
+      {
+         cerr << "failed to listen on " << socketPath << endl;
+         return 1;
+      }
+
+      cout << "serving queries on " << socketPath << endl;
+      sigwait(&sigs, &sig);
+
+      LOGINFO << "got signal " << sig << ", shutting down after " <<
+         server.getRequestCount() << " requests";
+      server.stop();
+   }
+
+   statsDumper.reset();
+   db.closeDatabases();
+   return 0;
+}
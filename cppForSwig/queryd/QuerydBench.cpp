@@ -0,0 +1,239 @@
+////////////////////////////////////////////////////////////////////////////////
+//                                                                            //
+//  Copyright (C) 2011-2015, Armory Technologies, Inc.                        //
+//  Distributed under the GNU Affero General Public License (AGPL v3)         //
+//  See LICENSE or http://www.gnu.org/licenses/agpl.html                      //
+//                                                                            //
+////////////////////////////////////////////////////////////////////////////////
+//
+// Load generator for ArmoryQueryd. Replays the request lines of a file over
+// several connections at once and reports throughput and latencies:
+//
+//    QuerydBench --socket=<path> --requests=<file>
+//       [--connections=<n>] [--count=<total requests>]
+//
+// Each connection sends one request, waits for the reply, sends the next.
+//
+
+#include <unistd.h>
+#include <string.h>
+#include <signal.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+
+#include <iostream>
+#include <fstream>
+#include <string>
+#include <vector>
+#include <thread>
+#include <chrono>
+#include <algorithm>
+
+using namespace std;
+using namespace std::chrono;
+
+struct ConnectionStats
+{
+   vector<double> latencies_;
+   size_t errors_ = 0;
+   bool failed_ = false;
+};
+
+////////////////////////////////////////////////////////////////////////////////
+static bool getArg(const string& arg, const string& name, string& value)
+{
+   const string prefix = "--" + name + "=";
+   if (arg.compare(0, prefix.size(), prefix) != 0)
+      return false;
+
+   value = arg.substr(prefix.size());
+   return true;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+static int connectTo(const string& socketPath)
+{
+   sockaddr_un addr;
+   memset(&addr, 0, sizeof(addr));
+   addr.sun_family = AF_UNIX;
+   strncpy(addr.sun_path, socketPath.c_str(), sizeof(addr.sun_path) - 1);
+
+   int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+   if (fd < 0)
+      return -1;
+
+   if (connect(fd, (sockaddr*)&addr, sizeof(addr)) != 0)
+   {
+      close(fd);
+      return -1;
+   }
+
+   return fd;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+static void runConnection(const string& socketPath,
+   const vector<string>& requests, size_t first, size_t count,
+   ConnectionStats& stats)
+{
+   int fd = connectTo(socketPath);
+   if (fd < 0)
+   {
+      stats.failed_ = true;
+      return;
+   }
+
+   stats.latencies_.reserve(count);
+   string buffer;
+   char readBuf[65536];
+
+   for (size_t i = 0; i < count; i++)
+   {
+      const string line = requests[(first + i) % requests.size()] + "\n";
+      auto start = steady_clock::now();
+
+      size_t sent = 0;
+      while (sent < line.size())
+      {
+         ssize_t n = send(fd, line.c_str() + sent, line.size() - sent, 0);
+         if (n <= 0)
+         {
+            stats.failed_ = true;
+            close(fd);
+            return;
+         }
+         sent += n;
+      }
+
+      size_t pos;
+      while ((pos = buffer.find('\n')) == string::npos)
+      {
+         ssize_t n = recv(fd, readBuf, sizeof(readBuf), 0);
+         if (n <= 0)
+         {
+            stats.failed_ = true;
+            close(fd);
+            return;
+         }
+         buffer.append(readBuf, n);
+      }
+
+      auto elapsed = steady_clock::now() - start;
+      stats.latencies_.push_back(
+         duration_cast<duration<double, micro>>(elapsed).count());
+
+      if (buffer.compare(0, 9, "{\"error\":") == 0)
+         stats.errors_++;
+      buffer.erase(0, pos + 1);
+   }
+
+   close(fd);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+int main(int argc, char* argv[])
+{
+   string socketPath, requestFile, value;
+   size_t nConnections = 8;
+   size_t count = 10000;
+
+   for (int i = 1; i < argc; i++)
+   {
+      const string arg(argv[i]);
+
+      if (getArg(arg, "socket", value))
+         socketPath = value;
+      else if (getArg(arg, "requests", value))
+         requestFile = value;
+      else if (getArg(arg, "connections", value))
+         nConnections = max<size_t>(1, strtoul(value.c_str(), nullptr, 10));
+      else if (getArg(arg, "count", value))
+         count = strtoul(value.c_str(), nullptr, 10);
+      else
+      {
+         socketPath.clear();
+         break;
+      }
+   }
+
+   if (socketPath.size() == 0 || requestFile.size() == 0)
+   {
+      cerr << "usage: QuerydBench --socket=<path> --requests=<file> "
+         "[--connections=<n>] [--count=<total requests>]" << endl;
+      return 1;
+   }
+
+   vector<string> requests;
+   {
+      ifstream file(requestFile);
+      string line;
+      while (getline(file, line))
+      {
+         if (line.size() > 0)
+            requests.push_back(line);
+      }
+   }
+
+   if (requests.size() == 0)
+   {
+      cerr << "no requests in " << requestFile << endl;
+      return 1;
+   }
+
+   signal(SIGPIPE, SIG_IGN);
+
+   //spread the requests evenly, each connection starting at another line
+   vector<ConnectionStats> stats(nConnections);
+   vector<thread> threads;
+
+   auto start = steady_clock::now();
+   for (size_t i = 0; i < nConnections; i++)
+   {
+      size_t connCount = count / nConnections +
+         (i < count % nConnections ? 1 : 0);
+      threads.push_back(thread(runConnection, cref(socketPath),
+         cref(requests), i * requests.size() / nConnections, connCount,
+         ref(stats[i])));
+   }
+
+   for (auto& t : threads)
+      t.join();
+   double seconds = duration_cast<duration<double>>(
+      steady_clock::now() - start).count();
+
+   vector<double> latencies;
+   size_t errors = 0, failedConnections = 0;
+   for (auto& s : stats)
+   {
+      latencies.insert(latencies.end(),
+         s.latencies_.begin(), s.latencies_.end());
+      errors += s.errors_;
+      if (s.failed_)
+         failedConnections++;
+   }
+
+   if (latencies.size() == 0)
+   {
+      cerr << "no replies from " << socketPath << endl;
+      return 1;
+   }
+
+   sort(latencies.begin(), latencies.end());
+   auto percentile = [&latencies](double p)->double
+   {
+      size_t i = (size_t)(p * (latencies.size() - 1));
+      return latencies[i];
+   };
+
+   cout << latencies.size() << " requests over " << nConnections <<
+      " connections in " << seconds << " s" << endl;
+   cout << "throughput: " << latencies.size() / seconds << " req/s" << endl;
+   cout << "latency (us): p50 " << percentile(0.5) <<
+      ", p90 " << percentile(0.9) <<
+      ", p99 " << percentile(0.99) <<
+      ", max " << latencies.back() << endl;
+   cout << "error replies: " << errors << ", failed connections: " <<
+      failedConnections << endl;
+
+   return failedConnections == 0 ? 0 : 1;
+}